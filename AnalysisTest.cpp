@@ -0,0 +1,109 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENAnalysis.h"
+#include "GENCoder.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+// Analysis test.  The load's result is used right away, so nearly all of its latency is exposed.
+//   The store has no response, and the EOT send is counted separately
+const char* ANALYSIS_TEST = STRINGIFY(
+
+bind Input  0x38
+bind Output 0x39
+
+reg addr
+reg data
+reg sum
+
+begin:
+
+mov(8) addr.u, r0.u1<0,1,0>
+send DwordLoad8(Input), data.u, addr.u
+add(8) sum.f, data.f, data.f
+mul(8) sum.f, sum.f, sum.f
+send DwordStore8(Output), null.u, addr.u
+
+end
+);
+
+void AnalysisTest()
+{
+    StringPrinter errors;
+    GEN::Encoder encoder;
+    GEN::Decoder decoder;
+
+    GEN::Assembler::Program program;
+    if( !program.Assemble( &encoder, ANALYSIS_TEST, &errors ) )
+    {
+        printf("AnalysisTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    GEN::CostTable costs;
+    GEN::KernelAnalysis analysis;
+    if( !analysis.Analyze( &decoder, program, costs ) )
+    {
+        printf("AnalysisTest: analysis failed\n");
+        return;
+    }
+
+    size_t nLoads=0, nStores=0, nEOTs=0;
+    for( size_t i=0; i<analysis.GetMessageTypeCount(); i++ )
+    {
+        const GEN::MessageCount& rCount = analysis.GetMessageType(i);
+        if( strcmp( rCount.pName, "DwordScatterRead" ) == 0 )
+            nLoads += rCount.nCount;
+        else if( strcmp( rCount.pName, "DwordScatterWrite" ) == 0 )
+            nStores += rCount.nCount;
+        else if( strcmp( rCount.pName, "EOT" ) == 0 )
+            nEOTs += rCount.nCount;
+    }
+    if( nLoads != 1 || nStores != 1 || nEOTs != 1 )
+    {
+        printf("AnalysisTest: wrong message counts.  %u loads, %u stores, %u EOTs\n", (unsigned)nLoads, (unsigned)nStores, (unsigned)nEOTs );
+        return;
+    }
+
+    if( analysis.GetSendLatencyCount() != 1 )
+    {
+        printf("AnalysisTest: expected one send with a response, got %u\n", (unsigned)analysis.GetSendLatencyCount() );
+        return;
+    }
+
+    const GEN::SendLatency& rLoad = analysis.GetSendLatency(0);
+    if( rLoad.nFirstUse != rLoad.nInstruction+1 || rLoad.nDistance != 0 ||
+        rLoad.nExposedCycles + costs.Send.nIssue != costs.Send.nLatency )
+    {
+        printf("AnalysisTest: wrong send latency.  First use [%u], exposed %u cycles\n",
+               (unsigned)rLoad.nFirstUse, (unsigned)rLoad.nExposedCycles );
+        return;
+    }
+
+    // addr, data, and sum are all live at the load's first use.  r0 might be counted where it is read
+    if( analysis.GetPeakLiveGPRs() < 3 || analysis.GetPeakLiveGPRs() > 4 )
+    {
+        printf("AnalysisTest: peak register pressure is %u\n", (unsigned)analysis.GetPeakLiveGPRs() );
+        return;
+    }
+
+    if( analysis.GetTotalCycles() < costs.Send.nLatency || analysis.ExceedsICache() )
+    {
+        printf("AnalysisTest: wrong totals.  %u cycles\n", (unsigned)analysis.GetTotalCycles() );
+        return;
+    }
+
+    StringPrinter report;
+    GEN::PrintAnalysis( report, analysis );
+    if( report.m_Text.find("DwordScatterRead: 1") == std::string::npos )
+    {
+        printf("AnalysisTest: report is missing the message counts\n%s", report.m_Text.c_str() );
+        return;
+    }
+
+    printf("AnalysisTest: passed\n");
+}
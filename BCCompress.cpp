@@ -150,37 +150,11 @@ mul(16) offs.u, DY, globals.u<0,1,0> // width*dy
 add(16) offs.u, offs.u, DX           // width*dy + dx
 
 // load all the pixels.  Pull in pixels i and i+1 in the same message
-add(8) addr0.u, base0.u, offs0.u0<0,1,0>
-add(8) addr1.u, base1.u, offs0.u1<0,1,0>
-send DWordLoad16(image), pixels0, addr
-
-add(8) addr0.u, base0.u, offs0.u2<0,1,0>
-add(8) addr1.u, base1.u, offs0.u3<0,1,0>
-send DWordLoad16(image), pixels2, addr
-
-add(8) addr0.u, base0.u, offs0.u4<0,1,0>
-add(8) addr1.u, base1.u, offs0.u5<0,1,0>
-send DWordLoad16(image), pixels4, addr
-
-add(8) addr0.u, base0.u, offs0.u6<0,1,0>
-add(8) addr1.u, base1.u, offs0.u7<0,1,0>
-send DWordLoad16(image), pixels6, addr
-
-add(8) addr0.u, base0.u, offs1.u0<0,1,0>
-add(8) addr1.u, base1.u, offs1.u1<0,1,0>
-send DWordLoad16(image), pixels8, addr
-
-add(8) addr0.u, base0.u, offs1.u2<0,1,0>
-add(8) addr1.u, base1.u, offs1.u3<0,1,0>
-send DWordLoad16(image), pixels10, addr
-
-add(8) addr0.u, base0.u, offs1.u4<0,1,0>
-add(8) addr1.u, base1.u, offs1.u5<0,1,0>
-send DWordLoad16(image), pixels12, addr
-
-add(8) addr0.u, base0.u, offs1.u6<0,1,0>
-add(8) addr1.u, base1.u, offs1.u7<0,1,0>
-send DWordLoad16(image), pixels14, addr
+repeat 8 as i {
+    add(8) addr0.u, base0.u, offs$(i/4).u$(2*i%8)<0,1,0>
+    add(8) addr1.u, base1.u, offs$(i/4).u$(2*i%8+1)<0,1,0>
+    send DWordLoad16(image), pixels$(2*i), addr
+}
 
 // pixels[i] contains the ith pixel in each of 8 blocks
 //  reduce this down hierarchically to 8 mins and maxes. 
@@ -0,0 +1,109 @@
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "src/GENBitfields.h"
+
+using namespace GEN::_INTERNAL;
+
+// Compares the bit-at-a-time field accessors against the compile-time BitField ones,
+//   using the same set of fields that the decoder reads for a two-source instruction
+
+static DWORD ReadFieldsSlow( const GEN::uint8* p )
+{
+    return ReadBits(p,6,0)   + ReadBits(p,8,8)   + ReadBits(p,9,9)   + ReadBit(p,11)     +
+           ReadBit(p,10)     + ReadBits(p,13,12) + ReadBits(p,15,14) + ReadBits(p,19,16) +
+           ReadBits(p,20,20) + ReadBits(p,23,21) + ReadBits(p,27,24) + ReadBits(p,28,28) +
+           ReadBits(p,31,31) + ReadBits(p,33,32) + ReadBits(p,36,34) + ReadBits(p,38,37) +
+           ReadBits(p,41,39) + ReadBits(p,43,42) + ReadBits(p,46,44) + ReadBits(p,62,61) +
+           ReadBits(p,60,53) + ReadBits(p,52,48) + ReadBits(p,88,85) + ReadBits(p,84,82) +
+           ReadBits(p,81,80) + ReadBits(p,76,69) + ReadBits(p,68,64) + ReadBits(p,120,117) +
+           ReadBits(p,108,101) + ReadBits(p,100,96) + ReadBit(p,90) + ReadBit(p,89);
+}
+
+static DWORD ReadFieldsFast( const GEN::uint8* p )
+{
+    return ReadBits<6,0>(p)   + ReadBits<8,8>(p)   + ReadBits<9,9>(p)   + ReadBit<11>(p)     +
+           ReadBit<10>(p)     + ReadBits<13,12>(p) + ReadBits<15,14>(p) + ReadBits<19,16>(p) +
+           ReadBits<20,20>(p) + ReadBits<23,21>(p) + ReadBits<27,24>(p) + ReadBits<28,28>(p) +
+           ReadBits<31,31>(p) + ReadBits<33,32>(p) + ReadBits<36,34>(p) + ReadBits<38,37>(p) +
+           ReadBits<41,39>(p) + ReadBits<43,42>(p) + ReadBits<46,44>(p) + ReadBits<62,61>(p) +
+           ReadBits<60,53>(p) + ReadBits<52,48>(p) + ReadBits<88,85>(p) + ReadBits<84,82>(p) +
+           ReadBits<81,80>(p) + ReadBits<76,69>(p) + ReadBits<68,64>(p) + ReadBits<120,117>(p) +
+           ReadBits<108,101>(p) + ReadBits<100,96>(p) + ReadBit<90>(p) + ReadBit<89>(p);
+}
+
+// The old WriteBits only ever set bits, so both of these start from a cleared instruction
+static void WriteFieldsSlow( GEN::uint8* p, DWORD v )
+{
+    memset(p,0,16);
+    WriteBits(p,v,6,0);     WriteBits(p,v,19,16);   WriteBits(p,v,23,21);   WriteBits(p,v,27,24);
+    WriteBits(p,v,33,32);   WriteBits(p,v,36,34);   WriteBits(p,v,38,37);   WriteBits(p,v,41,39);
+    WriteBits(p,v,43,42);   WriteBits(p,v,46,44);   WriteBits(p,v,60,53);   WriteBits(p,v,52,48);
+    WriteBits(p,v,62,61);   WriteBits(p,v,76,69);   WriteBits(p,v,88,85);   WriteBits(p,v,108,101);
+}
+
+static void WriteFieldsFast( GEN::uint8* p, DWORD v )
+{
+    memset(p,0,16);
+    WriteBits<6,0>(p,v);    WriteBits<19,16>(p,v);  WriteBits<23,21>(p,v);  WriteBits<27,24>(p,v);
+    WriteBits<33,32>(p,v);  WriteBits<36,34>(p,v);  WriteBits<38,37>(p,v);  WriteBits<41,39>(p,v);
+    WriteBits<43,42>(p,v);  WriteBits<46,44>(p,v);  WriteBits<60,53>(p,v);  WriteBits<52,48>(p,v);
+    WriteBits<62,61>(p,v);  WriteBits<76,69>(p,v);  WriteBits<88,85>(p,v);  WriteBits<108,101>(p,v);
+}
+
+static double Seconds( LARGE_INTEGER start, LARGE_INTEGER end )
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return ((double)(end.QuadPart-start.QuadPart)) / freq.QuadPart;
+}
+
+void BitfieldBenchmark()
+{
+    const size_t nInstructions = 64*1024;
+    const size_t nReps = 50;
+
+    std::vector<GEN::uint8> isa( 16*nInstructions );
+    for( size_t i=0; i<isa.size(); i++ )
+        isa[i] = rand();
+
+    LARGE_INTEGER t0,t1,t2,t3,t4;
+    DWORD nSlow=0;
+    DWORD nFast=0;
+
+    QueryPerformanceCounter(&t0);
+    for( size_t r=0; r<nReps; r++ )
+        for( size_t i=0; i<nInstructions; i++ )
+            nSlow += ReadFieldsSlow( &isa[16*i] );
+    QueryPerformanceCounter(&t1);
+    for( size_t r=0; r<nReps; r++ )
+        for( size_t i=0; i<nInstructions; i++ )
+            nFast += ReadFieldsFast( &isa[16*i] );
+    QueryPerformanceCounter(&t2);
+
+    std::vector<GEN::uint8> slow( isa.size() );
+    std::vector<GEN::uint8> fast( isa.size() );
+    for( size_t r=0; r<nReps; r++ )
+        for( size_t i=0; i<nInstructions; i++ )
+            WriteFieldsSlow( &slow[16*i], (DWORD)(i+r) );
+    QueryPerformanceCounter(&t3);
+    for( size_t r=0; r<nReps; r++ )
+        for( size_t i=0; i<nInstructions; i++ )
+            WriteFieldsFast( &fast[16*i], (DWORD)(i+r) );
+    QueryPerformanceCounter(&t4);
+
+    double nOps = (double)(nInstructions*nReps);
+    double fReadSlow  = 1e9*Seconds(t0,t1)/nOps;
+    double fReadFast  = 1e9*Seconds(t1,t2)/nOps;
+    double fWriteSlow = 1e9*Seconds(t2,t3)/nOps;
+    double fWriteFast = 1e9*Seconds(t3,t4)/nOps;
+
+    printf("Bitfield reads:  %.2f ns/inst (bitwise)  %.2f ns/inst (BitField)  %.1fx  %s\n",
+            fReadSlow, fReadFast, fReadSlow/fReadFast, nSlow==nFast ? "" : "MISMATCH!" );
+    printf("Bitfield writes: %.2f ns/inst (bitwise)  %.2f ns/inst (BitField)  %.1fx  %s\n",
+            fWriteSlow, fWriteFast, fWriteSlow/fWriteFast, slow==fast ? "" : "MISMATCH!" );
+}
@@ -0,0 +1,123 @@
+
+#include "HAXWell.h"
+#include "HAXWell_Utils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// Shader blob cache test.  Args with the same contents must get the same key wherever they live, any change
+//   to what 'PatchBlob' reads must change it, and a blob file must only be read back for the contents it was written for
+void BlobCacheTest()
+{
+    HAXWell::Blob templateBlob;
+    templateBlob.SetLength(64);
+    memset( templateBlob.GetBytes(), 0x11, 64 );
+
+    unsigned char pIsa[128];
+    unsigned char pCURBE[2*4*32];
+    for( size_t i=0; i<sizeof(pIsa); i++ )
+        pIsa[i] = (unsigned char)(3*i);
+    for( size_t i=0; i<sizeof(pCURBE); i++ )
+        pCURBE[i] = (unsigned char)(7*i);
+    std::vector<unsigned char> isaCopy( pIsa, pIsa+sizeof(pIsa) );
+
+    HAXWell::ShaderArgs args;
+    args.nDispatchThreadCount  = 4;
+    args.nSIMDMode             = 16;
+    args.pIsa                  = pIsa;
+    args.nIsaLength            = sizeof(pIsa);
+    args.nCURBEAllocsPerThread = 2;
+    args.pCURBE                = pCURBE;
+
+    std::vector<unsigned char> contents;
+    HAXWell::GetShaderContents( contents, args );
+    HAXWell::QWORD nKey = HAXWell::GetShaderKey( contents, templateBlob );
+
+    HAXWell::ShaderArgs copy = args;
+    copy.pIsa = isaCopy.data();
+    std::vector<unsigned char> copyContents;
+    HAXWell::GetShaderContents( copyContents, copy );
+    if( copyContents != contents || HAXWell::GetShaderKey( copyContents, templateBlob ) != nKey )
+    {
+        printf("BlobCacheTest: equal args have different keys\n");
+        return;
+    }
+
+    HAXWell::ShaderArgs changes[5] = { args, args, args, args, args };
+    changes[0].nDispatchThreadCount = 3;
+    changes[1].nSIMDMode = 8;
+    changes[2].nIsaLength = 64;
+    changes[3].nCURBEAllocsPerThread = 1;
+    isaCopy[100] ^= 1;
+    changes[4].pIsa = isaCopy.data();
+    for( size_t i=0; i<5; i++ )
+    {
+        std::vector<unsigned char> changed;
+        HAXWell::GetShaderContents( changed, changes[i] );
+        if( HAXWell::GetShaderKey( changed, templateBlob ) == nKey )
+        {
+            printf("BlobCacheTest: change %u kept the key\n", (unsigned)i );
+            return;
+        }
+    }
+
+    HAXWell::Blob newDriver;
+    newDriver.SetLength(64);
+    memset( newDriver.GetBytes(), 0x11, 64 );
+    ((unsigned char*)newDriver.GetBytes())[60] = 0x12;
+    if( HAXWell::GetShaderKey( contents, newDriver ) == nKey )
+    {
+        printf("BlobCacheTest: a different template kept the key\n");
+        return;
+    }
+
+    HAXWell::Blob patched;
+    patched.SetLength(1000);
+    for( size_t i=0; i<patched.GetLength(); i++ )
+        ((unsigned char*)patched.GetBytes())[i] = (unsigned char)(i ^ 0x5a);
+
+    HAXWell::WriteBlobFile( ".", nKey, contents, patched );
+
+    HAXWell::Blob loaded;
+    if( !HAXWell::ReadBlobFile( loaded, ".", nKey, contents ) ||
+        loaded.GetLength() != patched.GetLength() ||
+        memcmp( loaded.GetBytes(), patched.GetBytes(), patched.GetLength() ) != 0 )
+    {
+        printf("BlobCacheTest: blob file didn't read back\n");
+        return;
+    }
+
+    // as if another shader's contents hashed to the same key
+    std::vector<unsigned char> other = contents;
+    other.back() ^= 1;
+    bool bCollided = HAXWell::ReadBlobFile( loaded, ".", nKey, other );
+
+    // a header whose blob length doesn't match the file.  The length is the last dword of the header
+    char name[32];
+    sprintf( name, "./%08x%08x.blob", (unsigned)(nKey>>32), (unsigned)nKey );
+    FILE* fp = fopen( name, "r+b" );
+    bool bDamaged = false;
+    if( fp )
+    {
+        HAXWell::DWORD nShortLength = (HAXWell::DWORD)patched.GetLength() - 1;
+        fseek( fp, 20, SEEK_SET );
+        fwrite( &nShortLength, sizeof(nShortLength), 1, fp );
+        fclose(fp);
+        bDamaged = HAXWell::ReadBlobFile( loaded, ".", nKey, contents );
+    }
+    remove( name );
+
+    if( bCollided )
+    {
+        printf("BlobCacheTest: blob file was read for other contents\n");
+        return;
+    }
+    if( !fp || bDamaged )
+    {
+        printf("BlobCacheTest: blob file with a bad length was read\n");
+        return;
+    }
+
+    printf("BlobCacheTest: passed\n");
+}
@@ -0,0 +1,90 @@
+
+#include "HAXWell.h"
+#include "HAXWell_Utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// Checks that the streaming driver hash matches the one-shot version wherever it is split,
+//   and that blobs patched with a hash cache are signed the same as ones without
+void BlobHashTest()
+{
+    srand(7);
+    std::vector<HAXWell::DWORD> data(1000);
+    for( size_t i=0; i<data.size(); i++ )
+        data[i] = ((HAXWell::DWORD)rand() << 16) ^ rand();
+
+    HAXWell::DWORD pExpected[2];
+    HAXWell::DriverHashFunction( pExpected, data.data(), (HAXWell::DWORD)data.size() );
+    for( size_t nSplit=0; nSplit<=data.size(); nSplit += 37 )
+    {
+        HAXWell::DriverHash prefix;
+        prefix.Update( data.data(), (HAXWell::DWORD)nSplit );
+
+        HAXWell::DriverHash hash = prefix;
+        hash.Update( data.data()+nSplit, (HAXWell::DWORD)(data.size()-nSplit) );
+
+        HAXWell::DWORD pCRC[2];
+        hash.Finalize( pCRC );
+        if( pCRC[0] != pExpected[0] || pCRC[1] != pExpected[1] )
+        {
+            printf("BlobHashTest: hash split at dword %u doesn't match\n", (unsigned)nSplit );
+            return;
+        }
+    }
+
+    // A made up template, with an unaligned isa and just enough of the fields that 'PatchBlob' reads
+    const size_t TEMPLATE_LENGTH    = 4003;
+    const size_t TEMPLATE_ISA_START = 1501;
+    HAXWell::Blob templateBlob;
+    templateBlob.SetLength( TEMPLATE_LENGTH );
+    unsigned char* pTemplate = (unsigned char*) templateBlob.GetBytes();
+    for( size_t i=0; i<TEMPLATE_LENGTH; i++ )
+        pTemplate[i] = (unsigned char) rand();
+
+    HAXWell::DWORD pFields[3] = { TEMPLATE_LENGTH-696, 512+64, 2*32 };
+    memcpy( pTemplate+13, &pFields[0], 4 );
+    memcpy( pTemplate+TEMPLATE_ISA_START-4,  &pFields[1], 4 );
+    memcpy( pTemplate+TEMPLATE_ISA_START-40, &pFields[2], 4 );
+
+    unsigned char pIsa[512];
+    unsigned char pCURBE[4*16*32];
+    for( size_t i=0; i<sizeof(pIsa); i++ )
+        pIsa[i] = (unsigned char) rand();
+    for( size_t i=0; i<sizeof(pCURBE); i++ )
+        pCURBE[i] = (unsigned char) rand();
+
+    // the same few shapes over and over, as when autotuning
+    HAXWell::PatchBlobCache cache;
+    for( size_t i=0; i<24; i++ )
+    {
+        pIsa[i%sizeof(pIsa)] ^= 0x5a;
+
+        HAXWell::ShaderArgs args;
+        args.nDispatchThreadCount  = 1 + (i%4);
+        args.nSIMDMode             = (i&1) ? 16 : 8;
+        args.pIsa                  = pIsa;
+        args.nIsaLength            = 64*(1 + (i%3));
+        args.nCURBEAllocsPerThread = i%5;
+        args.pCURBE                = pCURBE;
+
+        HAXWell::Blob uncached;
+        HAXWell::Blob cached;
+        HAXWell::PatchBlob( uncached, args, templateBlob, TEMPLATE_ISA_START );
+        HAXWell::PatchBlob( cached, args, templateBlob, TEMPLATE_ISA_START, &cache );
+        if( cached.GetLength() != uncached.GetLength() || memcmp( cached.GetBytes(), uncached.GetBytes(), cached.GetLength() ) != 0 )
+        {
+            printf("BlobHashTest: blob %u is different with the hash cache\n", (unsigned)i );
+            return;
+        }
+        if( !cache.Find( cached.GetLength() ) )
+        {
+            printf("BlobHashTest: blob %u wasn't cached\n", (unsigned)i );
+            return;
+        }
+    }
+
+    printf("BlobHashTest: passed\n");
+}
@@ -0,0 +1,168 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENCoder.h"
+#include "GENIsa.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Structured control flow test.  Checks that branch offsets land on the right instructions,
+//   with and without compaction
+const char* BRANCH_TEST = STRINGIFY(
+
+reg count[2]
+reg limit[2]
+reg tmp[2]
+
+begin:
+
+mov(16)  count.u, 0
+mul(16)  limit.u, r0.u2<0,1,0>, 3
+do
+    add(16)  count.u, count.u, 1
+    cmpge(16)(f0.0) null.u, count.u, limit.u
+    if(16) (f0.0)
+        and(16)  tmp.u, count.u, 1
+        break(16) (f0.0)
+    else
+        add(16)  tmp.u, tmp.u, 2
+    endif
+    cmplt(16)(f0.1) null.u, count.u, 64
+while(16) (f0.1)
+
+end
+);
+
+// An empty loop is one error, not another for the 'do' at the end
+const char* BRANCH_EMPTY_LOOP_TEST = STRINGIFY(
+
+begin:
+do
+while(16) (f0.1)
+end
+);
+
+struct BranchExpectation
+{
+    size_t nIndex;
+    GEN::Operations eOp;
+    size_t nJIPTarget;
+    size_t nUIPTarget; // UIPs of 0 point back at the branch itself
+};
+
+// Instruction indices.  0 is the r0 header move the assembler inserts at 'begin'
+static const BranchExpectation BRANCH_EXPECTATIONS[] = {
+    { 5,  GEN::OP_IF,    9,  10 },
+    { 7,  GEN::OP_BREAK, 8,  12 },
+    { 8,  GEN::OP_ELSE,  10, 10 },
+    { 10, GEN::OP_ENDIF, 12, 10 },
+    { 12, GEN::OP_WHILE, 3,  12 },
+};
+
+static size_t FindInstruction( const std::vector<size_t>& offsets, int nOffset )
+{
+    for( size_t i=0; i<offsets.size(); i++ )
+        if( (int)offsets[i] == nOffset )
+            return i;
+    return (size_t)-1;
+}
+
+static bool CheckBranches( const char* pName, const GEN::Assembler::Program& program, GEN::IPrinter& pr )
+{
+    GEN::Decoder decoder;
+    const GEN::uint8* pIsa = (const GEN::uint8*) program.GetIsa();
+    size_t nIsaLength = program.GetIsaLengthInBytes();
+
+    std::vector<GEN::Instruction> ops;
+    std::vector<size_t> offsets;
+    size_t nOffset = 0;
+    while( nOffset < nIsaLength )
+    {
+        GEN::Instruction inst;
+        size_t nLength = decoder.Decode( &inst, pIsa + nOffset );
+        if( !nLength )
+        {
+            printf("BranchTest(%s): decode failed at offset %u\n", pName, (unsigned)nOffset );
+            return false;
+        }
+        ops.push_back(inst);
+        offsets.push_back(nOffset);
+        nOffset += nLength;
+    }
+
+    size_t nExpected = sizeof(BRANCH_EXPECTATIONS)/sizeof(BRANCH_EXPECTATIONS[0]);
+    size_t nFound = 0;
+    for( size_t i=0; i<ops.size(); i++ )
+    {
+        if( ops[i].GetClass() != GEN::IC_BRANCH )
+            continue;
+
+        const GEN::BranchInstruction& rBranch = static_cast<const GEN::BranchInstruction&>( ops[i] );
+        size_t nJIP = FindInstruction( offsets, (int)offsets[i] + 8*rBranch.GetJIP() );
+        size_t nUIP = FindInstruction( offsets, (int)offsets[i] + 8*rBranch.GetUIP() );
+
+        const BranchExpectation* pExpect = 0;
+        for( size_t j=0; j<nExpected; j++ )
+            if( BRANCH_EXPECTATIONS[j].nIndex == i )
+                pExpect = &BRANCH_EXPECTATIONS[j];
+
+        if( !pExpect || pExpect->eOp != rBranch.GetOperation() ||
+            pExpect->nJIPTarget != nJIP || pExpect->nUIPTarget != nUIP )
+        {
+            printf("BranchTest(%s): bad branch at instruction %u (JIP->%d UIP->%d)\n", pName, (unsigned)i, (int)nJIP, (int)nUIP );
+            GEN::Disassemble( pr, &decoder, pIsa, nIsaLength );
+            return false;
+        }
+        nFound++;
+    }
+
+    if( nFound != nExpected )
+    {
+        printf("BranchTest(%s): expected %u branches, found %u\n", pName, (unsigned)nExpected, (unsigned)nFound );
+        return false;
+    }
+    return true;
+}
+
+void BranchTest()
+{
+    class Printer : public GEN::IPrinter{
+    public:
+        virtual void Push( const char* p )
+        {
+            printf("%s", p );
+        }
+    };
+
+    Printer pr;
+    GEN::Encoder encoder;
+    GEN::Encoder nativeEncoder;
+    nativeEncoder.SetCompaction(false);
+
+    GEN::Assembler::Program compacted;
+    GEN::Assembler::Program native;
+    if( !compacted.Assemble( &encoder, BRANCH_TEST, &pr ) ||
+        !native.Assemble( &nativeEncoder, BRANCH_TEST, &pr ) )
+    {
+        printf("BranchTest: assembly failed\n");
+        return;
+    }
+
+    if( !CheckBranches( "native", native, pr ) || !CheckBranches( "compacted", compacted, pr ) )
+        return;
+
+    StringPrinter errors;
+    GEN::Assembler::Program empty;
+    if( empty.Assemble( &encoder, BRANCH_EMPTY_LOOP_TEST, &errors ) ||
+        errors.m_Text.find("Empty loop") == std::string::npos ||
+        errors.m_Text.find("without matching") != std::string::npos )
+    {
+        printf("BranchTest: wrong errors for an empty loop\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    printf("BranchTest: passed\n");
+}
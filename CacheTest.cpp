@@ -0,0 +1,101 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENCoder.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+// Program cache test.  The second assembly of the same text should come from the cache file the first one wrote,
+//   and match it exactly.  Changing an encoder option has to miss
+const char* CACHE_TEST = STRINGIFY(
+
+bind Output 0x38
+
+reg msg[2]
+
+curbe Values[1] = {1,2,3,4,5,6,7,8}
+
+begin:
+
+mov(8) msg0.u, r0.u1<0,1,0>
+add(8) msg1.u, Values.u, 3
+send DwordStore8(Output), null.u, msg0.u
+
+end
+);
+
+static bool SameProgram( const GEN::Assembler::Program& a, const GEN::Assembler::Program& b )
+{
+    return a.GetIsaLengthInBytes() == b.GetIsaLengthInBytes() &&
+           a.GetCURBERegCount() == b.GetCURBERegCount() &&
+           a.GetThreadsPerDispatch() == b.GetThreadsPerDispatch() &&
+           memcmp( a.GetIsa(), b.GetIsa(), a.GetIsaLengthInBytes() ) == 0 &&
+           memcmp( a.GetCURBE(), b.GetCURBE(), 32*a.GetCURBERegCount() ) == 0;
+}
+
+void CacheTest()
+{
+    StringPrinter errors;
+    GEN::Encoder encoder;
+
+    GEN::Assembler::Program first;
+    GEN::Assembler::Program second;
+    first.SetCacheDirectory(".");
+    second.SetCacheDirectory(".");
+    if( !first.Assemble( &encoder, CACHE_TEST, &errors ) )
+    {
+        printf("CacheTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+    remove( first.GetCacheFile().c_str() ); // in case an earlier run left it behind
+
+    if( !first.Assemble( &encoder, CACHE_TEST, &errors ) ||
+        !second.Assemble( &encoder, CACHE_TEST, &errors ) )
+    {
+        printf("CacheTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    if( first.IsFromCache() || !second.IsFromCache() || first.GetCacheFile() != second.GetCacheFile() )
+    {
+        printf("CacheTest: second assembly didn't come from the cache\n");
+        return;
+    }
+    if( !SameProgram( first, second ) )
+    {
+        printf("CacheTest: cached program doesn't match\n");
+        return;
+    }
+
+    // a cache file that is longer than its header says must be reassembled
+    FILE* fp = fopen( first.GetCacheFile().c_str(), "ab" );
+    if( fp )
+    {
+        fputc( 0, fp );
+        fclose(fp);
+    }
+    GEN::Assembler::Program damaged;
+    damaged.SetCacheDirectory(".");
+    if( !fp || !damaged.Assemble( &encoder, CACHE_TEST, &errors ) || damaged.IsFromCache() || !SameProgram( first, damaged ) )
+    {
+        printf("CacheTest: damaged cache file was used\n");
+        return;
+    }
+
+    GEN::Encoder uncompacted;
+    uncompacted.SetCompaction(false);
+    GEN::Assembler::Program third;
+    third.SetCacheDirectory(".");
+    if( !third.Assemble( &uncompacted, CACHE_TEST, &errors ) || third.IsFromCache() )
+    {
+        printf("CacheTest: compaction change hit the cache\n");
+        return;
+    }
+
+    remove( first.GetCacheFile().c_str() );
+    remove( third.GetCacheFile().c_str() );
+    printf("CacheTest: passed\n");
+}
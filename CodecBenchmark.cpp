@@ -0,0 +1,303 @@
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENCoder.h"
+#include "GENIsa.h"
+#include "Misc.h"
+
+// Throughput of the ISA tools themselves.
+//   Random instructions are built per instruction class using the helpers in GENIsa.cpp,
+//   and the shipped raytracer kernels are assembled repeatedly.  Every operation reports
+//   MB/s (of ISA, or of source text for the assembler) and instructions/s.
+//
+//   Machine-readable mode prints one CSV line per measurement, for tracking regressions
+
+static const char* KERNELS[] = {
+    "raytracer/eight_ray.inl",
+    "raytracer/single_ray.inl",
+    "raytracer/single_ray_qbvh.inl",
+    "raytracer/single_ray_vectri_x8.inl",
+    "raytracer/single_ray_vectri_x16.inl",
+};
+
+class NullPrinter : public GEN::IPrinter
+{
+public:
+    NullPrinter() : m_nChars(0) {}
+    virtual void Push( const char* p ) { m_nChars += strlen(p); }
+    size_t m_nChars;
+};
+
+static size_t RandomExecSize()
+{
+    static const size_t SIZES[] = {1,8,16};
+    return SIZES[rand()%3];
+}
+
+static GEN::RegisterRegion RandomGPR( size_t nExecSize )
+{
+    GEN::DirectRegReference reg( rand()%120 );
+    if( nExecSize == 1 )
+        return GEN::RegisterRegion( reg, 0, 1, 0 );
+    return GEN::RegisterRegion( reg, 8, 8, 1 );
+}
+
+static GEN::Instruction RandomInstruction( GEN::InstructionClass eClass )
+{
+    static const GEN::Operations BINARY_OPS[] = {
+        GEN::OP_ADD, GEN::OP_MUL, GEN::OP_AND, GEN::OP_OR, GEN::OP_XOR, GEN::OP_SHL, GEN::OP_SHR, GEN::OP_SEL
+    };
+    static const GEN::DataTypes TYPES[] = { GEN::DT_U32, GEN::DT_S32, GEN::DT_F32 };
+    static const GEN::MathFunctionIDs MATH_FUNCS[] = {
+        GEN::MATH_INVERSE, GEN::MATH_LOG, GEN::MATH_EXP, GEN::MATH_SQRT, GEN::MATH_RSQ, GEN::MATH_SIN, GEN::MATH_COS
+    };
+
+    GEN::uint32 nDst  = rand()%120;
+    GEN::uint32 nSrc0 = rand()%120;
+    GEN::uint32 nSrc1 = rand()%120;
+    switch( eClass )
+    {
+    case GEN::IC_UNARY:
+        if( rand()%2 )
+            return GEN::RegMoveIMM( nDst, rand() );
+        return GEN::RegMove( GEN::REG_GPR, nDst, GEN::REG_GPR, nSrc0 );
+
+    case GEN::IC_BINARY:
+        if( rand()%2 )
+            return GEN::DoMathIMM( RandomExecSize(), BINARY_OPS[rand()%6], nDst, nSrc0, rand() );
+        return GEN::DoMath( RandomExecSize(), BINARY_OPS[rand()%8], TYPES[rand()%3], nDst, nSrc0, nSrc1 );
+
+    case GEN::IC_TERNARY:
+        {
+            size_t nExec = 8 << (rand()%2);
+            return GEN::TernaryInstruction( nExec, (rand()%2) ? GEN::OP_FMA : GEN::OP_LRP,
+                                            GEN::DestOperand( GEN::DT_F32, RandomGPR(nExec) ),
+                                            GEN::SourceOperand( GEN::DT_F32, RandomGPR(nExec) ),
+                                            GEN::SourceOperand( GEN::DT_F32, RandomGPR(nExec) ),
+                                            GEN::SourceOperand( GEN::DT_F32, RandomGPR(nExec) ) );
+        }
+
+    case GEN::IC_SEND:
+        switch( rand()%5 )
+        {
+        case 0:  return GEN::OWordDualBlockRead( rand()%16, nSrc0, nDst );
+        case 1:  return GEN::OWordDualBlockWrite( rand()%16, nSrc0 );
+        case 2:  return GEN::DWordScatteredReadSIMD8( rand()%16, nSrc0, nDst );
+        case 3:  return GEN::UntypedRead_SIMD8x4( rand()%16, GEN::DirectRegReference(nSrc0), GEN::DirectRegReference(nDst) );
+        default: return GEN::ReadGatewayTimestamp( nDst, nSrc0 );
+        }
+
+    case GEN::IC_MATH:
+        {
+            size_t nExec = 8 << (rand()%2);
+            GEN::DestOperand dst( GEN::DT_F32, RandomGPR(nExec) );
+            GEN::SourceOperand src0( GEN::DT_F32, RandomGPR(nExec) );
+            if( rand()%4 == 0 )
+                return GEN::MathInstruction( nExec, GEN::MATH_POW, dst, src0, GEN::SourceOperand( GEN::DT_F32, RandomGPR(nExec) ) );
+            return GEN::MathInstruction( nExec, MATH_FUNCS[rand()%7], dst, src0 );
+        }
+
+    default:
+        return GEN::Instruction();
+    }
+}
+
+static double Seconds( LARGE_INTEGER start, LARGE_INTEGER end )
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return ((double)(end.QuadPart-start.QuadPart)) / freq.QuadPart;
+}
+
+static void Report( bool bMachineReadable, const char* pOperation, const char* pCorpus,
+                    size_t nBytes, size_t nInstructions, double fSeconds )
+{
+    double fMBPerSec   = (nBytes/(1024.0*1024.0)) / fSeconds;
+    double fInstPerSec = nInstructions / fSeconds;
+    if( bMachineReadable )
+        printf("codec,%s,%s,%u,%u,%.6f,%.3f,%.0f\n", pOperation, pCorpus, (unsigned)nBytes, (unsigned)nInstructions, fSeconds, fMBPerSec, fInstPerSec );
+    else
+        printf("  %-12s %-10s %10.2f MB/s %10.2f Minst/s\n", pOperation, pCorpus, fMBPerSec, fInstPerSec/1000000.0 );
+}
+
+/// Count the instructions in a stream, up to the first one that can't be decoded.  Returns the bytes they cover
+static size_t CountInstructions( GEN::Decoder& rDecoder, const GEN::uint8* pIsa, size_t nBytes, size_t* pInstructions )
+{
+    size_t nOffset=0;
+    while( nOffset < nBytes )
+    {
+        size_t nLength = rDecoder.DetermineLength( pIsa+nOffset );
+        if( !nLength || nLength > nBytes-nOffset )
+            break;
+        nOffset += nLength;
+        (*pInstructions)++;
+    }
+    return nOffset;
+}
+
+// Time decode, expand, and disassembly over an encoded instruction stream
+static void BenchmarkIsa( bool bMachineReadable, const char* pCorpus, const std::vector<GEN::uint8>& isa, size_t nReps )
+{
+    GEN::Decoder decoder;
+    const GEN::uint8* pIsa = isa.data();
+
+    // a malformed stream is only timed as far as it decodes
+    size_t nInstructions=0;
+    size_t nBytes = CountInstructions( decoder, pIsa, isa.size(), &nInstructions );
+
+    LARGE_INTEGER t0,t1;
+    GEN::Instruction inst;
+    QueryPerformanceCounter(&t0);
+    for( size_t r=0; r<nReps; r++ )
+    {
+        size_t nOffset=0;
+        while( nOffset < nBytes )
+        {
+            size_t nLength = decoder.Decode( &inst, pIsa+nOffset );
+            if( !nLength )
+                break;
+            nOffset += nLength;
+        }
+    }
+    QueryPerformanceCounter(&t1);
+    Report( bMachineReadable, "decode", pCorpus, nReps*nBytes, nReps*nInstructions, Seconds(t0,t1) );
+
+    GEN::uint8 expanded[16];
+    QueryPerformanceCounter(&t0);
+    for( size_t r=0; r<nReps; r++ )
+    {
+        size_t nOffset=0;
+        while( nOffset < nBytes )
+        {
+            size_t nLength = decoder.Expand( expanded, pIsa+nOffset );
+            if( !nLength )
+                break;
+            nOffset += nLength;
+        }
+    }
+    QueryPerformanceCounter(&t1);
+    Report( bMachineReadable, "expand", pCorpus, nReps*nBytes, nReps*nInstructions, Seconds(t0,t1) );
+
+    NullPrinter printer;
+    QueryPerformanceCounter(&t0);
+    for( size_t r=0; r<nReps; r++ )
+        GEN::Disassemble( printer, &decoder, pIsa, nBytes );
+    QueryPerformanceCounter(&t1);
+    Report( bMachineReadable, "disassemble", pCorpus, nReps*nBytes, nReps*nInstructions, Seconds(t0,t1) );
+}
+
+static void BenchmarkEncode( bool bMachineReadable, const char* pCorpus,
+                             const std::vector<GEN::Instruction>& ops, size_t nReps, std::vector<GEN::uint8>& isa )
+{
+    GEN::Encoder encoder;
+    isa.resize( encoder.GetBufferSize(ops.size()) );
+
+    size_t nBytes=0;
+    LARGE_INTEGER t0,t1;
+    QueryPerformanceCounter(&t0);
+    for( size_t r=0; r<nReps; r++ )
+        nBytes = encoder.Encode( isa.data(), ops.data(), ops.size() );
+    QueryPerformanceCounter(&t1);
+
+    isa.resize(nBytes);
+    Report( bMachineReadable, "encode", pCorpus, nReps*nBytes, nReps*ops.size(), Seconds(t0,t1) );
+}
+
+void CodecBenchmark( bool bMachineReadable )
+{
+    const size_t nInstructions = 64*1024;
+    const size_t nReps = 10;
+    const size_t nAssemblerReps = 20;
+
+    struct ClassCorpus
+    {
+        GEN::InstructionClass eClass;
+        const char* pName;
+    };
+    static const ClassCorpus CLASSES[] = {
+        { GEN::IC_UNARY,   "unary"   },
+        { GEN::IC_BINARY,  "binary"  },
+        { GEN::IC_TERNARY, "ternary" },
+        { GEN::IC_SEND,    "send"    },
+        { GEN::IC_MATH,    "math"    },
+    };
+    const size_t nClasses = sizeof(CLASSES)/sizeof(CLASSES[0]);
+
+    if( bMachineReadable )
+        printf("codec,operation,corpus,bytes,instructions,seconds,mb_per_sec,inst_per_sec\n");
+    else
+        printf("Codec benchmark: %u instructions per class, %u reps\n", (unsigned)nInstructions, (unsigned)nReps );
+
+    srand(0);
+
+    // per-class corpora, and a shuffled mix of all of them
+    std::vector<GEN::Instruction> mixed;
+    std::vector<GEN::uint8> isa;
+    for( size_t c=0; c<nClasses; c++ )
+    {
+        std::vector<GEN::Instruction> ops;
+        for( size_t i=0; i<nInstructions; i++ )
+            ops.push_back( RandomInstruction( CLASSES[c].eClass ) );
+
+        BenchmarkEncode( bMachineReadable, CLASSES[c].pName, ops, nReps, isa );
+        BenchmarkIsa( bMachineReadable, CLASSES[c].pName, isa, nReps );
+        mixed.insert( mixed.end(), ops.begin(), ops.begin() + nInstructions/nClasses );
+    }
+
+    for( size_t i=mixed.size()-1; i>0; i-- )
+        std::swap( mixed[i], mixed[rand()%(i+1)] );
+    BenchmarkEncode( bMachineReadable, "mixed", mixed, nReps, isa );
+    BenchmarkIsa( bMachineReadable, "mixed", isa, nReps );
+
+    // real kernels.  Anything that doesn't assemble is skipped
+    NullPrinter errors;
+    GEN::Encoder encoder;
+    std::vector<GEN::uint8> kernelIsa;
+    size_t nTextBytes=0;
+    size_t nKernelInstructions=0;
+    double fAssembleTime=0;
+    for( size_t k=0; k<sizeof(KERNELS)/sizeof(KERNELS[0]); k++ )
+    {
+        std::string text = ReadTextFile( KERNELS[k] );
+
+        GEN::Assembler::Program program;
+        LARGE_INTEGER t0,t1;
+        QueryPerformanceCounter(&t0);
+        bool bOk = true;
+        for( size_t r=0; r<nAssemblerReps && bOk; r++ )
+            bOk = program.Assemble( &encoder, text.c_str(), &errors );
+        QueryPerformanceCounter(&t1);
+        if( !bOk )
+            continue;
+
+        GEN::Decoder decoder;
+        const GEN::uint8* pIsa = (const GEN::uint8*) program.GetIsa();
+        size_t nIsaBytes = program.GetIsaLengthInBytes();
+        CountInstructions( decoder, pIsa, nIsaBytes, &nKernelInstructions );
+
+        nTextBytes += text.size();
+        fAssembleTime += Seconds(t0,t1);
+        kernelIsa.insert( kernelIsa.end(), pIsa, pIsa + nIsaBytes );
+    }
+
+    if( kernelIsa.empty() )
+    {
+        printf("CodecBenchmark: no kernels assembled\n");
+        return;
+    }
+
+    Report( bMachineReadable, "assemble", "kernels", nAssemblerReps*nTextBytes, nAssemblerReps*nKernelInstructions, fAssembleTime );
+
+    // replicate the kernels up to roughly the size of the random corpora
+    std::vector<GEN::uint8> kernels;
+    while( kernels.size() < 16*nInstructions )
+        kernels.insert( kernels.end(), kernelIsa.begin(), kernelIsa.end() );
+    BenchmarkIsa( bMachineReadable, "kernels", kernels, nReps );
+}
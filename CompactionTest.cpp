@@ -0,0 +1,208 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENCoder.h"
+#include "GENIsa.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// Round-trip test for instruction compaction.
+const char* COMPACTION_TEST = STRINGIFY(
+
+curbe OFFSETS[1] = {{0,1,2,3,4,5,6,7}}
+
+reg base[2]
+reg addr[4]
+reg data[2]
+reg tmp[2]
+reg scalar
+
+bind Input  0x38
+bind Output 0x39
+
+begin:
+
+mul(16)  base.u, r0.u2<0,1,0>, 16
+add(16)  addr.u, base.u, OFFSETS.u
+add(16)  addr.u, addr.u, 8
+send     DwordLoad16(Input), data.f, addr.u
+
+mov(1)   scalar.u, 0
+mov(8)   tmp.u, 5
+mov(16)  tmp.f, 1.0f
+mul(16)  data.f, data.f, tmp.f
+add(16)  data.f, data.f, data.f
+sub(16)  tmp.f, data.f, base.f
+max(16)  data.f, data.f, 0.0f
+and(16)  base.u, base.u, 255
+shl(16)  base.u, base.u, 2
+shr(8)   scalar.u, base.u, 1
+cmpne(16)(f0.0) null.u, data.f, 0.0f
+fma(16)  data.f, tmp.f, tmp.f
+rsq(16)  tmp.f, data.f
+
+mov(16)  addr2.f, data.f
+send     DwordStore16(Output), null.u, addr.u
+
+end
+);
+
+// Decoded jump offsets are in compacted bytes.  Re-encoding has to re-target them from there
+const char* COMPACTION_JUMP_TEST = STRINGIFY(
+
+bind Output 0x38
+
+reg msg[2]
+
+begin:
+
+mov(8) msg0.u, r0.u1<0,1,0>
+mov(8) msg1.u, 0
+loop:
+    add(8) msg1.u, msg1.u, 3
+    add(8) msg1.u, msg1.u, msg0.u
+    and(8) msg1.u, msg1.u, 255
+    cmplt(8)(f0.0) null.u, msg1.u, 200
+    jmpif(f0.0) loop
+send DwordStore8(Output), null.u, msg0.u
+
+end
+);
+
+/// Decode a compacted program with jumps in it, and check that it re-encodes to the same bits,
+///   and to the native encoding when compaction is off
+static bool JumpRoundTrip( GEN::Decoder& rDecoder, GEN::IPrinter& rPrinter )
+{
+    GEN::Encoder encoder;
+    GEN::Encoder nativeEncoder;
+    nativeEncoder.SetCompaction(false);
+
+    GEN::Assembler::Program compacted;
+    GEN::Assembler::Program native;
+    if( !compacted.Assemble( &encoder, COMPACTION_JUMP_TEST, &rPrinter ) ||
+        !native.Assemble( &nativeEncoder, COMPACTION_JUMP_TEST, &rPrinter ) )
+    {
+        printf("CompactionTest: jump assembly failed\n");
+        return false;
+    }
+
+    const GEN::uint8* pIsa = (const GEN::uint8*) compacted.GetIsa();
+    size_t nIsaLength      = compacted.GetIsaLengthInBytes();
+    if( nIsaLength == native.GetIsaLengthInBytes() )
+    {
+        printf("CompactionTest: nothing in the jump test was compacted\n");
+        return false;
+    }
+
+    std::vector<GEN::Instruction> ops;
+    std::vector<size_t> offsets;
+    size_t nOffset = 0;
+    while( nOffset < nIsaLength )
+    {
+        GEN::Instruction inst;
+        size_t nLength = rDecoder.Decode( &inst, pIsa + nOffset );
+        if( !nLength )
+        {
+            printf("CompactionTest: jump decode failed at offset %u\n", (unsigned)nOffset );
+            return false;
+        }
+        ops.push_back(inst);
+        offsets.push_back(nOffset);
+        nOffset += nLength;
+    }
+    offsets.push_back(nOffset);
+
+    std::vector<GEN::uint8> bytes( encoder.GetBufferSize(ops.size()) );
+    size_t nReencoded = encoder.Encode( &bytes[0], &ops[0], ops.size(), &offsets[0] );
+    if( nReencoded != nIsaLength || memcmp( &bytes[0], pIsa, nIsaLength ) != 0 )
+    {
+        printf("CompactionTest: re-encoded jumps don't match\n");
+        return false;
+    }
+
+    nReencoded = nativeEncoder.Encode( &bytes[0], &ops[0], ops.size(), &offsets[0] );
+    if( nReencoded != native.GetIsaLengthInBytes() || memcmp( &bytes[0], native.GetIsa(), nReencoded ) != 0 )
+    {
+        printf("CompactionTest: jumps re-encoded without compaction don't match\n");
+        return false;
+    }
+    return true;
+}
+
+void CompactionTest()
+{
+    class Printer : public GEN::IPrinter{
+    public:
+        virtual void Push( const char* p )
+        {
+            printf("%s", p );
+        }
+    };
+
+    Printer pr;
+    GEN::Decoder decoder;
+    GEN::Encoder encoder;
+    GEN::Encoder nativeEncoder;
+    nativeEncoder.SetCompaction(false);
+
+    GEN::Assembler::Program compacted;
+    GEN::Assembler::Program native;
+    if( !compacted.Assemble( &encoder, COMPACTION_TEST, &pr ) ||
+        !native.Assemble( &nativeEncoder, COMPACTION_TEST, &pr ) )
+    {
+        printf("CompactionTest: assembly failed\n");
+        return;
+    }
+
+    const GEN::uint8* pIsa    = (const GEN::uint8*) compacted.GetIsa();
+    const GEN::uint8* pNative = (const GEN::uint8*) native.GetIsa();
+    size_t nIsaLength         = compacted.GetIsaLengthInBytes();
+
+    // Every compacted instruction must expand back to exactly what the native encoder wrote
+    std::vector<GEN::Instruction> ops;
+    size_t nOffset = 0;
+    size_t nCompacted = 0;
+    while( nOffset < nIsaLength )
+    {
+        GEN::Instruction inst;
+        size_t nLength = decoder.Decode( &inst, pIsa + nOffset );
+        if( !nLength )
+        {
+            printf("CompactionTest: decode failed at offset %u\n", (unsigned)nOffset );
+            return;
+        }
+
+        GEN::uint8 pExpanded[16];
+        decoder.Expand( pExpanded, pIsa + nOffset );
+        if( memcmp( pExpanded, pNative + 16*ops.size(), 16 ) != 0 )
+        {
+            printf("CompactionTest: instruction %u doesn't expand to its native form\n", (unsigned)ops.size() );
+            return;
+        }
+
+        if( nLength == 8 )
+            nCompacted++;
+
+        ops.push_back(inst);
+        nOffset += nLength;
+    }
+
+    // Decode -> re-encode must give back the same bits
+    std::vector<GEN::uint8> bytes( encoder.GetBufferSize(ops.size()) );
+    size_t nReencoded = encoder.Encode( &bytes[0], &ops[0], ops.size() );
+    if( nReencoded != nIsaLength || memcmp( &bytes[0], pIsa, nIsaLength ) != 0 )
+    {
+        printf("CompactionTest: re-encoded ISA doesn't match\n");
+        GEN::Disassemble( pr, &decoder, pIsa, nIsaLength );
+        return;
+    }
+
+    if( !JumpRoundTrip( decoder, pr ) )
+        return;
+
+    printf("CompactionTest: passed.  %u of %u instructions compacted (%u bytes vs %u)\n",
+            (unsigned)nCompacted, (unsigned)ops.size(), (unsigned)nIsaLength, (unsigned)native.GetIsaLengthInBytes() );
+}
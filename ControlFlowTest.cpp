@@ -0,0 +1,151 @@
+
+#include "GENAssembler.h"
+#include "GENControlFlow.h"
+#include "GENDisassembler.h"
+#include "GENCoder.h"
+#include "GENIsa.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string>
+
+// Control-flow graph test.  Checks that jumps and structured branches split the program
+//   into the right basic blocks, with and without compaction
+const char* CONTROL_FLOW_TEST = STRINGIFY(
+
+reg count[2]
+reg limit[2]
+
+begin:
+
+mov(16)  count.u, 0
+mul(16)  limit.u, r0.u2<0,1,0>, 3
+spin:
+    add(16)  count.u, count.u, 1
+    cmplt(16)(f0.0) null.u, count.u, limit.u
+    jmpif(f0.0) spin
+do
+    add(16)  count.u, count.u, 2
+    cmpge(16)(f0.1) null.u, count.u, 64
+    break(16) (f0.1)
+    add(16)  limit.u, limit.u, 1
+while(16)
+
+end
+);
+
+struct EdgeExpectation
+{
+    size_t nFrom;   // instruction indices of the first instruction in each block
+    size_t nTo;
+    GEN::EdgeTypes eType;
+};
+
+// Instruction indices.  0 is the r0 header move the assembler inserts at 'begin'
+// The thread-ending send after the 'while' gets a block of its own, with no edges out of it
+static const size_t BLOCK_EXPECTATIONS[] = { 0, 3, 6, 9, 10 };
+static const EdgeExpectation EDGE_EXPECTATIONS[] = {
+    { 0,  3,  GEN::EDGE_FALLTHROUGH },
+    { 3,  6,  GEN::EDGE_FALLTHROUGH },
+    { 3,  3,  GEN::EDGE_JUMP },
+    { 6,  9,  GEN::EDGE_FALLTHROUGH },
+    { 6,  10, GEN::EDGE_JIP },
+    { 6,  10, GEN::EDGE_UIP },
+    { 9,  10, GEN::EDGE_FALLTHROUGH },
+    { 10, 6,  GEN::EDGE_JIP },
+    { 10, 11, GEN::EDGE_FALLTHROUGH },
+};
+
+static bool CheckGraph( const char* pName, const GEN::Assembler::Program& program )
+{
+    GEN::Decoder decoder;
+    GEN::ControlFlowGraph cfg;
+    if( !cfg.Build( &decoder, program.GetIsa(), program.GetIsaLengthInBytes() ) )
+    {
+        printf("ControlFlowTest(%s): decode failed\n", pName );
+        return false;
+    }
+
+    size_t nBlocks = sizeof(BLOCK_EXPECTATIONS)/sizeof(BLOCK_EXPECTATIONS[0]);
+    if( cfg.GetBlockCount() != nBlocks+1 )
+    {
+        printf("ControlFlowTest(%s): expected %u blocks, found %u\n", pName, (unsigned)(nBlocks+1), (unsigned)cfg.GetBlockCount() );
+        return false;
+    }
+    for( size_t i=0; i<nBlocks; i++ )
+    {
+        if( cfg.GetBlock(i).nFirstInstruction != BLOCK_EXPECTATIONS[i] )
+        {
+            printf("ControlFlowTest(%s): block %u starts at instruction %u\n", pName, (unsigned)i, (unsigned)cfg.GetBlock(i).nFirstInstruction );
+            return false;
+        }
+    }
+
+    // the 'while' is a block by itself, and the final block ends the thread
+    const GEN::BasicBlock& rWhile = cfg.GetBlock(nBlocks-1);
+    const GEN::BasicBlock& rLast  = cfg.GetBlock(nBlocks);
+    if( rWhile.nInstructionCount != 1 || rLast.nEdgeCount != 0 ||
+        cfg.GetInstruction( cfg.GetInstructionCount()-1 ).GetClass() != GEN::IC_SEND )
+    {
+        printf("ControlFlowTest(%s): bad loop exit\n", pName );
+        return false;
+    }
+
+    size_t nExpected = sizeof(EDGE_EXPECTATIONS)/sizeof(EDGE_EXPECTATIONS[0]);
+    for( size_t i=0; i<nExpected; i++ )
+    {
+        bool bFound = false;
+        for( size_t e=0; e<cfg.GetEdgeCount(); e++ )
+        {
+            const GEN::ControlFlowEdge& rEdge = cfg.GetEdge(e);
+            if( cfg.GetBlock(rEdge.nFromBlock).nFirstInstruction == EDGE_EXPECTATIONS[i].nFrom &&
+                cfg.GetBlock(rEdge.nToBlock).nFirstInstruction == EDGE_EXPECTATIONS[i].nTo &&
+                rEdge.eType == EDGE_EXPECTATIONS[i].eType )
+                bFound = true;
+        }
+        if( !bFound )
+        {
+            printf("ControlFlowTest(%s): missing edge %u->%u\n", pName, (unsigned)EDGE_EXPECTATIONS[i].nFrom, (unsigned)EDGE_EXPECTATIONS[i].nTo );
+            return false;
+        }
+    }
+
+    size_t nBackEdges = 0;
+    for( size_t e=0; e<cfg.GetEdgeCount(); e++ )
+        if( cfg.GetEdge(e).IsBackEdge() )
+            nBackEdges++;
+    if( nBackEdges != 2 )
+    {
+        printf("ControlFlowTest(%s): expected 2 back edges, found %u\n", pName, (unsigned)nBackEdges );
+        return false;
+    }
+
+    StringPrinter json;
+    if( !GEN::DisassembleJSON( json, &decoder, program.GetIsa(), program.GetIsaLengthInBytes() ) ||
+        json.m_Text.find("\"type\":\"uip\"") == std::string::npos )
+    {
+        printf("ControlFlowTest(%s): JSON disassembly failed\n", pName );
+        return false;
+    }
+    return true;
+}
+
+void ControlFlowTest()
+{
+    StringPrinter errors;
+    GEN::Encoder encoder;
+    GEN::Encoder nativeEncoder;
+    nativeEncoder.SetCompaction(false);
+
+    GEN::Assembler::Program compacted;
+    GEN::Assembler::Program native;
+    if( !compacted.Assemble( &encoder, CONTROL_FLOW_TEST, &errors ) ||
+        !native.Assemble( &nativeEncoder, CONTROL_FLOW_TEST, &errors ) )
+    {
+        printf("ControlFlowTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    if( CheckGraph( "native", native ) && CheckGraph( "compacted", compacted ) )
+        printf("ControlFlowTest: passed\n");
+}
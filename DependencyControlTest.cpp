@@ -0,0 +1,109 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENCoder.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Dependency control test.  The two halves of 'offs' are a run, so the first gets NoDDClr and the second NoDDChk.
+//   'other' is read between its two writes, and the predicated write to 'masked' can't be part of a run
+const char* DEPENDENCY_CONTROL_TEST = STRINGIFY(
+
+bind Output 0x38
+
+reg offs
+reg other
+reg masked
+reg sum
+
+begin:
+
+mov(8) offs.us0, 1
+mov(8) offs.us8, 2
+mov(8) other.us0, 3
+add(16) sum.u, other.us, offs.us
+mov(8) other.us8, 4
+cmpeq(8) (f0.0) null.u, sum.u, 0
+mov(8) masked.us0, 5
+pred(f0.0)
+{
+    mov(8) masked.us8, 6
+}
+send DwordStore8(Output), null.u, sum.u
+
+end
+);
+
+struct ExpectedBits
+{
+    bool bNoDDClr;
+    bool bNoDDChk;
+};
+
+// the assembler starts every program by copying r0 to r127
+static const ExpectedBits DEPENDENCY_CONTROL_EXPECTED[] = {
+    { false, false },
+    { true,  false },
+    { false, true  },
+    { false, false },
+    { false, false },
+    { false, false },
+    { false, false },
+    { false, false },
+    { false, false },
+};
+
+static bool CheckDependencyControl( const char* pName, GEN::Encoder& rEncoder )
+{
+    StringPrinter errors;
+    GEN::Assembler::Program program;
+    program.SetDependencyControl(true);
+    if( !program.Assemble( &rEncoder, DEPENDENCY_CONTROL_TEST, &errors ) )
+    {
+        printf("DependencyControlTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return false;
+    }
+
+    GEN::Decoder decoder;
+    const GEN::uint8* pIsa = (const GEN::uint8*) program.GetIsa();
+    size_t nIsaLength = program.GetIsaLengthInBytes();
+    size_t nOffset = 0;
+    size_t nExpected = sizeof(DEPENDENCY_CONTROL_EXPECTED)/sizeof(DEPENDENCY_CONTROL_EXPECTED[0]);
+    for( size_t i=0; i<nExpected; i++ )
+    {
+        GEN::Instruction inst;
+        size_t nLength = nOffset < nIsaLength ? decoder.Decode( &inst, pIsa + nOffset ) : 0;
+        if( !nLength )
+        {
+            printf("DependencyControlTest: %s decode failed at instruction %u\n", pName, (unsigned)i );
+            return false;
+        }
+
+        if( inst.IsDDClearDisabled() != DEPENDENCY_CONTROL_EXPECTED[i].bNoDDClr ||
+            inst.IsDDCheckDisabled() != DEPENDENCY_CONTROL_EXPECTED[i].bNoDDChk )
+        {
+            printf("DependencyControlTest: %s instruction %u has the wrong dependency control\n", pName, (unsigned)i );
+            GEN::Disassemble( errors, &decoder, pIsa, nIsaLength );
+            printf("%s", errors.m_Text.c_str() );
+            return false;
+        }
+        nOffset += nLength;
+    }
+    return true;
+}
+
+void DependencyControlTest()
+{
+    GEN::Encoder compacted;
+    GEN::Encoder native;
+    native.SetCompaction(false);
+    if( !CheckDependencyControl( "compacted", compacted ) ||
+        !CheckDependencyControl( "native", native ) )
+        return;
+
+    printf("DependencyControlTest: passed\n");
+}
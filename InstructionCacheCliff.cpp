@@ -173,8 +173,8 @@ void FindCliff( size_t nOps, FILE* plot )
     HAXWell::ReleaseBuffer(hBuffer);
     double latency = ((double)nAvg) / (nThreadsPerGroup*nGroups);
     
-    fprintf(plot, "%u, %f, %u\n", 16*ops.size(), latency,  ops.size() );
-    printf("%u, %f, %u\n", 16*ops.size(), latency, ops.size() );
+    fprintf(plot, "%u, %f, %u\n", (unsigned)isa.GetLength(), latency,  (unsigned)ops.size() );
+    printf("%u, %f, %u\n", (unsigned)isa.GetLength(), latency, (unsigned)ops.size() );
 
 }
 
@@ -0,0 +1,220 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENInterpreter.h"
+#include "GENCoder.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string>
+
+// Interpreter test.  Odd inputs are doubled and even ones get 100 added, then each lane loops
+//   (index&3)+1 times, adding one each time, and the result takes a round trip through floats.  This covers
+//   divergent if/else, a loop whose channels leave at different times, and both kinds of scattered message
+const char* INTERPRETER_TEST = STRINGIFY(
+
+curbe INDICES[2] = {{0,1,2,3,4,5,6,7},
+                    {8,9,10,11,12,13,14,15}}
+
+bind Input  0x38
+bind Output 0x39
+
+reg data[2]
+reg count[2]
+reg acc[2]
+reg root[2]
+reg out[4]
+
+begin:
+
+send DwordLoad16(Input), data.u, INDICES.u
+
+and(16) count.u, data.u, 1
+cmpne(16)(f0.0) null.u, count.u, 0
+if(16) (f0.0)
+    mul(16) data.u, data.u, 2
+else
+    add(16) data.u, data.u, 100
+endif
+
+and(16) count.u, INDICES.u, 3
+mov(16) acc.u, 0
+do
+    add(16) acc.u, acc.u, 1
+    cmple(16)(f0.1) null.u, acc.u, count.u
+while(16) (f0.1)
+add(16) data.u, data.u, acc.u
+
+mov(16) root.f, data.u
+mul(16) root.f, root.f, 0.5f
+add(16) root.f, root.f, root.f
+mov(16) data.u, root.f
+
+mov(16) out0.u, INDICES.u
+mov(16) out2.u, data.u
+send DwordStore16(Output), null.u, out.u
+
+end
+);
+
+// Integer multiplies.  Gen7 only uses the low 16 bits of a dword src1, so multiplying by 65539 is multiplying by 3
+const char* INTERPRETER_MUL_TEST = STRINGIFY(
+
+curbe INDICES[1] = {{0,1,2,3,4,5,6,7}}
+
+bind Output 0x38
+
+reg msg[2]
+
+begin:
+
+mov(8) msg0.u, INDICES.u
+mul(8) msg1.u, INDICES.u, 65539
+send DwordStore8(Output), null.u, msg0.u
+
+end
+);
+
+// A jump out of an 'if'.  The odd lanes take it, and the even ones, which were waiting at 'endif',
+//   have to pick the thread back up when it skips past them
+const char* INTERPRETER_JUMP_TEST = STRINGIFY(
+
+curbe INDICES[1] = {{0,1,2,3,4,5,6,7}}
+
+bind Output 0x38
+
+reg msg[2]
+
+begin:
+
+mov(8) msg0.u, INDICES.u
+and(8) msg1.u, INDICES.u, 1
+cmpne(8)(f0.0) null.u, msg1.u, 0
+if(8) (f0.0)
+    mov(8) msg1.u, 7
+    jmp skip
+endif
+mov(8) msg1.u, 9
+skip:
+send DwordStore8(Output), null.u, msg0.u
+
+end
+);
+
+void InterpreterTest()
+{
+    StringPrinter errors;
+    GEN::Encoder encoder;
+    GEN::Decoder decoder;
+
+    GEN::Assembler::Program program;
+    if( !program.Assemble( &encoder, INTERPRETER_TEST, &errors ) )
+    {
+        printf("InterpreterTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    GEN::Interpreter interpreter;
+    if( !interpreter.Load( &decoder, program.GetIsa(), program.GetIsaLengthInBytes() ) )
+    {
+        printf("InterpreterTest: decode failed\n");
+        return;
+    }
+
+    GEN::uint32 pInput[16];
+    GEN::uint32 pOutput[16];
+    for( size_t i=0; i<16; i++ )
+    {
+        pInput[i]  = 3*i + 7;
+        pOutput[i] = 0;
+    }
+
+    GEN::Surface pSurfaces[0x3A] = {};
+    pSurfaces[0x38].pData  = pInput;
+    pSurfaces[0x38].nBytes = sizeof(pInput);
+    pSurfaces[0x39].pData  = pOutput;
+    pSurfaces[0x39].nBytes = sizeof(pOutput);
+
+    GEN::ThreadPayload payload = {};
+    payload.pCURBE        = program.GetCURBE();
+    payload.nCURBERegs    = program.GetCURBERegCount();
+    payload.nDispatchMask = 0xffff;
+    payload.pSurfaces     = pSurfaces;
+    payload.nSurfaces     = 0x3A;
+    if( !interpreter.Run( payload, &errors ) )
+    {
+        printf("InterpreterTest: run failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    for( size_t i=0; i<16; i++ )
+    {
+        GEN::uint32 nExpected = (pInput[i] & 1) ? 2*pInput[i] : pInput[i] + 100;
+        nExpected += (i&3) + 1;
+        if( pOutput[i] != nExpected )
+        {
+            printf("InterpreterTest: lane %u is %u, expected %u\n", (unsigned)i, pOutput[i], nExpected );
+            GEN::Disassemble( errors, &decoder, program.GetIsa(), program.GetIsaLengthInBytes() );
+            printf("%s", errors.m_Text.c_str() );
+            return;
+        }
+    }
+
+    GEN::Assembler::Program mulProgram;
+    GEN::Interpreter mulInterpreter;
+    if( !mulProgram.Assemble( &encoder, INTERPRETER_MUL_TEST, &errors ) ||
+        !mulInterpreter.Load( &decoder, mulProgram.GetIsa(), mulProgram.GetIsaLengthInBytes() ) )
+    {
+        printf("InterpreterTest: multiply test failed to assemble\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    pSurfaces[0x38].pData  = pOutput;
+    pSurfaces[0x38].nBytes = 8*sizeof(pOutput[0]);
+    payload.pCURBE        = mulProgram.GetCURBE();
+    payload.nCURBERegs    = mulProgram.GetCURBERegCount();
+    payload.nDispatchMask = 0xff;
+    if( !mulInterpreter.Run( payload, &errors ) )
+    {
+        printf("InterpreterTest: multiply test failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+    for( size_t i=0; i<8; i++ )
+    {
+        if( pOutput[i] != 3*i )
+        {
+            printf("InterpreterTest: lane %u multiplied to %u, expected %u\n", (unsigned)i, pOutput[i], (unsigned)(3*i) );
+            return;
+        }
+    }
+
+    GEN::Assembler::Program jumpProgram;
+    GEN::Interpreter jumpInterpreter;
+    if( !jumpProgram.Assemble( &encoder, INTERPRETER_JUMP_TEST, &errors ) ||
+        !jumpInterpreter.Load( &decoder, jumpProgram.GetIsa(), jumpProgram.GetIsaLengthInBytes() ) )
+    {
+        printf("InterpreterTest: jump test failed to assemble\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    for( size_t i=0; i<8; i++ )
+        pOutput[i] = 0xdeadbeef;
+    payload.pCURBE     = jumpProgram.GetCURBE();
+    payload.nCURBERegs = jumpProgram.GetCURBERegCount();
+    if( !jumpInterpreter.Run( payload, &errors ) )
+    {
+        printf("InterpreterTest: jump test failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+    for( size_t i=0; i<8; i++ )
+    {
+        GEN::uint32 nExpected = (i&1) ? 7 : 0;
+        if( pOutput[i] != nExpected )
+        {
+            printf("InterpreterTest: lane %u stored %08x after the jump, expected %u\n", (unsigned)i, pOutput[i], nExpected );
+            return;
+        }
+    }
+
+    printf("InterpreterTest: passed\n");
+}
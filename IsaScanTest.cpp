@@ -0,0 +1,114 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENCoder.h"
+#include "HAXWell_Utils.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Checks that every program buried in a blob is found, and nothing else.
+//   The filler has plenty of SEND opcodes and EOT bits, but never both 15 bytes apart
+const char* ISA_SCAN_TEST = STRINGIFY(
+
+bind Output 0x38
+
+reg msg[2]
+
+begin:
+
+mov(8) msg0.u, r0.u1<0,1,0>
+mov(8) msg1.u, 0
+repeat COUNT as i {
+    add(8) msg1.u, msg1.u, $(i+1)
+}
+send DwordStore8(Output), null.u, msg0.u
+
+end
+);
+
+void IsaScanTest()
+{
+    StringPrinter errors;
+    GEN::Encoder encoder;
+
+    const size_t BLOB_SIZE = 4*1024*1024;
+    std::vector<unsigned char> blob( BLOB_SIZE );
+    srand(42);
+    for( size_t i=0; i<BLOB_SIZE; i++ )
+    {
+        blob[i] = rand() & 0x7f;
+        if( (i%64) == 0 )
+        {
+            blob[i] |= 0x80;
+            if( i >= 15 && blob[i-15] == 0x31 )
+                blob[i-15] = 0x30;
+        }
+    }
+
+    // odd offsets, so the vector scan doesn't see them aligned.  The last one is two copies of a program back to back,
+    //   which should come out as one program with two EOTs
+    const size_t OFFSETS[] = { 1001, 65537+3, 1024*1024+17, 3*1024*1024+255, BLOB_SIZE-1024+7 };
+    const size_t PROGRAMS  = sizeof(OFFSETS)/sizeof(OFFSETS[0]);
+
+    std::vector<HAXWell::IsaLocation> expected;
+    for( size_t i=0; i<PROGRAMS; i++ )
+    {
+        char count[16];
+        sprintf( count, "%u", (unsigned)(i+1) );
+        GEN::Assembler::Program program;
+        program.Define( "COUNT", count );
+        if( !program.Assemble( &encoder, ISA_SCAN_TEST, &errors ) )
+        {
+            printf("IsaScanTest: assembly failed\n%s", errors.m_Text.c_str() );
+            return;
+        }
+
+        const unsigned char* pIsa = (const unsigned char*) program.GetIsa();
+        size_t nIsaLength = program.GetIsaLengthInBytes();
+        size_t nCopies = (i == PROGRAMS-1) ? 2 : 1;
+
+        // nothing legal in the 16 bytes before a program, so that the walk back stops there
+        unsigned char* pWhere = &blob[OFFSETS[i]];
+        memset( pWhere-16, 0x7f, 16 );
+        for( size_t c=0; c<nCopies; c++ )
+            memcpy( pWhere + c*nIsaLength, pIsa, nIsaLength );
+
+        HAXWell::IsaLocation loc;
+        loc.nOffset = OFFSETS[i];
+        loc.nLength = nCopies*nIsaLength;
+        expected.push_back(loc);
+    }
+
+    std::vector<HAXWell::IsaLocation> found;
+    HAXWell::FindAllIsaInBlob( found, blob.data(), blob.size() );
+    if( found.size() != expected.size() )
+    {
+        printf("IsaScanTest: found %u programs, expected %u\n", (unsigned)found.size(), (unsigned)expected.size() );
+        return;
+    }
+    for( size_t i=0; i<found.size(); i++ )
+    {
+        if( found[i].nOffset != expected[i].nOffset || found[i].nLength != expected[i].nLength )
+        {
+            printf("IsaScanTest: program %u is %u bytes at %u, expected %u bytes at %u\n", (unsigned)i,
+                   (unsigned)found[i].nLength, (unsigned)found[i].nOffset, (unsigned)expected[i].nLength, (unsigned)expected[i].nOffset );
+            return;
+        }
+    }
+
+    size_t nOffset=0;
+    size_t nLength=0;
+    if( !HAXWell::FindIsaInBlob( &nOffset, &nLength, blob.data(), blob.size() ) ||
+        nOffset != expected[0].nOffset || nLength != expected[0].nLength )
+    {
+        printf("IsaScanTest: FindIsaInBlob didn't find the first program\n");
+        return;
+    }
+
+    printf("IsaScanTest: passed\n");
+}
@@ -0,0 +1,108 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENAnalysis.h"
+#include "GENCoder.h"
+#include "Misc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+class StdoutPrinter : public GEN::IPrinter
+{
+public:
+    virtual void Push( const char* p ) { fputs( p, stdout ); }
+};
+
+static void AnalyzerUsage()
+{
+    printf("usage: HAXWell analyze [-O] [-S] [-Dname=value] [-icache bytes] kernel...\n"
+           "   -O       run the optimizer\n"
+           "   -S       run the scheduler\n"
+           "   -D       define a macro\n"
+           "   -icache  instruction cache size to check against\n");
+}
+
+/// Assemble each kernel on the command line and print a static analysis of it.
+///   Returns the number of kernels which failed to assemble
+int AnalyzeKernels( int argc, char* argv[] )
+{
+    StdoutPrinter printer;
+    GEN::Encoder encoder;
+    GEN::Decoder decoder;
+    GEN::CostTable costs;
+    GEN::Assembler::Program program;
+
+    int nFailures = 0;
+    size_t nKernels = 0;
+    for( int i=0; i<argc; i++ )
+    {
+        if( strcmp( argv[i], "-O" ) == 0 )
+        {
+            program.SetOptimization(true);
+        }
+        else if( strcmp( argv[i], "-S" ) == 0 )
+        {
+            program.SetScheduling(true);
+        }
+        else if( strncmp( argv[i], "-D", 2 ) == 0 )
+        {
+            std::string name = argv[i]+2;
+            std::string value;
+            size_t nEquals = name.find('=');
+            if( nEquals != std::string::npos )
+            {
+                value = name.substr( nEquals+1 );
+                name.resize( nEquals );
+            }
+            program.Define( name.c_str(), value.c_str() );
+        }
+        else if( strcmp( argv[i], "-icache" ) == 0 && i+1 < argc )
+        {
+            costs.nICacheBytes = strtoul( argv[++i], 0, 0 );
+        }
+        else if( argv[i][0] == '-' )
+        {
+            AnalyzerUsage();
+            return 1;
+        }
+        else
+        {
+            nKernels++;
+            printf("%s:\n", argv[i] );
+
+            FILE* fp = fopen( argv[i], "r" );
+            if( !fp )
+            {
+                printf("can't open file\n\n");
+                nFailures++;
+                continue;
+            }
+            fclose(fp);
+
+            std::string text = ReadTextFile( argv[i] );
+            GEN::KernelAnalysis analysis;
+            if( !program.Assemble( &encoder, text.c_str(), &printer ) )
+            {
+                printf("assembly failed\n\n");
+                nFailures++;
+                continue;
+            }
+            if( !analysis.Analyze( &decoder, program, costs ) )
+            {
+                printf("analysis failed.  The ISA didn't decode\n\n");
+                nFailures++;
+                continue;
+            }
+
+            GEN::PrintAnalysis( printer, analysis );
+            printf("\n");
+        }
+    }
+
+    if( !nKernels )
+        AnalyzerUsage();
+    return nFailures;
+}
@@ -120,27 +120,24 @@ void CountOps( size_t nIsaLength, const unsigned char* pIsa, unsigned int* pALU,
 {
     *pSend = 0;
     *pALU = 0;
-     GEN::Decoder dec;
-    for( size_t i=0; i<nIsaLength; )
-    {
-        GEN::Instruction op;
-        i += dec.Decode( &op, pIsa + i );
+    GEN::Decoder dec;
+    GEN::DecodedProgram program;
+    dec.DecodeAll( pIsa, nIsaLength, program );
 
-        if( op.GetClass() == GEN::IC_SEND )
+    for( size_t i=0; i<program.GetInstructionCount(); i++ )
+    {
+        switch( program.GetClass(i) )
         {
+        case GEN::IC_SEND:
             (*pSend)++;
+            break;
+        case GEN::IC_MATH:
+        case GEN::IC_BINARY:
+        case GEN::IC_TERNARY:
+            (*pALU) += program.GetExecSize(i);
+            break;
         }
-        else if( op.GetClass() == GEN::IC_MATH ||
-                 op.GetClass() == GEN::IC_BINARY ||
-                 op.GetClass() == GEN::IC_TERNARY ||
-                 op.GetClass() == GEN::IC_BINARY )
-        {
-            
-            (*pALU) += op.GetExecSize();
-        }
-
     }
-    
 }
 
 
@@ -0,0 +1,112 @@
+
+#include "GENAssembler.h"
+#include "GENControlFlow.h"
+#include "GENDisassembler.h"
+#include "GENCoder.h"
+#include "GENIsa.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string>
+
+// Optimizer test.  Both multiplies should become shifts, once 'scale' is propagated into the second one.
+//   That leaves the 'mov' to 'scale' dead, along with the 'add' to 'unused'.  The loop has to survive,
+//   with its jump still pointing at the 'add' after the label
+const char* OPTIMIZER_TEST = STRINGIFY(
+
+bind Output 0x38
+
+reg msg[2]
+reg scale
+reg index
+reg unused
+
+begin:
+
+mov(8) scale.u, 4
+mul(8) index.u, r0.u1<0,1,0>, 8
+mul(8) msg0.u, index.u, scale.u
+add(8) unused.u, index.u, 1
+mov(8) msg1.u, 0
+loop:
+    add(8) msg1.u, msg1.u, 3
+    cmplt(8)(f0.0) null.u, msg1.u, 12
+    jmpif(f0.0) loop
+send DwordStore8(Output), null.u, msg0.u
+
+end
+);
+
+static bool CheckProgram( const GEN::Assembler::Program& program )
+{
+    GEN::Decoder decoder;
+    GEN::ControlFlowGraph cfg;
+    if( !cfg.Build( &decoder, program.GetIsa(), program.GetIsaLengthInBytes() ) )
+    {
+        printf("OptimizerTest: decode failed\n");
+        return false;
+    }
+
+    // 0 is the r0 header move the assembler inserts at 'begin'.  The 'mov' to 'scale' and the 'add' to 'unused' are gone
+    if( cfg.GetInstructionCount() != 9 )
+    {
+        printf("OptimizerTest: expected 9 instructions, found %u\n", (unsigned)cfg.GetInstructionCount() );
+        return false;
+    }
+
+    size_t nShifts = 0;
+    for( size_t i=0; i<cfg.GetInstructionCount(); i++ )
+    {
+        const GEN::Instruction& rInst = cfg.GetInstruction(i);
+        if( rInst.GetOperation() == GEN::OP_MUL )
+        {
+            printf("OptimizerTest: instruction %u is still a multiply\n", (unsigned)i );
+            return false;
+        }
+        if( rInst.GetOperation() == GEN::OP_SHL )
+            nShifts++;
+
+        int nTarget;
+        if( GEN::GetJumpTarget( rInst, 16*i, &nTarget ) && nTarget != 16*4 )
+        {
+            printf("OptimizerTest: jump at %u goes to instruction %d\n", (unsigned)i, nTarget/16 );
+            return false;
+        }
+    }
+    if( nShifts != 2 )
+    {
+        printf("OptimizerTest: expected 2 shifts, found %u\n", (unsigned)nShifts );
+        return false;
+    }
+    return true;
+}
+
+void OptimizerTest()
+{
+    // compaction off, so that jump offsets are 16 bytes per instruction
+    StringPrinter errors;
+    StringPrinter report;
+    GEN::Encoder encoder;
+    encoder.SetCompaction(false);
+
+    GEN::Assembler::Program program;
+    program.SetOptimization(true);
+    program.SetOptimizationReport(&report);
+    if( !program.Assemble( &encoder, OPTIMIZER_TEST, &errors ) )
+    {
+        printf("OptimizerTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+    if( !CheckProgram( program ) )
+        return;
+
+    if( report.m_Text.find("[2] mul -> shl (strength reduction)") == std::string::npos ||
+        report.m_Text.find("dead code: 2") == std::string::npos ||
+        report.m_Text.find("instructions: 11 -> 9") == std::string::npos )
+    {
+        printf("OptimizerTest: unexpected report\n%s", report.m_Text.c_str() );
+        return;
+    }
+
+    printf("OptimizerTest: passed\n");
+}
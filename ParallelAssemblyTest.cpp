@@ -0,0 +1,153 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENCoder.h"
+#include "Misc.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Checks that assembling a batch of programs on many threads produces exactly the same programs,
+//   and the same errors, as assembling them one at a time.  Then two threads assemble the same text
+//   with the cache on, so they both write the same cache file at once
+const char* PARALLEL_ASSEMBLY_TEST = STRINGIFY(
+
+bind Output 0x38
+
+reg msg[2]
+
+begin:
+
+mov(8) msg0.u, r0.u1<0,1,0>
+mov(8) msg1.u, 0
+repeat COUNT as i {
+    add(8) msg1.u, msg1.u, $(i+1)
+}
+send DwordStore8(Output), null.u, msg0.u
+
+end
+);
+
+static const size_t BATCH_SIZE = 64;
+static const size_t BAD_PROGRAM = 5;
+
+static bool SameProgram( const GEN::Assembler::Program& a, const GEN::Assembler::Program& b )
+{
+    return a.GetIsaLengthInBytes() == b.GetIsaLengthInBytes() &&
+           a.GetCURBERegCount() == b.GetCURBERegCount() &&
+           a.GetThreadsPerDispatch() == b.GetThreadsPerDispatch() &&
+           memcmp( a.GetIsa(), b.GetIsa(), a.GetIsaLengthInBytes() ) == 0 &&
+           memcmp( a.GetCURBE(), b.GetCURBE(), 32*a.GetCURBERegCount() ) == 0;
+}
+
+static void SetupProgram( GEN::Assembler::Program& program, size_t i )
+{
+    char count[16];
+    sprintf( count, "%u", (unsigned)(i%16 + 1) );
+    program.Define( "COUNT", count );
+    program.SetScheduling( (i%3) == 0 );
+    program.SetOptimization( (i%2) == 0 );
+}
+
+void ParallelAssemblyTest()
+{
+    std::string raytracer = ReadTextFile("raytracer/eight_ray.inl");
+
+    // a mix of small, large and broken programs
+    std::vector<const char*> texts;
+    for( size_t i=0; i<BATCH_SIZE; i++ )
+    {
+        if( i == BAD_PROGRAM )
+            texts.push_back( "begin:\nmov(8) bogus.u, 0\nend\n" );
+        else if( (i%8) == 7 )
+            texts.push_back( raytracer.c_str() );
+        else
+            texts.push_back( PARALLEL_ASSEMBLY_TEST );
+    }
+
+    GEN::Encoder encoder;
+    std::vector<GEN::Assembler::Program> serial(BATCH_SIZE);
+    std::vector<GEN::Assembler::Program> parallel(BATCH_SIZE);
+    StringPrinter serialErrors;
+    StringPrinter parallelErrors;
+    for( size_t i=0; i<BATCH_SIZE; i++ )
+    {
+        SetupProgram( serial[i], i );
+        SetupProgram( parallel[i], i );
+
+        StringPrinter errors;
+        if( !serial[i].Assemble( &encoder, texts[i], &errors ) )
+        {
+            char header[64];
+            sprintf( header, "Program %u:\n", (unsigned)i );
+            serialErrors.m_Text.append( header );
+            serialErrors.m_Text.append( errors.m_Text );
+        }
+    }
+
+    bool bOK = GEN::Assembler::AssembleParallel( &encoder, parallel.data(), texts.data(), BATCH_SIZE, &parallelErrors, 0 );
+    if( bOK || serialErrors.m_Text.empty() || parallelErrors.m_Text != serialErrors.m_Text )
+    {
+        printf("ParallelAssemblyTest: errors don't match\n%s\n%s", serialErrors.m_Text.c_str(), parallelErrors.m_Text.c_str() );
+        return;
+    }
+
+    for( size_t i=0; i<BATCH_SIZE; i++ )
+    {
+        if( i == BAD_PROGRAM )
+        {
+            if( parallel[i].GetIsa() )
+            {
+                printf("ParallelAssemblyTest: failed program isn't empty\n");
+                return;
+            }
+            continue;
+        }
+
+        if( !SameProgram( serial[i], parallel[i] ) )
+        {
+            printf("ParallelAssemblyTest: program %u doesn't match\n", (unsigned)i );
+            return;
+        }
+    }
+
+    // start with no cache file, so that both threads can miss and write it.  Either one might
+    //   start late enough to read what the other wrote, which is fine too
+    GEN::Assembler::Program cached[2];
+    const char* pCachedTexts[2] = { PARALLEL_ASSEMBLY_TEST, PARALLEL_ASSEMBLY_TEST };
+    for( size_t i=0; i<2; i++ )
+    {
+        SetupProgram( cached[i], 1 );
+        cached[i].SetCacheDirectory(".");
+    }
+    StringPrinter cachedErrors;
+    if( !cached[0].Assemble( &encoder, PARALLEL_ASSEMBLY_TEST, &cachedErrors ) )
+    {
+        printf("ParallelAssemblyTest: cached assembly failed\n%s", cachedErrors.m_Text.c_str() );
+        return;
+    }
+    remove( cached[0].GetCacheFile().c_str() );
+
+    if( !GEN::Assembler::AssembleParallel( &encoder, cached, pCachedTexts, 2, &cachedErrors, 2 ) ||
+        !SameProgram( cached[0], serial[1] ) || !SameProgram( cached[1], serial[1] ) )
+    {
+        printf("ParallelAssemblyTest: concurrent cached assembly doesn't match\n%s", cachedErrors.m_Text.c_str() );
+        return;
+    }
+
+    GEN::Assembler::Program reread;
+    SetupProgram( reread, 1 );
+    reread.SetCacheDirectory(".");
+    bool bReread = reread.Assemble( &encoder, PARALLEL_ASSEMBLY_TEST, &cachedErrors ) && reread.IsFromCache() && SameProgram( reread, serial[1] );
+    remove( reread.GetCacheFile().c_str() );
+    if( !bReread )
+    {
+        printf("ParallelAssemblyTest: cache file written by two threads didn't read back\n");
+        return;
+    }
+
+    printf("ParallelAssemblyTest: passed\n");
+}
@@ -0,0 +1,74 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENCoder.h"
+#include "GENIsa.h"
+#include "Misc.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Checks that parallel disassembly of many blobs produces exactly the same text as
+//   disassembling each blob serially, including for blobs with bad instructions in them
+
+void ParallelDisassemblyTest()
+{
+    StringPrinter errors;
+    GEN::Encoder encoder;
+    GEN::Assembler::Program program;
+    std::string text = ReadTextFile("raytracer/eight_ray.inl");
+    if( !program.Assemble( &encoder, text.c_str(), &errors ) )
+    {
+        printf("ParallelDisassemblyTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    const GEN::uint8* pIsa = (const GEN::uint8*) program.GetIsa();
+    size_t nIsaBytes = program.GetIsaLengthInBytes();
+
+    // a large blob made of many copies of the kernel, the kernel by itself, a blob with
+    //  garbage in the middle, and one which is cut off partway through the kernel's final send
+    std::vector<GEN::uint8> big;
+    for( size_t i=0; i<64; i++ )
+        big.insert( big.end(), pIsa, pIsa+nIsaBytes );
+
+    std::vector<GEN::uint8> corrupt( big.begin(), big.begin() + 8*nIsaBytes );
+    for( size_t i=0; i<16; i++ )
+        corrupt[ 5*nIsaBytes + i ] = 0xff;
+
+    GEN::IsaBlob blobs[] = {
+        { big.data(),       big.size()       },
+        { pIsa,             nIsaBytes        },
+        { corrupt.data(),   corrupt.size()   },
+        { pIsa,             nIsaBytes-8      },
+        { pIsa,             0                },
+    };
+    size_t nBlobs = sizeof(blobs)/sizeof(blobs[0]);
+
+    GEN::Decoder decoder;
+    StringPrinter serial;
+    bool bSerialOK = true;
+    for( size_t i=0; i<nBlobs; i++ )
+        bSerialOK = GEN::Disassemble( serial, &decoder, blobs[i].pIsaBytes, blobs[i].nIsaBytes ) && bSerialOK;
+    if( bSerialOK )
+    {
+        printf("ParallelDisassemblyTest: corrupt blobs were not detected\n");
+        return;
+    }
+
+    size_t THREAD_COUNTS[] = {1,2,7,0};
+    for( size_t t=0; t<sizeof(THREAD_COUNTS)/sizeof(THREAD_COUNTS[0]); t++ )
+    {
+        StringPrinter parallel;
+        bool bParallelOK = GEN::DisassembleParallel( parallel, blobs, nBlobs, THREAD_COUNTS[t] );
+        if( bParallelOK != bSerialOK || parallel.m_Text != serial.m_Text )
+        {
+            printf("ParallelDisassemblyTest: output mismatch with %u threads\n", (unsigned)THREAD_COUNTS[t] );
+            return;
+        }
+    }
+
+    printf("ParallelDisassemblyTest: passed.  %u bytes of text\n", (unsigned)serial.m_Text.size() );
+}
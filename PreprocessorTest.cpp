@@ -0,0 +1,130 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENCoder.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+// Preprocessor test.  The macros, repeats, and expressions should expand to exactly the same program as the
+//   hand-written version below.  'OUTPUT' and 'COUNT' come from the host, and 'STORE' comes from an include file
+const char* PREPROCESSOR_TEST = "#include \"store.inc\"\n" STRINGIFY(
+
+bind Output OUTPUT
+
+reg msg[2]
+
+begin:
+
+mov(8) msg0.u, 0
+mov(8) msg$(COUNT-3).u, 0
+repeat COUNT as i {
+    add(8) msg1.u, msg1.u, $(2*i+1)
+}
+STORE(msg0)
+
+end
+);
+
+const char* PREPROCESSOR_EXPECTED = STRINGIFY(
+
+bind Output 0x38
+
+reg msg[2]
+
+begin:
+
+mov(8) msg0.u, 0
+mov(8) msg1.u, 0
+add(8) msg1.u, msg1.u, 1
+add(8) msg1.u, msg1.u, 3
+add(8) msg1.u, msg1.u, 5
+add(8) msg1.u, msg1.u, 7
+send DwordStore8(Output), null.u, msg0.u
+
+end
+);
+
+// The repeat spans three lines, so the bad register after it is on line 5
+const char* PREPROCESSOR_LINE_TEST =
+    "begin:\n"
+    "repeat 2 as i {\n"
+    "    mov(8) r$(i+1).u, 0\n"
+    "}\n"
+    "mov(8) bogus.u, 0\n"
+    "end\n";
+
+class PreprocessorIncludes : public GEN::Assembler::IIncludeHandler
+{
+public:
+    virtual bool Read( const char* pFileName, std::string& rText )
+    {
+        if( strcmp( pFileName, "store.inc" ) != 0 )
+            return false;
+        rText = "// stores a message\n"
+                "macro STORE(addr) {\n"
+                "    send DwordStore8(Output), null.u, addr.u\n"
+                "}\n";
+        return true;
+    }
+};
+
+void PreprocessorTest()
+{
+    StringPrinter errors;
+    PreprocessorIncludes includes;
+    GEN::Encoder encoder;
+
+    GEN::Assembler::Program expected;
+    GEN::Assembler::Program preprocessed;
+    preprocessed.SetIncludeHandler(&includes);
+    preprocessed.Define( "OUTPUT", "0x38" );
+    preprocessed.Define( "COUNT", "4" );
+    if( !expected.Assemble( &encoder, PREPROCESSOR_EXPECTED, &errors ) ||
+        !preprocessed.Assemble( &encoder, PREPROCESSOR_TEST, &errors ) )
+    {
+        printf("PreprocessorTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    if( expected.GetIsaLengthInBytes() != preprocessed.GetIsaLengthInBytes() ||
+        memcmp( expected.GetIsa(), preprocessed.GetIsa(), expected.GetIsaLengthInBytes() ) != 0 )
+    {
+        printf("PreprocessorTest: expansion doesn't match the hand-written program\n");
+        return;
+    }
+
+    GEN::Assembler::Program program;
+    if( program.Assemble( &encoder, PREPROCESSOR_LINE_TEST, &errors ) ||
+        errors.m_Text.find("Line: 5:") == std::string::npos )
+    {
+        printf("PreprocessorTest: wrong line number for error after a repeat\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    errors.m_Text.clear();
+    if( program.Assemble( &encoder, "macro LOOP { LOOP }\nbegin:\nLOOP\nend\n", &errors ) ||
+        errors.m_Text.find("too deep") == std::string::npos )
+    {
+        printf("PreprocessorTest: recursive macro not caught\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    // a macro in a repeat body is defined once per iteration, the same way each time
+    errors.m_Text.clear();
+    if( !program.Assemble( &encoder, "begin:\nrepeat 2 as i { macro ZERO { 0 } mov(8) r$(i+1).u, ZERO }\nend\n", &errors ) )
+    {
+        printf("PreprocessorTest: macro in a repeat failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+    if( program.Assemble( &encoder, "macro ONE { 1 }\nmacro ONE { 2 }\nbegin:\nend\n", &errors ) ||
+        errors.m_Text.find("already defined differently") == std::string::npos )
+    {
+        printf("PreprocessorTest: conflicting macro not caught\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    printf("PreprocessorTest: passed\n");
+}
@@ -0,0 +1,172 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENCoder.h"
+#include "GENIsa.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string>
+
+// Register allocation test.  'early' is dead before the loop starts, so the loop temporary
+//   can share its register.  'keep' is live across the loop, and has to skip over r2,
+//   which is referenced by number
+const char* REGISTER_ALLOCATION_TEST = STRINGIFY(
+
+reg early
+reg keep
+reg temp
+
+begin:
+
+mov(8) early.u, 1
+add(8) keep.u, early.u, 2
+mov(8) r2.u, keep.u
+spin:
+    mov(8) temp.u, keep.u
+    add(8) temp.u, temp.u, 1
+    cmplt(8)(f0.0) null.u, temp.u, 5
+    jmpif(f0.0) spin
+add(8) keep.u, keep.u, 1
+
+end
+);
+
+// 'table' is indexed through a0, which can run on into 'after', so 'after' has to stay right
+//   behind it even though 'keep' is declared first and would otherwise take that register
+const char* REGISTER_ALLOCATION_INDEXED_TEST = STRINGIFY(
+
+reg keep
+reg table[2]
+reg after
+
+begin:
+
+mov(8) keep.u, 1
+mov(8) table0.u, keep.u
+mov(8) table1.u, 2
+mov(1) a0.us0, 32
+mov(8) after.u, table0[a0.0].u
+add(8) keep.u, keep.u, after.u
+
+end
+);
+
+struct DestExpectation
+{
+    size_t nInstruction;    // 0 is the r0 header move the assembler inserts at 'begin'
+    size_t nReg;
+};
+
+static const DestExpectation DEST_EXPECTATIONS[] = {
+    { 1, 1 },   // early
+    { 2, 3 },   // keep
+    { 4, 1 },   // temp
+    { 8, 3 },   // keep
+};
+
+/// Register number that the 'n'th instruction writes, or -1 if there aren't that many
+static size_t GetDestReg( const GEN::Assembler::Program& program, size_t n )
+{
+    GEN::Decoder decoder;
+    const GEN::uint8* pIsa = (const GEN::uint8*) program.GetIsa();
+    size_t nOffset = 0;
+    for( size_t i=0; nOffset < program.GetIsaLengthInBytes(); i++ )
+    {
+        GEN::Instruction inst;
+        size_t nLength = decoder.Decode( &inst, pIsa + nOffset );
+        if( !nLength )
+            break;
+        nOffset += nLength;
+        if( i != n )
+            continue;
+
+        GEN::RegReference base = static_cast<GEN::UnaryInstruction&>(inst).GetDest().GetRegRegion().GetBaseRegister();
+        return static_cast<GEN::DirectRegReference&>(base).GetRegNumber();
+    }
+    return (size_t)-1;
+}
+
+static bool CheckDests( const GEN::Assembler::Program& program )
+{
+    size_t nExpected = sizeof(DEST_EXPECTATIONS)/sizeof(DEST_EXPECTATIONS[0]);
+    for( size_t nExpectation=0; nExpectation < nExpected; nExpectation++ )
+    {
+        size_t i = DEST_EXPECTATIONS[nExpectation].nInstruction;
+        size_t nReg = GetDestReg( program, i );
+        if( nReg != DEST_EXPECTATIONS[nExpectation].nReg )
+        {
+            printf("RegisterAllocationTest: instruction %u writes r%u, expected r%u\n", (unsigned)i, (unsigned)nReg, (unsigned)DEST_EXPECTATIONS[nExpectation].nReg );
+            return false;
+        }
+    }
+    return true;
+}
+
+void RegisterAllocationTest()
+{
+    StringPrinter errors;
+    GEN::Encoder encoder;
+    GEN::Assembler::Program program;
+    if( !program.Assemble( &encoder, REGISTER_ALLOCATION_TEST, &errors ) )
+    {
+        printf("RegisterAllocationTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+    if( !CheckDests( program ) )
+        return;
+
+    // 160 registers worth of declarations, which are never live at the same time
+    std::string text;
+    char line[128];
+    for( size_t i=0; i<40; i++ )
+    {
+        sprintf( line, "reg tmp%u_[4]\n", (unsigned)i );
+        text.append(line);
+    }
+    text.append("reg sum[2]\nbegin:\nmov(16) sum.u, 0\n");
+    for( size_t i=0; i<40; i++ )
+    {
+        sprintf( line, "mov(16) tmp%u_0.u, %u\nmov(16) tmp%u_2.u, 1\n", (unsigned)i, (unsigned)i, (unsigned)i );
+        text.append(line);
+        sprintf( line, "add(16) sum.u, sum.u, tmp%u_0.u\nadd(16) sum.u, sum.u, tmp%u_2.u\n", (unsigned)i, (unsigned)i );
+        text.append(line);
+    }
+    text.append("end\n");
+
+    if( !program.Assemble( &encoder, text.c_str(), &errors ) )
+    {
+        printf("RegisterAllocationTest: short-lived regs failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    // instruction 1 clears 'sum', and each 'tmpN_' starts at 2+4N
+    size_t nSum  = GetDestReg( program, 1 );
+    size_t nTmp0 = GetDestReg( program, 2 );
+    size_t nTmp1 = GetDestReg( program, 6 );
+    if( nTmp0 != nTmp1 )
+    {
+        printf("RegisterAllocationTest: disjoint regs got r%u and r%u\n", (unsigned)nTmp0, (unsigned)nTmp1 );
+        return;
+    }
+    if( nSum+2 > nTmp0 && nTmp0+4 > nSum )
+    {
+        printf("RegisterAllocationTest: 'sum' at r%u overlaps 'tmp0_' at r%u\n", (unsigned)nSum, (unsigned)nTmp0 );
+        return;
+    }
+
+    if( !program.Assemble( &encoder, REGISTER_ALLOCATION_INDEXED_TEST, &errors ) )
+    {
+        printf("RegisterAllocationTest: indexed regs failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+    size_t nTable = GetDestReg( program, 2 );
+    size_t nAfter = GetDestReg( program, 5 );
+    if( nAfter != nTable+2 )
+    {
+        printf("RegisterAllocationTest: 'after' is at r%u, expected r%u\n", (unsigned)nAfter, (unsigned)(nTable+2) );
+        return;
+    }
+
+    printf("RegisterAllocationTest: passed\n");
+}
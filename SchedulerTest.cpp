@@ -0,0 +1,151 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENCoder.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+// Instruction scheduling test.  The work on 'x' and 'y' should move up in between
+//   the load and the 'add' which uses it.  Nothing may move across the label
+const char* SCHEDULER_TEST = STRINGIFY(
+
+bind Input 0x38
+
+reg addr
+reg value
+reg x
+reg y
+
+begin:
+
+mov(8) addr.u, 0
+send DwordLoad8(Input), value.u, addr.u
+add(8) value.u, value.u, 1
+mul(8) x.u, r0.u1<0,1,0>, 3
+add(8) x.u, x.u, 7
+mov(8) y.u, 5
+later:
+add(8) value.u, value.u, x.u
+add(8) value.u, value.u, y.u
+add(8) value.u, value.u, addr.u
+
+end
+);
+
+// Timestamp reads must stay put, with the work that they time between them
+const char* SCHEDULER_TIMESTAMP_TEST = STRINGIFY(
+
+bind Input 0x38
+
+reg addr
+reg value
+reg x
+reg stamp
+
+begin:
+
+mov(8) addr.u, 0
+send DwordLoad8(Input), value.u, addr.u
+mov(2) stamp.u0, tm0.u0
+mul(8) x.u, r0.u1<0,1,0>, 3
+add(8) x.u, x.u, 7
+add(8) value.u, value.u, x.u
+mov(2) stamp.u2, tm0.u0
+add(8) value.u, value.u, stamp.u0
+
+end
+);
+
+static const size_t FIRST_STAMP_INDEX  = 3;
+static const size_t SECOND_STAMP_INDEX = 7;
+
+// Instruction indices.  0 is the r0 header move the assembler inserts at 'begin'
+static const size_t SEND_INDEX  = 2;
+static const size_t USE_INDEX   = 3;
+static const size_t LABEL_INDEX = 7;
+
+static size_t FindInstruction( const GEN::Assembler::Program& program, const GEN::uint8* pInstruction )
+{
+    const GEN::uint8* pIsa = (const GEN::uint8*) program.GetIsa();
+    for( size_t i=0; 16*i < program.GetIsaLengthInBytes(); i++ )
+        if( memcmp( pIsa + 16*i, pInstruction, 16 ) == 0 )
+            return i;
+    return (size_t)-1;
+}
+
+void SchedulerTest()
+{
+    // compaction off, so that every instruction is 16 bytes and we can find them by their encodings
+    StringPrinter errors;
+    GEN::Encoder encoder;
+    encoder.SetCompaction(false);
+
+    GEN::Assembler::Program original;
+    GEN::Assembler::Program scheduled;
+    scheduled.SetScheduling(true);
+    if( !original.Assemble( &encoder, SCHEDULER_TEST, &errors ) ||
+        !scheduled.Assemble( &encoder, SCHEDULER_TEST, &errors ) )
+    {
+        printf("SchedulerTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    if( original.GetIsaLengthInBytes() != scheduled.GetIsaLengthInBytes() )
+    {
+        printf("SchedulerTest: instruction count changed\n");
+        return;
+    }
+
+    const GEN::uint8* pOriginal = (const GEN::uint8*) original.GetIsa();
+    for( size_t i=0; 16*i < original.GetIsaLengthInBytes(); i++ )
+    {
+        size_t nScheduled = FindInstruction( scheduled, pOriginal + 16*i );
+        if( nScheduled == (size_t)-1 )
+        {
+            printf("SchedulerTest: instruction %u is missing\n", (unsigned)i );
+            return;
+        }
+        if( i >= LABEL_INDEX && nScheduled != i )
+        {
+            printf("SchedulerTest: instruction %u moved across a label\n", (unsigned)i );
+            return;
+        }
+    }
+
+    size_t nSend = FindInstruction( scheduled, pOriginal + 16*SEND_INDEX );
+    size_t nUse  = FindInstruction( scheduled, pOriginal + 16*USE_INDEX );
+    if( nUse != LABEL_INDEX-1 || nSend+1 >= nUse )
+    {
+        printf("SchedulerTest: load latency not covered.  send at %u, use at %u\n", (unsigned)nSend, (unsigned)nUse );
+        return;
+    }
+
+    GEN::Assembler::Program originalStamps;
+    GEN::Assembler::Program scheduledStamps;
+    scheduledStamps.SetScheduling(true);
+    if( !originalStamps.Assemble( &encoder, SCHEDULER_TIMESTAMP_TEST, &errors ) ||
+        !scheduledStamps.Assemble( &encoder, SCHEDULER_TIMESTAMP_TEST, &errors ) )
+    {
+        printf("SchedulerTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    const GEN::uint8* pOriginalStamps = (const GEN::uint8*) originalStamps.GetIsa();
+    for( size_t i=0; 16*i < originalStamps.GetIsaLengthInBytes(); i++ )
+    {
+        size_t nScheduled = FindInstruction( scheduledStamps, pOriginalStamps + 16*i );
+        bool bTimed = i > FIRST_STAMP_INDEX && i < SECOND_STAMP_INDEX;
+        bool bStaysTimed = nScheduled > FIRST_STAMP_INDEX && nScheduled < SECOND_STAMP_INDEX;
+        if( nScheduled == (size_t)-1 || bTimed != bStaysTimed ||
+            ((i == FIRST_STAMP_INDEX || i == SECOND_STAMP_INDEX) && nScheduled != i) )
+        {
+            printf("SchedulerTest: instruction %u moved across a timestamp read\n", (unsigned)i );
+            return;
+        }
+    }
+
+    printf("SchedulerTest: passed\n");
+}
@@ -0,0 +1,135 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENAnalysis.h"
+#include "GENCoder.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+// Send coalescing test.  The three loads read dwords 0, 1 and 2 past the same per-lane addresses into
+//   consecutive registers, so they should become one three-channel untyped read.  The store is left alone
+const char* SEND_COALESCING_TEST = STRINGIFY(
+
+curbe OFFSETS[2] = {{0,4,8,12,16,20,24,28},
+                    {32,36,40,44,48,52,56,60}}
+
+bind Input  0x38
+bind Output 0x39
+
+reg base[2]
+reg addr0[2]
+reg addr1[2]
+reg addr2[2]
+reg data[6]
+reg store[4]
+
+begin:
+
+shl(16) base.u, r0.u1<0,1,0>, 6
+add(16) addr0.u, base.u, OFFSETS.u
+add(16) addr1.u, addr0.u, 1
+add(16) addr2.u, addr0.u, 2
+send DwordLoad16(Input), data0.u, addr0.u
+send DwordLoad16(Input), data2.u, addr1.u
+send DwordLoad16(Input), data4.u, addr2.u
+add(16) data0.f, data0.f, data2.f
+add(16) data0.f, data0.f, data4.f
+mov(16) store0.u, addr0.u
+mov(16) store2.f, data0.f
+send DwordStore16(Output), null.u, store.u
+
+end
+);
+
+void SendCoalescingTest()
+{
+    StringPrinter errors;
+    StringPrinter report;
+    GEN::Encoder encoder;
+    GEN::Decoder decoder;
+
+    GEN::Assembler::Program program;
+    program.SetSendCoalescing(true);
+    program.SetOptimizationReport(&report);
+    if( !program.Assemble( &encoder, SEND_COALESCING_TEST, &errors ) )
+    {
+        printf("SendCoalescingTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    GEN::CostTable costs;
+    GEN::KernelAnalysis analysis;
+    if( !analysis.Analyze( &decoder, program, costs ) )
+    {
+        printf("SendCoalescingTest: analysis failed\n");
+        return;
+    }
+
+    size_t nScattered=0, nUntyped=0;
+    for( size_t i=0; i<analysis.GetMessageTypeCount(); i++ )
+    {
+        const GEN::MessageCount& rCount = analysis.GetMessageType(i);
+        if( strcmp( rCount.pName, "DwordScatterRead" ) == 0 )
+            nScattered += rCount.nCount;
+        else if( strcmp( rCount.pName, "UntypedRead" ) == 0 )
+            nUntyped += rCount.nCount;
+    }
+    if( nScattered != 0 || nUntyped != 1 )
+    {
+        printf("SendCoalescingTest: %u scattered reads and %u untyped reads are left\n", (unsigned)nScattered, (unsigned)nUntyped );
+        GEN::Disassemble( errors, &decoder, program.GetIsa(), program.GetIsaLengthInBytes() );
+        printf("%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    // the untyped read should fetch all three channels, two registers each.  Its byte addresses go in the
+    //   response registers, so 'addr0', which is stored afterwards, must never be shifted
+    const GEN::uint8* pIsa = (const GEN::uint8*) program.GetIsa();
+    size_t nIsaLength = program.GetIsaLengthInBytes();
+    size_t nOffset = 0;
+    while( nOffset < nIsaLength )
+    {
+        GEN::Instruction inst;
+        size_t nLength = decoder.Decode( &inst, pIsa + nOffset );
+        if( !nLength )
+        {
+            printf("SendCoalescingTest: decode failed\n");
+            return;
+        }
+
+        if( inst.GetClass() == GEN::IC_SEND )
+        {
+            const GEN::SendInstruction& rSend = static_cast<const GEN::SendInstruction&>(inst);
+            if( rSend.GetRecipient() == GEN::SFID_DP_DC1 && rSend.GetResponseLengthFromDescriptor() != 6 )
+            {
+                printf("SendCoalescingTest: untyped read has a %u register response\n", (unsigned)rSend.GetResponseLengthFromDescriptor() );
+                return;
+            }
+            GEN::RegReference src = rSend.GetSource().GetRegRegion().GetBaseRegister();
+            GEN::RegReference dst = rSend.GetDest().GetRegRegion().GetBaseRegister();
+            if( rSend.GetRecipient() == GEN::SFID_DP_DC1 &&
+                static_cast<GEN::DirectRegReference&>(src).GetRegNumber() != static_cast<GEN::DirectRegReference&>(dst).GetRegNumber() )
+            {
+                printf("SendCoalescingTest: untyped read doesn't take its addresses from its response registers\n");
+                return;
+            }
+        }
+        else if( inst.GetOperation() == GEN::OP_SHR )
+        {
+            printf("SendCoalescingTest: an address was shifted in place\n");
+            return;
+        }
+        nOffset += nLength;
+    }
+
+    if( report.m_Text.find("3 DwordLoad16 -> UntypedRead16x3") == std::string::npos )
+    {
+        printf("SendCoalescingTest: report is missing the merge\n%s", report.m_Text.c_str() );
+        return;
+    }
+
+    printf("SendCoalescingTest: passed\n");
+}
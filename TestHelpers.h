@@ -0,0 +1,17 @@
+#ifndef _TEST_HELPERS_H_
+#define _TEST_HELPERS_H_
+
+#include <string>
+#include "GENDisassembler.h" // for 'IPrinter'
+
+#define STRINGIFY(...) #__VA_ARGS__
+
+/// Collects everything printed to it.  Tests use it for assembler errors and disassembly
+class StringPrinter : public GEN::IPrinter
+{
+public:
+    virtual void Push( const char* p ) { m_Text.append(p); }
+    std::string m_Text;
+};
+
+#endif
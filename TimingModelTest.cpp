@@ -0,0 +1,152 @@
+
+#include "GENAssembler.h"
+#include "GENDisassembler.h"
+#include "GENTimingModel.h"
+#include "GENCoder.h"
+#include "TestHelpers.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Timing model test.  Like 'ThreadTimings', each thread records sr0 and the timestamps around a spin loop.
+//   There are more single-thread groups than thread slots, so some of them have to wait for others to retire
+const char* TIMING_MODEL_TEST = STRINGIFY(
+
+curbe LANES[1] = {{0,1,2,3,4,5,6,7}}
+
+bind Output 0x38
+
+reg msg[2]
+reg stamp
+reg count
+
+begin:
+
+mov(2) stamp.u0, tm0.u0
+mov(8) msg1.u, 0
+mov(1) msg1.u0, sr0.u0
+mov(8) count.u, 0
+spin:
+    add(8) count.u, count.u, 1
+    cmplt(8)(f0.0) null.u, count.u, 20
+    jmpif(f0.0) spin
+mov(2) stamp.u2, tm0.u0
+mov(1) msg1.u1, stamp.u0
+mov(1) msg1.u2, stamp.u2
+mov(1) msg1.u3, r0.u1
+shl(8) msg0.u, r0.u1<0,1,0>, 3
+add(8) msg0.u, msg0.u, LANES.u
+send DwordStore8(Output), null.u, msg.u
+
+end
+);
+
+void TimingModelTest()
+{
+    StringPrinter errors;
+    GEN::Encoder encoder;
+    GEN::Decoder decoder;
+
+    GEN::Assembler::Program program;
+    if( !program.Assemble( &encoder, TIMING_MODEL_TEST, &errors ) )
+    {
+        printf("TimingModelTest: assembly failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    GEN::Interpreter interpreter;
+    if( !interpreter.Load( &decoder, program.GetIsa(), program.GetIsaLengthInBytes() ) )
+    {
+        printf("TimingModelTest: decode failed\n");
+        return;
+    }
+
+    const size_t GROUPS = 200;
+    std::vector<GEN::uint32> output( 8*GROUPS, 0 );
+    GEN::Surface pSurfaces[0x39] = {};
+    pSurfaces[0x38].pData  = output.data();
+    pSurfaces[0x38].nBytes = 4*output.size();
+
+    GEN::TimingDispatch dispatch = {};
+    dispatch.nGroups             = GROUPS;
+    dispatch.nThreadsPerGroup    = 1;
+    dispatch.nDispatchMask       = 0xff;
+    dispatch.pCURBE              = program.GetCURBE();
+    dispatch.nCURBERegsPerThread = program.GetCURBERegCount();
+    dispatch.pSurfaces           = pSurfaces;
+    dispatch.nSurfaces           = 0x39;
+    dispatch.nStartCycle         = 1000;
+
+    GEN::TimingParameters params;
+    GEN::TimingModel model;
+    if( !model.Run( interpreter, params, dispatch, &errors ) )
+    {
+        printf("TimingModelTest: run failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    GEN::uint64 nFirstEnd = ~(GEN::uint64)0, nLastStart = 0;
+    for( size_t i=0; i<GROUPS; i++ )
+    {
+        const GEN::ThreadTiming& rThread = model.GetThread(i);
+        const GEN::uint32* pOut = &output[8*i];
+        if( pOut[0] != rThread.nState || pOut[3] != i )
+        {
+            printf("TimingModelTest: group %u wrote sr0=%08x, expected %08x\n", (unsigned)i, pOut[0], rThread.nState );
+            return;
+        }
+        if( rThread.nStartCycle < dispatch.nStartCycle || pOut[1] < rThread.nStartCycle || pOut[2] <= pOut[1] || pOut[2] > rThread.nEndCycle )
+        {
+            printf("TimingModelTest: group %u has bad timestamps\n", (unsigned)i );
+            return;
+        }
+
+        // nothing else can be in the same slot at the same time
+        for( size_t j=0; j<i; j++ )
+        {
+            const GEN::ThreadTiming& rOther = model.GetThread(j);
+            if( rOther.nState == rThread.nState && rOther.nEndCycle >= rThread.nStartCycle && rThread.nEndCycle >= rOther.nStartCycle )
+            {
+                printf("TimingModelTest: groups %u and %u share a thread slot\n", (unsigned)j, (unsigned)i );
+                return;
+            }
+        }
+
+        nFirstEnd  = (rThread.nEndCycle < nFirstEnd) ? rThread.nEndCycle : nFirstEnd;
+        nLastStart = (rThread.nStartCycle > nLastStart) ? rThread.nStartCycle : nLastStart;
+    }
+    if( nLastStart <= nFirstEnd )
+    {
+        printf("TimingModelTest: no thread waited for a free slot\n");
+        return;
+    }
+
+    // with room for one line, the spin loop misses every time it wraps
+    GEN::TimingModel thrashing;
+    params.Costs.nICacheBytes = params.nICacheLineBytes;
+    if( !thrashing.Run( interpreter, params, dispatch, &errors ) )
+    {
+        printf("TimingModelTest: run failed\n%s", errors.m_Text.c_str() );
+        return;
+    }
+    if( thrashing.GetICacheMisses() <= model.GetICacheMisses() || thrashing.GetTotalCycles() <= model.GetTotalCycles() )
+    {
+        printf("TimingModelTest: a smaller instruction cache didn't cost anything\n");
+        return;
+    }
+
+    // bad parameters have to say which one is wrong
+    GEN::TimingModel unrunnable;
+    GEN::TimingParameters noPort;
+    noPort.nDataPortBytesPerCycle = 0;
+    errors.m_Text.clear();
+    if( unrunnable.Run( interpreter, noPort, dispatch, &errors ) || errors.m_Text.find("nDataPortBytesPerCycle") == std::string::npos )
+    {
+        printf("TimingModelTest: zero port bandwidth wasn't reported\n%s", errors.m_Text.c_str() );
+        return;
+    }
+
+    printf("TimingModelTest: passed.  %u cycles, %u with a %u byte instruction cache\n",
+           (unsigned)model.GetTotalCycles(), (unsigned)thrashing.GetTotalCycles(), (unsigned)params.Costs.nICacheBytes );
+}
@@ -0,0 +1,155 @@
+#ifndef _GEN_ANALYSIS_H_
+#define _GEN_ANALYSIS_H_
+
+#include <vector>
+#include "GENIsa.h"
+#include "GENControlFlow.h"
+
+namespace GEN
+{
+    class Decoder;
+    class IPrinter;
+
+    namespace Assembler
+    {
+        class Program;
+    }
+
+    enum OtherResources
+    {
+        RESOURCE_FLAGS   = 0x0f,    ///< One bit per flag subreg.  f0.0,f0.1,f1.0,f1.1
+        RESOURCE_ADDRESS = 0x10,
+        RESOURCE_ACCUM   = 0x20,
+        RESOURCE_ARF     = 0x40,    ///< Any other architecture reg
+        RESOURCE_MEMORY  = 0x80,    ///< Sends stay in order with each other
+    };
+
+    /// Registers and other state which an instruction reads or writes.  Bit i of 'GPRs' is ri
+    struct Resources
+    {
+        uint32 GPRs[4];
+        uint32 nOther;
+
+        void Clear() { GPRs[0]=GPRs[1]=GPRs[2]=GPRs[3]=0; nOther=0; }
+        void AddGPRs( size_t nFirst, size_t nEnd )
+        {
+            for( size_t r=nFirst; r<nEnd && r<128; r++ )
+                GPRs[r/32] |= 1u<<(r%32);
+        }
+        bool Overlaps( const Resources& r ) const
+        {
+            return ((GPRs[0]&r.GPRs[0]) | (GPRs[1]&r.GPRs[1]) | (GPRs[2]&r.GPRs[2]) | (GPRs[3]&r.GPRs[3]) | (nOther&r.nOther)) != 0;
+        }
+    };
+
+    /// Collect the registers and other state an instruction reads and writes.  Indirect operands could touch any GPR
+    void GetResources( const Instruction& rInst, Resources* pReads, Resources* pWrites );
+
+    /// Find the GPR bytes which an instruction operand touches.  'nOperand' is 0 for the destination, or 1+i for source i.
+    ///   Byte offsets are relative to r0, or to the start of the 'reg' declaration for unallocated regs.
+    ///   Returns false if the operand isn't a GPR.  Indirect operands have no footprint
+    bool GetGPRFootprint( const Instruction& rInst, size_t nOperand, bool* pIndirect, size_t* pFirstByte, size_t* pEndByte );
+
+    /// Check whether a write replaces the entire contents of every GPR in [nFirstByte,nEndByte)
+    bool IsWholeRegWrite( const Instruction& rInst, size_t nFirstByte, size_t nEndByte );
+
+    struct InstructionCost
+    {
+        uint32 nIssue;      ///< Cycles before the next instruction can issue
+        uint32 nLatency;    ///< Cycles from issue until the result can be read
+    };
+
+    /// Costs which the analyzer assumes for each kind of instruction.  These are rough Haswell numbers.
+    ///   They are for SIMD8 on 32-bit types.  Wider instructions issue in two halves, and 64-bit types take twice as long again.
+    ///   The default latencies match the scheduler's 'LatencyTable'
+    struct CostTable
+    {
+        CostTable();
+
+        InstructionCost Ops[OP_COUNT];
+        InstructionCost Math[MATH_INVALID];
+        InstructionCost Send;
+
+        /// Programs bigger than this fall off the instruction cache cliff.  Measure it with 'FindICacheCliff'.  The default is only a guess
+        size_t nICacheBytes;
+
+        InstructionCost GetCost( const Instruction& rInst ) const;
+    };
+
+    struct BlockCost
+    {
+        size_t nIssueCycles;    ///< Cycles spent issuing the block's instructions
+        size_t nStallCycles;    ///< Cycles spent waiting for results produced earlier in the block
+    };
+
+    /// How well a send's latency is hidden
+    struct SendLatency
+    {
+        size_t nInstruction;
+        size_t nFirstUse;           ///< First instruction in the same block which reads the response.  -1 if there isn't one
+        size_t nDistance;           ///< Instructions between the send and its first use
+        size_t nExposedCycles;      ///< Cycles that the first use waits for the response
+    };
+
+    struct MessageCount
+    {
+        const char* pName;      ///< Dataport message name, or the shared function's name for other messages
+        size_t nCount;
+    };
+
+    /// Static performance estimates for a blob of ISA.
+    ///
+    ///  Cycle counts come from an in-order issue model of each basic block, using a 'CostTable'.
+    ///  Every block starts with all of its inputs ready, and is counted as if it ran once, so loops are not weighted.
+    ///  Register pressure is the peak number of live GPRs at any point, from a liveness analysis over the control-flow graph.
+    ///  Indirect register accesses are ignored by the liveness analysis
+    class KernelAnalysis
+    {
+    public:
+
+        /// Returns false if any instruction fails to decode
+        bool Analyze( Decoder* pDecoder, const void* pIsaBytes, size_t nIsaBytes, const CostTable& rCosts );
+        bool Analyze( Decoder* pDecoder, const Assembler::Program& rProgram, const CostTable& rCosts );
+
+        const ControlFlowGraph& GetControlFlow() const { return m_CFG; }
+
+        /// One per basic block
+        const BlockCost& GetBlockCost( size_t nBlock ) const { return m_BlockCosts[nBlock]; }
+        size_t GetTotalCycles() const { return m_nTotalCycles; }
+
+        size_t GetPeakLiveGPRs() const { return m_nPeakLiveGPRs; }
+        size_t GetPeakInstruction() const { return m_nPeakInstruction; }   ///< An instruction where pressure peaks
+
+        /// One per send which has a response
+        size_t GetSendLatencyCount() const { return m_SendLatencies.size(); }
+        const SendLatency& GetSendLatency( size_t i ) const { return m_SendLatencies[i]; }
+
+        size_t GetMessageTypeCount() const { return m_MessageCounts.size(); }
+        const MessageCount& GetMessageType( size_t i ) const { return m_MessageCounts[i]; }
+
+        size_t GetIsaBytes() const { return m_nIsaBytes; }
+        size_t GetICacheBytes() const { return m_nICacheBytes; }
+        bool ExceedsICache() const { return m_nIsaBytes > m_nICacheBytes; }
+
+    private:
+
+        void CountMessages();
+        void ComputeBlockCosts( const CostTable& rCosts );
+        void ComputeRegisterPressure();
+
+        ControlFlowGraph m_CFG;
+        std::vector<BlockCost> m_BlockCosts;
+        std::vector<SendLatency> m_SendLatencies;
+        std::vector<MessageCount> m_MessageCounts;
+        size_t m_nTotalCycles;
+        size_t m_nPeakLiveGPRs;
+        size_t m_nPeakInstruction;
+        size_t m_nIsaBytes;
+        size_t m_nICacheBytes;
+    };
+
+    /// Print a summary of an analysis, one basic block and one send per line
+    void PrintAnalysis( IPrinter& rPrinter, const KernelAnalysis& rAnalysis );
+}
+
+#endif
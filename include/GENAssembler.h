@@ -3,6 +3,7 @@
 #define _GEN_ASM_H_
 
 #include <vector>
+#include <string>
 #include "GENIsa.h"
 
 namespace GEN
@@ -12,6 +13,27 @@ namespace GEN
  
     namespace Assembler
     {
+        /// Latencies, in cycles, which the scheduler assumes for the results of each kind of instruction
+        struct LatencyTable
+        {
+            LatencyTable() : nALU(8), nMath(22), nSend(200) {}
+
+            size_t nALU;    ///< Everything other than math and sends
+            size_t nMath;   ///< Extended math (rcp, sqrt, idiv and friends)
+            size_t nSend;   ///< Time for a send's response to land in its destination regs
+        };
+
+        /// Supplies the text of files named by '#include' directives.
+        ///   Without one, the assembler reads them from disk, relative to the working directory
+        class IIncludeHandler
+        {
+        public:
+            virtual ~IIncludeHandler() {}
+
+            /// Return false if the file can't be found
+            virtual bool Read( const char* pFileName, std::string& rText ) = 0;
+        };
+
         class Program
         {
         public:
@@ -20,6 +42,63 @@ namespace GEN
 
             ~Program();
 
+            /// Turn instruction scheduling on or off.  It is off by default.
+            ///   When on, instructions are re-ordered to hide latency, by moving independent
+            ///   work in between long-latency instructions and the first instructions that use their results.
+            ///   Labels, jumps, branches and pred blocks are barriers, which nothing is moved across
+            void SetScheduling( bool bEnable ) { m_bScheduling = bEnable; }
+            bool IsSchedulingEnabled() const { return m_bScheduling; }
+
+            void SetLatencies( const LatencyTable& rLatencies ) { m_Latencies = rLatencies; }
+            const LatencyTable& GetLatencies() const { return m_Latencies; }
+
+            /// Turn the peephole and dead-code optimizer on or off.  It is off by default.
+            ///   When on, constants and copies are propagated into the instructions which use them,
+            ///   immediate-only integer ops are folded, multiplies and divides by powers of two become shifts,
+            ///   and instructions whose results are never read are removed.  This runs before scheduling
+            void SetOptimization( bool bEnable ) { m_bOptimization = bEnable; }
+            bool IsOptimizationEnabled() const { return m_bOptimization; }
+
+            /// Turn send coalescing on or off.  It is off by default.
+            ///   When on, dword scattered loads from the same surface whose addresses are provably 1, 2 or 3 dwords apart,
+            ///   and whose responses land in consecutive registers, become a single untyped read.  Addresses which differ by
+            ///   a runtime value are never merged.  This runs before scheduling
+            void SetSendCoalescing( bool bEnable ) { m_bSendCoalescing = bEnable; }
+            bool IsSendCoalescingEnabled() const { return m_bSendCoalescing; }
+
+            /// Print a list of what the optimizer and send coalescing changed, along with some totals, each time a program is assembled.
+            ///   Null turns the report off
+            void SetOptimizationReport( IPrinter* pReport ) { m_pOptimizationReport = pReport; }
+
+            /// Turn automatic dependency control on or off.  It is off by default.
+            ///   When on, consecutive writes to disjoint parts of the same GPR, with nothing reading it in between,
+            ///   get NoDDClr and NoDDChk so that they don't wait for each other.  This runs after scheduling
+            void SetDependencyControl( bool bEnable ) { m_bDependencyControl = bEnable; }
+            bool IsDependencyControlEnabled() const { return m_bDependencyControl; }
+
+            /// Where '#include' directives get their text from.  Null reads files from disk
+            void SetIncludeHandler( IIncludeHandler* pHandler ) { m_pIncludeHandler = pHandler; }
+
+            /// Pre-define a macro with no parameters, which every program assembled afterwards can use.
+            ///   This is how the host passes constants, like unroll counts or bind points, into kernels
+            void Define( const char* pName, const char* pValue );
+            void ClearDefinitions() { m_Definitions.clear(); }
+
+            /// Keep assembled programs in files in this directory, which must already exist.  Null turns caching off, which is the default.
+            ///   Files are named by a hash of the preprocessed text, of the assembler and encoder options, and of when the assembler was built.  When a matching file is found,
+            ///   its ISA, CURBE and thread count are loaded and the text is not parsed.  Cached programs don't produce optimization reports
+            void SetCacheDirectory( const char* pPath ) { m_CacheDirectory = pPath ? pPath : ""; }
+
+            /// True if the last 'Assemble' was satisfied from the cache
+            bool IsFromCache() const { return m_bFromCache; }
+
+            /// The cache file that the last 'Assemble' read or wrote.  Empty if caching is off
+            const std::string& GetCacheFile() const { return m_CacheFile; }
+
+            /// Safe to call from many threads at once, as long as each thread has its own Program.
+            ///   The assembler has no mutable global state, and the encoder is only read.  Error streams,
+            ///   include handlers and optimization reports are called on the calling thread, so any of those
+            ///   which are shared between threads need to be thread safe themselves
             bool Assemble( Encoder* pCoder, const char* pText, IPrinter* pErrorStream );
 
             void Clear();
@@ -31,7 +110,22 @@ namespace GEN
             size_t GetCURBERegCount() const { return m_nCURBECount; }
             size_t GetThreadsPerDispatch() const { return m_nThreadsPerGroup; }
         private:
+
+            uint64 GetCacheKey( const Encoder* pEncoder, const std::string& rText ) const;
+            bool ReadCache( uint64 nKey );
+            void WriteCache( uint64 nKey ) const;
             
+            bool m_bScheduling;
+            LatencyTable m_Latencies;
+            bool m_bOptimization;
+            IPrinter* m_pOptimizationReport;
+            bool m_bSendCoalescing;
+            bool m_bDependencyControl;
+            IIncludeHandler* m_pIncludeHandler;
+            std::vector< std::pair<std::string,std::string> > m_Definitions;
+            std::string m_CacheDirectory;
+            std::string m_CacheFile;
+            bool m_bFromCache;
             size_t m_nThreadsPerGroup;
             size_t m_nIsaLengthInBytes;
             size_t m_nCURBECount;
@@ -39,6 +133,12 @@ namespace GEN
             void* m_pCURBE;
         };
 
+        /// Assemble a set of independent programs using 'nThreads' threads (0 means one per core).
+        ///   pPrograms[i] assembles ppTexts[i] with its own settings, so the programs are filled in input order.
+        ///   Each program's errors are collected separately, and pushed to 'pErrorStream' in input order once they're all done.
+        ///   Programs which fail are left empty.  Returns false if any of them failed
+        bool AssembleParallel( Encoder* pEncoder, Program* pPrograms, const char* const* ppTexts, size_t nPrograms, IPrinter* pErrorStream, size_t nThreads );
+
 
     }
 };
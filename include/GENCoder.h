@@ -2,15 +2,63 @@
 #ifndef _GEN_DECODER_H_
 #define _GEN_DECODER_H_
 
+#include <vector>
+#include "GENIsa.h"
+
 namespace GEN
 {
-    typedef unsigned char uint8;
     typedef char int8;
-    typedef unsigned int uint32;
-    typedef int int32;
 
-    enum Operations;
-    class Instruction;
+    ///
+    /// Structure-of-arrays form of a decoded instruction stream, produced by 'Decoder::DecodeAll'
+    ///   Only the commonly used fields are kept, one column per field.
+    ///   The caller owns this, and should re-use it across decodes to avoid re-allocating the columns
+    ///
+    ///  Operands which an instruction doesn't have are reported as REG_INVALID/DT_INVALID.  
+    ///   Immediates are REG_IMM.  Indirect operands report GPR 0
+    ///
+    class DecodedProgram
+    {
+    public:
+
+        enum OperandSlot
+        {
+            OPERAND_DEST,
+            OPERAND_SRC0,
+            OPERAND_SRC1,
+            OPERAND_COUNT
+        };
+
+        void Clear();
+
+        size_t GetInstructionCount() const { return m_Offsets.size(); }
+
+        uint32 GetOffset( size_t i ) const                   { return m_Offsets[i]; }
+        Operations GetOperation( size_t i ) const            { return (Operations) m_Ops[i]; }
+        InstructionClass GetClass( size_t i ) const          { return (InstructionClass) m_Classes[i]; }
+        uint32 GetExecSize( size_t i ) const                 { return m_ExecSizes[i]; }
+        RegTypes GetRegType( size_t i, OperandSlot e ) const { return (RegTypes) m_RegTypes[e][i]; }
+        uint32 GetRegNum( size_t i, OperandSlot e ) const    { return m_RegNums[e][i]; }
+        DataTypes GetDataType( size_t i, OperandSlot e ) const { return (DataTypes) m_DataTypes[e][i]; }
+
+        /// Immediate message descriptor for sends.  0 for non-sends, or sends whose descriptor is in a register
+        uint32 GetSendDescriptor( size_t i ) const           { return m_SendDescriptors[i]; }
+
+    private:
+
+        friend class Decoder;
+
+        void Resize( size_t n );
+
+        std::vector<uint32> m_Offsets;
+        std::vector<uint8>  m_Ops;
+        std::vector<uint8>  m_Classes;
+        std::vector<uint8>  m_ExecSizes;
+        std::vector<uint8>  m_RegTypes[OPERAND_COUNT];
+        std::vector<uint8>  m_RegNums[OPERAND_COUNT];
+        std::vector<uint8>  m_DataTypes[OPERAND_COUNT];
+        std::vector<uint32> m_SendDescriptors;
+    };
 
     ///
     /// 'Decoder' and 'Encoder are classes that seperates logical instruction
@@ -44,6 +92,11 @@ namespace GEN
         ///   or copy it (if native)
         size_t Expand( uint8* pOut, const uint8* pInstruction );
 
+        /// Decode an entire instruction stream into 'rProgram', replacing its contents
+        ///   Returns false if an unrecognized or truncated instruction is hit.  
+        ///   In that case, 'rProgram' holds everything up to the bad instruction
+        bool DecodeAll( const uint8* pBytes, size_t nBytes, DecodedProgram& rProgram );
+
     private:
 
         void DecodeInstructionHeader( Instruction* pInst, const uint8* pBytes );
@@ -62,6 +115,13 @@ namespace GEN
     {
     public:
 
+        Encoder() : m_bCompaction(true) {}
+
+        /// Turn instruction compaction on or off.  It is on by default.
+        ///   When on, any instruction that has an 8-byte encoding will be emitted in compacted form
+        void SetCompaction( bool bEnable ) { m_bCompaction = bEnable; }
+        bool IsCompactionEnabled() const { return m_bCompaction; }
+
         /// Query required buffer size for encoding
         size_t GetBufferSize( size_t nOps );
 
@@ -70,8 +130,21 @@ namespace GEN
         ///   Returns size of encoded instructions.  This may be less than required size
         ///      if compressed instructions were used
         ///
-        size_t Encode( void* pOutputBuffer, const GEN::Instruction* pOps, size_t nOps );
+        ///  IP-relative jumps (add ip, ip, imm) are expected to have their offsets expressed as if 
+        ///   every instruction were 16 bytes.  The same goes for branch JIP/UIP, which are in 8-byte units.
+        ///   The encoder re-targets them to account for compaction.  Jumps themselves are never compacted
+        ///
+        ///  Ops decoded from a blob have offsets in that blob's layout, which may have been compacted.
+        ///   Pass the byte offset of each op in it as 'pSourceOffsets', with one more entry for the end,
+        ///   and jumps are re-targeted from there instead
+        ///
+        size_t Encode( void* pOutputBuffer, const GEN::Instruction* pOps, size_t nOps, const size_t* pSourceOffsets=0 );
+
+    private:
+
+        size_t EncodeNative( void* pOutputBuffer, const GEN::Instruction* pOps, size_t nOps );
 
+        bool m_bCompaction;
     };
 }
 
@@ -0,0 +1,85 @@
+#ifndef _GEN_CONTROLFLOW_H_
+#define _GEN_CONTROLFLOW_H_
+
+#include <vector>
+#include "GENIsa.h"
+
+namespace GEN
+{
+    class Decoder;
+
+    enum EdgeTypes : uint8
+    {
+        EDGE_FALLTHROUGH,   ///< Execution continues to the next instruction
+        EDGE_JUMP,          ///< IP-relative jump ('add ip, ip, imm')
+        EDGE_JIP,           ///< Structured branch, taken when no channels remain enabled
+        EDGE_UIP,           ///< Structured branch, taken by 'break' and 'cont'
+    };
+
+    struct BasicBlock
+    {
+        size_t nFirstInstruction;
+        size_t nInstructionCount;
+        size_t nStartOffset;        ///< Byte offset of the first instruction
+        size_t nEndOffset;          ///< Byte offset one past the last instruction
+        size_t nSendCount;
+        size_t nFirstEdge;          ///< Edges leaving this block are [nFirstEdge,nFirstEdge+nEdgeCount)
+        size_t nEdgeCount;
+    };
+
+    struct ControlFlowEdge
+    {
+        size_t nFromBlock;
+        size_t nToBlock;
+        EdgeTypes eType;
+
+        /// Back edges are the ones which close loops
+        bool IsBackEdge() const { return nToBlock <= nFromBlock; }
+    };
+
+    /// Basic blocks and control-flow edges for a blob of ISA.
+    ///
+    ///  Block boundaries are placed at the targets of 'add ip' jumps and at the JIP/UIP targets
+    ///  of structured branches, and after any instruction which can transfer control.
+    ///  Unpredicated jumps and EOT sends do not fall through.  Targets which land outside
+    ///  the program, or in the middle of an instruction, are ignored.
+    class ControlFlowGraph
+    {
+    public:
+
+        /// Decode and analyze an instruction stream.  Returns false if any instruction
+        ///  fails to decode, in which case the graph is left empty
+        bool Build( Decoder* pDecoder, const void* pIsaBytes, size_t nIsaBytes );
+
+        void Clear();
+
+        size_t GetInstructionCount() const { return m_Instructions.size(); }
+        const Instruction& GetInstruction( size_t i ) const { return m_Instructions[i]; }
+        size_t GetInstructionOffset( size_t i ) const { return m_Offsets[i]; }
+        size_t GetInstructionLength( size_t i ) const { return m_Offsets[i+1] - m_Offsets[i]; }
+        size_t GetInstructionBlock( size_t i ) const { return m_InstructionBlocks[i]; }
+
+        /// Find the instruction which starts at a given byte offset.  Returns -1 if there isn't one
+        size_t FindInstruction( size_t nOffset ) const;
+
+        size_t GetBlockCount() const { return m_Blocks.size(); }
+        const BasicBlock& GetBlock( size_t i ) const { return m_Blocks[i]; }
+
+        size_t GetEdgeCount() const { return m_Edges.size(); }
+        const ControlFlowEdge& GetEdge( size_t i ) const { return m_Edges[i]; }
+
+    private:
+
+        std::vector<Instruction> m_Instructions;
+        std::vector<size_t> m_Offsets;              ///< One per instruction, plus the end of the program
+        std::vector<size_t> m_InstructionBlocks;
+        std::vector<BasicBlock> m_Blocks;
+        std::vector<ControlFlowEdge> m_Edges;
+    };
+
+    /// Return the byte offset of an IP-relative jump's target, relative to the start of the program.
+    ///  Returns false if the instruction is not an 'add ip, ip, imm'
+    bool GetJumpTarget( const Instruction& rInst, size_t nOffset, int* pTarget );
+}
+
+#endif
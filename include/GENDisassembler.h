@@ -16,6 +16,24 @@ namespace GEN
 
     bool Disassemble( IPrinter& rPrinter, Decoder* pDecoder, const void* pIsaBytes, size_t nIsaBytes );
 
+    /// Disassemble to JSON, for tools that want to analyze a program rather than read it.
+    ///   Emits the decoded fields and byte offset of each instruction, along with the program's basic blocks
+    ///   and control-flow edges (see 'ControlFlowGraph').  Branch and jump targets are byte offsets from
+    ///   the start of the program.  Returns false, and prints nothing, if any instruction fails to decode
+    bool DisassembleJSON( IPrinter& rPrinter, Decoder* pDecoder, const void* pIsaBytes, size_t nIsaBytes );
+
+    struct IsaBlob
+    {
+        const void* pIsaBytes;
+        size_t nIsaBytes;
+    };
+
+    /// Disassemble a set of independent ISA blobs using 'nThreads' threads (0 means one per core).
+    ///   Blobs are split into instruction-aligned chunks which are formatted in parallel.
+    ///   Output is pushed to 'rPrinter' in order, and is byte-identical to calling 'Disassemble' 
+    ///     on each blob in turn.  Returns false if any blob failed to disassemble
+    bool DisassembleParallel( IPrinter& rPrinter, const IsaBlob* pBlobs, size_t nBlobs, size_t nThreads );
+
 }
 
 #endif
\ No newline at end of file
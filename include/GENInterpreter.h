@@ -0,0 +1,126 @@
+
+#ifndef _GEN_INTERPRETER_H_
+#define _GEN_INTERPRETER_H_
+
+#include <vector>
+#include "GENIsa.h"
+
+namespace GEN
+{
+    class Decoder;
+    class IPrinter;
+
+    /// A buffer which dataport messages can read and write.  Reads outside of it return 0, and writes outside of it are dropped
+    struct Surface
+    {
+        void* pData;
+        size_t nBytes;
+    };
+
+    /// Everything a hardware thread starts out with
+    struct ThreadPayload
+    {
+        uint32 Header[8];           ///< Copied to r0.  Dword 1 is the thread group ID
+        const void* pCURBE;         ///< Copied to r1 onwards
+        size_t nCURBERegs;
+        uint32 nDispatchMask;       ///< Channels which exist.  0xff for SIMD8 dispatch, 0xffff for SIMD16
+        const Surface* pSurfaces;   ///< Indexed by binding table index.  Null entries, and indices past the end, are empty
+        size_t nSurfaces;
+    };
+
+    /// GEN ISA, decoded so that it can be run on the CPU by 'InterpreterThread'.
+    ///   Once loaded, it is never modified, so any number of threads can run it at once
+    class Interpreter
+    {
+    public:
+
+        /// Returns false if any instruction fails to decode
+        bool Load( Decoder* pDecoder, const void* pIsaBytes, size_t nIsaBytes );
+
+        size_t GetInstructionCount() const { return m_Instructions.size(); }
+        const Instruction& GetInstruction( size_t i ) const { return m_Instructions[i]; }
+        size_t GetOffset( size_t i ) const { return m_Offsets[i]; }
+
+        /// Index of the instruction at a byte offset.  -1 if no instruction starts there
+        size_t FindInstruction( size_t nOffset ) const;
+
+        /// Run one thread to its EOT.  Returns false, and prints why to 'pErrors', if it hits something that can't be run
+        bool Run( const ThreadPayload& rPayload, IPrinter* pErrors ) const;
+
+    private:
+        std::vector<Instruction> m_Instructions;
+        std::vector<size_t> m_Offsets;
+    };
+
+    /// One hardware thread's registers and channel state, run an instruction at a time.
+    ///
+    ///  Each instruction's channels are evaluated in lockstep, on arrays of 16, so the compiler can use host SIMD for them.
+    ///  Structured control flow follows the hardware's per-channel instruction pointers: a disabled channel waits
+    ///  for the thread to reach the instruction it will resume at, and the thread skips ahead when no channels are left.
+    ///
+    ///  Dword scattered reads and writes, untyped reads and writes, and OWord block reads and writes are emulated against
+    ///  the payload's surfaces.  Atomics, samplers, barriers and most other messages are not.  Neither are align16 instructions
+    ///
+    class InterpreterThread
+    {
+    public:
+
+        enum StepResult
+        {
+            STEP_OK,
+            STEP_DONE,      ///< The thread sent its EOT
+            STEP_ERROR,     ///< See 'GetError'
+        };
+
+        void Start( const Interpreter& rProgram, const ThreadPayload& rPayload );
+
+        /// Execute the instruction at 'GetIP'
+        StepResult Step();
+
+        size_t GetIP() const { return m_nIP; }  ///< Index of the next instruction
+        const char* GetError() const { return m_Error; }
+
+        /// What reads of the timestamp register return.  Until this is called, they read a host clock
+        void SetTimestamp( uint64 nTimestamp ) { m_nTimestamp = nTimestamp; m_bHostTimestamp = false; }
+
+        /// What reads of sr0 return.  It starts out zero
+        void SetState( const uint32* pState );
+
+        const uint8* GetGPRs() const { return m_GPRs; }
+
+    private:
+
+        uint8* GetRegBytes( RegTypes eReg, size_t nReg, size_t* pBytes );
+        uint8* GetOperandBytes( const RegisterRegion& rRegion, size_t* pBytes );
+        bool ReadSource( const SourceOperand& rSrc, size_t nExec, bool bFloat, bool bLogic, float* pFloats, int64* pInts );
+        bool GetPredicateMask( const Instruction& rInst, uint32* pMask );
+        uint32 GetFlags( FlagReference flag );
+        void SetFlags( FlagReference flag, uint32 nMask, uint32 nBits );
+        void WaitAt( uint32 nChannels, size_t nIP );
+
+        bool ExecuteALU( const Instruction& rInst, size_t* pNextIP );
+        bool ExecuteBranch( const BranchInstruction& rBranch, size_t* pNextIP );
+        bool ExecuteSend( const SendInstruction& rSend, uint32 nChannels );
+        bool ExecuteDataPort( const SendInstruction& rSend, uint32 nChannels );
+        bool Fail( const char* pWhat );
+
+        const Interpreter* m_pProgram;
+        ThreadPayload m_Payload;
+        size_t m_nIP;
+        uint32 m_nRunning;          ///< Channels that are following the thread
+        uint32 m_nWaiting;          ///< Channels which are parked at 'm_WaitIP'
+        size_t m_WaitIP[32];
+        uint64 m_nTimestamp;
+        bool m_bHostTimestamp;
+        uint32 m_State[4];
+        char m_Error[128];
+
+        uint8 m_GPRs[128*32];
+        uint8 m_Accumulators[64];   ///< acc0 then acc1, so SIMD16 regions run from one into the other
+        uint8 m_Flags[8];
+        uint8 m_Address[32];
+        uint8 m_Scratch[128];        ///< Null writes, and reads of registers which are made up on the spot
+    };
+}
+
+#endif
@@ -7,6 +7,7 @@
 namespace GEN
 {
     typedef unsigned __int64 uint64;
+    typedef __int64 int64;
     typedef unsigned int     uint32;
     typedef int int32;
     typedef unsigned short   uint16;
@@ -14,6 +15,7 @@ namespace GEN
     typedef short int16;
 
     static_assert( sizeof(uint64) == 8, "derp" );
+    static_assert( sizeof(int64)  == 8, "derp" );
     static_assert( sizeof(uint32) == 4, "derp" );
     static_assert( sizeof(int32)  == 4, "derp" );
     static_assert( sizeof(uint16) == 2, "derp" );
@@ -315,8 +317,8 @@ namespace GEN
         bool IsInverted() const { return m_bInvert; }
 
     private:
-        unsigned m_eMode : 7;
-        unsigned m_bInvert : 1;
+        uint8 m_eMode : 7;
+        uint8 m_bInvert : 1;
     };
 
     class FlagReference
@@ -333,8 +335,8 @@ namespace GEN
         size_t GetSubReg() const { return m_nSubReg; }
 
     private:
-        uint8 m_nReg;
-        uint8 m_nSubReg;
+        uint8 m_nReg : 4;
+        uint8 m_nSubReg : 4;
     };
 
     class RegReference
@@ -510,6 +512,7 @@ namespace GEN
 
         const uint8* GetImmediateBits() const { return fields.Imm; }
     private:
+        friend class Instruction;
 
         Swizzle m_Swizzle;
         DataTypes m_eDataType;
@@ -544,6 +547,7 @@ namespace GEN
 
         DataTypes GetDataType() const { return (DataTypes)m_eDataType; }
         RegisterRegion GetRegRegion() const { return m_RegRegion; }
+        uint8 GetWriteMask() const { return m_nWriteMask; }
 
         bool IsValid() const
         {
@@ -566,8 +570,10 @@ namespace GEN
     {
     public:
         Instruction() 
-            : m_eClass(IC_NULL), m_eOp(OP_ILLEGAL), m_bEOT(0), m_bNoDDChk(0), m_bMsgDescriptorFromReg(0)
-        {}
+            : m_eOp(OP_ILLEGAL), m_eClass(IC_NULL)
+        {
+            ClearFields();
+        }
 
         Predicate GetPredicate() const { return m_Predicate; }
         InstructionClass GetClass() const { return (InstructionClass)m_eClass; };
@@ -580,40 +586,88 @@ namespace GEN
         bool IsDDCheckDisabled() const { return m_bNoDDChk; }
         void DisableDDCheck() { m_bNoDDChk = 1; };
 
+        /// NoDDClr.  The instruction leaves its destination marked busy, for a following NoDDChk instruction to clear
+        bool IsDDClearDisabled() const { return m_bNoDDClr; }
+        void DisableDDClear() { m_bNoDDClr = 1; };
+
         FlagReference GetFlagReference() const { return m_Flags; }
         void SetFlagReference( const FlagReference& rFlag ) { m_Flags = rFlag; }
         void SetPredicate( Predicate p ) { m_Predicate = p; }
         
-        size_t GetExecSize() const { return m_nExecSize; }
+        size_t GetExecSize() const { return UnpackRegionCode( m_nExecSize, 7 ); }
+
+        /// Move a GPR operand up by 'nRegs' registers.  'nOperand' is 0 for the destination, or 1+i for source i.
+        ///   The assembler uses this to place 'reg' declarations once registers are allocated.
+        ///   Returns false if the operand's register number or indirect offset no longer fits
+        bool RelocateGPR( size_t nOperand, size_t nRegs );
         
     protected:
         Instruction( InstructionClass e ) 
-            : m_eClass(e),
-              m_eOp(NOT_AN_OP),
-              m_nExecSize(0),
-              m_bEOT(0), 
-              m_bNoDDChk(0), 
-              m_bMsgDescriptorFromReg(0)
+            : m_eOp(NOT_AN_OP),
+              m_eClass(e)
         {
+            ClearFields();
         };
 
         friend class Decoder;
 
+        /// Operands are stored in 6 bytes apiece.  Strides, widths and exec sizes are kept as
+        ///  log2 codes (0 for 0, log2(n)+1 otherwise).  Immediate values are not stored in the 
+        ///  operand, they live in the instruction's immediate slot
+        struct PackedOperand
+        {
+            uint16 m_nRegBits   : 14;    ///< regnum | subreg<<8, or addrsubreg | offset<<4 if indirect
+            uint16 m_eModifier  : 2;
+            uint16 m_eRegType   : 6;
+            uint16 m_bIndirect  : 1;
+            uint16 m_eDataType  : 4;
+            uint16 m_bImmediate : 1;
+            uint16 m_nHStride   : 3;
+            uint16 m_nSwizzle   : 8;     ///< Write mask, for destinations
+            uint16 m_nVStride   : 4;
+            uint16 m_nWidth     : 3;
+        };
+
+        static uint32 PackRegionCode( size_t n, uint32 nInvalid );
+        static size_t UnpackRegionCode( uint32 nCode, uint32 nInvalid );
+        static void PackOperand( PackedOperand& rOp, DataTypes eType, const RegisterRegion& rRegion, uint32 nSwizzle );
+        static RegisterRegion UnpackRegion( const PackedOperand& rOp );
+
+        void ClearFields();
+        void SetExecSize( size_t n ) { m_nExecSize = PackRegionCode(n,7); }
+        void SetDest( const DestOperand& rDest );
+        void SetSource( size_t i, const SourceOperand& rSource );
+        DestOperand GetDestOperand() const;
+        SourceOperand GetSourceOperand( size_t i ) const;
+
         uint8 m_eOp;
-        uint8 m_eClass;
-        uint8 m_nExecSize;
-        unsigned m_bNoWriteMask : 1;
-        unsigned m_bNoDDChk : 1;
+        uint8 m_eClass        : 3;
+        uint8 m_nExecSize     : 3;
+        uint8 m_bNoWriteMask  : 1;
+        uint8 m_bNoDDChk      : 1;
         Predicate m_Predicate;
+        FlagReference m_Flags;
+
+        union
+        {
+            uint8 m_eFunctionCtrl;   // math
+            uint8 m_eSFID;          // send
+            uint8 m_eCondModifier;  // others
+        };
+
+        uint8 m_bNoDDClr : 1;   ///< Shares a byte with the send bits, to keep instructions small
 
         /////////////////////////////////////
         // Send instruction only
-        unsigned m_bEOT : 1;
-        unsigned m_bMsgDescriptorFromReg : 1;
+        uint8 m_bEOT : 1;
+        uint8 m_bMsgDescriptorFromReg : 1;
         ////////////////////////////////////
 
+        PackedOperand m_Dest;
+        PackedOperand m_Source0;
+        PackedOperand m_Source1;
 
-
+        // Three-source instructions never take immediates, so src2 can share their storage
         union
         {
             uint8 m_ImmediateOperand[8];
@@ -622,22 +676,8 @@ namespace GEN
                 int32 JIP;
                 int32 UIP;
             } m_BranchOffsets;
+            PackedOperand m_Source2;
         };
-    
-        union
-        {
-            uint8 m_eFunctionCtrl;   // math
-            uint8 m_eSFID;          // send
-            uint8 m_eCondModifier;  // others
-        };
-        
-
-        DestOperand m_Dest;
-        SourceOperand m_Source0;
-        SourceOperand m_Source1;
-        SourceOperand m_Source2;
-        FlagReference m_Flags;
-
     };
 
 
@@ -652,9 +692,9 @@ namespace GEN
             : Instruction(IC_UNARY) 
         {
             m_eOp = eOp;
-            m_nExecSize = nExecSize;
-            m_Dest = dst;
-            m_Source0 = src;
+            SetExecSize(nExecSize);
+            SetDest(dst);
+            SetSource(0,src);
             m_eCondModifier = CM_NONE;
             if( src.IsImmediate() )
                 memcpy( &m_ImmediateOperand, src.GetImmediateBits(), 8 );
@@ -665,9 +705,9 @@ namespace GEN
         void SetConditionalModifier( ConditionalModifiers eMod ) { m_eCondModifier = eMod; }
 
 
-        size_t GetExecSize() const { return m_nExecSize; }
-        const DestOperand& GetDest() const { return m_Dest; }
-        const SourceOperand& GetSource0() const { return m_Source0; };
+        size_t GetExecSize() const { return Instruction::GetExecSize(); }
+        DestOperand GetDest() const { return GetDestOperand(); }
+        SourceOperand GetSource0() const { return GetSourceOperand(0); };
 
     private:
 
@@ -682,10 +722,10 @@ namespace GEN
             : Instruction(IC_BINARY) 
         {
             m_eOp = eOp;
-            m_nExecSize = nExecSize;
-            m_Dest = dst;
-            m_Source0 = src0;
-            m_Source1 = src1;
+            SetExecSize(nExecSize);
+            SetDest(dst);
+            SetSource(0,src0);
+            SetSource(1,src1);
             m_eCondModifier = CM_NONE;
             if( src1.IsImmediate() )
                 memcpy( &m_ImmediateOperand, src1.GetImmediateBits(), 8 );
@@ -696,10 +736,10 @@ namespace GEN
         ConditionalModifiers GetConditionModifier() const { return (ConditionalModifiers)m_eCondModifier; }
         void SetConditionalModifier( ConditionalModifiers eMod ) { m_eCondModifier = eMod; }
 
-        size_t GetExecSize() const { return m_nExecSize; }
-        const DestOperand& GetDest() const { return m_Dest; }
-        const SourceOperand& GetSource0() const { return m_Source0; };
-        const SourceOperand& GetSource1() const { return m_Source1; };
+        size_t GetExecSize() const { return Instruction::GetExecSize(); }
+        DestOperand GetDest() const { return GetDestOperand(); }
+        SourceOperand GetSource0() const { return GetSourceOperand(0); };
+        SourceOperand GetSource1() const { return GetSourceOperand(1); };
     
         
     };
@@ -712,23 +752,23 @@ namespace GEN
             : Instruction(IC_TERNARY)
         {
             m_eOp = eOp;
-            m_nExecSize = nExecSize;
-            m_Dest = dst;
-            m_Source0 = src0;
-            m_Source1 = src1;
-            m_Source2 = src2;
+            SetExecSize(nExecSize);
+            SetDest(dst);
+            SetSource(0,src0);
+            SetSource(1,src1);
+            SetSource(2,src2);
             m_eCondModifier = CM_NONE;
         }
 
         ConditionalModifiers GetConditionModifier() const { return (ConditionalModifiers)m_eCondModifier; }
         void SetConditionalModifier( ConditionalModifiers eMod ) { m_eCondModifier = eMod; }
 
-        size_t GetExecSize() const { return m_nExecSize; }
+        size_t GetExecSize() const { return Instruction::GetExecSize(); }
           
-        const DestOperand& GetDest() const { return m_Dest; }
-        const SourceOperand& GetSource0() const { return m_Source0; };
-        const SourceOperand& GetSource1() const { return m_Source1; };
-        const SourceOperand& GetSource2() const { return m_Source2; };
+        DestOperand GetDest() const { return GetDestOperand(); }
+        SourceOperand GetSource0() const { return GetSourceOperand(0); };
+        SourceOperand GetSource1() const { return GetSourceOperand(1); };
+        SourceOperand GetSource2() const { return GetSourceOperand(2); };
     };
 
     class SendInstruction : public Instruction
@@ -744,9 +784,9 @@ namespace GEN
             : Instruction( IC_SEND )
         {
             m_eOp = OP_SEND;
-            m_Source0   = src0;
-            m_Dest      = dst;
-            m_nExecSize = nExec;
+            SetSource(0,src0);
+            SetDest(dst);
+            SetExecSize(nExec);
             m_eSFID = eDest;
             m_bEOT=0;
             m_bMsgDescriptorFromReg=0;
@@ -756,9 +796,9 @@ namespace GEN
         bool IsEOT() const { return m_bEOT; }
         bool IsDescriptorInRegister() const { return m_bMsgDescriptorFromReg; }
         uint32 GetDescriptorIMM() const { return GetImmediate<uint32>(); }
-        const DestOperand& GetDest() const { return m_Dest; }
-        const SourceOperand& GetSource() const { return m_Source0; }
-        size_t GetExecSize() const { return m_nExecSize; }
+        DestOperand GetDest() const { return GetDestOperand(); }
+        SourceOperand GetSource() const { return GetSourceOperand(0); }
+        size_t GetExecSize() const { return Instruction::GetExecSize(); }
         SharedFunctionIDs GetRecipient() const { return (SharedFunctionIDs)m_eSFID; }
 
         void SetEOT( ) { m_bEOT = true; };
@@ -793,25 +833,27 @@ namespace GEN
         {
             m_eOp = OP_MATH;
             m_eFunctionCtrl = eFunction;
-            m_nExecSize = nExecSize;
-            m_Dest = dst;
-            m_Source0 = src0;
-            m_Source1 = src1;
+            SetExecSize(nExecSize);
+            SetDest(dst);
+            SetSource(0,src0);
+            SetSource(1,src1);
+            if( src1.IsImmediate() )
+                memcpy( &m_ImmediateOperand, src1.GetImmediateBits(), 8 );
         }
         MathInstruction( size_t nExecSize, MathFunctionIDs eFunction, DestOperand dst, SourceOperand src0 ) 
             : Instruction(IC_MATH) 
         {
             m_eOp = OP_MATH;
             m_eFunctionCtrl = eFunction;
-            m_nExecSize = nExecSize;
-            m_Dest = dst;
-            m_Source0 = src0;
-            m_Source1 = SourceOperand(GEN::DT_INVALID, GEN::RegisterRegion( GEN::DirectRegReference( REG_NULL, 0 ),0,0,0 ) );
+            SetExecSize(nExecSize);
+            SetDest(dst);
+            SetSource(0,src0);
+            SetSource(1,SourceOperand(GEN::DT_INVALID, GEN::RegisterRegion( GEN::DirectRegReference( REG_NULL, 0 ),0,0,0 ) ));
         }
-        size_t GetExecSize() const { return m_nExecSize; }
-        const DestOperand& GetDest() const { return m_Dest; }
-        const SourceOperand& GetSource0() const { return m_Source0; }
-        const SourceOperand& GetSource1() const { return m_Source1; }
+        size_t GetExecSize() const { return Instruction::GetExecSize(); }
+        DestOperand GetDest() const { return GetDestOperand(); }
+        SourceOperand GetSource0() const { return GetSourceOperand(0); }
+        SourceOperand GetSource1() const { return GetSourceOperand(1); }
 
         MathFunctionIDs GetFunction() const { return (MathFunctionIDs) m_eFunctionCtrl; }
 
@@ -821,9 +863,24 @@ namespace GEN
     {
     public:
         BranchInstruction() : Instruction( IC_BRANCH ){}
-        size_t GetExecSize() const { return m_nExecSize; }
+        BranchInstruction( size_t nExecSize, Operations eOp, int nJIP, int nUIP )
+            : Instruction( IC_BRANCH )
+        {
+            m_eOp = eOp;
+            SetExecSize(nExecSize);
+            m_BranchOffsets.JIP = nJIP;
+            m_BranchOffsets.UIP = nUIP;
+        }
+
+        size_t GetExecSize() const { return Instruction::GetExecSize(); }
+
+        /// Jump offsets are in 8-byte units, relative to the branch instruction itself.
+        ///   JIP is where the thread goes if all channels are disabled, UIP is where
+        ///   the channels re-converge (for if/else/break/cont)
         int GetJIP() const { return m_BranchOffsets.JIP; }
         int GetUIP() const { return m_BranchOffsets.UIP; }
+        void SetJIP( int n ) { m_BranchOffsets.JIP = n; }
+        void SetUIP( int n ) { m_BranchOffsets.UIP = n; }
     };
 
 
@@ -832,6 +889,9 @@ namespace GEN
     const char* ConditionalModifierToString( ConditionalModifiers op );
 
     const char* SharedFunctionToString( SharedFunctionIDs eFunc );
+
+    /// Name of a dataport message, from bits 17:14 of its descriptor.  Returns null if it isn't one we know
+    const char* DataPortMessageToString( SharedFunctionIDs eSFID, uint32 nMsgType );
     
     size_t GetTypeSize( DataTypes eTypes );
 
@@ -853,6 +913,7 @@ namespace GEN
     static_assert( sizeof(Instruction) == sizeof(SendInstruction),       "derp" );
     static_assert( sizeof(Instruction) == sizeof(MathInstruction),       "derp" );
     static_assert( sizeof(Instruction) == sizeof(BranchInstruction),     "derp" );
+    static_assert( sizeof(Instruction) <= 32, "derp" );
 
   
     
@@ -896,6 +957,10 @@ namespace GEN
     SendInstruction DWordScatteredWrite_SIMD16( uint32 nBindTableIndex, RegReference nAddress, RegReference writeCommit );
     SendInstruction UntypedRead_SIMD8x4( uint32 nBindTableIndex, GEN::RegReference addr, GEN::RegReference data );
     SendInstruction UntypedRead_SIMD16x4( uint32 nBindTableIndex, GEN::RegReference addr, GEN::RegReference data );
+
+    /// Untyped read of 'nChannels' consecutive dwords at each of 8 or 16 byte offsets.
+    ///   The response is channel by channel, with one GPR per channel for SIMD8, or two for SIMD16
+    SendInstruction UntypedRead( uint32 nBindTableIndex, size_t nSIMD, size_t nChannels, GEN::RegReference addr, GEN::RegReference data );
     SendInstruction UntypedWrite_SIMD16x2( uint32 nBindTableIndex, RegReference nAddress, RegReference writeCommit );
  
     inline SendInstruction DWordScatteredReadSIMD8( uint32 nBindTableIndex, uint32 nAddress, uint32 nData )
@@ -0,0 +1,93 @@
+
+#ifndef _GEN_TIMING_MODEL_H_
+#define _GEN_TIMING_MODEL_H_
+
+#include <vector>
+#include "GENAnalysis.h"
+#include "GENInterpreter.h"
+
+namespace GEN
+{
+    class IPrinter;
+
+    /// Machine shape and costs for 'TimingModel'.  The defaults are a Haswell GT2 (HD 4400), matching what
+    ///   'ThreadTimings' and 'IssueTest' measure.  'Costs' holds the per-opcode issue and latency tables, the send latency,
+    ///   and the instruction cache size
+    struct TimingParameters
+    {
+        TimingParameters();
+
+        CostTable Costs;
+
+        size_t nSubSlices;
+        size_t nEUsPerSubSlice;
+        size_t nThreadsPerEU;
+
+        size_t nDispatchCycles;         ///< Cycles between thread launches.  The dispatcher starts one thread at a time
+        size_t nDataPortBytesPerCycle;  ///< Each subslice's dataport moves this much message and response data per cycle
+        size_t nICacheLineBytes;
+        size_t nICacheMissCycles;       ///< Fetch stall for a line which isn't in the subslice's instruction cache
+        size_t nClockMHz;               ///< For turning cycles into time.  Timestamps count cycles
+    };
+
+    /// What to run, and what each HW thread starts out with
+    struct TimingDispatch
+    {
+        size_t nGroups;
+        size_t nThreadsPerGroup;        ///< All of a group's threads go to the same subslice
+        uint32 nDispatchMask;           ///< 0xff for SIMD8 dispatch, 0xffff for SIMD16
+        const void* pCURBE;             ///< nThreadsPerGroup slices of nCURBERegsPerThread registers, one per thread
+        size_t nCURBERegsPerThread;
+        const Surface* pSurfaces;       ///< Indexed by binding table index
+        size_t nSurfaces;
+        uint64 nStartCycle;             ///< Where the clock starts, so that back-to-back dispatches can share one timeline
+    };
+
+    struct ThreadTiming
+    {
+        size_t nGroup;
+        size_t nThreadInGroup;
+        uint32 nState;          ///< What the thread read from sr0.  Slot in bits 2:0, EU in bits 11:8, subslice in bit 12
+        uint64 nStartCycle;     ///< First instruction issue.  Cycles are on the same clock as the timestamps
+        uint64 nEndCycle;       ///< EOT issue
+    };
+
+    /// A discrete-event model of a dispatch, which runs each thread's instructions on the interpreter as they issue.
+    ///
+    ///  Each EU issues one instruction at a time, picking round-robin among its thread slots for a thread whose operands are ready.
+    ///  An instruction holds the EU for its issue cycles, and its results are ready after its latency.  Sends queue on their
+    ///  subslice's dataport, which moves 'nDataPortBytesPerCycle' of payload and response, and their responses are ready
+    ///  'Costs.Send.nLatency' cycles after that.  Each subslice has an LRU instruction cache.  The dispatcher puts each thread
+    ///  group on the subslice with the most free slots, and each thread on that subslice's least loaded EU.
+    ///
+    ///  Reads of tm0 return the current cycle, and reads of sr0 return the thread's slot, so kernels which record them
+    ///  write what they would on hardware.  Memory effects happen in the order that the model issues the sends
+    ///
+    class TimingModel
+    {
+    public:
+
+        TimingModel() : m_nTotalCycles(0), m_nIssueCycles(0), m_nICacheMisses(0), m_nPortStallCycles(0) {}
+
+        /// Returns false, and prints why to 'pErrors', if the shape can't hold a group, or any thread fails to run
+        bool Run( const Interpreter& rProgram, const TimingParameters& rParams, const TimingDispatch& rDispatch, IPrinter* pErrors );
+
+        /// One per thread, in dispatch order
+        size_t GetThreadCount() const { return m_Threads.size(); }
+        const ThreadTiming& GetThread( size_t i ) const { return m_Threads[i]; }
+
+        uint64 GetTotalCycles() const { return m_nTotalCycles; }      ///< From the dispatch's start to the last thread's retirement
+        uint64 GetIssueCycles() const { return m_nIssueCycles; }        ///< Summed over all EUs
+        uint64 GetICacheMisses() const { return m_nICacheMisses; }
+        uint64 GetDataPortStallCycles() const { return m_nPortStallCycles; } ///< Cycles that sends spent queued behind others
+
+    private:
+        std::vector<ThreadTiming> m_Threads;
+        uint64 m_nTotalCycles;
+        uint64 m_nIssueCycles;
+        uint64 m_nICacheMisses;
+        uint64 m_nPortStallCycles;
+    };
+}
+
+#endif
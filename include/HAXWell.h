@@ -4,6 +4,9 @@
 
 #include "HAXWell_Utils.h"
 
+// Define HAXWELL_CPU to run shaders on the host, through the ISA interpreter, instead of handing them to the GL driver.
+//   Like the rest of the project, this only builds with Visual C++
+
 namespace HAXWell
 {
     typedef void* ShaderHandle;
@@ -45,6 +48,12 @@ namespace HAXWell
     ShaderHandle CreateGLSLShader( const char* pGLSL );
     void ReleaseShader( ShaderHandle hShader );
 
+    /// Keep patched program blobs in files in this directory, which must already exist, so that shaders which earlier runs
+    ///   created only need to be loaded.  Null turns this off, which is the default.  Separately, the GL implementation's 'CreateShader'
+    ///   returns the same handle for args with the same contents, and that handle must be released once per 'CreateShader'.
+    ///   There are no blobs on the CPU, so there this does nothing
+    void SetShaderCacheDirectory( const char* pPath );
+
     // Timer usage:
     //   t = BeginTimer()
     //    .. do stuff....
@@ -65,6 +74,12 @@ namespace HAXWell
     /// Compile GLSL and extract its ISA
     bool RipIsaFromGLSL( Blob& blob, const char* pGLSL );
 
+#ifdef HAXWELL_CPU
+    /// Run dispatches through the cycle model in 'GENTimingModel.h', one at a time, instead of on a pool of host threads.
+    ///   Kernels then read modelled timestamps and thread slots from tm0 and sr0, and timers report modelled time
+    void SetTimingModel( bool bEnable );
+#endif
+
 }
 
 
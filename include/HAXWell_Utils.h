@@ -2,10 +2,16 @@
 #ifndef _HAXWELL_UTILS_H_
 #define _HAXWELL_UTILS_H_
 
+#include <map>
+#include <string>
+#include <vector>
+
 namespace HAXWell
 {
     typedef unsigned int DWORD;
+    typedef unsigned long long QWORD;
     static_assert( sizeof(DWORD) == 4, "derp" );
+    static_assert( sizeof(QWORD) == 8, "derp" );
 
     struct ShaderArgs;
 
@@ -39,11 +45,64 @@ namespace HAXWell
     ///   The hash length is 64-bits (2 dwords)
     void DriverHashFunction( DWORD* pCRCOut, const DWORD* pBlob, DWORD nBlobLengthInDWORDs );
 
+    /// Streaming form of 'DriverHashFunction'.  Copying one snapshots its state, so a prefix which
+    ///   many blobs share only needs to be hashed once
+    class DriverHash
+    {
+    public:
+        DriverHash() { Init(); }
+
+        void Init();
+        void Update( const DWORD* pData, DWORD nDwords );
+        void Finalize( DWORD* pCRCOut ) const;
+
+    private:
+        DWORD m_esi;
+        DWORD m_edx;
+        DWORD m_edi;
+    };
+
+    /// Hash states for the part of a patched blob which 'PatchBlob' fills in the same way every time.
+    ///   That part contains the blob length, so there is one per length.  A cache belongs to one template blob
+    class PatchBlobCache
+    {
+    public:
+        const DriverHash* Find( size_t nBlobLength ) const;
+        void Add( size_t nBlobLength, const DriverHash& rHash ) { m_Prefixes[nBlobLength] = rHash; }
+        void Clear() { m_Prefixes.clear(); }
+
+    private:
+        std::map<size_t,DriverHash> m_Prefixes;
+    };
+
     /// Locate valid GEN Isa inside an Intel OpenGL program blob
     bool FindIsaInBlob( size_t* pIsaOffset, size_t* pIsaLength, const void* pBlob, size_t nBlobLength );
 
-    /// Create a new Intel OpenGL program blob by patching an existing one
-    void PatchBlob( Blob& rOutputBlob, const ShaderArgs& rArgs, const Blob& rTemplateBlob, size_t nTemplateIsaStart );
+    struct IsaLocation
+    {
+        size_t nOffset;
+        size_t nLength;
+    };
+
+    /// Locate every GEN program in a blob, in blob order, and return how many there were.
+    ///   A program with several EOT sends is reported once, ending after its last one
+    size_t FindAllIsaInBlob( std::vector<IsaLocation>& rPrograms, const void* pBlob, size_t nBlobLength );
+
+    /// Create a new Intel OpenGL program blob by patching an existing one.
+    ///   If 'pHashCache' is given, signing the blob only hashes what comes after the template's unchanged prefix
+    void PatchBlob( Blob& rOutputBlob, const ShaderArgs& rArgs, const Blob& rTemplateBlob, size_t nTemplateIsaStart,
+                    PatchBlobCache* pHashCache=0 );
+
+    /// Everything that 'PatchBlob' reads from 'rArgs', flattened into bytes.  Args with the same contents make the same blob
+    void GetShaderContents( std::vector<unsigned char>& rContents, const ShaderArgs& rArgs );
+
+    /// 64-bit FNV-1a of a shader's contents and of the template blob's signature, so that a new driver changes every key
+    QWORD GetShaderKey( const std::vector<unsigned char>& rContents, const Blob& rTemplateBlob );
+
+    /// Patched blobs can be kept in files in a directory, which must already exist.  Files are named by their keys, and also
+    ///   hold the contents that their blob was made from.  A file is only read if those match, so a key collision is just a miss
+    bool ReadBlobFile( Blob& rBlob, const std::string& rDirectory, QWORD nKey, const std::vector<unsigned char>& rContents );
+    void WriteBlobFile( const std::string& rDirectory, QWORD nKey, const std::vector<unsigned char>& rContents, const Blob& rBlob );
 
 }
 
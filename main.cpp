@@ -2,6 +2,7 @@
 
 #include "HAXWell.h"
 #include <windows.h>
+#include <string.h>
 #define MACHINE_THREAD_COUNT 140
 #define MACHINE_EU_COUNT 20
 #define SUBSLICE_EU_COUNT 10
@@ -20,12 +21,37 @@ void Raytrace();
 
 
 void AssemblerTest();
+void CompactionTest();
+void BitfieldBenchmark();
+void BranchTest();
+void CodecBenchmark( bool bMachineReadable );
+void ParallelDisassemblyTest();
+void ControlFlowTest();
+void RegisterAllocationTest();
+void SchedulerTest();
+void OptimizerTest();
+void PreprocessorTest();
+void CacheTest();
+void ParallelAssemblyTest();
+void AnalysisTest();
+void DependencyControlTest();
+void SendCoalescingTest();
+void InterpreterTest();
+void TimingModelTest();
+void IsaScanTest();
+void BlobHashTest();
+void BlobCacheTest();
+int AnalyzeKernels( int argc, char* argv[] );
 void BlockCompress();
 
 void BlockMinMax();
 
 int main( int argc, char* argv[] )
 {
+    // HAXWell analyze [options] kernel...  doesn't need the GPU
+    if( argc > 1 && strcmp( argv[1], "analyze" ) == 0 )
+        return AnalyzeKernels( argc-2, argv+2 );
+
     HAXWell::Init(true);
 
     
@@ -66,6 +92,26 @@ int main( int argc, char* argv[] )
     //BlockMinMax();
     
    // AssemblerTest();
+   // CompactionTest();
+   // BitfieldBenchmark();
+   // BranchTest();
+   // CodecBenchmark(false);
+   // ParallelDisassemblyTest();
+   // ControlFlowTest();
+   // RegisterAllocationTest();
+   // SchedulerTest();
+   // OptimizerTest();
+   // PreprocessorTest();
+   // CacheTest();
+   // ParallelAssemblyTest();
+   // AnalysisTest();
+   // DependencyControlTest();
+   // SendCoalescingTest();
+   // InterpreterTest();
+   // TimingModelTest();
+   // IsaScanTest();
+   // BlobHashTest();
+   // BlobCacheTest();
 
     return 0;
 }
\ No newline at end of file
@@ -532,6 +532,7 @@ void Raytrace()
 
     Printer pr;
     GEN::Assembler::Program program;
+    program.SetCacheDirectory("raytracer");
     if( !program.Assemble( &encoder, RAYTRACE_HSW.c_str(), &pr ) )
         return;
 
@@ -0,0 +1,525 @@
+
+#include "GENAnalysis.h"
+#include "GENAssembler.h"
+#include "GENDisassembler.h" // for 'IPrinter'
+#include "GENCoder.h"
+#include "GENAssembler_Parser.h" // for 'GetOperandRegion'
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+namespace GEN
+{
+    namespace _INTERNAL
+    {
+        enum
+        {
+            RESOURCE_BITS = 128 + 8,    ///< GPRs, then the 'OtherResources' bits
+        };
+
+        static bool IsResourceSet( const Resources& r, size_t nBit )
+        {
+            if( nBit < 128 )
+                return (r.GPRs[nBit/32] & (1u<<(nBit%32))) != 0;
+            return (r.nOther & (1u<<(nBit-128))) != 0;
+        }
+
+        static size_t CountGPRs( const Resources& r )
+        {
+            size_t n = 0;
+            for( size_t i=0; i<4; i++ )
+                for( uint32 bits = r.GPRs[i]; bits; bits &= bits-1 )
+                    n++;
+            return n;
+        }
+
+        static bool OverlapsGPRs( const Resources& a, const Resources& b )
+        {
+            return ((a.GPRs[0]&b.GPRs[0]) | (a.GPRs[1]&b.GPRs[1]) | (a.GPRs[2]&b.GPRs[2]) | (a.GPRs[3]&b.GPRs[3])) != 0;
+        }
+
+        /// GPRs an instruction reads, writes, and completely overwrites.  Indirect operands are left out
+        struct GPRUsage
+        {
+            Resources Uses;
+            Resources Defs;
+            Resources Kills;
+        };
+
+        static void GetGPRUsage( const Instruction& rInst, GPRUsage* pUsage )
+        {
+            pUsage->Uses.Clear();
+            pUsage->Defs.Clear();
+            pUsage->Kills.Clear();
+            for( size_t nOperand=0; nOperand<4; nOperand++ )
+            {
+                bool bIndirect;
+                size_t nFirst, nEnd;
+                if( !GetGPRFootprint( rInst, nOperand, &bIndirect, &nFirst, &nEnd ) || bIndirect )
+                    continue;
+
+                if( nOperand != 0 )
+                {
+                    pUsage->Uses.AddGPRs( nFirst/32, (nEnd+31)/32 );
+                    continue;
+                }
+
+                pUsage->Defs.AddGPRs( nFirst/32, (nEnd+31)/32 );
+                if( IsWholeRegWrite( rInst, nFirst, nEnd ) )
+                    pUsage->Kills.AddGPRs( nFirst/32, nEnd/32 );
+            }
+        }
+
+        static const char* GetMessageName( const SendInstruction& rSend )
+        {
+            if( rSend.IsEOT() )
+                return "EOT";
+            if( !rSend.IsDescriptorInRegister() )
+            {
+                const char* pName = DataPortMessageToString( rSend.GetRecipient(), (rSend.GetDescriptorIMM()>>14)&0xf );
+                if( pName )
+                    return pName;
+            }
+            return SharedFunctionToString( rSend.GetRecipient() );
+        }
+
+        static uint32 GetFlagBit( const FlagReference& rFlag )
+        {
+            return 1<<(2*rFlag.GetReg() + rFlag.GetSubReg());
+        }
+
+        static void AddOperand( Resources& rResources, const Instruction& rInst, size_t nOperand )
+        {
+            RegisterRegion region;
+            DataTypes eType;
+            size_t nMsgRegs;
+            if( !Assembler::_INTERNAL::GetOperandRegion( rInst, nOperand, &region, &eType, &nMsgRegs ) )
+                return;
+
+            RegReference base = region.GetBaseRegister();
+            if( !base.IsDirect() )
+            {
+                // indexed.  Could be anything
+                rResources.AddGPRs(0,128);
+                rResources.nOther |= RESOURCE_ADDRESS;
+                return;
+            }
+
+            switch( base.GetRegType() )
+            {
+            case REG_NULL:
+                break;
+            case REG_GPR:
+                {
+                    bool bIndirect;
+                    size_t nFirst, nEnd;
+                    if( GetGPRFootprint( rInst, nOperand, &bIndirect, &nFirst, &nEnd ) )
+                        rResources.AddGPRs( nFirst/32, (nEnd+31)/32 );
+                }
+                break;
+            case REG_ADDRESS:  rResources.nOther |= RESOURCE_ADDRESS; break;
+            case REG_ACCUM0:
+            case REG_ACCUM1:   rResources.nOther |= RESOURCE_ACCUM;   break;
+            case REG_FLAG0:    rResources.nOther |= 0x3;              break;
+            case REG_FLAG1:    rResources.nOther |= 0xc;              break;
+            default:           rResources.nOther |= RESOURCE_ARF;     break;
+            }
+        }
+    }
+
+    void GetResources( const Instruction& rInst, Resources* pReads, Resources* pWrites )
+    {
+        using namespace _INTERNAL;
+        pReads->Clear();
+        pWrites->Clear();
+        for( size_t i=1; i<4; i++ )
+            AddOperand( *pReads, rInst, i );
+        AddOperand( *pWrites, rInst, 0 );
+
+        if( rInst.GetPredicate().GetMode() != PM_NONE )
+            pReads->nOther |= GetFlagBit( rInst.GetFlagReference() );
+
+        switch( rInst.GetClass() )
+        {
+        case IC_UNARY:
+        case IC_BINARY:
+        case IC_TERNARY:
+            if( static_cast<const UnaryInstruction&>(rInst).GetConditionModifier() != CM_NONE )
+                pWrites->nOther |= GetFlagBit( rInst.GetFlagReference() );
+            break;
+        case IC_SEND:
+            pReads->nOther  |= RESOURCE_MEMORY;
+            pWrites->nOther |= RESOURCE_MEMORY;
+            if( static_cast<const SendInstruction&>(rInst).IsDescriptorInRegister() )
+                pReads->nOther |= RESOURCE_ADDRESS;
+            break;
+        default:
+            break;
+        }
+
+        if( Assembler::_INTERNAL::UsesImplicitAccumulator( rInst.GetOperation() ) )
+        {
+            pReads->nOther  |= RESOURCE_ACCUM;
+            pWrites->nOther |= RESOURCE_ACCUM;
+        }
+    }
+
+    bool GetGPRFootprint( const Instruction& rInst, size_t nOperand, bool* pIndirect, size_t* pFirstByte, size_t* pEndByte )
+    {
+        RegisterRegion region;
+        DataTypes eType;
+        size_t nMsgRegs;
+        if( !Assembler::_INTERNAL::GetOperandRegion( rInst, nOperand, &region, &eType, &nMsgRegs ) )
+            return false;
+
+        RegReference base = region.GetBaseRegister();
+        if( base.GetRegType() != REG_GPR )
+            return false;
+
+        *pIndirect = !base.IsDirect();
+        if( *pIndirect )
+            return true;
+
+        const DirectRegReference& rDirect = static_cast<const DirectRegReference&>(base);
+        size_t nFirst = 32*rDirect.GetRegNumber() + rDirect.GetSubRegOffset();
+        size_t nExec  = rInst.GetExecSize();
+        size_t nType  = GetTypeSize(eType);
+        size_t nBytes;
+        if( nMsgRegs )
+        {
+            nFirst = 32*rDirect.GetRegNumber();
+            nBytes = 32*nMsgRegs;
+        }
+        else if( nOperand == 0 )
+        {
+            size_t nHStride = region.GetHStride() ? region.GetHStride() : 1;
+            nBytes = ((nExec-1)*nHStride + 1)*nType;
+
+            // 'idiv_both' writes the remainder into the registers after the quotient
+            if( rInst.GetClass() == IC_MATH &&
+                static_cast<const MathInstruction&>(rInst).GetFunction() == MATH_IDIV_BOTH )
+                nBytes *= 2;
+        }
+        else
+        {
+            size_t nWidth = region.GetWidth() ? region.GetWidth() : 1;
+            size_t nRows  = (nExec > nWidth) ? nExec/nWidth : 1;
+            nBytes = ((nRows-1)*region.GetVStride() + (nWidth-1)*region.GetHStride())*nType + nType;
+        }
+
+        *pFirstByte = nFirst;
+        *pEndByte   = nFirst + nBytes;
+        return nBytes != 0;
+    }
+
+    bool IsWholeRegWrite( const Instruction& rInst, size_t nFirstByte, size_t nEndByte )
+    {
+        if( rInst.GetPredicate().GetMode() != PM_NONE || (nFirstByte%32) != 0 || (nEndByte%32) != 0 )
+            return false;
+        if( rInst.GetClass() == IC_SEND )
+            return true;
+
+        // strided writes leave gaps
+        DestOperand dst = static_cast<const UnaryInstruction&>(rInst).GetDest();
+        return dst.GetRegRegion().GetHStride() <= 1;
+    }
+
+    CostTable::CostTable()
+    {
+        InstructionCost alu  = { 1, 8 };
+        InstructionCost mul  = { 2, 8 };
+        InstructionCost math = { 4, 22 };
+        InstructionCost slow = { 8, 22 };
+        InstructionCost div  = { 16, 22 };
+        InstructionCost send = { 1, 200 };
+
+        for( size_t i=0; i<OP_COUNT; i++ )
+            Ops[i] = alu;
+        Ops[OP_MUL]  = mul;
+        Ops[OP_MAC]  = mul;
+        Ops[OP_MACH] = mul;
+
+        for( size_t i=0; i<MATH_INVALID; i++ )
+            Math[i] = math;
+        Math[MATH_FDIV] = slow;
+        Math[MATH_POW]  = slow;
+        Math[MATH_IDIV_BOTH]      = div;
+        Math[MATH_IDIV_QUOTIENT]  = div;
+        Math[MATH_IDIV_REMAINDER] = div;
+
+        Send = send;
+        nICacheBytes = 32*1024;
+    }
+
+    InstructionCost CostTable::GetCost( const Instruction& rInst ) const
+    {
+        InstructionCost cost;
+        switch( rInst.GetClass() )
+        {
+        case IC_SEND:
+            return Send; // the message is sent once, however wide it is
+
+        case IC_MATH:
+            {
+                MathFunctionIDs eFunction = static_cast<const MathInstruction&>(rInst).GetFunction();
+                cost = (eFunction < MATH_INVALID) ? Math[eFunction] : Ops[OP_MATH];
+            }
+            break;
+
+        default:
+            cost = (rInst.GetOperation() < OP_COUNT) ? Ops[rInst.GetOperation()] : Ops[OP_NOP];
+            break;
+        }
+
+        if( rInst.GetExecSize() > 8 )
+            cost.nIssue *= 2;
+
+        switch( rInst.GetClass() )
+        {
+        case IC_UNARY:
+        case IC_BINARY:
+        case IC_TERNARY:
+        case IC_MATH:
+            if( static_cast<const UnaryInstruction&>(rInst).GetDest().GetDataType() == DT_F64 )
+                cost.nIssue *= 2;
+            break;
+        default:
+            break;
+        }
+        return cost;
+    }
+
+    bool KernelAnalysis::Analyze( Decoder* pDecoder, const Assembler::Program& rProgram, const CostTable& rCosts )
+    {
+        return Analyze( pDecoder, rProgram.GetIsa(), rProgram.GetIsaLengthInBytes(), rCosts );
+    }
+
+    bool KernelAnalysis::Analyze( Decoder* pDecoder, const void* pIsaBytes, size_t nIsaBytes, const CostTable& rCosts )
+    {
+        m_BlockCosts.clear();
+        m_SendLatencies.clear();
+        m_MessageCounts.clear();
+        m_nTotalCycles     = 0;
+        m_nPeakLiveGPRs    = 0;
+        m_nPeakInstruction = 0;
+        m_nIsaBytes        = nIsaBytes;
+        m_nICacheBytes     = rCosts.nICacheBytes;
+
+        if( !m_CFG.Build( pDecoder, pIsaBytes, nIsaBytes ) )
+            return false;
+
+        CountMessages();
+        ComputeBlockCosts( rCosts );
+        ComputeRegisterPressure();
+        return true;
+    }
+
+    void KernelAnalysis::CountMessages()
+    {
+        for( size_t i=0; i<m_CFG.GetInstructionCount(); i++ )
+        {
+            const Instruction& rInst = m_CFG.GetInstruction(i);
+            if( rInst.GetClass() != IC_SEND )
+                continue;
+
+            const char* pName = _INTERNAL::GetMessageName( static_cast<const SendInstruction&>(rInst) );
+            size_t m=0;
+            while( m < m_MessageCounts.size() && strcmp( m_MessageCounts[m].pName, pName ) != 0 )
+                m++;
+            if( m == m_MessageCounts.size() )
+            {
+                MessageCount count = { pName, 0 };
+                m_MessageCounts.push_back(count);
+            }
+            m_MessageCounts[m].nCount++;
+        }
+    }
+
+    void KernelAnalysis::ComputeBlockCosts( const CostTable& rCosts )
+    {
+        // In-order issue.  Each instruction waits for everything it reads, then holds the pipe for its issue time.
+        //  Sends are in order with each other, but that doesn't cost anything here
+        std::vector<size_t> ReadyCycles( _INTERNAL::RESOURCE_BITS );
+        std::vector<Resources> SendWrites;
+        std::vector<size_t> SendReadyCycles;
+        std::vector<size_t> OpenSends;
+        for( size_t b=0; b<m_CFG.GetBlockCount(); b++ )
+        {
+            const BasicBlock& rBlock = m_CFG.GetBlock(b);
+            BlockCost cost = { 0, 0 };
+            std::fill( ReadyCycles.begin(), ReadyCycles.end(), 0 );
+            OpenSends.clear();
+
+            size_t nCycle = 0;
+            for( size_t i=rBlock.nFirstInstruction; i<rBlock.nFirstInstruction+rBlock.nInstructionCount; i++ )
+            {
+                const Instruction& rInst = m_CFG.GetInstruction(i);
+                Resources reads, writes;
+                GetResources( rInst, &reads, &writes );
+                reads.nOther  &= ~RESOURCE_MEMORY;
+                writes.nOther &= ~RESOURCE_MEMORY;
+
+                size_t nStart = nCycle;
+                for( size_t r=0; r<_INTERNAL::RESOURCE_BITS; r++ )
+                    if( _INTERNAL::IsResourceSet( reads, r ) )
+                        nStart = std::max( nStart, ReadyCycles[r] );
+
+                for( size_t s=0; s<OpenSends.size(); )
+                {
+                    if( !_INTERNAL::OverlapsGPRs( SendWrites[OpenSends[s]], reads ) )
+                    {
+                        s++;
+                        continue;
+                    }
+                    SendLatency& rSend = m_SendLatencies[ OpenSends[s] ];
+                    rSend.nFirstUse      = i;
+                    rSend.nDistance      = i - rSend.nInstruction - 1;
+                    rSend.nExposedCycles = (SendReadyCycles[OpenSends[s]] > nCycle) ? SendReadyCycles[OpenSends[s]] - nCycle : 0;
+                    OpenSends.erase( OpenSends.begin() + s );
+                }
+
+                InstructionCost instCost = rCosts.GetCost( rInst );
+                for( size_t r=0; r<_INTERNAL::RESOURCE_BITS; r++ )
+                    if( _INTERNAL::IsResourceSet( writes, r ) )
+                        ReadyCycles[r] = std::max( ReadyCycles[r], nStart + instCost.nLatency );
+
+                if( rInst.GetClass() == IC_SEND && _INTERNAL::CountGPRs(writes) )
+                {
+                    SendLatency send = { i, (size_t)-1, 0, 0 };
+                    OpenSends.push_back( m_SendLatencies.size() );
+                    m_SendLatencies.push_back( send );
+                    SendWrites.resize( m_SendLatencies.size() );
+                    SendReadyCycles.resize( m_SendLatencies.size() );
+                    SendWrites.back()      = writes;
+                    SendReadyCycles.back() = nStart + instCost.nLatency;
+                }
+
+                cost.nStallCycles += nStart - nCycle;
+                cost.nIssueCycles += instCost.nIssue;
+                nCycle = nStart + instCost.nIssue;
+            }
+
+            m_BlockCosts.push_back( cost );
+            m_nTotalCycles += cost.nIssueCycles + cost.nStallCycles;
+        }
+    }
+
+    void KernelAnalysis::ComputeRegisterPressure()
+    {
+        size_t nInstructions = m_CFG.GetInstructionCount();
+        size_t nBlocks = m_CFG.GetBlockCount();
+        std::vector<_INTERNAL::GPRUsage> Usage( nInstructions );
+        for( size_t i=0; i<nInstructions; i++ )
+            _INTERNAL::GetGPRUsage( m_CFG.GetInstruction(i), &Usage[i] );
+
+        Resources empty;
+        empty.Clear();
+        std::vector<Resources> LiveIn( nBlocks, empty );
+        std::vector<Resources> LiveOut( nBlocks, empty );
+
+        // iterate to a fixed point.  Going backwards through the blocks gets there quickly for code without loops
+        bool bChanged = true;
+        while( bChanged )
+        {
+            bChanged = false;
+            for( size_t b=nBlocks; b-- > 0; )
+            {
+                const BasicBlock& rBlock = m_CFG.GetBlock(b);
+                Resources live = empty;
+                for( size_t e=rBlock.nFirstEdge; e<rBlock.nFirstEdge+rBlock.nEdgeCount; e++ )
+                {
+                    const Resources& rSucc = LiveIn[ m_CFG.GetEdge(e).nToBlock ];
+                    for( size_t w=0; w<4; w++ )
+                        live.GPRs[w] |= rSucc.GPRs[w];
+                }
+                LiveOut[b] = live;
+
+                for( size_t i=rBlock.nFirstInstruction+rBlock.nInstructionCount; i-- > rBlock.nFirstInstruction; )
+                    for( size_t w=0; w<4; w++ )
+                        live.GPRs[w] = (live.GPRs[w] & ~Usage[i].Kills.GPRs[w]) | Usage[i].Uses.GPRs[w];
+
+                if( memcmp( live.GPRs, LiveIn[b].GPRs, sizeof(live.GPRs) ) != 0 )
+                {
+                    LiveIn[b] = live;
+                    bChanged = true;
+                }
+            }
+        }
+
+        // registers which are written but never read still have to be somewhere, so count them where they're written
+        for( size_t b=0; b<nBlocks; b++ )
+        {
+            const BasicBlock& rBlock = m_CFG.GetBlock(b);
+            Resources live = LiveOut[b];
+            for( size_t i=rBlock.nFirstInstruction+rBlock.nInstructionCount; i-- > rBlock.nFirstInstruction; )
+            {
+                Resources busy = live;
+                for( size_t w=0; w<4; w++ )
+                {
+                    busy.GPRs[w] |= Usage[i].Defs.GPRs[w];
+                    live.GPRs[w] = (live.GPRs[w] & ~Usage[i].Kills.GPRs[w]) | Usage[i].Uses.GPRs[w];
+                }
+
+                size_t nBusy = std::max( _INTERNAL::CountGPRs(busy), _INTERNAL::CountGPRs(live) );
+                if( nBusy > m_nPeakLiveGPRs || (nBusy == m_nPeakLiveGPRs && i < m_nPeakInstruction) )
+                {
+                    m_nPeakLiveGPRs    = nBusy;
+                    m_nPeakInstruction = i;
+                }
+            }
+        }
+    }
+
+    void PrintAnalysis( IPrinter& rPrinter, const KernelAnalysis& rAnalysis )
+    {
+        const ControlFlowGraph& rCFG = rAnalysis.GetControlFlow();
+        char line[256];
+
+        size_t nIssue = 0;
+        for( size_t b=0; b<rCFG.GetBlockCount(); b++ )
+            nIssue += rAnalysis.GetBlockCost(b).nIssueCycles;
+
+        sprintf( line, "isa: %u bytes, %u instructions, %u blocks\n",
+                 (unsigned)rAnalysis.GetIsaBytes(), (unsigned)rCFG.GetInstructionCount(), (unsigned)rCFG.GetBlockCount() );
+        rPrinter.Push(line);
+        sprintf( line, "instruction cache: %u of %u bytes%s\n", (unsigned)rAnalysis.GetIsaBytes(), (unsigned)rAnalysis.GetICacheBytes(),
+                 rAnalysis.ExceedsICache() ? ".  Over the cliff!" : "" );
+        rPrinter.Push(line);
+        sprintf( line, "cycles: %u (issue %u, stall %u)\n", (unsigned)rAnalysis.GetTotalCycles(), (unsigned)nIssue,
+                 (unsigned)(rAnalysis.GetTotalCycles() - nIssue) );
+        rPrinter.Push(line);
+        sprintf( line, "peak live GPRs: %u, at [%u]\n", (unsigned)rAnalysis.GetPeakLiveGPRs(), (unsigned)rAnalysis.GetPeakInstruction() );
+        rPrinter.Push(line);
+
+        rPrinter.Push("blocks:\n");
+        for( size_t b=0; b<rCFG.GetBlockCount(); b++ )
+        {
+            const BasicBlock& rBlock = rCFG.GetBlock(b);
+            const BlockCost& rCost = rAnalysis.GetBlockCost(b);
+            sprintf( line, "  %u: [%u-%u] issue %u, stall %u\n", (unsigned)b, (unsigned)rBlock.nFirstInstruction,
+                     (unsigned)(rBlock.nFirstInstruction + rBlock.nInstructionCount - 1), (unsigned)rCost.nIssueCycles, (unsigned)rCost.nStallCycles );
+            rPrinter.Push(line);
+        }
+
+        rPrinter.Push("messages:\n");
+        for( size_t m=0; m<rAnalysis.GetMessageTypeCount(); m++ )
+        {
+            const MessageCount& rCount = rAnalysis.GetMessageType(m);
+            sprintf( line, "  %s: %u\n", rCount.pName, (unsigned)rCount.nCount );
+            rPrinter.Push(line);
+        }
+
+        rPrinter.Push("send latency:\n");
+        for( size_t s=0; s<rAnalysis.GetSendLatencyCount(); s++ )
+        {
+            const SendLatency& rSend = rAnalysis.GetSendLatency(s);
+            if( rSend.nFirstUse == (size_t)-1 )
+                sprintf( line, "  [%u] not read in its block\n", (unsigned)rSend.nInstruction );
+            else
+                sprintf( line, "  [%u] first use [%u], distance %u, exposed %u cycles\n", (unsigned)rSend.nInstruction,
+                         (unsigned)rSend.nFirstUse, (unsigned)rSend.nDistance, (unsigned)rSend.nExposedCycles );
+            rPrinter.Push(line);
+        }
+    }
+}
@@ -1,13 +1,40 @@
 
 #include "GENAssembler.h"
 #include "GENAssembler_Parser.h"
+#include "GENCacheFile.h"
 #include "GENCoder.h"
+#include "GENDisassembler.h" // for 'IPrinter'
+
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <atomic>
 
 namespace GEN{
 namespace Assembler{
-    
+
+    /// Header at the start of each cache file.  The ISA and then the CURBE follow it
+    struct CacheHeader
+    {
+        uint32 nMagic;
+        uint32 nVersion;
+        uint64 nKey;
+        uint32 nThreadsPerGroup;
+        uint32 nIsaLengthInBytes;
+        uint32 nCURBECount;
+        uint32 nReserved;
+    };
+    static_assert( sizeof(CacheHeader) == 32, "derp" );
+
+    static const uint32 CACHE_MAGIC   = 0x43575848; // 'HXWC'
+    static const uint32 CACHE_VERSION = 1;          // bump this whenever 'CacheHeader' or the file layout changes
+
+    /// Goes into every cache key, so that a rebuilt assembler never reads programs which an older one wrote.
+    ///   This is when this file was compiled, so a build that only recompiles one of the passes should clear the cache
+    static const char BUILD_STAMP[] = __DATE__ " " __TIME__;
+
     Program::Program()
-        : m_nThreadsPerGroup(0), m_nIsaLengthInBytes(0), m_nCURBECount(0), m_pIsa(0), m_pCURBE(0)
+        : m_bScheduling(false), m_bOptimization(false), m_pOptimizationReport(0), m_bSendCoalescing(false), m_bDependencyControl(false), m_pIncludeHandler(0), m_bFromCache(false), m_nThreadsPerGroup(0), m_nIsaLengthInBytes(0), m_nCURBECount(0), m_pIsa(0), m_pCURBE(0)
     {
     }
 
@@ -26,6 +53,98 @@ namespace Assembler{
         m_nCURBECount=0;
         m_pIsa=0;
         m_pCURBE=0;
+        m_CacheFile.clear();
+        m_bFromCache=false;
+    }
+
+    uint64 Program::GetCacheKey( const Encoder* pEncoder, const std::string& rText ) const
+    {
+        // which passes run, and how
+        uint32 pOptions[8] = {
+            CACHE_VERSION,
+            pEncoder->IsCompactionEnabled(),
+            m_bOptimization,
+            m_bSendCoalescing,
+            m_bDependencyControl,
+            m_bScheduling,
+            m_bScheduling ? (uint32)m_Latencies.nALU : 0,
+            m_bScheduling ? (uint32)m_Latencies.nMath : 0,
+        };
+        uint32 nSendLatency = m_bScheduling ? (uint32)m_Latencies.nSend : 0;
+
+        uint64 nHash = GEN::_INTERNAL::FNV_OFFSET_BASIS;
+        nHash = GEN::_INTERNAL::HashBytes( nHash, BUILD_STAMP, sizeof(BUILD_STAMP) );
+        nHash = GEN::_INTERNAL::HashBytes( nHash, pOptions, sizeof(pOptions) );
+        nHash = GEN::_INTERNAL::HashBytes( nHash, &nSendLatency, sizeof(nSendLatency) );
+        return GEN::_INTERNAL::HashBytes( nHash, rText.data(), rText.length() );
+    }
+
+    bool Program::ReadCache( uint64 nKey )
+    {
+        FILE* fp = fopen( m_CacheFile.c_str(), "rb" );
+        if( !fp )
+            return false;
+
+        CacheHeader header;
+        bool bOK = fread( &header, sizeof(header), 1, fp ) == 1 &&
+                   header.nMagic == CACHE_MAGIC &&
+                   header.nVersion == CACHE_VERSION &&
+                   header.nKey == nKey &&
+                   GEN::_INTERNAL::IsFileLength( fp, sizeof(header) + (uint64)header.nIsaLengthInBytes + 32*(uint64)header.nCURBECount );
+        if( bOK )
+        {
+            m_pIsa   = malloc( header.nIsaLengthInBytes );
+            m_pCURBE = malloc( 32*(size_t)header.nCURBECount );
+            bOK = m_pIsa && m_pCURBE &&
+                  fread( m_pIsa, 1, header.nIsaLengthInBytes, fp ) == header.nIsaLengthInBytes &&
+                  fread( m_pCURBE, 32, header.nCURBECount, fp ) == header.nCURBECount;
+        }
+        fclose(fp);
+
+        if( !bOK )
+        {
+            // stale, truncated, or damaged.  It'll be overwritten once the text is assembled
+            free(m_pIsa);
+            free(m_pCURBE);
+            m_pIsa=0;
+            m_pCURBE=0;
+            return false;
+        }
+
+        m_nThreadsPerGroup  = header.nThreadsPerGroup;
+        m_nIsaLengthInBytes = header.nIsaLengthInBytes;
+        m_nCURBECount       = header.nCURBECount;
+        m_bFromCache        = true;
+        return true;
+    }
+
+    void Program::WriteCache( uint64 nKey ) const
+    {
+        CacheHeader header;
+        header.nMagic            = CACHE_MAGIC;
+        header.nVersion          = CACHE_VERSION;
+        header.nKey              = nKey;
+        header.nThreadsPerGroup  = (uint32) m_nThreadsPerGroup;
+        header.nIsaLengthInBytes = (uint32) m_nIsaLengthInBytes;
+        header.nCURBECount       = (uint32) m_nCURBECount;
+        header.nReserved         = 0;
+
+        const void* ppPieces[3] = { &header, m_pIsa, m_pCURBE };
+        size_t pLengths[3]      = { sizeof(header), m_nIsaLengthInBytes, 32*m_nCURBECount };
+        GEN::_INTERNAL::WriteFileAtomically( m_CacheFile, ppPieces, pLengths, 3 );
+    }
+
+    void Program::Define( const char* pName, const char* pValue )
+    {
+        for( size_t i=0; i<m_Definitions.size(); i++ )
+        {
+            if( m_Definitions[i].first == pName )
+            {
+                m_Definitions[i].second = pValue;
+                return;
+            }
+        }
+        m_Definitions.push_back( std::make_pair( std::string(pName), std::string(pValue) ) );
     }
 
     bool Program::Assemble( Encoder* pEncoder, const char* pText, IPrinter* pErrorStream )
@@ -33,7 +152,38 @@ namespace Assembler{
         Clear();
 
         GEN::Assembler::_INTERNAL::Parser parser;
-        if( !parser.Parse( pText, pErrorStream ) )
+        if( m_bScheduling )
+            parser.SetLatencies( &m_Latencies );
+        if( m_bOptimization )
+            parser.SetOptimization( true, m_pOptimizationReport );
+        if( m_bSendCoalescing )
+            parser.SetSendCoalescing( true, m_pOptimizationReport );
+        parser.SetDependencyControl( m_bDependencyControl );
+        parser.SetIncludeHandler( m_pIncludeHandler );
+        for( size_t i=0; i<m_Definitions.size(); i++ )
+            parser.Define( m_Definitions[i].first.c_str(), m_Definitions[i].second.c_str() );
+
+        std::string text;
+        if( !parser.Preprocess( pText, text, pErrorStream ) )
+            return false;
+
+        uint64 nKey = 0;
+        if( pEncoder && !m_CacheDirectory.empty() )
+        {
+            nKey = GetCacheKey( pEncoder, text );
+
+            char name[32];
+            sprintf( name, "%08x%08x.isa", (uint32)(nKey>>32), (uint32)nKey );
+            m_CacheFile = m_CacheDirectory;
+            if( m_CacheFile[m_CacheFile.length()-1] != '/' && m_CacheFile[m_CacheFile.length()-1] != '\\' )
+                m_CacheFile.push_back('/');
+            m_CacheFile.append(name);
+
+            if( ReadCache( nKey ) )
+                return true;
+        }
+
+        if( !parser.ParsePreprocessed( text.c_str(), pErrorStream ) )
             return false;
 
         if( !pEncoder )
@@ -55,8 +205,63 @@ namespace Assembler{
         memcpy( m_pCURBE, parser.GetCURBE().data(), m_nCURBECount*32 ); 
 
         m_nThreadsPerGroup = parser.GetThreadsPerGroup();
+
+        if( !m_CacheFile.empty() )
+            WriteCache( nKey );
         return true;
     }
 
+    namespace _INTERNAL
+    {
+        class BufferedPrinter : public IPrinter
+        {
+        public:
+            virtual void Push( const char* p ) { m_Text.append(p); }
+            std::string m_Text;
+        };
+    }
+
+    bool AssembleParallel( Encoder* pEncoder, Program* pPrograms, const char* const* ppTexts, size_t nPrograms, IPrinter* pErrorStream, size_t nThreads )
+    {
+        if( !nThreads )
+            nThreads = std::thread::hardware_concurrency();
+        if( !nThreads )
+            nThreads = 1;
+        if( nThreads > nPrograms )
+            nThreads = nPrograms;
+
+        // Programs are handed out one at a time, so a thread which draws a big one doesn't hold up the rest
+        std::vector<_INTERNAL::BufferedPrinter> errors(nPrograms);
+        std::vector<uint8> results(nPrograms,0);   // not vector<bool>, which threads can't write to independently
+        std::atomic<size_t> nNext(0);
+        auto worker = [&]()
+        {
+            for( size_t i = nNext++; i < nPrograms; i = nNext++ )
+                results[i] = pPrograms[i].Assemble( pEncoder, ppTexts[i], &errors[i] );
+        };
+
+        std::vector<std::thread> threads;
+        for( size_t t=1; t<nThreads; t++ )
+            threads.push_back( std::thread(worker) );
+        worker();
+        for( size_t t=0; t<threads.size(); t++ )
+            threads[t].join();
+
+        bool bResult = true;
+        for( size_t i=0; i<nPrograms; i++ )
+        {
+            if( results[i] )
+                continue;
+            bResult = false;
+            if( pErrorStream )
+            {
+                char header[64];
+                sprintf( header, "Program %u:\n", (uint32)i );
+                pErrorStream->Push( header );
+                pErrorStream->Push( errors[i].m_Text.c_str() );
+            }
+        }
+        return bResult;
+    }
     
 }}
\ No newline at end of file
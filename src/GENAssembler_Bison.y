@@ -38,6 +38,13 @@
 %token T_KW_JMP
 %token T_KW_JMPIF
 %token T_KW_PRED
+%token T_KW_IF
+%token T_KW_ELSE
+%token T_KW_ENDIF
+%token T_KW_DO
+%token T_KW_WHILE
+%token T_KW_BREAK
+%token T_KW_CONT
 %token T_KW_IMM_UVEC
 %token T_KW_IMM_IVEC
 %token T_KW_IMM_FVEC
@@ -123,6 +130,7 @@ instruction:
 |   send_instruction
 |   jmp_instruction
 |   predicate_block
+|   branch_instruction
 ;
 
 label:
@@ -157,6 +165,22 @@ jmp_instruction:
 |   T_KW_JMPIF '(' '!' flag_ref ')' T_IDENTIFIER    { pParser->JmpIf( $6, $4.fields.node, true ); }
 ;
 
+branch_instruction:
+    T_KW_IF '(' T_UINT_LITERAL ')' '(' flag_ref ')'             { pParser->If( $1, $3.fields.Int, $6.fields.node, false ); }
+|   T_KW_IF '(' T_UINT_LITERAL ')' '(' '!' flag_ref ')'         { pParser->If( $1, $3.fields.Int, $7.fields.node, true ); }
+|   T_KW_ELSE                                                   { pParser->Else( $1 ); }
+|   T_KW_ENDIF                                                  { pParser->EndIf( $1 ); }
+|   T_KW_DO                                                     { pParser->Do( $1 ); }
+|   T_KW_WHILE '(' T_UINT_LITERAL ')'                           { pParser->While( $1, $3.fields.Int, 0, false ); }
+|   T_KW_WHILE '(' T_UINT_LITERAL ')' '(' flag_ref ')'          { pParser->While( $1, $3.fields.Int, $6.fields.node, false ); }
+|   T_KW_WHILE '(' T_UINT_LITERAL ')' '(' '!' flag_ref ')'      { pParser->While( $1, $3.fields.Int, $7.fields.node, true ); }
+|   T_KW_BREAK '(' T_UINT_LITERAL ')'                           { pParser->LoopJump( $1, GEN::OP_BREAK, $3.fields.Int, 0, false ); }
+|   T_KW_BREAK '(' T_UINT_LITERAL ')' '(' flag_ref ')'          { pParser->LoopJump( $1, GEN::OP_BREAK, $3.fields.Int, $6.fields.node, false ); }
+|   T_KW_BREAK '(' T_UINT_LITERAL ')' '(' '!' flag_ref ')'      { pParser->LoopJump( $1, GEN::OP_BREAK, $3.fields.Int, $7.fields.node, true ); }
+|   T_KW_CONT '(' T_UINT_LITERAL ')'                            { pParser->LoopJump( $1, GEN::OP_CONT, $3.fields.Int, 0, false ); }
+|   T_KW_CONT '(' T_UINT_LITERAL ')' '(' flag_ref ')'           { pParser->LoopJump( $1, GEN::OP_CONT, $3.fields.Int, $6.fields.node, false ); }
+|   T_KW_CONT '(' T_UINT_LITERAL ')' '(' '!' flag_ref ')'       { pParser->LoopJump( $1, GEN::OP_CONT, $3.fields.Int, $7.fields.node, true ); }
+;
 
 predicate_block:
      predicate_block_header '{' block_instruction_list '}' { pParser->EndPredBlock(); }
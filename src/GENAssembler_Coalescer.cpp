@@ -0,0 +1,432 @@
+#include "GENDisassembler.h" // for 'IPrinter'
+#include "GENAssembler_Parser.h"
+
+#include <stdio.h>
+
+namespace GEN{
+namespace Assembler{
+namespace _INTERNAL{
+
+    //
+    // Send coalescing.
+    //
+    //  Dword scattered reads fetch one dword per address, which makes them far more expensive per byte than
+    //   messages that fetch several.  A forward pass over each region tracks every GPR dword as some unknown
+    //   value plus a constant, through moves and adds.  CURBE registers are known constants, so index tables
+    //   declared with 'curbe' are understood.  That's enough to prove that one load's addresses are exactly
+    //   1, 2 or 3 dwords past another's in every channel.
+    //  Loads from the same surface at base+0, base+1, ... whose responses are in consecutive registers are
+    //   exactly an untyped read of that many channels, so the first one becomes that, and the rest are removed.
+    //   Untyped reads take byte offsets, so the first load's addresses are shifted left by 2 into its response registers,
+    //   which the read overwrites anyway, and sent from there.  The address registers are never touched.
+    //   Dword addresses of 2^30 or more wrap, but those are past the end of anything that can be bound.
+    //
+    //  A load is only pulled up to an earlier one if nothing in between touches the registers it writes,
+    //   and nothing in between is a send other than another load.  Nothing is merged across region boundaries
+    //
+    //  What this finds is the structure-of-arrays pattern, where x, y and z are loaded from base, base+1 and base+2
+    //   into one register block (Nbody's position loads would merge if X0,Y0,Z0 were declared as one 'reg P[6]').
+    //   Addresses which differ by a runtime amount, like BCCompress's row loads, are never merged.
+    //  OWord block reads are deliberately left out.  They need every channel of one load to be consecutive and
+    //   OWord aligned, which the symbolic values can't prove for an unknown base, so it isn't worth finding a
+    //   free register for their header
+    //
+
+    /// An unknown value plus a constant.  Symbol 0 is zero, so known constants have symbol 0
+    struct SymbolicValue
+    {
+        uint32 nSymbol;
+        uint32 nOffset;
+    };
+
+    /// A dword scattered read, as the assembler writes them
+    struct ScatteredLoad
+    {
+        size_t nInstruction;
+        size_t nRegion;
+        uint32 nBind;
+        size_t nSIMD;
+        size_t nAddressReg;
+        size_t nDataReg;
+        SymbolicValue Address[16];
+    };
+
+    static bool GetScatteredLoad( const Instruction& rInst, ScatteredLoad* pLoad )
+    {
+        if( rInst.GetClass() != IC_SEND || rInst.GetPredicate().GetMode() != PM_NONE )
+            return false;
+
+        const SendInstruction& rSend = static_cast<const SendInstruction&>(rInst);
+        if( rSend.IsEOT() || rSend.IsDescriptorInRegister() || rSend.GetRecipient() != SFID_DP_DC0 )
+            return false;
+
+        uint32 nDescriptor = rSend.GetDescriptorIMM();
+        if( ((nDescriptor>>14)&0xf) != 3 )
+            return false;
+
+        switch( (nDescriptor>>8)&7 )
+        {
+        case 2:  pLoad->nSIMD = 8;  break;
+        case 3:  pLoad->nSIMD = 16; break;
+        default: return false;
+        }
+        if( rSend.GetMessageLengthFromDescriptor() != pLoad->nSIMD/8 ||
+            rSend.GetResponseLengthFromDescriptor() != pLoad->nSIMD/8 )
+            return false;
+
+        RegReference dst = rSend.GetDest().GetRegRegion().GetBaseRegister();
+        RegReference src = rSend.GetSource().GetRegRegion().GetBaseRegister();
+        if( dst.GetRegType() != REG_GPR || !dst.IsDirect() || src.GetRegType() != REG_GPR || !src.IsDirect() )
+            return false;
+
+        const DirectRegReference& rDst = static_cast<const DirectRegReference&>(dst);
+        const DirectRegReference& rSrc = static_cast<const DirectRegReference&>(src);
+        if( rDst.GetSubRegOffset() || rSrc.GetSubRegOffset() )
+            return false;
+
+        pLoad->nBind       = nDescriptor & 0xff;
+        pLoad->nAddressReg = rSrc.GetRegNumber();
+        pLoad->nDataReg    = rDst.GetRegNumber();
+        return true;
+    }
+
+    static bool IsDword( DataTypes eType )
+    {
+        return eType == DT_U32 || eType == DT_S32;
+    }
+
+    /// What the forward pass knows about each GPR dword
+    class SymbolTracker
+    {
+    public:
+        SymbolTracker( const std::vector<uint8>& rCURBE, bool bCURBEIsConstant )
+            : m_rCURBE(rCURBE), m_bCURBEIsConstant(bCURBEIsConstant), m_nNextSymbol(1)
+        {
+        }
+
+        /// Forget everything, except the CURBE contents if nothing ever writes them
+        void Reset()
+        {
+            Forget( 0, SLOT_COUNT );
+            if( !m_bCURBEIsConstant )
+                return;
+            for( size_t i=0; i<m_rCURBE.size()/4 && 8+i<SLOT_COUNT; i++ )
+            {
+                m_Slots[8+i].nSymbol = 0;
+                memcpy( &m_Slots[8+i].nOffset, &m_rCURBE[4*i], 4 );
+            }
+        }
+
+        const SymbolicValue& Get( size_t nSlot ) const { return m_Slots[nSlot]; }
+
+        void Update( const Instruction& rInst )
+        {
+            bool bIndirect;
+            size_t nFirst, nEnd;
+            if( !GetGPRFootprint( rInst, 0, &bIndirect, &nFirst, &nEnd ) )
+                return;
+            if( bIndirect )
+            {
+                Forget( 0, SLOT_COUNT );
+                return;
+            }
+
+            SymbolicValue Result[16];
+            if( !Evaluate( rInst, Result ) )
+            {
+                Forget( nFirst/4, (nEnd+3)/4 );
+                return;
+            }
+
+            size_t nFirstSlot = nFirst/4;
+            for( size_t i=0; i<rInst.GetExecSize() && nFirstSlot+i<SLOT_COUNT; i++ )
+                m_Slots[nFirstSlot+i] = Result[i];
+        }
+
+    private:
+
+        enum
+        {
+            SLOT_COUNT = 128*8
+        };
+
+        void Forget( size_t nFirst, size_t nEnd )
+        {
+            for( size_t i=nFirst; i<nEnd && i<SLOT_COUNT; i++ )
+            {
+                m_Slots[i].nSymbol = m_nNextSymbol++;
+                m_Slots[i].nOffset = 0;
+            }
+        }
+
+        /// Work out what each channel of a source holds.  Word sources are only understood if they're constants
+        bool ReadSource( const SourceOperand& rSrc, size_t nExec, SymbolicValue* pValues ) const
+        {
+            if( rSrc.GetModifier() != SM_NONE || !rSrc.GetSwizzle().IsIdentity() )
+                return false;
+
+            DataTypes eType = rSrc.GetDataType();
+            if( rSrc.IsImmediate() )
+            {
+                uint32 nValue;
+                if( IsDword(eType) )
+                    memcpy( &nValue, rSrc.GetImmediateBits(), 4 );
+                else if( eType == DT_U16 )
+                    nValue = *(const uint16*)rSrc.GetImmediateBits();
+                else if( eType == DT_S16 )
+                    nValue = (uint32)(int32) *(const int16*)rSrc.GetImmediateBits();
+                else
+                    return false;
+
+                for( size_t i=0; i<nExec; i++ )
+                {
+                    pValues[i].nSymbol = 0;
+                    pValues[i].nOffset = nValue;
+                }
+                return true;
+            }
+
+            if( !IsDword(eType) && eType != DT_U16 && eType != DT_S16 )
+                return false;
+
+            RegisterRegion region = rSrc.GetRegRegion();
+            RegReference base = region.GetBaseRegister();
+            if( base.GetRegType() != REG_GPR || !base.IsDirect() )
+                return false;
+
+            const DirectRegReference& rDirect = static_cast<const DirectRegReference&>(base);
+            size_t nFirstByte = 32*rDirect.GetRegNumber() + rDirect.GetSubRegOffset();
+            size_t nTypeSize  = GetTypeSize(eType);
+            size_t nWidth     = region.GetWidth() ? region.GetWidth() : 1;
+            for( size_t i=0; i<nExec; i++ )
+            {
+                size_t nElement = (i/nWidth)*region.GetVStride() + (i%nWidth)*region.GetHStride();
+                size_t nByte    = nFirstByte + nElement*nTypeSize;
+                if( nByte % nTypeSize || nByte/4 >= SLOT_COUNT )
+                    return false;
+
+                const SymbolicValue& rSlot = m_Slots[nByte/4];
+                if( nTypeSize == 4 )
+                {
+                    pValues[i] = rSlot;
+                    continue;
+                }
+                if( rSlot.nSymbol != 0 )
+                    return false;
+
+                uint32 nWord = (rSlot.nOffset >> (8*(nByte%4))) & 0xffff;
+                pValues[i].nSymbol = 0;
+                pValues[i].nOffset = (eType == DT_S16) ? (uint32)(int32)(int16)nWord : nWord;
+            }
+            return true;
+        }
+
+        /// Moves and adds of dwords into packed destinations are tracked.  Everything else makes new unknowns
+        bool Evaluate( const Instruction& rInst, SymbolicValue* pResult ) const
+        {
+            if( rInst.GetPredicate().GetMode() != PM_NONE )
+                return false;
+
+            size_t nExec = rInst.GetExecSize();
+            const UnaryInstruction& rUnary = static_cast<const UnaryInstruction&>(rInst);
+            bool bMove = rInst.GetClass() == IC_UNARY  && rInst.GetOperation() == OP_MOV;
+            bool bAdd  = rInst.GetClass() == IC_BINARY && rInst.GetOperation() == OP_ADD;
+            if( (!bMove && !bAdd) || nExec > 16 )
+                return false;
+
+            DestOperand dst = rUnary.GetDest();
+            RegisterRegion dstRegion = dst.GetRegRegion();
+            RegReference dstBase = dstRegion.GetBaseRegister();
+            if( !IsDword( dst.GetDataType() ) || (nExec > 1 && dstRegion.GetHStride() != 1) ||
+                static_cast<const DirectRegReference&>(dstBase).GetSubRegOffset() % 4 )
+                return false;
+
+            if( rUnary.GetConditionModifier() != CM_NONE )
+                return false;
+
+            if( !ReadSource( rUnary.GetSource0(), nExec, pResult ) )
+                return false;
+            if( bMove )
+                return true;
+
+            SymbolicValue Src1[16];
+            if( !ReadSource( static_cast<const BinaryInstruction&>(rInst).GetSource1(), nExec, Src1 ) )
+                return false;
+
+            for( size_t i=0; i<nExec; i++ )
+            {
+                if( pResult[i].nSymbol && Src1[i].nSymbol )
+                    return false;
+                pResult[i].nSymbol |= Src1[i].nSymbol;
+                pResult[i].nOffset += Src1[i].nOffset;
+            }
+            return true;
+        }
+
+        const std::vector<uint8>& m_rCURBE;
+        bool m_bCURBEIsConstant;
+        uint32 m_nNextSymbol;
+        SymbolicValue m_Slots[SLOT_COUNT];
+    };
+
+    /// How many dwords past 'rFirst' each of the addresses in 'rNext' is.  0 if they aren't all the same distance
+    static size_t GetDistance( const ScatteredLoad& rFirst, const ScatteredLoad& rNext )
+    {
+        uint32 nDistance = rNext.Address[0].nOffset - rFirst.Address[0].nOffset;
+        for( size_t i=0; i<rFirst.nSIMD; i++ )
+        {
+            if( rNext.Address[i].nSymbol != rFirst.Address[i].nSymbol ||
+                rNext.Address[i].nOffset - rFirst.Address[i].nOffset != nDistance )
+                return 0;
+        }
+        return (nDistance < 4) ? nDistance : 0;
+    }
+
+    static bool OverlapsRegs( const Resources& rResources, size_t nFirst, size_t nCount )
+    {
+        Resources regs;
+        regs.Clear();
+        regs.AddGPRs( nFirst, nFirst+nCount );
+        return regs.Overlaps( rResources );
+    }
+
+    void Parser::CoalesceSends()
+    {
+        size_t nInstructions = m_Instructions.size();
+        const size_t NONE = (size_t)-1;
+
+        std::vector<bool> Boundaries;
+        GetRegionBoundaries( Boundaries );
+
+        // CURBE registers can be trusted everywhere, unless something writes them
+        bool bCURBEIsConstant = true;
+        for( size_t i=0; i<nInstructions; i++ )
+        {
+            bool bIndirect;
+            size_t nFirst, nEnd;
+            if( GetGPRFootprint( m_Instructions[i], 0, &bIndirect, &nFirst, &nEnd ) &&
+                (bIndirect || (nEnd > 32 && nFirst < 32 + m_CURBE.size())) )
+                bCURBEIsConstant = false;
+        }
+
+        // find the loads, and what their addresses are
+        SymbolTracker* pTracker = new SymbolTracker( m_CURBE, bCURBEIsConstant );
+        std::vector<ScatteredLoad> Loads;
+        std::vector<size_t> LoadAt( nInstructions, NONE );
+        size_t nRegion = 0;
+        for( size_t i=0; i<nInstructions; i++ )
+        {
+            if( i == 0 || Boundaries[i] )
+            {
+                pTracker->Reset();
+                nRegion++;
+            }
+
+            ScatteredLoad load;
+            if( GetScatteredLoad( m_Instructions[i], &load ) )
+            {
+                load.nInstruction = i;
+                load.nRegion      = nRegion;
+                for( size_t c=0; c<load.nSIMD; c++ )
+                    load.Address[c] = pTracker->Get( 8*load.nAddressReg + c );
+                LoadAt[i] = Loads.size();
+                Loads.push_back(load);
+            }
+            pTracker->Update( m_Instructions[i] );
+        }
+        delete pTracker;
+
+        // pull later loads up into earlier ones
+        std::vector<bool> Removed( nInstructions, false );
+        std::vector<size_t> Channels( nInstructions, 1 );
+        size_t nRemoved = 0;
+        for( size_t l=0; l<Loads.size(); l++ )
+        {
+            const ScatteredLoad& rFirst = Loads[l];
+            size_t nRegsPerChannel = rFirst.nSIMD/8;
+            if( Removed[rFirst.nInstruction] )
+                continue;
+
+            size_t pMerged[4] = { rFirst.nInstruction, NONE, NONE, NONE };
+            Resources touched;
+            touched.Clear();
+            for( size_t i=rFirst.nInstruction+1; i<nInstructions && !Boundaries[i]; i++ )
+            {
+                const Instruction& rInst = m_Instructions[i];
+                if( LoadAt[i] != NONE && !Removed[i] )
+                {
+                    const ScatteredLoad& rNext = Loads[ LoadAt[i] ];
+                    size_t k = GetDistance( rFirst, rNext );
+                    if( k && rNext.nBind == rFirst.nBind && rNext.nSIMD == rFirst.nSIMD && pMerged[k] == NONE &&
+                        rNext.nDataReg == rFirst.nDataReg + k*nRegsPerChannel &&
+                        !OverlapsRegs( touched, rNext.nDataReg, nRegsPerChannel ) )
+                        pMerged[k] = i;
+                }
+                else if( rInst.GetClass() == IC_SEND )
+                {
+                    break;
+                }
+
+                Resources reads, writes;
+                GetResources( rInst, &reads, &writes );
+                for( size_t w=0; w<4; w++ )
+                    touched.GPRs[w] |= reads.GPRs[w] | writes.GPRs[w];
+            }
+
+            size_t nChannels = 1;
+            while( nChannels < 4 && pMerged[nChannels] != NONE )
+                nChannels++;
+
+            if( nChannels == 1 )
+                continue;
+
+            Channels[rFirst.nInstruction] = nChannels;
+            for( size_t k=1; k<nChannels; k++ )
+                Removed[pMerged[k]] = true;
+            nRemoved += nChannels-1;
+
+            if( m_pCoalescingReport )
+            {
+                char line[128];
+                sprintf( line, "  [%u] %u DwordLoad%u -> UntypedRead%ux%u\n", (unsigned)rFirst.nInstruction, (unsigned)nChannels,
+                         (unsigned)rFirst.nSIMD, (unsigned)rFirst.nSIMD, (unsigned)nChannels );
+                m_pCoalescingReport->Push(line);
+            }
+        }
+
+        if( m_pCoalescingReport )
+        {
+            char line[128];
+            sprintf( line, "sends coalesced: %u -> %u\n", (unsigned)Loads.size(), (unsigned)(Loads.size() - nRemoved) );
+            m_pCoalescingReport->Push(line);
+        }
+        if( !nRemoved )
+            return;
+
+        std::vector<size_t> FirstNew( nInstructions+1 );
+        std::vector<Instruction> New;
+        New.reserve( nInstructions + nRemoved );
+        for( size_t i=0; i<nInstructions; i++ )
+        {
+            FirstNew[i] = New.size();
+            if( Removed[i] )
+                continue;
+            if( Channels[i] == 1 )
+            {
+                New.push_back( m_Instructions[i] );
+                continue;
+            }
+
+            const ScatteredLoad& rLoad = Loads[ LoadAt[i] ];
+            GEN::DirectRegReference addr( REG_GPR, rLoad.nAddressReg );
+            GEN::DirectRegReference data( REG_GPR, rLoad.nDataReg );
+            RegisterRegion dwords( addr, 8, 8, 1 );
+            RegisterRegion bytes( data, 8, 8, 1 );
+            New.push_back( BinaryInstruction( rLoad.nSIMD, OP_SHL, DestOperand( DT_U32, bytes ), SourceOperand( DT_U32, dwords ), SourceOperand( DT_U32, (uint32)2 ) ) );
+            New.push_back( UntypedRead( rLoad.nBind, rLoad.nSIMD, Channels[i], data, data ) );
+        }
+        FirstNew[nInstructions] = New.size();
+        ReplaceInstructions( New, FirstNew );
+    }
+
+}}}
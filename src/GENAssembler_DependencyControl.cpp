@@ -0,0 +1,138 @@
+#include "GENAssembler_Parser.h"
+
+#include <algorithm>
+
+namespace GEN{
+namespace Assembler{
+namespace _INTERNAL{
+
+    //
+    // Dependency control.
+    //
+    //  When several instructions each write part of the same GPR, the hardware makes each one wait for
+    //  the one before it, even though they don't overlap.  If nothing reads the register in between, the first
+    //  write can set NoDDClr, to leave the register marked busy, and the next one can set NoDDChk, to skip the wait.
+    //  The last write in a run only has NoDDChk, so it clears the register for whoever reads it next.
+    //
+    //  The restrictions follow the PRM.  The last write in a run needs a non-zero execution mask, so predicated
+    //  instructions are left out.  64-bit types and dword integer multiplies can't use dependency control, and it's
+    //  unreliable around sends and math, so those end every run.  Runs also end at region boundaries
+    //
+
+    static bool IsDwordInt( DataTypes eType )
+    {
+        return eType == DT_U32 || eType == DT_S32;
+    }
+
+    /// Instructions which may start, continue or end a run
+    static bool IsDependencyControlSafe( const Instruction& rInst )
+    {
+        DataTypes pTypes[4];
+        size_t nTypes = 0;
+        switch( rInst.GetClass() )
+        {
+        case IC_UNARY:
+            {
+                const UnaryInstruction& rUnary = static_cast<const UnaryInstruction&>(rInst);
+                pTypes[nTypes++] = rUnary.GetDest().GetDataType();
+                pTypes[nTypes++] = rUnary.GetSource0().GetDataType();
+            }
+            break;
+        case IC_BINARY:
+            {
+                const BinaryInstruction& rBinary = static_cast<const BinaryInstruction&>(rInst);
+                pTypes[nTypes++] = rBinary.GetDest().GetDataType();
+                pTypes[nTypes++] = rBinary.GetSource0().GetDataType();
+                pTypes[nTypes++] = rBinary.GetSource1().GetDataType();
+            }
+            break;
+        case IC_TERNARY:
+            {
+                const TernaryInstruction& rTernary = static_cast<const TernaryInstruction&>(rInst);
+                pTypes[nTypes++] = rTernary.GetDest().GetDataType();
+                pTypes[nTypes++] = rTernary.GetSource0().GetDataType();
+                pTypes[nTypes++] = rTernary.GetSource1().GetDataType();
+                pTypes[nTypes++] = rTernary.GetSource2().GetDataType();
+            }
+            break;
+        default:
+            return false;
+        }
+
+        if( rInst.GetPredicate().GetMode() != PM_NONE || rInst.GetOperation() == OP_DIM )
+            return false;
+        for( size_t i=0; i<nTypes; i++ )
+            if( pTypes[i] == DT_F64 )
+                return false;
+
+        switch( rInst.GetOperation() )
+        {
+        case OP_MUL:
+        case OP_MAC:
+        case OP_MACH:
+            return !(IsDwordInt(pTypes[1]) && IsDwordInt(pTypes[2]));
+        default:
+            return true;
+        }
+    }
+
+    void Parser::AddDependencyControl()
+    {
+        size_t nInstructions = m_Instructions.size();
+
+        std::vector<bool> Boundaries;
+        GetRegionBoundaries( Boundaries );
+
+        // the latest write to each GPR in the current run, and which of its bytes the run has written
+        const size_t NONE = (size_t)-1;
+        size_t pLastWrite[128];
+        uint32 pBytesWritten[128];
+        std::fill( pLastWrite, pLastWrite+128, NONE );
+
+        for( size_t i=0; i<nInstructions; i++ )
+        {
+            Instruction& rInst = m_Instructions[i];
+            if( Boundaries[i] || !IsDependencyControlSafe(rInst) )
+            {
+                std::fill( pLastWrite, pLastWrite+128, NONE );
+                continue;
+            }
+
+            // a read ends the run on whatever it reads.  Indirect operands could touch anything
+            bool bIndirect = false;
+            size_t nFirst, nEnd;
+            for( size_t nOperand=1; nOperand<4 && !bIndirect; nOperand++ )
+                if( GetGPRFootprint( rInst, nOperand, &bIndirect, &nFirst, &nEnd ) && !bIndirect )
+                    std::fill( pLastWrite + std::min<size_t>(nFirst/32,128), pLastWrite + std::min<size_t>((nEnd+31)/32,128), NONE );
+
+            if( !bIndirect && !GetGPRFootprint( rInst, 0, &bIndirect, &nFirst, &nEnd ) )
+                continue;
+            if( bIndirect )
+            {
+                std::fill( pLastWrite, pLastWrite+128, NONE );
+                continue;
+            }
+            if( nFirst/32 != (nEnd-1)/32 )
+            {
+                std::fill( pLastWrite + std::min<size_t>(nFirst/32,128), pLastWrite + std::min<size_t>((nEnd+31)/32,128), NONE );
+                continue;
+            }
+
+            size_t nReg = nFirst/32;
+            size_t nBytes = nEnd - nFirst;
+            uint32 nMask = (nBytes == 32) ? 0xffffffff : ((1u<<nBytes)-1) << (nFirst%32);
+            if( pLastWrite[nReg] != NONE && !(pBytesWritten[nReg] & nMask) )
+            {
+                m_Instructions[pLastWrite[nReg]].DisableDDClear();
+                rInst.DisableDDCheck();
+                pBytesWritten[nReg] |= nMask;
+            }
+            else
+            {
+                pBytesWritten[nReg] = nMask;
+            }
+            pLastWrite[nReg] = i;
+        }
+    }
+
+}}}
@@ -0,0 +1,862 @@
+
+#include "GENDisassembler.h" // for 'IPrinter'
+#include "GENAssembler_Parser.h"
+#include "GENControlFlow.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+namespace GEN{
+namespace Assembler{
+namespace _INTERNAL{
+
+    //
+    // Peephole and dead-code optimization.
+    //
+    //  This runs after register allocation, so it sees physical registers.  A forward pass over each
+    //   straight-line stretch of code tracks which GPR dwords hold known constants, and which registers
+    //   are plain copies of other ones, and rewrites the instructions which read them.  It also folds
+    //   immediate-only integer ops, and turns multiplies and divides by powers of two into shifts.
+    //  After that, instructions whose results are never read are removed, using the same sort of
+    //   liveness as the register allocator, and the jump and branch offsets are patched to match.
+    //
+    //  Code inside if/else or do/while may run with some channels disabled, so its writes are never
+    //   trusted as constants or copies, and never count as overwriting a whole register
+    //
+
+    enum ChangeTypes
+    {
+        CHANGE_CONSTANT_PROPAGATION,
+        CHANGE_COPY_PROPAGATION,
+        CHANGE_CONSTANT_FOLDING,
+        CHANGE_STRENGTH_REDUCTION,
+        CHANGE_IDENTITY,
+        CHANGE_DEAD_CODE,
+        CHANGE_TYPE_COUNT
+    };
+
+    static const char* CHANGE_NAMES[CHANGE_TYPE_COUNT] = {
+        "constant propagation",
+        "copy propagation",
+        "constant folding",
+        "strength reduction",
+        "identity",
+        "dead code",
+    };
+
+    static const char* GetOpName( const Instruction& rInst )
+    {
+        if( rInst.GetClass() == IC_MATH )
+        {
+            switch( static_cast<const MathInstruction&>(rInst).GetFunction() )
+            {
+            case MATH_IDIV_QUOTIENT:  return "idiv";
+            case MATH_IDIV_REMAINDER: return "imod";
+            default:                  break;
+            }
+        }
+        return OperationToString( rInst.GetOperation() );
+    }
+
+    /// Counts what the optimizer did, and lists each change if there's somewhere to print it.
+    ///   Instructions are numbered as they were before anything was removed
+    class OptimizationReport
+    {
+    public:
+        OptimizationReport( IPrinter* pPrinter ) : m_pPrinter(pPrinter)
+        {
+            memset( m_Counts, 0, sizeof(m_Counts) );
+        }
+
+        void Change( size_t nInstruction, const Instruction& rOld, const Instruction& rNew, ChangeTypes eType )
+        {
+            m_Counts[eType]++;
+            if( !m_pPrinter )
+                return;
+
+            char line[128];
+            if( rOld.GetOperation() == rNew.GetOperation() && rOld.GetClass() == rNew.GetClass() )
+                sprintf( line, "  [%u] %s (%s)\n", (unsigned)nInstruction, GetOpName(rOld), CHANGE_NAMES[eType] );
+            else
+                sprintf( line, "  [%u] %s -> %s (%s)\n", (unsigned)nInstruction, GetOpName(rOld), GetOpName(rNew), CHANGE_NAMES[eType] );
+            m_pPrinter->Push(line);
+        }
+
+        void Remove( size_t nInstruction, const Instruction& rInst, ChangeTypes eType )
+        {
+            m_Counts[eType]++;
+            if( !m_pPrinter )
+                return;
+
+            char line[128];
+            sprintf( line, "  [%u] %s removed (%s)\n", (unsigned)nInstruction, GetOpName(rInst), CHANGE_NAMES[eType] );
+            m_pPrinter->Push(line);
+        }
+
+        void Summarize( size_t nBefore, size_t nAfter )
+        {
+            if( !m_pPrinter )
+                return;
+
+            char line[128];
+            for( size_t i=0; i<CHANGE_TYPE_COUNT; i++ )
+            {
+                if( !m_Counts[i] )
+                    continue;
+                sprintf( line, "%s: %u\n", CHANGE_NAMES[i], (unsigned)m_Counts[i] );
+                m_pPrinter->Push(line);
+            }
+            sprintf( line, "instructions: %u -> %u\n", (unsigned)nBefore, (unsigned)nAfter );
+            m_pPrinter->Push(line);
+        }
+
+    private:
+        IPrinter* m_pPrinter;
+        size_t m_Counts[CHANGE_TYPE_COUNT];
+    };
+
+    /// A 'mov' of one GPR range into another, which hasn't been overwritten since
+    struct Copy
+    {
+        size_t nDstFirst;   ///< Byte offsets from r0
+        size_t nDstEnd;
+        size_t nSrcFirst;
+        DataTypes eType;
+    };
+
+    /// What the forward pass knows about the GPRs at the current instruction
+    class KnownValues
+    {
+    public:
+        KnownValues() { Clear(); }
+
+        void Clear()
+        {
+            memset( m_Known, 0, sizeof(m_Known) );
+            m_Copies.clear();
+        }
+
+        /// Forget anything which depends on the bytes in [nFirst,nEnd)
+        void Write( size_t nFirst, size_t nEnd )
+        {
+            for( size_t i=nFirst/4; i<(nEnd+3)/4 && i<DWORD_COUNT; i++ )
+                m_Known[i] = false;
+
+            for( size_t i=0; i<m_Copies.size(); )
+            {
+                const Copy& c = m_Copies[i];
+                size_t nSrcEnd = c.nSrcFirst + (c.nDstEnd - c.nDstFirst);
+                if( (nFirst < c.nDstEnd && c.nDstFirst < nEnd) || (nFirst < nSrcEnd && c.nSrcFirst < nEnd) )
+                {
+                    m_Copies[i] = m_Copies.back();
+                    m_Copies.pop_back();
+                }
+                else
+                {
+                    i++;
+                }
+            }
+        }
+
+        void SetConstant( size_t nFirst, size_t nEnd, uint32 nValue )
+        {
+            for( size_t i=nFirst/4; i<nEnd/4; i++ )
+            {
+                m_Known[i]  = true;
+                m_Values[i] = nValue;
+            }
+        }
+
+        bool GetConstant( size_t nFirst, size_t nEnd, uint32* pValue ) const
+        {
+            if( nFirst%4 || nEnd%4 || nEnd/4 > DWORD_COUNT )
+                return false;
+            for( size_t i=nFirst/4; i<nEnd/4; i++ )
+                if( !m_Known[i] || m_Values[i] != m_Values[nFirst/4] )
+                    return false;
+
+            *pValue = m_Values[nFirst/4];
+            return true;
+        }
+
+        void AddCopy( const Copy& rCopy ) { m_Copies.push_back(rCopy); }
+
+        const Copy* FindCopy( size_t nFirst, size_t nEnd, DataTypes eType ) const
+        {
+            for( size_t i=0; i<m_Copies.size(); i++ )
+            {
+                const Copy& c = m_Copies[i];
+                if( c.nDstFirst <= nFirst && nEnd <= c.nDstEnd && c.eType == eType )
+                    return &c;
+            }
+            return 0;
+        }
+
+    private:
+        enum { DWORD_COUNT = 128*8 };
+        bool m_Known[DWORD_COUNT];
+        uint32 m_Values[DWORD_COUNT];
+        std::vector<Copy> m_Copies;
+    };
+
+    static bool IsInt32( DataTypes eType )
+    {
+        return eType == DT_U32 || eType == DT_S32;
+    }
+
+    static bool IsPowerOfTwo( uint32 n )
+    {
+        return n && !(n & (n-1));
+    }
+
+    static uint32 Log2( uint32 n )
+    {
+        uint32 nLog = 0;
+        while( n > 1 )
+        {
+            n >>= 1;
+            nLog++;
+        }
+        return nLog;
+    }
+
+    static uint32 GetImmediateValue( const SourceOperand& rSrc )
+    {
+        uint32 n;
+        memcpy( &n, rSrc.GetImmediateBits(), sizeof(n) );
+        return n;
+    }
+
+    /// Rebuild a unary or binary instruction with new operands, keeping its predication and flags
+    static Instruction Rebuild( const Instruction& rOld, Operations eOp, const DestOperand& dst, const SourceOperand& src0, const SourceOperand* pSrc1 )
+    {
+        Instruction inst;
+        if( pSrc1 )
+            inst = BinaryInstruction( rOld.GetExecSize(), eOp, dst, src0, *pSrc1 );
+        else
+            inst = UnaryInstruction( rOld.GetExecSize(), eOp, dst, src0 );
+
+        if( rOld.GetClass() == IC_UNARY || rOld.GetClass() == IC_BINARY )
+            static_cast<UnaryInstruction&>(inst).SetConditionalModifier( static_cast<const UnaryInstruction&>(rOld).GetConditionModifier() );
+        inst.SetPredicate( rOld.GetPredicate() );
+        inst.SetFlagReference( rOld.GetFlagReference() );
+        if( rOld.IsDDCheckDisabled() )
+            inst.DisableDDCheck();
+        if( rOld.IsDDClearDisabled() )
+            inst.DisableDDClear();
+        return inst;
+    }
+
+    /// Ops which take an immediate in src1
+    static bool AcceptsImmediate( Operations eOp )
+    {
+        switch( eOp )
+        {
+        case OP_ADD:
+        case OP_MUL:
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+        case OP_SHL:
+        case OP_SHR:
+        case OP_ASR:
+        case OP_CMP:
+        case OP_SEL:
+        case OP_AVG:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool IsCommutative( Operations eOp )
+    {
+        switch( eOp )
+        {
+        case OP_ADD:
+        case OP_MUL:
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+        case OP_AVG:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// Evaluate a 32-bit integer op.  Shift counts use the low 5 bits, like the hardware does.
+    ///   Multiplies only fold if they're small enough that Gen7's 32x16 multiply gives the same answer
+    static bool Fold( Operations eOp, uint32 a, uint32 b, uint32* pResult )
+    {
+        switch( eOp )
+        {
+        case OP_ADD: *pResult = a + b; return true;
+        case OP_AND: *pResult = a & b; return true;
+        case OP_OR:  *pResult = a | b; return true;
+        case OP_XOR: *pResult = a ^ b; return true;
+        case OP_SHL: *pResult = a << (b&31); return true;
+        case OP_SHR: *pResult = a >> (b&31); return true;
+        case OP_ASR: *pResult = (uint32)( ((int32)a) >> (b&31) ); return true;
+        case OP_MUL:
+            if( a >= 0x8000 || b >= 0x8000 )
+                return false;
+            *pResult = a * b;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// Check for a source which the forward pass can reason about.  Returns its GPR bytes
+    static bool GetTrackableSource( const Instruction& rInst, size_t nOperand, const SourceOperand& rSrc, size_t* pFirst, size_t* pEnd )
+    {
+        if( rSrc.IsImmediate() || rSrc.GetModifier() != SM_NONE || !rSrc.GetSwizzle().IsIdentity() )
+            return false;
+
+        bool bIndirect;
+        return GetGPRFootprint( rInst, nOperand, &bIndirect, pFirst, pEnd ) && !bIndirect;
+    }
+
+    /// Check whether a source reads its elements in the same order, and with the same spacing, as a packed destination
+    static bool IsPackedRegion( const RegisterRegion& rRegion, size_t nExecSize )
+    {
+        if( nExecSize == 1 )
+            return true;
+        if( rRegion.GetHStride() != 1 )
+            return false;
+        return rRegion.GetWidth() == nExecSize || rRegion.GetVStride() == rRegion.GetWidth();
+    }
+
+    /// Replace a source with a constant, or with the register it was copied from
+    static ChangeTypes PropagateSource( const KnownValues& rKnown, const Instruction& rInst, size_t nOperand,
+                                        SourceOperand& rSrc, bool bAllowImmediate )
+    {
+        size_t nFirst, nEnd;
+        if( !GetTrackableSource( rInst, nOperand, rSrc, &nFirst, &nEnd ) )
+            return CHANGE_TYPE_COUNT;
+
+        uint32 nValue;
+        if( bAllowImmediate && GetTypeSize(rSrc.GetDataType()) == 4 && rKnown.GetConstant( nFirst, nEnd, &nValue ) )
+        {
+            rSrc = SourceOperand( rSrc.GetDataType(), nValue );
+            return CHANGE_CONSTANT_PROPAGATION;
+        }
+
+        const Copy* pCopy = rKnown.FindCopy( nFirst, nEnd, rSrc.GetDataType() );
+        if( !pCopy )
+            return CHANGE_TYPE_COUNT;
+
+        // regions keep the same alignment within a GPR, so they still span the same number of registers
+        RegReference base = rSrc.GetRegRegion().GetBaseRegister();
+        const DirectRegReference& rBase = static_cast<const DirectRegReference&>(base);
+        size_t nByte = pCopy->nSrcFirst + (32*rBase.GetRegNumber() + rBase.GetSubRegOffset()) - pCopy->nDstFirst;
+
+        RegisterRegion region = rSrc.GetRegRegion();
+        rSrc.SetRegRegion( RegisterRegion( DirectRegReference( REG_GPR, nByte/32, nByte%32 ), region.GetVStride(), region.GetWidth(), region.GetHStride() ) );
+        return CHANGE_COPY_PROPAGATION;
+    }
+
+    /// Remember what a 'mov' put in its destination
+    static void TrackMove( KnownValues& rKnown, const Instruction& rInst, size_t nDstFirst, size_t nDstEnd )
+    {
+        const UnaryInstruction& rMov = static_cast<const UnaryInstruction&>(rInst);
+        if( rMov.GetOperation() != OP_MOV || rMov.GetClass() != IC_UNARY ||
+            rMov.GetPredicate().GetMode() != PM_NONE || rMov.GetConditionModifier() != CM_NONE )
+            return;
+
+        DestOperand dst   = rMov.GetDest();
+        SourceOperand src = rMov.GetSource0();
+        if( src.GetModifier() != SM_NONE || dst.GetWriteMask() != 0xff ||
+            (dst.GetRegRegion().GetHStride() > 1 && rMov.GetExecSize() > 1) )
+            return;
+
+        // integer literals are signed, but moving them into an unsigned reg doesn't change any bits
+        if( src.IsImmediate() )
+        {
+            bool bSameBits = src.GetDataType() == dst.GetDataType() || (IsInt32(src.GetDataType()) && IsInt32(dst.GetDataType()));
+            if( bSameBits && GetTypeSize(dst.GetDataType()) == 4 && nDstFirst%4 == 0 )
+                rKnown.SetConstant( nDstFirst, nDstEnd, GetImmediateValue(src) );
+            return;
+        }
+        if( src.GetDataType() != dst.GetDataType() )
+            return;
+
+        size_t nSrcFirst, nSrcEnd;
+        if( !GetTrackableSource( rInst, 1, src, &nSrcFirst, &nSrcEnd ) ||
+            !IsPackedRegion( src.GetRegRegion(), rMov.GetExecSize() ) ||
+            nSrcEnd - nSrcFirst != nDstEnd - nDstFirst ||
+            nSrcFirst%32 != nDstFirst%32 ||
+            (nSrcFirst < nDstEnd && nDstFirst < nSrcEnd) )
+            return;
+
+        Copy c;
+        c.nDstFirst = nDstFirst;
+        c.nDstEnd   = nDstEnd;
+        c.nSrcFirst = nSrcFirst;
+        c.eType     = dst.GetDataType();
+        rKnown.AddCopy(c);
+    }
+
+    /// Check for a 'mov' which puts a register's contents back where they already are
+    static bool IsSelfMove( const Instruction& rInst )
+    {
+        if( rInst.GetClass() != IC_UNARY || rInst.GetOperation() != OP_MOV )
+            return false;
+
+        const UnaryInstruction& rMov = static_cast<const UnaryInstruction&>(rInst);
+        DestOperand dst   = rMov.GetDest();
+        SourceOperand src = rMov.GetSource0();
+        size_t nDstFirst, nDstEnd, nSrcFirst, nSrcEnd;
+        bool bIndirect;
+        return rMov.GetConditionModifier() == CM_NONE &&
+               src.GetDataType() == dst.GetDataType() &&
+               GetTrackableSource( rInst, 1, src, &nSrcFirst, &nSrcEnd ) &&
+               IsPackedRegion( src.GetRegRegion(), rMov.GetExecSize() ) &&
+               (dst.GetRegRegion().GetHStride() <= 1 || rMov.GetExecSize() == 1) &&
+               GetGPRFootprint( rInst, 0, &bIndirect, &nDstFirst, &nDstEnd ) && !bIndirect &&
+               nSrcFirst == nDstFirst && nSrcEnd == nDstEnd;
+    }
+
+    /// Rewrite a unary or binary instruction using what's known about its sources, and simplify it.
+    ///   Returns the change which was made, or CHANGE_TYPE_COUNT if there wasn't one
+    static ChangeTypes RewriteALU( const KnownValues& rKnown, Instruction& rInst )
+    {
+        const BinaryInstruction& rOld = static_cast<const BinaryInstruction&>(rInst);
+        bool bBinary  = rInst.GetClass() == IC_BINARY;
+        Operations eOp = rInst.GetOperation();
+        DestOperand dst    = rOld.GetDest();
+        SourceOperand src0 = rOld.GetSource0();
+        SourceOperand src1 = bBinary ? rOld.GetSource1() : SourceOperand();
+        bool bNoCMod = rOld.GetConditionModifier() == CM_NONE;
+
+        if( !bBinary )
+        {
+            // 'not' of a constant
+            SourceOperand constant = src0;
+            if( eOp == OP_NOT && bNoCMod && IsInt32(src0.GetDataType()) && IsInt32(dst.GetDataType()) &&
+                PropagateSource( rKnown, rInst, 1, constant, true ) == CHANGE_CONSTANT_PROPAGATION )
+            {
+                rInst = Rebuild( rInst, OP_MOV, dst, SourceOperand( dst.GetDataType(), ~GetImmediateValue(constant) ), 0 );
+                return CHANGE_CONSTANT_FOLDING;
+            }
+
+            // only 'mov' can take an immediate
+            ChangeTypes eChange = PropagateSource( rKnown, rInst, 1, src0, eOp == OP_MOV );
+            if( eChange != CHANGE_TYPE_COUNT )
+                rInst = Rebuild( rInst, eOp, dst, src0, 0 );
+            return eChange;
+        }
+
+        // sources which hold constants become immediates.  Only src1 may be an immediate,
+        //  but commutative ops can swap a constant src0 into it.  'nSrc0' tracks which of the original
+        //  operands ends up in src0, since that's where its footprint comes from
+        ChangeTypes eChange = CHANGE_TYPE_COUNT;
+        size_t nSrc0 = 1;
+        if( AcceptsImmediate(eOp) )
+        {
+            if( !src1.IsImmediate() && PropagateSource( rKnown, rInst, 2, src1, true ) == CHANGE_CONSTANT_PROPAGATION )
+                eChange = CHANGE_CONSTANT_PROPAGATION;
+
+            SourceOperand constant = src0;
+            if( PropagateSource( rKnown, rInst, 1, constant, true ) == CHANGE_CONSTANT_PROPAGATION )
+            {
+                uint32 nResult;
+                if( src1.IsImmediate() && bNoCMod && src1.GetModifier() == SM_NONE &&
+                    IsInt32(src0.GetDataType()) && IsInt32(src1.GetDataType()) && IsInt32(dst.GetDataType()) &&
+                    Fold( eOp, GetImmediateValue(constant), GetImmediateValue(src1), &nResult ) )
+                {
+                    rInst = Rebuild( rInst, OP_MOV, dst, SourceOperand( dst.GetDataType(), nResult ), 0 );
+                    return CHANGE_CONSTANT_FOLDING;
+                }
+                if( !src1.IsImmediate() && IsCommutative(eOp) )
+                {
+                    src0  = src1;
+                    src1  = constant;
+                    nSrc0 = 2;
+                    eChange = CHANGE_CONSTANT_PROPAGATION;
+                }
+            }
+        }
+
+        // whatever's left can read from the originals of any copies
+        if( PropagateSource( rKnown, rInst, 2, src1, false ) == CHANGE_COPY_PROPAGATION && eChange == CHANGE_TYPE_COUNT )
+            eChange = CHANGE_COPY_PROPAGATION;
+        if( PropagateSource( rKnown, rInst, nSrc0, src0, false ) == CHANGE_COPY_PROPAGATION && eChange == CHANGE_TYPE_COUNT )
+            eChange = CHANGE_COPY_PROPAGATION;
+
+        if( eChange != CHANGE_TYPE_COUNT )
+            rInst = Rebuild( rInst, eOp, dst, src0, &src1 );
+        return eChange;
+    }
+
+    /// Replace integer ops by special immediates with cheaper ones.
+    ///   Returns the change which was made, or CHANGE_TYPE_COUNT if there wasn't one
+    static ChangeTypes Simplify( const KnownValues& rKnown, Instruction& rInst )
+    {
+        if( rInst.GetClass() == IC_MATH )
+        {
+            // unsigned divides by powers of two
+            const MathInstruction& rMath = static_cast<const MathInstruction&>(rInst);
+            MathFunctionIDs eFunc = rMath.GetFunction();
+            if( eFunc != MATH_IDIV_QUOTIENT && eFunc != MATH_IDIV_REMAINDER )
+                return CHANGE_TYPE_COUNT;
+
+            DestOperand dst    = rMath.GetDest();
+            SourceOperand src0 = rMath.GetSource0();
+            SourceOperand src1 = rMath.GetSource1();
+            if( !src1.IsImmediate() && PropagateSource( rKnown, rInst, 2, src1, true ) != CHANGE_CONSTANT_PROPAGATION )
+                return CHANGE_TYPE_COUNT;
+
+            uint32 nDivisor = GetImmediateValue(src1);
+            if( src0.IsImmediate() || src0.GetModifier() != SM_NONE || src1.GetModifier() != SM_NONE ||
+                src0.GetDataType() != DT_U32 || src1.GetDataType() != DT_U32 || dst.GetDataType() != DT_U32 ||
+                !IsPowerOfTwo(nDivisor) )
+                return CHANGE_TYPE_COUNT;
+
+            SourceOperand imm = (eFunc == MATH_IDIV_QUOTIENT) ? SourceOperand( DT_U32, Log2(nDivisor) ) : SourceOperand( DT_U32, nDivisor-1 );
+            rInst = Rebuild( rInst, (eFunc == MATH_IDIV_QUOTIENT) ? OP_SHR : OP_AND, dst, src0, &imm );
+            return CHANGE_STRENGTH_REDUCTION;
+        }
+
+        if( rInst.GetClass() != IC_BINARY )
+            return CHANGE_TYPE_COUNT;
+
+        const BinaryInstruction& rBin = static_cast<const BinaryInstruction&>(rInst);
+        DestOperand dst    = rBin.GetDest();
+        SourceOperand src0 = rBin.GetSource0();
+        SourceOperand src1 = rBin.GetSource1();
+        if( !src1.IsImmediate() || src0.IsImmediate() || rBin.GetConditionModifier() != CM_NONE ||
+            src0.GetModifier() != SM_NONE || src1.GetModifier() != SM_NONE ||
+            !IsInt32(src0.GetDataType()) || !IsInt32(src1.GetDataType()) || !IsInt32(dst.GetDataType()) )
+            return CHANGE_TYPE_COUNT;
+
+        uint32 nValue = GetImmediateValue(src1);
+        switch( rInst.GetOperation() )
+        {
+        case OP_ADD:
+        case OP_OR:
+        case OP_XOR:
+        case OP_SHL:
+        case OP_SHR:
+        case OP_ASR:
+            if( nValue != 0 )
+                return CHANGE_TYPE_COUNT;
+            rInst = Rebuild( rInst, OP_MOV, dst, src0, 0 );
+            return CHANGE_IDENTITY;
+
+        case OP_AND:
+            if( nValue == 0 )
+            {
+                rInst = Rebuild( rInst, OP_MOV, dst, SourceOperand( dst.GetDataType(), 0u ), 0 );
+                return CHANGE_CONSTANT_FOLDING;
+            }
+            if( nValue != 0xffffffff )
+                return CHANGE_TYPE_COUNT;
+            rInst = Rebuild( rInst, OP_MOV, dst, src0, 0 );
+            return CHANGE_IDENTITY;
+
+        case OP_MUL:
+            if( nValue == 0 )
+            {
+                rInst = Rebuild( rInst, OP_MOV, dst, SourceOperand( dst.GetDataType(), 0u ), 0 );
+                return CHANGE_CONSTANT_FOLDING;
+            }
+            if( nValue == 1 )
+            {
+                rInst = Rebuild( rInst, OP_MOV, dst, src0, 0 );
+                return CHANGE_IDENTITY;
+            }
+
+            // Gen7 multiplies only use the low 16 bits of a dword src1, so bigger ones aren't really shifts
+            if( !IsPowerOfTwo(nValue) || nValue >= 0x10000 )
+                return CHANGE_TYPE_COUNT;
+            {
+                SourceOperand shift( src1.GetDataType(), Log2(nValue) );
+                rInst = Rebuild( rInst, OP_SHL, dst, src0, &shift );
+            }
+            return CHANGE_STRENGTH_REDUCTION;
+
+        default:
+            return CHANGE_TYPE_COUNT;
+        }
+    }
+
+    /// Mark instructions which may run with some channels disabled.  That's everything between an 'if'
+    ///   and its 'endif', and everything in a loop body
+    static void FindDivergentCode( const std::vector<Instruction>& rInstructions, std::vector<bool>& rDivergent )
+    {
+        size_t nInstructions = rInstructions.size();
+        rDivergent.assign( nInstructions, false );
+        for( size_t i=0; i<nInstructions; i++ )
+        {
+            if( rInstructions[i].GetClass() != IC_BRANCH )
+                continue;
+
+            const BranchInstruction& rBranch = static_cast<const BranchInstruction&>(rInstructions[i]);
+            int nFirst = 0;
+            int nEnd   = 0;
+            if( rBranch.GetOperation() == OP_IF )
+            {
+                nFirst = (int)i + 1;
+                nEnd   = (int)i + rBranch.GetUIP()/2;
+            }
+            else if( rBranch.GetOperation() == OP_WHILE )
+            {
+                nFirst = (int)i + rBranch.GetJIP()/2;
+                nEnd   = (int)i;
+            }
+
+            for( int n=std::max(nFirst,0); n<nEnd && n<(int)nInstructions; n++ )
+                rDivergent[n] = true;
+        }
+    }
+
+    /// Registers which an instruction reads and writes, for dead-code elimination
+    struct RegisterUsage
+    {
+        uint32 Uses[4];
+        uint32 Kills[4];
+        uint32 Writes[4];
+    };
+
+    static void AddRegs( uint32* pBits, size_t nFirstByte, size_t nEndByte )
+    {
+        for( size_t r=nFirstByte/32; r<(nEndByte+31)/32 && r<128; r++ )
+            pBits[r/32] |= 1u<<(r%32);
+    }
+
+    static void GetRegisterUsage( const Instruction& rInst, bool bDivergent, RegisterUsage* pUsage )
+    {
+        memset( pUsage, 0, sizeof(*pUsage) );
+
+        bool bIndirect;
+        size_t nFirst, nEnd;
+        for( size_t i=1; i<4; i++ )
+        {
+            if( !GetGPRFootprint( rInst, i, &bIndirect, &nFirst, &nEnd ) )
+                continue;
+            if( bIndirect )
+                AddRegs( pUsage->Uses, 0, 128*32 );
+            else
+                AddRegs( pUsage->Uses, nFirst, nEnd );
+        }
+
+        if( GetGPRFootprint( rInst, 0, &bIndirect, &nFirst, &nEnd ) && !bIndirect )
+        {
+            AddRegs( pUsage->Writes, nFirst, nEnd );
+            if( !bDivergent && IsWholeRegWrite( rInst, nFirst, nEnd ) )
+                AddRegs( pUsage->Kills, nFirst, nEnd );
+        }
+    }
+
+    /// Instructions which do nothing but write their destination GPRs
+    static bool IsRemovable( const Instruction& rInst )
+    {
+        switch( rInst.GetClass() )
+        {
+        case IC_UNARY:
+        case IC_BINARY:
+        case IC_TERNARY:
+            if( static_cast<const UnaryInstruction&>(rInst).GetConditionModifier() != CM_NONE )
+                return false;
+            break;
+        case IC_MATH:
+            break;
+        default:
+            return false;
+        }
+
+        bool bIndirect;
+        size_t nFirst, nEnd;
+        return !UsesImplicitAccumulator( rInst.GetOperation() ) &&
+               GetGPRFootprint( rInst, 0, &bIndirect, &nFirst, &nEnd ) && !bIndirect;
+    }
+
+    void Parser::Optimize()
+    {
+        size_t nInstructions = m_Instructions.size();
+        OptimizationReport report( m_pOptimizationReport );
+
+        std::vector<bool> Divergent;
+        FindDivergentCode( m_Instructions, Divergent );
+
+        // forget everything at labels, pred blocks, and anywhere control can arrive from more than one place
+        std::vector<size_t> Successors;
+        GetSuccessors( Successors );
+        std::vector<bool> Leaders( nInstructions+1, false );
+        for( size_t i=0; i<m_ScheduleBarriers.size(); i++ )
+            Leaders[ std::min( m_ScheduleBarriers[i], nInstructions ) ] = true;
+        for( size_t i=0; i<nInstructions; i++ )
+        {
+            for( size_t s=0; s<3; s++ )
+            {
+                size_t nSucc = Successors[3*i+s];
+                if( nSucc <= nInstructions && nSucc != i+1 )
+                    Leaders[nSucc] = true;
+            }
+            if( Successors[3*i] != i+1 || Successors[3*i+1] != (size_t)-1 )
+                Leaders[i+1] = true;
+        }
+
+        std::vector<bool> Removed( nInstructions, false );
+        KnownValues* pKnown = new KnownValues();
+        for( size_t i=0; i<nInstructions; i++ )
+        {
+            if( Leaders[i] )
+                pKnown->Clear();
+
+            Instruction& rInst = m_Instructions[i];
+            Instruction original = rInst;
+            if( (rInst.GetClass() == IC_UNARY || rInst.GetClass() == IC_BINARY) && !UsesImplicitAccumulator( rInst.GetOperation() ) )
+            {
+                ChangeTypes eChange = RewriteALU( *pKnown, rInst );
+                if( eChange != CHANGE_TYPE_COUNT )
+                    report.Change( i, original, rInst, eChange );
+            }
+            if( rInst.GetClass() == IC_BINARY || rInst.GetClass() == IC_MATH )
+            {
+                Instruction before = rInst;
+                ChangeTypes eChange = Simplify( *pKnown, rInst );
+                if( eChange != CHANGE_TYPE_COUNT )
+                    report.Change( i, before, rInst, eChange );
+            }
+            if( IsSelfMove(rInst) )
+            {
+                Removed[i] = true;
+                report.Remove( i, original, CHANGE_IDENTITY );
+                continue;
+            }
+
+            bool bIndirect;
+            size_t nFirst, nEnd;
+            if( GetGPRFootprint( rInst, 0, &bIndirect, &nFirst, &nEnd ) )
+            {
+                if( bIndirect )
+                {
+                    pKnown->Clear();
+                }
+                else
+                {
+                    pKnown->Write( nFirst, nEnd );
+                    if( !Divergent[i] && rInst.GetClass() == IC_UNARY )
+                        TrackMove( *pKnown, rInst, nFirst, nEnd );
+                }
+            }
+        }
+        delete pKnown;
+
+        // remove instructions whose results are never read.  That can leave more of them unread, so repeat until nothing changes
+        std::vector<RegisterUsage> Usage( nInstructions );
+        std::vector<uint32> LiveIn( 4*nInstructions );
+        std::vector<uint32> LiveOut( 4*nInstructions );
+        bool bRemoved = true;
+        while( bRemoved )
+        {
+            for( size_t i=0; i<nInstructions; i++ )
+            {
+                if( Removed[i] )
+                    memset( &Usage[i], 0, sizeof(Usage[i]) );
+                else
+                    GetRegisterUsage( m_Instructions[i], Divergent[i], &Usage[i] );
+            }
+
+            std::fill( LiveIn.begin(), LiveIn.end(), 0 );
+            std::fill( LiveOut.begin(), LiveOut.end(), 0 );
+            bool bChanged = true;
+            while( bChanged )
+            {
+                bChanged = false;
+                for( size_t i=nInstructions; i-- > 0; )
+                {
+                    uint32 Out[4] = {0,0,0,0};
+                    for( size_t s=0; s<3; s++ )
+                    {
+                        size_t nSucc = Successors[3*i+s];
+                        if( nSucc < nInstructions )
+                            for( size_t w=0; w<4; w++ )
+                                Out[w] |= LiveIn[4*nSucc+w];
+                    }
+                    for( size_t w=0; w<4; w++ )
+                    {
+                        uint32 nIn = Usage[i].Uses[w] | (Out[w] & ~Usage[i].Kills[w]);
+                        if( nIn != LiveIn[4*i+w] || Out[w] != LiveOut[4*i+w] )
+                            bChanged = true;
+                        LiveIn[4*i+w]  = nIn;
+                        LiveOut[4*i+w] = Out[w];
+                    }
+                }
+            }
+
+            bRemoved = false;
+            for( size_t i=0; i<nInstructions; i++ )
+            {
+                if( Removed[i] || !IsRemovable( m_Instructions[i] ) )
+                    continue;
+
+                uint32 nLive = 0;
+                for( size_t w=0; w<4; w++ )
+                    nLive |= Usage[i].Writes[w] & LiveOut[4*i+w];
+                if( nLive )
+                    continue;
+
+                Removed[i] = true;
+                bRemoved   = true;
+                report.Remove( i, m_Instructions[i], CHANGE_DEAD_CODE );
+            }
+        }
+
+        // squeeze out the removed instructions
+        std::vector<size_t> FirstNew( nInstructions+1 );
+        std::vector<Instruction> Kept;
+        Kept.reserve(nInstructions);
+        for( size_t i=0; i<nInstructions; i++ )
+        {
+            FirstNew[i] = Kept.size();
+            if( !Removed[i] )
+                Kept.push_back( m_Instructions[i] );
+        }
+        FirstNew[nInstructions] = Kept.size();
+
+        size_t nKept = Kept.size();
+        if( nKept != nInstructions )
+            ReplaceInstructions( Kept, FirstNew );
+
+        report.Summarize( nInstructions, nKept );
+    }
+
+    void Parser::ReplaceInstructions( std::vector<Instruction>& rNew, const std::vector<size_t>& rFirstNew )
+    {
+        // anything which pointed at an old instruction now points at the first of its replacements, or whatever came next
+        size_t nOld = m_Instructions.size();
+        for( size_t i=0; i<nOld; i++ )
+        {
+            for( size_t n=rFirstNew[i]; n<rFirstNew[i+1]; n++ )
+            {
+                Instruction& rInst = rNew[n];
+                int nTarget;
+                if( GetJumpTarget( rInst, 16*i, &nTarget ) )
+                {
+                    const BinaryInstruction& rJump = static_cast<const BinaryInstruction&>(rInst);
+                    int nOffset = 16*( (int)rFirstNew[nTarget/16] - (int)n );
+                    SourceOperand offset( rJump.GetSource1().GetDataType(), (uint32)nOffset );
+                    rInst = Rebuild( rInst, OP_ADD, rJump.GetDest(), rJump.GetSource0(), &offset );
+                }
+                else if( rInst.GetClass() == IC_BRANCH )
+                {
+                    BranchInstruction& rBranch = static_cast<BranchInstruction&>(rInst);
+                    size_t nJIP = (size_t)( (int)i + rBranch.GetJIP()/2 );
+                    size_t nUIP = (size_t)( (int)i + rBranch.GetUIP()/2 );
+                    rBranch.SetJIP( 2*( (int)rFirstNew[nJIP] - (int)n ) );
+                    rBranch.SetUIP( 2*( (int)rFirstNew[nUIP] - (int)n ) );
+                }
+            }
+        }
+        m_Instructions.swap(rNew);
+
+        for( size_t i=0; i<m_ScheduleBarriers.size(); i++ )
+            m_ScheduleBarriers[i] = rFirstNew[ std::min( m_ScheduleBarriers[i], nOld ) ];
+    }
+
+}}}
@@ -4,6 +4,8 @@
 #include "GENAssembler_Parser.h"
 
 #include "GENIsa.h"
+#include "GENControlFlow.h"
+#include <algorithm>
 #include <stdarg.h>
 
 int yylex_init_extra(GEN::Assembler::_INTERNAL::Parser* yy_user_defined,yyscan_t* ptr_yy_globals );
@@ -35,6 +37,7 @@ namespace _INTERNAL{
         DirectRegRefNode( size_t line ) : RegRefNode(line,true) {}
         RegTypes eRegType;
         size_t nRegNum;
+        size_t nNamedReg;   ///< 'reg' declaration this refers to, or -1
         
     };
     struct IndirectRegRefNode : public RegRefNode
@@ -42,6 +45,7 @@ namespace _INTERNAL{
         IndirectRegRefNode( size_t line ) : RegRefNode(line,false){}
         size_t nGPR;
         size_t nAddrSubReg;
+        size_t nNamedReg;
     };
 
     struct SourceModifierNode : public ParseNode
@@ -80,6 +84,7 @@ namespace _INTERNAL{
         GEN::DataTypes eType;
         RegReference base;
         SourceModifierNode* pRegionOrSwizzle;
+        size_t nNamedReg;
         virtual bool IsImmediate() { return false; }
     
     };
@@ -95,6 +100,7 @@ namespace _INTERNAL{
     {
         DestRegNode( size_t line ) : ParseNode(line){}
         GEN::DestOperand dest;
+        size_t nNamedReg;
     };
     struct FlagReferenceNode : public ParseNode
     {
@@ -117,23 +123,144 @@ namespace _INTERNAL{
         uint32 ID;
     };
 
-    const TokenID* Lookup( const TokenID* pTable, const char* str )
+    /// A table of tokens, hashed so that finding one doesn't mean scanning all of them
+    class TokenTable
     {
-        while( pTable->Token )
+    public:
+        template< size_t N >
+        TokenTable( const TokenID (&tokens)[N] ) : m_pTokens(tokens)
         {
-            if( strcmp(pTable->Token,str) == 0 )
-                return pTable;
-            ++pTable;
+            for( size_t i=0; i<N; i++ )
+                if( tokens[i].Token )
+                    m_Names.Insert( tokens[i].Token, i );
         }
-        return 0;
+
+        const TokenID* Find( const char* str ) const
+        {
+            size_t i = m_Names.Find(str);
+            return (i == (size_t)-1) ? 0 : &m_pTokens[i];
+        }
+
+    private:
+        const TokenID* m_pTokens;
+        SymbolTable m_Names;
+    };
+
+    void* Arena::Allocate( size_t nBytes )
+    {
+        nBytes = (nBytes + ALIGNMENT-1) & ~(size_t)(ALIGNMENT-1);
+        if( nBytes > m_nRemaining )
+        {
+            // big allocations get a block to themselves, so that the current one isn't wasted
+            if( nBytes > BLOCK_SIZE/4 )
+            {
+                void* pBlock = malloc(nBytes);
+                m_Blocks.push_back(pBlock);
+                return pBlock;
+            }
+
+            m_pCurrent   = (uint8*) malloc(BLOCK_SIZE);
+            m_nRemaining = BLOCK_SIZE;
+            m_Blocks.push_back(m_pCurrent);
+        }
+
+        void* p = m_pCurrent;
+        m_pCurrent   += nBytes;
+        m_nRemaining -= nBytes;
+        return p;
+    }
+
+    const char* Arena::StoreString( const char* pString )
+    {
+        size_t nBytes = strlen(pString)+1;
+        char* p = (char*) Allocate(nBytes);
+        memcpy( p, pString, nBytes );
+        return p;
+    }
+
+    void Arena::Clear()
+    {
+        for( size_t i=0; i<m_Blocks.size(); i++ )
+            free( m_Blocks[i] );
+        m_Blocks.clear();
+        m_pCurrent   = 0;
+        m_nRemaining = 0;
     }
 
+    uint32 SymbolTable::Hash( const char* pName, size_t nLength )
+    {
+        // FNV-1a
+        uint32 nHash = 2166136261u;
+        for( size_t i=0; i<nLength; i++ )
+            nHash = (nHash ^ (uint8)pName[i]) * 16777619u;
+        return nHash;
+    }
+
+    void SymbolTable::Grow()
+    {
+        std::vector<Entry> Old;
+        Old.swap(m_Entries);
+
+        Entry empty;
+        empty.pName = 0;
+        m_Entries.resize( Old.empty() ? 16 : 2*Old.size(), empty );
+
+        size_t nMask = m_Entries.size()-1;
+        for( size_t i=0; i<Old.size(); i++ )
+        {
+            if( !Old[i].pName )
+                continue;
+            size_t nSlot = Old[i].nHash & nMask;
+            while( m_Entries[nSlot].pName )
+                nSlot = (nSlot+1) & nMask;
+            m_Entries[nSlot] = Old[i];
+        }
+    }
+
+    bool SymbolTable::Insert( const char* pName, size_t nValue )
+    {
+        size_t nLength = strlen(pName);
+        if( Find( pName, nLength ) != (size_t)-1 )
+            return false;
+
+        // stay under 3/4 full, so that probe sequences stay short
+        if( 4*(m_nCount+1) > 3*m_Entries.size() )
+            Grow();
+
+        Entry e;
+        e.pName   = pName;
+        e.nLength = nLength;
+        e.nHash   = Hash( pName, nLength );
+        e.nValue  = nValue;
+
+        size_t nMask = m_Entries.size()-1;
+        size_t nSlot = e.nHash & nMask;
+        while( m_Entries[nSlot].pName )
+            nSlot = (nSlot+1) & nMask;
+        m_Entries[nSlot] = e;
+        m_nCount++;
+        return true;
+    }
+
+    size_t SymbolTable::Find( const char* pName, size_t nLength ) const
+    {
+        if( m_Entries.empty() )
+            return (size_t)-1;
+
+        uint32 nHash = Hash( pName, nLength );
+        size_t nMask = m_Entries.size()-1;
+        for( size_t nSlot = nHash & nMask; m_Entries[nSlot].pName; nSlot = (nSlot+1) & nMask )
+        {
+            const Entry& e = m_Entries[nSlot];
+            if( e.nHash == nHash && e.nLength == nLength && memcmp( e.pName, pName, nLength ) == 0 )
+                return e.nValue;
+        }
+        return (size_t)-1;
+    }
 
     Parser::~Parser()
     {
-        // TODO: ick...   Replace this with a pool allocator...
-        for( auto it : m_Nodes )
-            delete it;
+        // parse nodes live in the arena, which frees them all at once
     }
 
     void Parser::ErrorF( size_t nLine, const char* msg, ... )
@@ -193,8 +320,7 @@ namespace _INTERNAL{
 
     const char* Parser::StoreString( const char* yytext )
     {
-        m_TokenStrings.push_back( yytext );
-        return m_TokenStrings.back().c_str();
+        return m_Arena.StoreString( yytext );
     }
 
     void Parser::RegDeclaration( TokenStruct& name, size_t nCount )
@@ -206,7 +332,7 @@ namespace _INTERNAL{
         }
 
         GEN::DirectRegReference reg(0);
-        AddNamedReg( name.fields.ID, reg, nCount );
+        AddNamedReg( name.fields.ID, reg, nCount, true );
     }
    
     void Parser::BindDeclaration( TokenStruct& name, int point )
@@ -220,6 +346,7 @@ namespace _INTERNAL{
         BindPoint b;
         b.pName = name.fields.ID;
         b.bind = point;
+        m_BindNames.Insert( b.pName, m_BindPoints.size() );
         m_BindPoints.push_back(b);
 
 
@@ -238,7 +365,7 @@ namespace _INTERNAL{
         }
 
         // register this curbe's name and reserve regs for it
-        AddNamedReg(name.fields.ID, GEN::DirectRegReference(m_nCURBERegCount+1), nSizeInRegs );
+        AddNamedReg(name.fields.ID, GEN::DirectRegReference(m_nCURBERegCount+1), nSizeInRegs, false );
         m_nCURBERegCount += nSizeInRegs;
 
         memset( m_CURBEScratch, 0, sizeof(m_CURBEScratch) );
@@ -295,7 +422,9 @@ namespace _INTERNAL{
         LabelInfo lbl;
         lbl.nInstructionIndex = m_Instructions.size();
         lbl.pName = label.fields.ID;
+        m_LabelNames.Insert( lbl.pName, m_Labels.size() );
         m_Labels.push_back(lbl);
+        m_ScheduleBarriers.push_back( m_Instructions.size() );
 
         return true;
     }
@@ -408,8 +537,7 @@ namespace _INTERNAL{
         }
        
         
-        SubRegNode* pN = new SubRegNode(rToken.LineNumber);
-        m_Nodes.push_back(pN);
+        SubRegNode* pN = NewNode<SubRegNode>(rToken.LineNumber);
         pN->eType = eType;
         pN->nSubregOffset = nSubreg;
         pN->nRegDisplacement = nRegDisplacement;
@@ -450,49 +578,54 @@ namespace _INTERNAL{
         {"fc14" ,  REG_FC14              },
         {"fc15" ,  REG_FC15              },
     };
+    static const TokenTable ARCH_REGS_LOOKUP( ARCH_REGS );
 
 
-    bool Parser::InterpretRegName( GEN::RegTypes* pRegType, size_t* pRegNum, const TokenStruct& rToken )
+    bool Parser::InterpretRegName( GEN::RegTypes* pRegType, size_t* pRegNum, size_t* pNamedReg, const TokenStruct& rToken )
     {
-        // check for a match with a user-defined named reg      
+        *pNamedReg = (size_t)-1;
+
+        // check for a match with a user-defined named reg.
+        //  If the token is of the form <reg-label>%u then it's an offset from that reg label.
+        //  Any front part of the token which is followed by a digit could be a reg name,
+        //   and if several of them are, the one which was declared first wins
         const char* pID = rToken.fields.ID;
         size_t nIDLength = strlen(pID);
-        for( size_t i=0; i<m_NamedRegs.size(); i++ )
+        size_t nMatch = (size_t)-1;
+        size_t nMatchLength = 0;
+        for( size_t nLength=1; nLength<=nIDLength; nLength++ )
         {
-            const char* pReg = m_NamedRegs[i].pName;
-            if( strlen(pReg) > nIDLength )
-                continue; // no match
+            if( pID[nLength] && (pID[nLength] < '0' || pID[nLength] > '9') )
+                continue;
 
-            // see if front part of token matches reg name exactly
-            size_t j=0;
-            while( pReg[j] )
+            size_t nReg = m_RegNames.Find( pID, nLength );
+            if( nReg < nMatch )
             {
-                if( pID[j] != pReg[j] )
-                    break;
-                j++;
+                nMatch       = nReg;
+                nMatchLength = nLength;
             }
-            if( pReg[j] )
-                continue; // no match
+        }
 
-            // if token is of the form <reg-label>%u
-            //  then it's an offset from this reg label
-            //  otherwise, it refers to something else
+        if( nMatch != (size_t)-1 )
+        {
+            const NamedReg& rReg = m_NamedRegs[nMatch];
             size_t offset=0;
-            if( pID[j] )
+            if( pID[nMatchLength] )
             {
-                if( sscanf( pID+j, "%u", &offset ) == 0 )
-                    continue; // no match
+                sscanf( pID+nMatchLength, "%u", &offset );
 
                 // now make sure user didn't screw up
-                if( offset >= m_NamedRegs[i].nRegArraySize )
+                if( offset >= rReg.nRegArraySize )
                 {
-                    ErrorF(rToken.LineNumber, "Overrun of named register %s", pReg);
+                    ErrorF(rToken.LineNumber, "Overrun of named register %s", rReg.pName);
                     return false;
                 }
             }
 
-            *pRegType = m_NamedRegs[i].reg.GetRegType();
-            *pRegNum = m_NamedRegs[i].reg.GetRegNumber() + offset;
+            *pRegType = rReg.reg.GetRegType();
+            *pRegNum = rReg.reg.GetRegNumber() + offset;
+            if( rReg.bVirtual )
+                *pNamedReg = nMatch;
             return true;
         }
 
@@ -519,7 +652,7 @@ namespace _INTERNAL{
         }
 
         // check for an arch register
-        const TokenID* pArchID = Lookup( ARCH_REGS, pName );
+        const TokenID* pArchID = ARCH_REGS_LOOKUP.Find( pName );
         if( pArchID )
         {
             *pRegType = (RegTypes) pArchID->ID;
@@ -535,13 +668,14 @@ namespace _INTERNAL{
     {
         GEN::RegTypes eRegType;
         size_t nRegNum;
-        if( !InterpretRegName( &eRegType, &nRegNum, rToken ) )
+        size_t nNamedReg;
+        if( !InterpretRegName( &eRegType, &nRegNum, &nNamedReg, rToken ) )
             return 0;
 
-        DirectRegRefNode* pN = new DirectRegRefNode(rToken.LineNumber);
-        m_Nodes.push_back(pN);
+        DirectRegRefNode* pN = NewNode<DirectRegRefNode>(rToken.LineNumber);
         pN->eRegType  = eRegType;
         pN->nRegNum   = nRegNum;
+        pN->nNamedReg = nNamedReg;
         pN->bIsDirect = true;
         return pN;
 
@@ -551,12 +685,14 @@ namespace _INTERNAL{
     {
         GEN::RegTypes eRegType;
         size_t nRegNum;
-        if( !InterpretRegName( &eRegType, &nRegNum, rGPR ) )
+        size_t nNamedReg;
+        if( !InterpretRegName( &eRegType, &nRegNum, &nNamedReg, rGPR ) )
             return 0;
 
         GEN::RegTypes eAddrType;
         size_t nAddrNum;
-        if( !InterpretRegName( &eAddrType, &nAddrNum, rAddr ) )
+        size_t nAddrNamedReg;
+        if( !InterpretRegName( &eAddrType, &nAddrNum, &nAddrNamedReg, rAddr ) )
             return 0;
 
         if( eAddrType != GEN::REG_ADDRESS || eRegType != GEN::REG_GPR || nAddrNum != 0 )
@@ -565,10 +701,10 @@ namespace _INTERNAL{
             return 0;
         }
 
-        IndirectRegRefNode* pN = new IndirectRegRefNode(rGPR.LineNumber);
-        m_Nodes.push_back(pN);
+        IndirectRegRefNode* pN = NewNode<IndirectRegRefNode>(rGPR.LineNumber);
         pN->nAddrSubReg = addrsub;
         pN->nGPR = nRegNum;
+        pN->nNamedReg = nNamedReg;
         pN->bIsDirect = false;
         return pN;
     }
@@ -577,7 +713,7 @@ namespace _INTERNAL{
     {
         // TODO: check all these
 
-        RegionNode* pN = new RegionNode(line);
+        RegionNode* pN = NewNode<RegionNode>(line);
         pN->width      = width;
         pN->hstride    = hstride;
         pN->vstride    = vstride;
@@ -587,8 +723,7 @@ namespace _INTERNAL{
     
     ParseNode* Parser::Swizzle( TokenStruct& tok )
     {
-        SwizzleNode* pN = new SwizzleNode(tok.LineNumber);
-        m_Nodes.push_back(pN);
+        SwizzleNode* pN = NewNode<SwizzleNode>(tok.LineNumber);
 
         const char* pStr = tok.fields.ID;
         uint8 pIDs[4] = {0,1,2,3};
@@ -644,6 +779,7 @@ namespace _INTERNAL{
        
         RegRefNode* pRegRef = static_cast<RegRefNode*>(pReg);
         GEN::RegReference base;
+        size_t nNamedReg;
         if( pRegRef->bIsDirect )
         {
             DirectRegRefNode* pDir = static_cast<DirectRegRefNode*>( pRegRef);
@@ -655,20 +791,26 @@ namespace _INTERNAL{
             }
 
             base = GEN::DirectRegReference( pDir->eRegType, nRegNum, pSub->nSubregOffset );
+            nNamedReg = pDir->nNamedReg;
+            if( nNamedReg == (size_t)-1 && pDir->eRegType == REG_GPR )
+                m_RawGPRs[nRegNum] = true;
         }
         else
         {
             IndirectRegRefNode* pInDir = static_cast<IndirectRegRefNode*>( pRegRef );
             base = GEN::IndirectRegReference( pInDir->nGPR*32, pInDir->nAddrSubReg );
+            nNamedReg = pInDir->nNamedReg;
+            if( nNamedReg == (size_t)-1 )
+                m_RawGPRs[pInDir->nGPR] = true;
         }
        
         
-        SourceRegNode* pS = new SourceRegNode(pReg->LineNumber);
-        m_Nodes.push_back(pS);
+        SourceRegNode* pS = NewNode<SourceRegNode>(pReg->LineNumber);
 
         pS->base = base;
         pS->eType = eType;
         pS->pRegionOrSwizzle = static_cast<SourceModifierNode*>(pRegionOrSwizzle);;
+        pS->nNamedReg = nNamedReg;
         
         return pS;
     }
@@ -683,6 +825,7 @@ namespace _INTERNAL{
 
         RegRefNode* pRegRef = static_cast<RegRefNode*>(pReg);
         GEN::RegReference base;
+        size_t nNamedReg;
         if( pRegRef->bIsDirect )
         {
             DirectRegRefNode* pDir = static_cast<DirectRegRefNode*>( pRegRef);
@@ -693,11 +836,15 @@ namespace _INTERNAL{
                 return 0;
             }
             base = GEN::DirectRegReference( pDir->eRegType, nRegNum, pSub->nSubregOffset );
+            nNamedReg = pDir->nNamedReg;
+            if( nNamedReg == (size_t)-1 && pDir->eRegType == REG_GPR )
+                m_RawGPRs[nRegNum] = true;
         }
         else
         {
             IndirectRegRefNode* pInDir = static_cast<IndirectRegRefNode*>( pRegRef );
 
+            // 'reg' declarations are checked again once they've been allocated
             if( pInDir->nGPR* 32 > 512 )
             {
                 Error(pInDir->LineNumber,"Base register for indirect addressing is too high. Must start within the first 512 bytes of reg file");
@@ -705,21 +852,24 @@ namespace _INTERNAL{
             }
 
             base = GEN::IndirectRegReference( pInDir->nGPR*32, pInDir->nAddrSubReg );
+            nNamedReg = pInDir->nNamedReg;
+            if( nNamedReg == (size_t)-1 )
+                m_RawGPRs[pInDir->nGPR] = true;
         }
         
         GEN::RegisterRegion region( base, 8,hstride,1); 
         GEN::DestOperand operand( eType, region );
 
-        DestRegNode* pD = new DestRegNode(pReg->LineNumber);
-        m_Nodes.push_back(pD);
+        DestRegNode* pD = NewNode<DestRegNode>(pReg->LineNumber);
         pD->dest = operand;
+        pD->nNamedReg = nNamedReg;
 
         return pD;
     }
 
     
 
-    ParseNode* Parser::Operation( TokenStruct& rToken, int nExecSize, ParseNode* pFlagRef )
+    static bool IsValidExecSize( int nExecSize )
     {
         switch( nExecSize )
         {
@@ -729,16 +879,22 @@ namespace _INTERNAL{
         case 8:
         case 16:
         case 32:
-            break;
+            return true;
         default:
+            return false;
+        }
+    }
+
+    ParseNode* Parser::Operation( TokenStruct& rToken, int nExecSize, ParseNode* pFlagRef )
+    {
+        if( !IsValidExecSize(nExecSize) )
+        {
             Error( rToken.LineNumber, "Bad exec size");
             return 0;
         }
 
-      
 
-        OperationNode* pN = new OperationNode(rToken.LineNumber);
-        m_Nodes.push_back(pN);
+        OperationNode* pN = NewNode<OperationNode>(rToken.LineNumber);
         pN->nExecSize = nExecSize;
         pN->pName = rToken.fields.ID;
         pN->pFlagRef = static_cast<FlagReferenceNode*>(pFlagRef);
@@ -747,15 +903,13 @@ namespace _INTERNAL{
 
     ParseNode* Parser::IntLiteral( size_t line, int i )
     {
-        ImmediateNode* pS = new ImmediateNode(line);
-        m_Nodes.push_back(pS);
+        ImmediateNode* pS = NewNode<ImmediateNode>(line);
         pS->imm = GEN::SourceOperand( GEN::DT_S32, i );
         return pS;
     }
     ParseNode* Parser::FloatLiteral( size_t line, float f )
     {
-        ImmediateNode* pS = new ImmediateNode(line);
-        m_Nodes.push_back(pS);       
+        ImmediateNode* pS = NewNode<ImmediateNode>(line);
         pS->imm = GEN::SourceOperand(f);
         return pS;
     }
@@ -763,7 +917,8 @@ namespace _INTERNAL{
     {
         GEN::RegTypes eRegType;
         size_t nNum;
-        if( !InterpretRegName( &eRegType, &nNum, id ) )
+        size_t nNamedReg;
+        if( !InterpretRegName( &eRegType, &nNum, &nNamedReg, id ) )
             return 0;
 
         if( (eRegType != REG_FLAG0 && eRegType != REG_FLAG1) || 
@@ -773,8 +928,7 @@ namespace _INTERNAL{
             return 0;
         }
 
-        FlagReferenceNode* pF = new FlagReferenceNode(id.LineNumber);
-        m_Nodes.push_back(pF);
+        FlagReferenceNode* pF = NewNode<FlagReferenceNode>(id.LineNumber);
         pF->Flag.Set( eRegType - REG_FLAG0, subReg.fields.Int );
         return pF;
     }
@@ -841,6 +995,7 @@ namespace _INTERNAL{
         {"cos"  , MATH_COS}    ,
         {0,0}                  ,
     };
+    static const TokenTable UNARY_MATH_LOOKUP( UNARY_MATH );
 
     static const TokenID UNARY_ARITH[] ={
         {"mov"    , OP_MOV      },
@@ -861,6 +1016,7 @@ namespace _INTERNAL{
         {"dim"    , OP_DIM      },
         {0,0}                  ,
     };
+    static const TokenTable UNARY_ARITH_LOOKUP( UNARY_ARITH );
 
     void Parser::Unary( ParseNode* pOp, ParseNode* pDst, ParseNode* pSrc )
     {
@@ -869,21 +1025,23 @@ namespace _INTERNAL{
 
         OperationNode* pOperation = static_cast<OperationNode*>(pOp);
 
-        const TokenID* pID = Lookup( UNARY_MATH, pOperation->pName );
+        const TokenID* pID = UNARY_MATH_LOOKUP.Find( pOperation->pName );
         if( pID )
         {
             m_Instructions.push_back( 
                 GEN::MathInstruction( pOperation->nExecSize, (MathFunctionIDs)pID->ID, DestFromNode(pDst), SourceFromNode(pSrc,pOperation->nExecSize) )
                 );
+            TrackRegs( pDst, pSrc, 0, 0 );
             return;
         }
        
-        pID = Lookup( UNARY_ARITH, pOperation->pName );
+        pID = UNARY_ARITH_LOOKUP.Find( pOperation->pName );
         if( pID )
         {
             m_Instructions.push_back( 
                 GEN::UnaryInstruction( pOperation->nExecSize, (Operations)pID->ID, DestFromNode(pDst), SourceFromNode(pSrc,pOperation->nExecSize) )
                 );
+            TrackRegs( pDst, pSrc, 0, 0 );
             return;
         }
 
@@ -900,6 +1058,7 @@ namespace _INTERNAL{
         { "fdiv"   , MATH_FDIV },
         { 0, 0 }
     };
+    static const TokenTable BINARY_MATH_LOOKUP( BINARY_MATH );
 
     static const TokenID BINARY_ARITH[] = {
         {"and"   , OP_AND },
@@ -927,6 +1086,7 @@ namespace _INTERNAL{
         {"pln"   , OP_PLN },
         {0,0}
     };
+    static const TokenTable BINARY_ARITH_LOOKUP( BINARY_ARITH );
 
 
     
@@ -939,6 +1099,7 @@ namespace _INTERNAL{
         { "cmpge", CM_GREATER_EQUAL },
         { 0, 0 }
     };
+    static const TokenTable BINARY_COMPARE_LOOKUP( BINARY_COMPARE );
 
     static bool HasRegioning( ParseNode* pN )
     {
@@ -958,7 +1119,7 @@ namespace _INTERNAL{
 
         OperationNode* pOperation = static_cast<OperationNode*>(pOp);
 
-        const TokenID* pID = Lookup( BINARY_MATH, pOperation->pName );
+        const TokenID* pID = BINARY_MATH_LOOKUP.Find( pOperation->pName );
         if( pID )
         {
             m_Instructions.push_back( 
@@ -967,10 +1128,11 @@ namespace _INTERNAL{
                     SourceFromNode(pSrc0,pOperation->nExecSize),
                     SourceFromNode(pSrc1,pOperation->nExecSize))
                 );
+            TrackRegs( pDst, pSrc0, pSrc1, 0 );
             return;
         }
        
-        pID = Lookup( BINARY_ARITH, pOperation->pName );
+        pID = BINARY_ARITH_LOOKUP.Find( pOperation->pName );
         if( pID )
         {
             m_Instructions.push_back( 
@@ -979,10 +1141,11 @@ namespace _INTERNAL{
                     SourceFromNode(pSrc0,pOperation->nExecSize),
                     SourceFromNode(pSrc1,pOperation->nExecSize))
                 );
+            TrackRegs( pDst, pSrc0, pSrc1, 0 );
             return;
         }
 
-        pID = Lookup( BINARY_COMPARE, pOperation->pName );
+        pID = BINARY_COMPARE_LOOKUP.Find( pOperation->pName );
         if( pID )
         {
             FlagReferenceNode* pFlag = pOperation->pFlagRef;
@@ -1001,6 +1164,7 @@ namespace _INTERNAL{
             op.SetConditionalModifier( (ConditionalModifiers)pID->ID );
             
             m_Instructions.push_back( op );
+            TrackRegs( pDst, pSrc0, pSrc1, 0 );
             return;
         }
 
@@ -1017,6 +1181,7 @@ namespace _INTERNAL{
                     src1
                 );
             m_Instructions.push_back( inst );
+            TrackRegs( pDst, pSrc0, pSrc1, 0 );
             return;
         }
 
@@ -1049,6 +1214,8 @@ namespace _INTERNAL{
                 );
 
             m_Instructions.push_back( inst );
+            TrackReg( pDst->LineNumber, 1, static_cast<DestRegNode*>(pDst)->nNamedReg );
+            TrackRegs( pDst, 0, pSrc0, pSrc1 );
             return;
         }
 
@@ -1064,6 +1231,7 @@ namespace _INTERNAL{
 
             inst.SetConditionalModifier( CM_LESS_EQUAL );
             m_Instructions.push_back( inst );
+            TrackRegs( pDst, pSrc0, pSrc1, 0 );
             return;
         }
         if( strcmp( pOperation->pName, "max" ) == 0 )
@@ -1077,6 +1245,7 @@ namespace _INTERNAL{
 
             inst.SetConditionalModifier( CM_GREATER_EQUAL );
             m_Instructions.push_back( inst );
+            TrackRegs( pDst, pSrc0, pSrc1, 0 );
             return;
         }
 
@@ -1090,6 +1259,7 @@ namespace _INTERNAL{
         {"lrp"   , OP_LRP },
         {0,0}
     };
+    static const TokenTable TERNARY_ARITH_LOOKUP( TERNARY_ARITH );
 
     void Parser::Ternary( ParseNode* pOp, ParseNode* pDst, ParseNode* pSrc0, ParseNode* pSrc1, ParseNode* pSrc2  )
     {
@@ -1098,7 +1268,7 @@ namespace _INTERNAL{
         
         OperationNode* pOperation = static_cast<OperationNode*>(pOp);
 
-        const TokenID* pID = Lookup( TERNARY_ARITH, pOperation->pName );
+        const TokenID* pID = TERNARY_ARITH_LOOKUP.Find( pOperation->pName );
         if( pID )
         {
             GEN::SourceOperand src0 = SourceFromNode(pSrc0,pOperation->nExecSize);
@@ -1124,6 +1294,7 @@ namespace _INTERNAL{
                     src2
                     )
                 );
+            TrackRegs( pDst, pSrc0, pSrc1, pSrc2 );
             return;
         }
 
@@ -1145,6 +1316,8 @@ namespace _INTERNAL{
 
         GEN::RegReference Dst0Reg = static_cast<DestRegNode*>(pDst0)->dest.GetRegRegion().GetBaseRegister();
         GEN::RegReference Dst1Reg = static_cast<DestRegNode*>(pDst1)->dest.GetRegRegion().GetBaseRegister();
+        size_t nInstructions = m_Instructions.size();
+        bool bNullDest = false;
         
         if( strcmp( msg.fields.ID, "DwordLoad8" ) == 0 )
         {
@@ -1177,11 +1350,20 @@ namespace _INTERNAL{
         else if( strcmp( msg.fields.ID, "OWordBlockWrite" ) == 0 )
         {
             m_Instructions.push_back( GEN::OWordBlockWrite( pBind->bind, Dst1Reg ) );
+            bNullDest = true;
         }
         else
         {
             Error(msg.LineNumber, "Unknown message");
         }
+
+        // the second reg is the message payload, which is the send's source
+        if( m_Instructions.size() > nInstructions )
+        {
+            if( !bNullDest )
+                TrackReg( pDst0->LineNumber, 0, static_cast<DestRegNode*>(pDst0)->nNamedReg );
+            TrackReg( pDst1->LineNumber, 1, static_cast<DestRegNode*>(pDst1)->nNamedReg );
+        }
     }
         
     void Parser::Jmp( TokenStruct& label )
@@ -1225,6 +1407,8 @@ namespace _INTERNAL{
         Predicate pred;
         pred.Set( GEN::PM_SEQUENTIAL_FLAG, m_bPredBlockInvert );
 
+        m_ScheduleBarriers.push_back( m_nPredStart );
+        m_ScheduleBarriers.push_back( m_Instructions.size() );
         while( m_nPredStart < m_Instructions.size() )
         {
             m_Instructions[m_nPredStart].SetPredicate(pred);
@@ -1235,29 +1419,195 @@ namespace _INTERNAL{
         m_pPred=0;
     }
 
-    bool Parser::Begin( size_t line )
+    //
+    // Structured control flow.
+    //
+    //  if/else/endif and do/while/break/cont use the hardware branch instructions, so channels
+    //   which fail the condition are masked off rather than making the whole thread branch.
+    //   JIP is where the thread goes if no channels are left, UIP is where channels re-converge.
+    //  Offsets are in 8-byte units relative to the branch, assuming 16 bytes per instruction.
+    //    The encoder fixes them up if it compacts anything.
+    //
+    //  Gen7 has no 'do' instruction.  'do' just marks the top of the loop for the 'while' to jump back to
+    //
+    bool Parser::PushBranch( size_t nLine, GEN::Operations eOp, int nExecSize, ParseNode* pFlagRef, bool bInvert )
     {
-        m_pPred=0;
+        if( !IsValidExecSize(nExecSize) )
+        {
+            Error( nLine, "Bad exec size");
+            return false;
+        }
 
-        // after the pre-amble is done, allocate registers for all 'reg' declarations
-        //   We allow mixing of 'reg' and 'curbe' in the pre-amble, so we need to defer
-        //  the assignment of 'reg' regs until all the curbes are known
-        size_t nRegNum = m_nCURBERegCount+1;
-        for( size_t i=0; i<m_NamedRegs.size(); i++ )
+        GEN::BranchInstruction inst( nExecSize, eOp, 0, 0 );
+        if( pFlagRef )
         {
-            if( m_NamedRegs[i].reg.GetRegNumber() == 0 )
-            {
-                if( nRegNum >= 128 )
-                {
-                    Error(line, "Too many reg declarations");
-                    return false;
-                }
+            Predicate pred;
+            pred.Set( GEN::PM_SEQUENTIAL_FLAG, bInvert );
+            inst.SetPredicate(pred);
+            inst.SetFlagReference( static_cast<FlagReferenceNode*>(pFlagRef)->Flag );
+        }
 
-                m_NamedRegs[i].reg.SetRegNumber(nRegNum);
-                nRegNum += m_NamedRegs[i].nRegArraySize;
-            }
+        m_Instructions.push_back(inst);
+        return true;
+    }
+
+    void Parser::SetJIP( size_t nBranch, size_t nTarget )
+    {
+        GEN::BranchInstruction& rBranch = static_cast<GEN::BranchInstruction&>( m_Instructions[nBranch] );
+        rBranch.SetJIP( 2*((int)nTarget - (int)nBranch) );
+    }
+
+    void Parser::SetUIP( size_t nBranch, size_t nTarget )
+    {
+        GEN::BranchInstruction& rBranch = static_cast<GEN::BranchInstruction&>( m_Instructions[nBranch] );
+        rBranch.SetUIP( 2*((int)nTarget - (int)nBranch) );
+    }
+
+    void Parser::PatchJIPs( FlowBlock& rBlock, size_t nTarget )
+    {
+        for( size_t i=0; i<rBlock.JIPs.size(); i++ )
+            SetJIP( rBlock.JIPs[i], nTarget );
+        rBlock.JIPs.clear();
+    }
+
+    void Parser::If( TokenStruct& tok, int nExecSize, ParseNode* pFlagRef, bool bInvert )
+    {
+        if( !pFlagRef )
+            return; // pass errors through
+
+        FlowBlock block;
+        block.bLoop     = false;
+        block.nLine     = tok.LineNumber;
+        block.nExecSize = nExecSize;
+        block.nStart    = m_Instructions.size();
+        block.nElse     = 0;
+        if( !PushBranch( tok.LineNumber, GEN::OP_IF, nExecSize, pFlagRef, bInvert ) )
+            return;
+
+        m_FlowBlocks.push_back(block);
+    }
+
+    void Parser::Else( TokenStruct& tok )
+    {
+        if( m_FlowBlocks.empty() || m_FlowBlocks.back().bLoop || m_FlowBlocks.back().nElse )
+        {
+            Error( tok.LineNumber, "'else' without matching 'if'");
+            return;
+        }
+
+        FlowBlock& rBlock = m_FlowBlocks.back();
+        rBlock.nElse = m_Instructions.size();
+        PatchJIPs( rBlock, rBlock.nElse );
+        PushBranch( tok.LineNumber, GEN::OP_ELSE, rBlock.nExecSize, 0, false );
+    }
+
+    void Parser::EndIf( TokenStruct& tok )
+    {
+        if( m_FlowBlocks.empty() || m_FlowBlocks.back().bLoop )
+        {
+            Error( tok.LineNumber, "'endif' without matching 'if'");
+            return;
+        }
+
+        FlowBlock& rBlock = m_FlowBlocks.back();
+        size_t nEndIf = m_Instructions.size();
+        PatchJIPs( rBlock, nEndIf );
+        PushBranch( tok.LineNumber, GEN::OP_ENDIF, rBlock.nExecSize, 0, false );
+
+        // 'if' skips to just past the 'else' if there is one. 'else' skips to the 'endif'
+        SetUIP( rBlock.nStart, nEndIf );
+        if( rBlock.nElse )
+        {
+            SetJIP( rBlock.nStart, rBlock.nElse+1 );
+            SetJIP( rBlock.nElse, nEndIf );
+            SetUIP( rBlock.nElse, nEndIf );
+        }
+        else
+        {
+            SetJIP( rBlock.nStart, nEndIf );
+        }
+
+        m_FlowBlocks.pop_back();
+
+        // 'endif' JIP is the end of the enclosing block, or the next instruction if there isn't one
+        if( m_FlowBlocks.empty() )
+            SetJIP( nEndIf, nEndIf+1 );
+        else
+            m_FlowBlocks.back().JIPs.push_back(nEndIf);
+    }
+
+    void Parser::Do( TokenStruct& tok )
+    {
+        FlowBlock block;
+        block.bLoop     = true;
+        block.nLine     = tok.LineNumber;
+        block.nExecSize = 0;
+        block.nStart    = m_Instructions.size();
+        block.nElse     = 0;
+        m_FlowBlocks.push_back(block);
+    }
+
+    void Parser::While( TokenStruct& tok, int nExecSize, ParseNode* pFlagRef, bool bInvert )
+    {
+        if( m_FlowBlocks.empty() || !m_FlowBlocks.back().bLoop )
+        {
+            Error( tok.LineNumber, "'while' without matching 'do'");
+            return;
         }
 
+        FlowBlock& rBlock = m_FlowBlocks.back();
+        size_t nWhile = m_Instructions.size();
+        if( nWhile == rBlock.nStart )
+        {
+            Error( tok.LineNumber, "Empty loop");
+            m_FlowBlocks.pop_back(); // so that 'End' doesn't report it again
+            return;
+        }
+
+        if( !PushBranch( tok.LineNumber, GEN::OP_WHILE, nExecSize, pFlagRef, bInvert ) )
+        {
+            m_FlowBlocks.pop_back();
+            return;
+        }
+
+        SetJIP( nWhile, rBlock.nStart );
+        PatchJIPs( rBlock, nWhile );
+        for( size_t i=0; i<rBlock.UIPs.size(); i++ )
+            SetUIP( rBlock.UIPs[i], nWhile );
+
+        m_FlowBlocks.pop_back();
+    }
+
+    void Parser::LoopJump( TokenStruct& tok, GEN::Operations eOp, int nExecSize, ParseNode* pFlagRef, bool bInvert )
+    {
+        // find the innermost loop.  UIP goes to its 'while', JIP goes to the end of the innermost block
+        size_t nLoop = m_FlowBlocks.size();
+        while( nLoop > 0 && !m_FlowBlocks[nLoop-1].bLoop )
+            nLoop--;
+
+        if( nLoop == 0 )
+        {
+            Error( tok.LineNumber, "'break' or 'cont' outside of a loop");
+            return;
+        }
+
+        size_t nBranch = m_Instructions.size();
+        if( !PushBranch( tok.LineNumber, eOp, nExecSize, pFlagRef, bInvert ) )
+            return;
+
+        m_FlowBlocks[nLoop-1].UIPs.push_back(nBranch);
+        m_FlowBlocks.back().JIPs.push_back(nBranch);
+    }
+
+    bool Parser::Begin( size_t line )
+    {
+        m_pPred=0;
+
+        // 'reg' declarations are placed by 'AllocateRegisters' once the whole program is known.
+        //   We allow mixing of 'reg' and 'curbe' in the pre-amble, so the curbes need to be known 
+        //   before any of the 'reg' regs can be placed anyway
+        m_nBeginLine = line;
+
         // Start every program by saving off the r0 header 
         m_Instructions.push_back( GEN::RegMove(GEN::REG_GPR,127,GEN::REG_GPR,0) );
         return true;
@@ -1265,6 +1615,13 @@ namespace _INTERNAL{
 
     void Parser::End()
     {
+        if( !m_FlowBlocks.empty() )
+        {
+            const FlowBlock& rBlock = m_FlowBlocks.back();
+            Error( rBlock.nLine, rBlock.bLoop ? "'do' without matching 'while'" : "'if' without matching 'endif'" );
+            return;
+        }
+
         // now that we have all the labels, build the jumps
         for( auto& it : m_Jumps )
         {
@@ -1307,41 +1664,454 @@ namespace _INTERNAL{
         //    Note that docs specify that upper regs should be used to send EOT message.
         //     because new threads can spawn concurrently with the message processing
         m_Instructions.push_back( GEN::SendEOT(127) );
+
+        if( !m_bError && AllocateRegisters() )
+        {
+            if( m_bOptimize )
+                Optimize();
+            if( m_bCoalesceSends )
+                CoalesceSends();
+            if( m_pLatencies )
+                Schedule();
+            if( m_bDependencyControl )
+                AddDependencyControl();
+        }
     }
 
     Parser::LabelInfo* Parser::FindLabel( const char* pLabel )
     {
-        for( auto& it : m_Labels )
+        size_t i = m_LabelNames.Find( pLabel );
+        return (i == (size_t)-1) ? 0 : &m_Labels[i];
+    }
+
+    Parser::NamedReg* Parser::FindNamedReg( const char* pLabel )
+    {
+        size_t i = m_RegNames.Find( pLabel );
+        return (i == (size_t)-1) ? 0 : &m_NamedRegs[i];
+    }
+    
+    Parser::BindPoint* Parser::FindBindPoint( const char* pName )
+    {
+        size_t i = m_BindNames.Find( pName );
+        return (i == (size_t)-1) ? 0 : &m_BindPoints[i];
+    }
+
+    void Parser::AddNamedReg( const char* pLabel, GEN::DirectRegReference reg, size_t nArraySize, bool bVirtual )
+    {
+        m_RegNames.Insert( pLabel, m_NamedRegs.size() );
+        m_NamedRegs.push_back(NamedReg(pLabel,reg, nArraySize,bVirtual));
+    }
+
+    void Parser::TrackReg( size_t nLine, size_t nOperand, size_t nNamedReg )
+    {
+        if( nNamedReg == (size_t)-1 )
+            return;
+
+        RegUse use;
+        use.nLine        = nLine;
+        use.nInstruction = m_Instructions.size()-1;
+        use.nOperand     = nOperand;
+        use.nNamedReg    = nNamedReg;
+        use.bConditional = !m_FlowBlocks.empty();
+        m_RegUses.push_back(use);
+    }
+
+    void Parser::TrackRegs( ParseNode* pDst, ParseNode* pSrc0, ParseNode* pSrc1, ParseNode* pSrc2 )
+    {
+        if( pDst )
+            TrackReg( pDst->LineNumber, 0, static_cast<DestRegNode*>(pDst)->nNamedReg );
+
+        ParseNode* pSources[] = { pSrc0, pSrc1, pSrc2 };
+        for( size_t i=0; i<3; i++ )
         {
-            if( strcmp( it.pName, pLabel ) == 0 )
-                return &it;
+            SourceNode* pSrc = static_cast<SourceNode*>( pSources[i] );
+            if( pSrc && !pSrc->IsImmediate() )
+                TrackReg( pSrc->LineNumber, i+1, static_cast<SourceRegNode*>(pSrc)->nNamedReg );
         }
-        return 0;
     }
 
-    Parser::NamedReg* Parser::FindNamedReg( const char* pLabel )
+    bool GetOperandRegion( const Instruction& rInst, size_t nOperand, RegisterRegion* pRegion, DataTypes* pType, size_t* pMsgRegs )
     {
-        for( auto& it : m_NamedRegs )
+        DestOperand dst;
+        SourceOperand src;
+        size_t nMsgRegs = 0;
+        switch( rInst.GetClass() )
         {
-            if( strcmp( it.pName, pLabel ) == 0 )
-                return &it;
+        case IC_UNARY:
+            {
+                const UnaryInstruction& it = static_cast<const UnaryInstruction&>(rInst);
+                dst = it.GetDest();
+                if( nOperand == 1 )
+                    src = it.GetSource0();
+            }
+            break;
+        case IC_BINARY:
+            {
+                const BinaryInstruction& it = static_cast<const BinaryInstruction&>(rInst);
+                dst = it.GetDest();
+                if( nOperand == 1 )
+                    src = it.GetSource0();
+                else if( nOperand == 2 )
+                    src = it.GetSource1();
+            }
+            break;
+        case IC_TERNARY:
+            {
+                const TernaryInstruction& it = static_cast<const TernaryInstruction&>(rInst);
+                dst = it.GetDest();
+                if( nOperand == 1 )
+                    src = it.GetSource0();
+                else if( nOperand == 2 )
+                    src = it.GetSource1();
+                else if( nOperand == 3 )
+                    src = it.GetSource2();
+            }
+            break;
+        case IC_MATH:
+            {
+                const MathInstruction& it = static_cast<const MathInstruction&>(rInst);
+                dst = it.GetDest();
+                if( nOperand == 1 )
+                    src = it.GetSource0();
+                else if( nOperand == 2 )
+                    src = it.GetSource1();
+            }
+            break;
+        case IC_SEND:
+            {
+                // sends read and write whole registers
+                const SendInstruction& it = static_cast<const SendInstruction&>(rInst);
+                dst = it.GetDest();
+                src = it.GetSource();
+                nMsgRegs = (nOperand == 0) ? it.GetResponseLengthFromDescriptor() : it.GetMessageLengthFromDescriptor();
+                if( !nMsgRegs || nOperand > 1 )
+                    return false;
+            }
+            break;
+        default:
+            return false;
         }
-        return 0;
+
+        *pMsgRegs = nMsgRegs;
+        if( nOperand == 0 )
+        {
+            *pRegion = dst.GetRegRegion();
+            *pType   = dst.GetDataType();
+        }
+        else
+        {
+            if( src.GetDataType() == DT_INVALID || src.IsImmediate() )
+                return false;
+            *pRegion = src.GetRegRegion();
+            *pType   = src.GetDataType();
+        }
+        return true;
     }
-    
-    Parser::BindPoint* Parser::FindBindPoint( const char* pName )
+
+    /// Find where each instruction can go next.  There are 3 entries per instruction, unused ones are -1
+    void Parser::GetSuccessors( std::vector<size_t>& rSuccessors ) const
     {
-        for( auto& it : m_BindPoints )
+        // Jumps are 'add ip' with offsets of 16 bytes per instruction, and branch offsets are in units of 8 bytes
+        size_t nInstructions = m_Instructions.size();
+        rSuccessors.assign( 3*nInstructions, (size_t)-1 );
+        for( size_t i=0; i<nInstructions; i++ )
         {
-            if( strcmp( it.pName, pName ) == 0 )
-                return &it;
+            const Instruction& rInst = m_Instructions[i];
+            size_t* pSucc = &rSuccessors[3*i];
+            int nTarget;
+            if( GetJumpTarget( rInst, 16*i, &nTarget ) )
+            {
+                pSucc[0] = (size_t)(nTarget/16);
+                if( rInst.GetPredicate().GetMode() != PM_NONE )
+                    pSucc[1] = i+1;
+            }
+            else if( rInst.GetClass() == IC_BRANCH )
+            {
+                const BranchInstruction& rBranch = static_cast<const BranchInstruction&>(rInst);
+                pSucc[0] = i+1;
+                pSucc[1] = (size_t)( (int)i + rBranch.GetJIP()/2 );
+                pSucc[2] = (size_t)( (int)i + rBranch.GetUIP()/2 );
+            }
+            else if( rInst.GetClass() != IC_SEND || !static_cast<const SendInstruction&>(rInst).IsEOT() )
+            {
+                pSucc[0] = i+1;
+            }
         }
-        return 0;
     }
 
-    void Parser::AddNamedReg( const char* pLabel, GEN::DirectRegReference reg, size_t nArraySize )
+    //
+    // Register allocation for 'reg' declarations.
+    //
+    //  Until this runs, references to a 'reg' are numbered relative to the start of the declaration.
+    //  We do a backwards liveness pass over the program, and let declarations which are never 
+    //   live at the same time share registers.  
+    //
+    //  A few things constrain where a declaration can go:
+    //    - Regions which run off the end of a declaration into the next one are legal, and people
+    //       do it on purpose.  Declarations which are joined this way stay together, in declaration order
+    //    - Declarations which are indexed through a0 are kept live for the whole program,
+    //       since we don't know which registers are touched.  They are placed first so that they 
+    //       stay in the first 512 bytes of the register file.  Indexing can run past the end, so every
+    //       declaration after an indexed one stays behind it in declaration order, as if they were joined
+    //    - GPRs which are referenced by number are never used, nor is r127, which holds the r0 header
+    //    - Writes which are predicated, which are inside structured control flow, or which 
+    //       only cover part of a register do not end a live range
+    //
+    bool Parser::AllocateRegisters()
     {
-        m_NamedRegs.push_back(NamedReg(pLabel,reg, nArraySize));
+        // number the 'reg' declarations as if they were laid out end to end
+        size_t nNamedRegs = m_NamedRegs.size();
+        std::vector<size_t> VirtualBase( nNamedRegs, 0 );
+        std::vector<size_t> Extent( nNamedRegs, 0 );
+        std::vector<bool> Pinned( nNamedRegs, false );
+        size_t nVirtualRegs = 0;
+        for( size_t i=0; i<nNamedRegs; i++ )
+        {
+            if( !m_NamedRegs[i].bVirtual )
+                continue;
+            VirtualBase[i] = nVirtualRegs;
+            Extent[i]      = m_NamedRegs[i].nRegArraySize;
+            nVirtualRegs  += m_NamedRegs[i].nRegArraySize;
+        }
+
+        if( !nVirtualRegs )
+            return true;
+
+        // find out how far each declaration's references reach, and which operands are references to 'reg's
+        size_t nInstructions = m_Instructions.size();
+        std::vector<uint8> Tracked( nInstructions, 0 );
+        for( size_t u=0; u<m_RegUses.size(); u++ )
+        {
+            const RegUse& rUse = m_RegUses[u];
+            Tracked[rUse.nInstruction] |= (1<<rUse.nOperand);
+
+            bool bIndirect;
+            size_t nFirst, nEnd;
+            if( !GetGPRFootprint( m_Instructions[rUse.nInstruction], rUse.nOperand, &bIndirect, &nFirst, &nEnd ) )
+                continue;
+            if( bIndirect )
+                Pinned[rUse.nNamedReg] = true;
+            else
+                Extent[rUse.nNamedReg] = std::max( Extent[rUse.nNamedReg], (nEnd+31)/32 );
+        }
+
+        // anything else which touches a GPR by number makes that GPR off limits
+        bool RawGPRs[128];
+        memcpy( RawGPRs, m_RawGPRs, sizeof(RawGPRs) );
+        RawGPRs[127] = true;
+        for( size_t i=0; i<nInstructions; i++ )
+        {
+            for( size_t nOperand=0; nOperand<4; nOperand++ )
+            {
+                bool bIndirect;
+                size_t nFirst, nEnd;
+                if( (Tracked[i] & (1<<nOperand)) ||
+                    !GetGPRFootprint( m_Instructions[i], nOperand, &bIndirect, &nFirst, &nEnd ) || bIndirect )
+                    continue;
+                for( size_t r=nFirst/32; r<(nEnd+31)/32 && r<128; r++ )
+                    RawGPRs[r] = true;
+            }
+        }
+
+        // join declarations which are reached into from the one before.  
+        struct Group
+        {
+            size_t nVirtualBase;
+            size_t nRegs;
+            size_t nFirstSlot;  ///< Index of this group's first register in the liveness bitsets
+            size_t nBase;       ///< Where it ended up
+            bool bPinned;
+            bool bPlaced;
+        };
+        std::vector<Group> Groups;
+        std::vector<size_t> GroupOf( nNamedRegs, (size_t)-1 );
+        size_t nSlots = 0;
+        bool bIndexedTail = false;
+        for( size_t i=0; i<nNamedRegs; i++ )
+        {
+            if( !m_NamedRegs[i].bVirtual )
+                continue;
+
+            if( Groups.empty() || (!bIndexedTail && Groups.back().nVirtualBase + Groups.back().nRegs <= VirtualBase[i]) )
+            {
+                if( !Groups.empty() )
+                    nSlots += Groups.back().nRegs;
+
+                Group g;
+                g.nVirtualBase = VirtualBase[i];
+                g.nRegs        = 0;
+                g.nFirstSlot   = nSlots;
+                g.nBase        = 0;
+                g.bPinned      = false;
+                g.bPlaced      = false;
+                Groups.push_back(g);
+            }
+
+            Group& rGroup = Groups.back();
+            rGroup.nRegs    = std::max( rGroup.nRegs, VirtualBase[i] - rGroup.nVirtualBase + Extent[i] );
+            rGroup.bPinned |= Pinned[i];
+            bIndexedTail   |= Pinned[i];
+            GroupOf[i] = Groups.size()-1;
+        }
+        nSlots += Groups.back().nRegs;
+
+        // registers each instruction reads, writes, and completely overwrites
+        size_t nWords = (nSlots+31)/32;
+        std::vector<uint32> Uses( nInstructions*nWords, 0 );
+        std::vector<uint32> Kills( nInstructions*nWords, 0 );
+        std::vector<uint32> Touches( nInstructions*nWords, 0 );
+        for( size_t u=0; u<m_RegUses.size(); u++ )
+        {
+            const RegUse& rUse = m_RegUses[u];
+            const Instruction& rInst = m_Instructions[rUse.nInstruction];
+            bool bIndirect;
+            size_t nFirst, nEnd;
+            if( !GetGPRFootprint( rInst, rUse.nOperand, &bIndirect, &nFirst, &nEnd ) || bIndirect )
+                continue;
+
+            const Group& rGroup = Groups[GroupOf[rUse.nNamedReg]];
+            size_t nSlot = rGroup.nFirstSlot + VirtualBase[rUse.nNamedReg] - rGroup.nVirtualBase;
+            bool bKill = rUse.nOperand == 0 && !rUse.bConditional && IsWholeRegWrite( rInst, nFirst, nEnd );
+            size_t nWord = rUse.nInstruction*nWords;
+            for( size_t r=nFirst/32; r<(nEnd+31)/32; r++ )
+            {
+                uint32 nBit = 1u<<((nSlot+r)%32);
+                size_t w    = nWord + (nSlot+r)/32;
+                Touches[w] |= nBit;
+                if( rUse.nOperand != 0 )
+                    Uses[w] |= nBit;
+                else if( bKill )
+                    Kills[w] |= nBit;
+            }
+        }
+
+        std::vector<size_t> Successors;
+        GetSuccessors( Successors );
+
+        // iterate to a fixed point, going backwards since liveness flows that way
+        std::vector<uint32> LiveIn( nInstructions*nWords, 0 );
+        std::vector<uint32> LiveOut( nInstructions*nWords, 0 );
+        bool bChanged = true;
+        while( bChanged )
+        {
+            bChanged = false;
+            for( size_t i=nInstructions; i-- > 0; )
+            {
+                uint32* pIn  = &LiveIn[i*nWords];
+                uint32* pOut = &LiveOut[i*nWords];
+                for( size_t s=0; s<3; s++ )
+                {
+                    size_t nSucc = Successors[3*i+s];
+                    if( nSucc >= nInstructions )
+                        continue;
+                    for( size_t w=0; w<nWords; w++ )
+                        pOut[w] |= LiveIn[nSucc*nWords+w];
+                }
+
+                for( size_t w=0; w<nWords; w++ )
+                {
+                    uint32 nIn = Uses[i*nWords+w] | (pOut[w] & ~Kills[i*nWords+w]);
+                    if( nIn != pIn[w] )
+                    {
+                        pIn[w] = nIn;
+                        bChanged = true;
+                    }
+                }
+            }
+        }
+
+        // groups interfere if they're both live, or touched, at the same instruction.  
+        std::vector<size_t> SlotGroups( nSlots );
+        for( size_t g=0; g<Groups.size(); g++ )
+            for( size_t r=0; r<Groups[g].nRegs; r++ )
+                SlotGroups[ Groups[g].nFirstSlot + r ] = g;
+
+        size_t nGroups = Groups.size();
+        std::vector<bool> Interferes( nGroups*nGroups, false );
+        std::vector<size_t> Present;
+        for( size_t i=0; i<nInstructions; i++ )
+        {
+            Present.clear();
+            for( size_t s=0; s<nSlots; s++ )
+            {
+                size_t w = i*nWords + s/32;
+                if( ((LiveIn[w] | LiveOut[w] | Touches[w]) >> (s%32)) & 1 )
+                {
+                    if( Present.empty() || Present.back() != SlotGroups[s] )
+                        Present.push_back( SlotGroups[s] );
+                }
+            }
+
+            for( size_t a=0; a<Present.size(); a++ )
+                for( size_t b=0; b<Present.size(); b++ )
+                    Interferes[ Present[a]*nGroups + Present[b] ] = true;
+        }
+
+        // place indexed groups first, then everything else in declaration order, 
+        //   each one at the lowest register that nothing it interferes with is using
+        for( size_t nPass=0; nPass<2; nPass++ )
+        {
+            for( size_t g=0; g<nGroups; g++ )
+            {
+                Group& rGroup = Groups[g];
+                if( rGroup.bPinned != (nPass == 0) )
+                    continue;
+
+                size_t nBase = m_nCURBERegCount+1;
+                while( nBase + rGroup.nRegs <= 128 )
+                {
+                    size_t nConflict = 0;
+                    for( size_t r=nBase; r<nBase+rGroup.nRegs; r++ )
+                        if( RawGPRs[r] )
+                            nConflict = r+1;
+
+                    for( size_t h=0; h<nGroups; h++ )
+                    {
+                        const Group& rOther = Groups[h];
+                        if( !rOther.bPlaced || 
+                            !(rGroup.bPinned || rOther.bPinned || Interferes[g*nGroups+h]) )
+                            continue;
+                        if( rOther.nBase < nBase+rGroup.nRegs && nBase < rOther.nBase+rOther.nRegs )
+                            nConflict = std::max( nConflict, rOther.nBase+rOther.nRegs );
+                    }
+
+                    if( !nConflict )
+                        break;
+                    nBase = nConflict;
+                }
+
+                if( nBase + rGroup.nRegs > 128 )
+                {
+                    Error( m_nBeginLine, "Too many reg declarations");
+                    return false;
+                }
+
+                rGroup.nBase   = nBase;
+                rGroup.bPlaced = true;
+            }
+        }
+
+        for( size_t i=0; i<nNamedRegs; i++ )
+        {
+            if( GroupOf[i] != (size_t)-1 )
+            {
+                const Group& rGroup = Groups[GroupOf[i]];
+                m_NamedRegs[i].reg.SetRegNumber( rGroup.nBase + VirtualBase[i] - rGroup.nVirtualBase );
+            }
+        }
+
+        // and move all the references
+        for( size_t u=0; u<m_RegUses.size(); u++ )
+        {
+            const RegUse& rUse = m_RegUses[u];
+            if( !m_Instructions[rUse.nInstruction].RelocateGPR( rUse.nOperand, m_NamedRegs[rUse.nNamedReg].reg.GetRegNumber() ) )
+            {
+                Error( rUse.nLine, "Base register for indirect addressing is too high. Must start within the first 512 bytes of reg file");
+                return false;
+            }
+        }
+
+        return true;
     }
 
     void Parser::VecIMMPush( ParseNode* pN )
@@ -1407,9 +2177,8 @@ namespace _INTERNAL{
                     }
 
                     
-                    ImmediateNode* pImm = new ImmediateNode(m_nVecIMMLine);
+                    ImmediateNode* pImm = NewNode<ImmediateNode>(m_nVecIMMLine);
                     pImm->imm = PackHalfByte_SINT(pValues);
-                    m_Nodes.push_back(pImm);
                     return pImm;
                 }
                 else
@@ -1423,9 +2192,8 @@ namespace _INTERNAL{
                         }
                     }
                     
-                    ImmediateNode* pImm = new ImmediateNode(m_nVecIMMLine);
+                    ImmediateNode* pImm = NewNode<ImmediateNode>(m_nVecIMMLine);
                     pImm->imm = PackHalfByte_UINT((const uint32*)pValues);
-                    m_Nodes.push_back(pImm);
                     return pImm;
                 }
             }
@@ -1437,7 +2205,7 @@ namespace _INTERNAL{
 
     //=====================================================================================================================
     //=====================================================================================================================
-    static size_t StripComments( char* p )
+    size_t StripComments( char* p )
     {
         size_t nLine=1;
         int i=0;
@@ -1478,13 +2246,10 @@ namespace _INTERNAL{
     }
 
 
-    bool Parser::Parse( const char* pText, IPrinter* pErrorStream )
+    bool Parser::Preprocess( const char* pText, std::string& rOut, IPrinter* pErrorStream )
     {
-        if( yylex_init_extra( this, &m_scanner ) != 0 )
-        {
-            m_bError = true;
-            return false;
-        }
+        m_pErrorPrinter = pErrorStream;
+        m_bError = false;
 
         char* pMutableText = (char*)malloc( strlen(pText)+1 );
         strcpy(pMutableText,pText);
@@ -1496,11 +2261,36 @@ namespace _INTERNAL{
             return false;
         }
 
-        m_pText = pMutableText;
+        bool bExpanded = ExpandMacros( pMutableText, rOut );
+        free(pMutableText);
+        return bExpanded;
+    }
+
+    bool Parser::Parse( const char* pText, IPrinter* pErrorStream )
+    {
+        std::string expanded;
+        if( !Preprocess( pText, expanded, pErrorStream ) )
+            return false;
+        return ParsePreprocessed( expanded.c_str(), pErrorStream );
+    }
+
+    bool Parser::ParsePreprocessed( const char* pText, IPrinter* pErrorStream )
+    {
+        if( yylex_init_extra( this, &m_scanner ) != 0 )
+        {
+            m_bError = true;
+            return false;
+        }
+
+        m_pText = pText;
         m_pErrorPrinter = pErrorStream;
         m_bError = false;
         m_nThreadsPerGroup = 1;
         m_nCURBERegCount = 0;
+        m_nBeginLine = 0;
+        m_RegUses.clear();
+        m_ScheduleBarriers.clear();
+        memset( m_RawGPRs, 0, sizeof(m_RawGPRs) );
        
 
         
@@ -1513,7 +2303,6 @@ namespace _INTERNAL{
         }
 
         yylex_destroy( m_scanner );
-        free(pMutableText);
         return !m_bError;
     }
 
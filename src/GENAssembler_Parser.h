@@ -1,11 +1,14 @@
 
 
 
-#include <string>
-#include <list>
 #include <vector>
+#include <string>
+#include <new>
+#include <string.h>
 
 #include "GENIsa.h"
+#include "GENAssembler.h"
+#include "GENAnalysis.h" // for 'Resources' and the operand footprints
 
 typedef void* yyscan_t;
 
@@ -37,17 +40,101 @@ namespace GEN
             } fields;
         };
 
+        /// Bump allocator for parse nodes and token strings.  Everything in it is freed at once, when the arena goes away.
+        ///   Destructors are never run, so it may only hold things which don't need them
+        class Arena
+        {
+        public:
+            Arena() : m_pCurrent(0), m_nRemaining(0) {}
+            ~Arena() { Clear(); }
+
+            void* Allocate( size_t nBytes );
+            const char* StoreString( const char* pString );
+            void Clear();
+
+        private:
+            Arena( const Arena& );
+            Arena& operator=( const Arena& );
+
+            enum
+            {
+                BLOCK_SIZE = 16*1024,
+                ALIGNMENT  = 16,
+            };
+
+            std::vector<void*> m_Blocks;
+            uint8* m_pCurrent;
+            size_t m_nRemaining;
+        };
+
+        /// Hash table which maps names to indices.  Names are not copied, so they must outlive the table
+        class SymbolTable
+        {
+        public:
+            SymbolTable() : m_nCount(0) {}
+
+            /// Returns false, and changes nothing, if the name is already in the table
+            bool Insert( const char* pName, size_t nValue );
+
+            /// Returns the value for the first 'nLength' characters of 'pName', or -1 if there isn't one
+            size_t Find( const char* pName, size_t nLength ) const;
+            size_t Find( const char* pName ) const { return Find( pName, strlen(pName) ); }
+
+            void Clear() { m_Entries.clear(); m_nCount = 0; }
+
+        private:
+            struct Entry
+            {
+                const char* pName;  ///< Null for empty slots
+                size_t nLength;
+                uint32 nHash;
+                size_t nValue;
+            };
+
+            static uint32 Hash( const char* pName, size_t nLength );
+            void Grow();
+
+            std::vector<Entry> m_Entries;   ///< Open addressing, the size is always a power of two
+            size_t m_nCount;
+        };
+
         class Parser
         {
         public:
+            Parser() : m_pLatencies(0), m_bOptimize(false), m_pOptimizationReport(0), m_bCoalesceSends(false), m_pCoalescingReport(0), m_bDependencyControl(false), m_pIncludeHandler(0) {}
             ~Parser();
 
+            /// Schedule the instructions once they're parsed, using these latencies.  Null turns the scheduler off
+            void SetLatencies( const LatencyTable* pLatencies ) { m_pLatencies = pLatencies; }
+
+            /// Run the peephole and dead-code optimizer once the instructions are parsed, and print what it did to 'pReport', if any
+            void SetOptimization( bool bEnable, IPrinter* pReport ) { m_bOptimize = bEnable; m_pOptimizationReport = pReport; }
+
+            /// Merge scattered dword loads into untyped reads after optimizing, and print what was merged to 'pReport', if any
+            void SetSendCoalescing( bool bEnable, IPrinter* pReport ) { m_bCoalesceSends = bEnable; m_pCoalescingReport = pReport; }
+
+            /// Set NoDDClr/NoDDChk on runs of independent partial writes to the same GPR, after everything else
+            void SetDependencyControl( bool bEnable ) { m_bDependencyControl = bEnable; }
+
+            /// Where the preprocessor gets the text of '#include' files.  Null reads them from disk
+            void SetIncludeHandler( IIncludeHandler* pHandler ) { m_pIncludeHandler = pHandler; }
+
+            /// Pre-define a macro with no parameters
+            void Define( const char* pName, const char* pValue );
+
             const std::vector<Instruction>& GetInstructions() { return m_Instructions; }
             const std::vector<uint8>& GetCURBE() const { return m_CURBE; }
             size_t GetThreadsPerGroup() const { return m_nThreadsPerGroup; }
 
+            /// Preprocess and then parse
             bool Parse( const char* pText, IPrinter* pErrorStream );
 
+            /// Strip comments and expand macros, includes and repeats
+            bool Preprocess( const char* pText, std::string& rOut, IPrinter* pErrorStream );
+
+            /// Parse text which has already been through 'Preprocess'
+            bool ParsePreprocessed( const char* pText, IPrinter* pErrorStream );
+
             bool Begin( size_t line );
             void End();
 
@@ -97,6 +184,13 @@ namespace GEN
             void BeginPredBlock( ParseNode* pFlagRef, bool bInvert );
             void EndPredBlock();
 
+            void If( TokenStruct& tok, int nExecSize, ParseNode* pFlagRef, bool bInvert );
+            void Else( TokenStruct& tok );
+            void EndIf( TokenStruct& tok );
+            void Do( TokenStruct& tok );
+            void While( TokenStruct& tok, int nExecSize, ParseNode* pFlagRef, bool bInvert );
+            void LoopJump( TokenStruct& tok, GEN::Operations eOp, int nExecSize, ParseNode* pFlagRef, bool bInvert );
+
 
             void BeginIMM_UVec( size_t line ) { m_nVecIMMNodes=0; m_nVecIMMLine = line; m_eVecImmType = GEN::DT_VEC_HALFBYTE_UINT;  }
             void BeginIMM_IVec( size_t line ) { m_nVecIMMNodes=0; m_nVecIMMLine = line; m_eVecImmType = GEN::DT_VEC_HALFBYTE_SINT;  }
@@ -110,14 +204,28 @@ namespace GEN
 
         private:
 
-            bool InterpretRegName( GEN::RegTypes* pRegType, size_t* pRegNum, const TokenStruct& rToken);
+            bool InterpretRegName( GEN::RegTypes* pRegType, size_t* pRegNum, size_t* pNamedReg, const TokenStruct& rToken);
   
+            /// A 'reg' or 'curbe' declaration.  Curbe regs have fixed locations.
+            ///   'reg' declarations are virtual until 'AllocateRegisters' places them, and until then
+            ///   references to them are numbered relative to the start of the declaration
             struct NamedReg
             {
-                NamedReg( const char* p, GEN::DirectRegReference d, size_t nRegs ) : pName(p), reg(d), nRegArraySize(nRegs) {}
+                NamedReg( const char* p, GEN::DirectRegReference d, size_t nRegs, bool bVirtual ) : pName(p), reg(d), nRegArraySize(nRegs), bVirtual(bVirtual) {}
                 const char* pName;
                 GEN::DirectRegReference reg;
                 size_t nRegArraySize;
+                bool bVirtual;
+            };
+
+            /// An instruction operand which refers to a 'reg' declaration
+            struct RegUse
+            {
+                size_t nLine;
+                size_t nInstruction;
+                size_t nOperand;        ///< 0 for the destination, 1+i for source i
+                size_t nNamedReg;
+                bool bConditional;      ///< Instruction is inside structured control flow, so its writes may be partial
             };
 
             struct Jump
@@ -129,6 +237,19 @@ namespace GEN
                 const char* pLabelName;
             };
 
+            /// An open if/else/endif or do/while block.
+            ///   Branch offsets are patched in as the blocks close
+            struct FlowBlock
+            {
+                bool bLoop;
+                size_t nLine;
+                size_t nExecSize;
+                size_t nStart;              ///< Index of the 'if', or of the first instruction in the loop
+                size_t nElse;               ///< Index of the 'else', 0 if there isn't one
+                std::vector<size_t> JIPs;   ///< Branches whose JIP is the next else/endif/while of this block
+                std::vector<size_t> UIPs;   ///< break/cont whose UIP is this loop's 'while'
+            };
+
             struct BindPoint
             {
                 const char* pName;
@@ -142,21 +263,61 @@ namespace GEN
 
             BindPoint* FindBindPoint( const char* pName );
             NamedReg* FindNamedReg( const char* pName );
-            void AddNamedReg( const char* pName, GEN::DirectRegReference reg, size_t nArraySize );
+            void AddNamedReg( const char* pName, GEN::DirectRegReference reg, size_t nArraySize, bool bVirtual );
+            void TrackReg( size_t nLine, size_t nOperand, size_t nNamedReg );
+            void TrackRegs( ParseNode* pDst, ParseNode* pSrc0, ParseNode* pSrc1, ParseNode* pSrc2 );
+            bool AllocateRegisters();
+            void GetSuccessors( std::vector<size_t>& rSuccessors ) const;
+            void Optimize();
+
+            /// Swap in 'rNew', in which old instruction i has become the instructions in [rFirstNew[i],rFirstNew[i+1]), if any.
+            ///   Jumps and branches in 'rNew' still have their old offsets, and are patched, along with the barriers
+            void ReplaceInstructions( std::vector<Instruction>& rNew, const std::vector<size_t>& rFirstNew );
+            void GetRegionBoundaries( std::vector<bool>& rBoundaries ) const;   ///< Instructions which start a region that nothing may cross into
+            void CoalesceSends();
+            void Schedule();
+            void AddDependencyControl();
+            template< class T > T* NewNode( size_t nLine ) { return new( m_Arena.Allocate(sizeof(T)) ) T(nLine); }
+            bool PushBranch( size_t nLine, GEN::Operations eOp, int nExecSize, ParseNode* pFlagRef, bool bInvert );
+            void PatchJIPs( FlowBlock& rBlock, size_t nTarget );
+            void SetJIP( size_t nBranch, size_t nTarget );
+            void SetUIP( size_t nBranch, size_t nTarget );
             LabelInfo* FindLabel( const char* pName );
+            bool ExpandMacros( const char* pText, std::string& rOut );
 
             size_t m_nThreadsPerGroup;
 
             GEN::IPrinter* m_pErrorPrinter;
             const char* m_pText;
-            std::list< std::string > m_TokenStrings;
-            std::vector< ParseNode* > m_Nodes;
+            Arena m_Arena;      ///< Parse nodes and token strings
             std::vector< NamedReg > m_NamedRegs;
             std::vector< BindPoint > m_BindPoints;
             std::vector< LabelInfo > m_Labels;
+            SymbolTable m_RegNames;     ///< Indices into the arrays above
+            SymbolTable m_BindNames;
+            SymbolTable m_LabelNames;
             std::vector< Jump > m_Jumps;
+            std::vector< FlowBlock > m_FlowBlocks;
             std::vector<uint8> m_CURBE;
             std::vector<Instruction> m_Instructions;
+            std::vector<RegUse> m_RegUses;
+            bool m_RawGPRs[128];        ///< GPRs which are referenced by number, and can't be allocated
+            size_t m_nBeginLine;
+            std::vector<size_t> m_ScheduleBarriers;   ///< Instructions which nothing may be moved across the start of
+            const LatencyTable* m_pLatencies;
+            bool m_bOptimize;
+            GEN::IPrinter* m_pOptimizationReport;
+            bool m_bCoalesceSends;
+            GEN::IPrinter* m_pCoalescingReport;
+            bool m_bDependencyControl;
+            IIncludeHandler* m_pIncludeHandler;
+
+            struct Definition
+            {
+                const char* pName;
+                const char* pValue;
+            };
+            std::vector< Definition > m_Definitions;    ///< Names and values are in the arena
 
             ParseNode* m_pVecIMMNodes[8];
             size_t m_nVecIMMNodes;
@@ -176,6 +337,17 @@ namespace GEN
             
         };
 
+        /// Blank out comments, leaving the newlines in place.  Returns the line an unterminated block comment starts on, or 0
+        size_t StripComments( char* p );
+
+        /// Fetch an instruction's register operand.  'nOperand' is 0 for the destination, or 1+i for source i.
+        ///   For sends, 'pMsgRegs' receives the number of whole registers in the message or response.  It is 0 for everything else.
+        ///   Returns false if the operand doesn't exist or is an immediate
+        bool GetOperandRegion( const Instruction& rInst, size_t nOperand, RegisterRegion* pRegion, DataTypes* pType, size_t* pMsgRegs );
+
+        /// Ops which read and write the accumulator without saying so
+        bool UsesImplicitAccumulator( Operations eOp );
+
 
 
 
@@ -0,0 +1,662 @@
+
+#include "GENAssembler_Parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
+
+namespace GEN{
+namespace Assembler{
+namespace _INTERNAL{
+
+    //
+    // Preprocessor.  Runs on the comment-stripped text, before the lexer sees it.
+    //
+    //  #include "file"                 Pastes in another file
+    //  macro NAME { body }             Every later 'NAME' is replaced with the body
+    //  macro NAME(a,b) { body }        'NAME(x,y)' is replaced with the body, with 'a' and 'b' replaced by 'x' and 'y'.
+    //                                   A macro can be defined again only with the same parameters and body
+    //  repeat N as i { body }          The body, N times, with 'i' replaced by 0..N-1
+    //  $( expr )                       An integer expression, evaluated at assembly time.  'tmp$(2*i+1).u'
+    //
+    //  Directives are delimited by braces and parens, not by lines, so they work inside kernels written with STRINGIFY.
+    //  Expansions are pasted in on one line.  The newlines they replaced are put back at the end of that line,
+    //   so line numbers stay right for everything after it.  Errors inside an expansion are reported on the line where it started
+    //
+
+    static const size_t MAX_EXPANSION_DEPTH = 64;
+    static const int MAX_REPEAT_COUNT = 4096;
+
+    static bool IsIDStart( char c ) { return isalpha((unsigned char)c) || c == '_'; }
+    static bool IsIDChar( char c ) { return isalnum((unsigned char)c) || c == '_'; }
+
+    static size_t SkipSpace( const char* p, size_t n, size_t i )
+    {
+        while( i < n && isspace((unsigned char)p[i]) )
+            i++;
+        return i;
+    }
+
+    static size_t SkipID( const char* p, size_t n, size_t i )
+    {
+        while( i < n && IsIDChar(p[i]) )
+            i++;
+        return i;
+    }
+
+    /// Returns the index of the bracket which closes the one at 'nOpen', or 'n' if it's never closed
+    static size_t FindClose( const char* p, size_t n, size_t nOpen )
+    {
+        char open  = p[nOpen];
+        char close = (open == '(') ? ')' : '}';
+        size_t nDepth = 0;
+        for( size_t i=nOpen; i<n; i++ )
+        {
+            if( p[i] == open )
+                nDepth++;
+            else if( p[i] == close && --nDepth == 0 )
+                return i;
+        }
+        return n;
+    }
+
+    static size_t CountLines( const char* p, size_t n )
+    {
+        size_t nLines = 0;
+        for( size_t i=0; i<n; i++ )
+            if( p[i] == '\n' )
+                nLines++;
+        return nLines;
+    }
+
+    static std::string Trim( const std::string& s )
+    {
+        size_t nStart = 0;
+        size_t nEnd = s.length();
+        while( nStart < nEnd && isspace((unsigned char)s[nStart]) )
+            nStart++;
+        while( nEnd > nStart && isspace((unsigned char)s[nEnd-1]) )
+            nEnd--;
+        return s.substr( nStart, nEnd-nStart );
+    }
+
+    /// Recursive descent evaluator for '$()' and repeat counts.  C precedence, integers only
+    class Expression
+    {
+    public:
+        Expression( const char* p ) : m_p(p), m_pError(0) {}
+
+        const char* Evaluate( int* pValue )
+        {
+            *pValue = Or();
+            SkipSpace();
+            if( !m_pError && *m_p )
+                m_pError = "Unexpected characters in expression";
+            return m_pError;
+        }
+
+    private:
+
+        void SkipSpace() { while( isspace((unsigned char)*m_p) ) m_p++; }
+        bool Match( const char* pOp )
+        {
+            SkipSpace();
+            size_t n = strlen(pOp);
+            if( strncmp( m_p, pOp, n ) != 0 )
+                return false;
+            m_p += n;
+            return true;
+        }
+
+        int Or()    { int n = Xor(); while( Match("|") ) n |= Xor(); return n; }
+        int Xor()   { int n = And(); while( Match("^") ) n ^= And(); return n; }
+        int And()   { int n = Shift(); while( Match("&") ) n &= Shift(); return n; }
+        int Shift()
+        {
+            int n = Add();
+            while( true )
+            {
+                if( Match("<<") )      n = (int)((unsigned)n << (Add() & 31));
+                else if( Match(">>") ) n = n >> (Add() & 31);
+                else                   return n;
+            }
+        }
+        int Add()
+        {
+            int n = Mul();
+            while( true )
+            {
+                if( Match("+") )      n = (int)((unsigned)n + (unsigned)Mul());
+                else if( Match("-") ) n = (int)((unsigned)n - (unsigned)Mul());
+                else                  return n;
+            }
+        }
+        int Mul()
+        {
+            int n = Unary();
+            while( true )
+            {
+                bool bDiv = false;
+                if( Match("*") )
+                {
+                    n = (int)((unsigned)n * (unsigned)Unary());
+                    continue;
+                }
+                else if( Match("/") )
+                    bDiv = true;
+                else if( !Match("%") )
+                    return n;
+
+                int d = Unary();
+                if( d == 0 || (d == -1 && n == INT_MIN) )
+                {
+                    if( !m_pError )
+                        m_pError = "Division by zero in expression";
+                    return 0;
+                }
+                n = bDiv ? n/d : n%d;
+            }
+        }
+        int Unary()
+        {
+            if( Match("-") ) return (int)(0u - (unsigned)Unary());
+            if( Match("~") ) return ~Unary();
+            if( Match("+") ) return Unary();
+            return Primary();
+        }
+        int Primary()
+        {
+            SkipSpace();
+            if( Match("(") )
+            {
+                int n = Or();
+                if( !Match(")") && !m_pError )
+                    m_pError = "Missing ')' in expression";
+                return n;
+            }
+            if( isdigit((unsigned char)*m_p) )
+            {
+                char* pEnd;
+                unsigned long n = strtoul( m_p, &pEnd, 0 );
+                m_p = pEnd;
+                return (int)n;
+            }
+            if( !m_pError )
+                m_pError = IsIDStart(*m_p) ? "Unknown name in expression" : "Malformed expression";
+            return 0;
+        }
+
+        const char* m_p;
+        const char* m_pError;
+    };
+
+    class Preprocessor
+    {
+    public:
+        Preprocessor( Parser* pParser, Arena* pArena, IIncludeHandler* pIncludes )
+            : m_pParser(pParser), m_pArena(pArena), m_pIncludes(pIncludes), m_nLine(1), m_nPendingLines(0)
+        {
+        }
+
+        bool Define( const char* pName, const char* pValue )
+        {
+            Macro macro;
+            macro.pName = pName;
+            macro.pBody = pValue;
+            macro.nBodyLength = strlen(pValue);
+            macro.bHasParams = false;
+            return AddMacro( macro );
+        }
+
+        bool Run( const char* pText, std::string& rOut )
+        {
+            Bindings none;
+            if( !Expand( pText, strlen(pText), none, 0, rOut ) )
+                return false;
+            rOut.append( m_nPendingLines, '\n' );
+            return true;
+        }
+
+    private:
+
+        typedef std::vector< std::pair<std::string,std::string> > Bindings;
+
+        struct Macro
+        {
+            const char* pName;
+            std::vector<const char*> Params;
+            const char* pBody;
+            size_t nBodyLength;
+            bool bHasParams;    ///< Invoked with parens, even if there are no params
+        };
+
+        const char* Store( const char* p, size_t n )
+        {
+            char* pCopy = (char*) m_pArena->Allocate(n+1);
+            memcpy( pCopy, p, n );
+            pCopy[n] = 0;
+            return pCopy;
+        }
+
+        static bool IsSameMacro( const Macro& a, const Macro& b )
+        {
+            if( a.bHasParams != b.bHasParams || a.Params.size() != b.Params.size() ||
+                a.nBodyLength != b.nBodyLength || memcmp( a.pBody, b.pBody, a.nBodyLength ) != 0 )
+                return false;
+            for( size_t i=0; i<a.Params.size(); i++ )
+                if( strcmp( a.Params[i], b.Params[i] ) != 0 )
+                    return false;
+            return true;
+        }
+
+        /// Defining a macro again the same way is allowed, so that 'repeat' bodies can contain macros
+        bool AddMacro( const Macro& rMacro )
+        {
+            if( !m_MacroNames.Insert( rMacro.pName, m_Macros.size() ) )
+            {
+                if( IsSameMacro( m_Macros[ m_MacroNames.Find( rMacro.pName ) ], rMacro ) )
+                    return true;
+                m_pParser->ErrorF( m_nLine, "Macro '%s' is already defined differently", rMacro.pName );
+                return false;
+            }
+            m_Macros.push_back( rMacro );
+            return true;
+        }
+
+        const std::string* FindBinding( const Bindings& rBindings, const char* pName, size_t nLength )
+        {
+            for( size_t i=rBindings.size(); i-- > 0; )
+                if( rBindings[i].first.length() == nLength && rBindings[i].first.compare( 0, nLength, pName, nLength ) == 0 )
+                    return &rBindings[i].second;
+            return 0;
+        }
+
+        /// Newlines inside a top-level construct are held back until the end of the line it finishes on
+        void ConsumeLines( const char* p, size_t n, size_t nDepth )
+        {
+            if( nDepth != 0 )
+                return;
+            size_t nLines = CountLines( p, n );
+            m_nLine += nLines;
+            m_nPendingLines += nLines;
+        }
+
+        bool Evaluate( const std::string& rText, int* pValue )
+        {
+            Expression expr( rText.c_str() );
+            const char* pError = expr.Evaluate( pValue );
+            if( pError )
+            {
+                m_pParser->ErrorF( m_nLine, "%s: '%s'", pError, Trim(rText).c_str() );
+                return false;
+            }
+            return true;
+        }
+
+        bool ReadInclude( const std::string& rFileName, std::string& rText )
+        {
+            if( m_pIncludes )
+                return m_pIncludes->Read( rFileName.c_str(), rText );
+
+            FILE* fp = fopen( rFileName.c_str(), "rb" );
+            if( !fp )
+                return false;
+            char buffer[4096];
+            size_t nRead;
+            while( (nRead = fread( buffer, 1, sizeof(buffer), fp )) > 0 )
+                rText.append( buffer, nRead );
+            fclose(fp);
+            return true;
+        }
+
+        size_t Include( const char* p, size_t n, size_t i, const Bindings& rBindings, size_t nDepth, std::string& rOut, bool* pOK )
+        {
+            size_t nStart = i;
+            i = SkipSpace( p, n, i + strlen("#include") );
+            size_t nEnd = (i < n && p[i] == '"') ? i+1 : n;
+            while( nEnd < n && p[nEnd] != '"' && p[nEnd] != '\n' )
+                nEnd++;
+            if( nEnd >= n || p[nEnd] != '"' )
+            {
+                m_pParser->Error( m_nLine, "Expected a quoted file name after '#include'" );
+                *pOK = false;
+                return n;
+            }
+
+            std::string fileName( p+i+1, nEnd-(i+1) );
+            std::string text;
+            if( !ReadInclude( fileName, text ) )
+            {
+                m_pParser->ErrorF( m_nLine, "Can't read include file '%s'", fileName.c_str() );
+                *pOK = false;
+                return n;
+            }
+
+            std::vector<char> stripped( text.begin(), text.end() );
+            stripped.push_back(0);
+            if( StripComments( &stripped[0] ) )
+            {
+                m_pParser->ErrorF( m_nLine, "Unterminated block comment in '%s'", fileName.c_str() );
+                *pOK = false;
+                return n;
+            }
+
+            *pOK = Expand( &stripped[0], stripped.size()-1, rBindings, nDepth+1, rOut );
+            rOut.push_back(' ');
+            ConsumeLines( p+nStart, nEnd+1-nStart, nDepth );
+            return nEnd+1;
+        }
+
+        size_t DefineMacro( const char* p, size_t n, size_t i, size_t nDepth, std::string& rOut, bool* pOK )
+        {
+            size_t nStart = i;
+            Macro macro;
+            macro.bHasParams = false;
+
+            i = SkipSpace( p, n, i + strlen("macro") );
+            size_t nNameEnd = SkipID( p, n, i );
+            if( i == nNameEnd || !IsIDStart(p[i]) )
+            {
+                m_pParser->Error( m_nLine, "Expected a name after 'macro'" );
+                *pOK = false;
+                return n;
+            }
+            macro.pName = Store( p+i, nNameEnd-i );
+
+            i = SkipSpace( p, n, nNameEnd );
+            if( i < n && p[i] == '(' )
+            {
+                macro.bHasParams = true;
+                i = SkipSpace( p, n, i+1 );
+                while( i < n && p[i] != ')' )
+                {
+                    size_t nParamEnd = SkipID( p, n, i );
+                    if( i == nParamEnd || !IsIDStart(p[i]) )
+                    {
+                        m_pParser->ErrorF( m_nLine, "Bad parameter list for macro '%s'", macro.pName );
+                        *pOK = false;
+                        return n;
+                    }
+                    macro.Params.push_back( Store( p+i, nParamEnd-i ) );
+                    i = SkipSpace( p, n, nParamEnd );
+                    if( i < n && p[i] == ',' )
+                        i = SkipSpace( p, n, i+1 );
+                }
+                i = SkipSpace( p, n, i+1 );
+            }
+
+            size_t nClose = (i < n && p[i] == '{') ? FindClose( p, n, i ) : n;
+            if( nClose == n )
+            {
+                m_pParser->ErrorF( m_nLine, "Expected a '{ }' body for macro '%s'", macro.pName );
+                *pOK = false;
+                return n;
+            }
+            // trimmed, so that 'NAME.u' works for a macro which names a register
+            std::string body = Trim( std::string( p+i+1, nClose-(i+1) ) );
+            macro.pBody = Store( body.c_str(), body.length() );
+            macro.nBodyLength = body.length();
+
+            *pOK = AddMacro( macro );
+            rOut.push_back(' ');
+            ConsumeLines( p+nStart, nClose+1-nStart, nDepth );
+            return nClose+1;
+        }
+
+        size_t Repeat( const char* p, size_t n, size_t i, const Bindings& rBindings, size_t nDepth, std::string& rOut, bool* pOK )
+        {
+            size_t nStart = i;
+            i += strlen("repeat");
+
+            // the count runs up to the 'as'
+            size_t nCountStart = i;
+            size_t nAs = n;
+            while( i < n && p[i] != '{' )
+            {
+                if( !IsIDStart(p[i]) )
+                {
+                    i++;
+                    continue;
+                }
+                size_t nEnd = SkipID( p, n, i );
+                if( nEnd-i == 2 && p[i] == 'a' && p[i+1] == 's' )
+                {
+                    nAs = i;
+                    break;
+                }
+                i = nEnd;
+            }
+
+            size_t nVar = SkipSpace( p, n, nAs+2 );
+            size_t nVarEnd = (nAs < n) ? SkipID( p, n, nVar ) : n;
+            if( nAs == n || nVar == nVarEnd || !IsIDStart(p[nVar]) )
+            {
+                m_pParser->Error( m_nLine, "Expected 'repeat <count> as <name> { ... }'" );
+                *pOK = false;
+                return n;
+            }
+
+            size_t nOpen = SkipSpace( p, n, nVarEnd );
+            size_t nClose = (nOpen < n && p[nOpen] == '{') ? FindClose( p, n, nOpen ) : n;
+            if( nClose == n )
+            {
+                m_pParser->Error( m_nLine, "Expected a '{ }' body for 'repeat'" );
+                *pOK = false;
+                return n;
+            }
+
+            std::string count;
+            int nCount;
+            if( !Expand( p+nCountStart, nAs-nCountStart, rBindings, nDepth+1, count ) || !Evaluate( count, &nCount ) )
+            {
+                *pOK = false;
+                return n;
+            }
+            if( nCount < 0 || nCount > MAX_REPEAT_COUNT )
+            {
+                m_pParser->ErrorF( m_nLine, "Repeat count %d is out of range", nCount );
+                *pOK = false;
+                return n;
+            }
+
+            Bindings bindings( rBindings );
+            bindings.push_back( std::make_pair( std::string( p+nVar, nVarEnd-nVar ), std::string() ) );
+            for( int k=0; k<nCount; k++ )
+            {
+                char index[16];
+                sprintf( index, "%d", k );
+                bindings.back().second = index;
+                if( !Expand( p+nOpen+1, nClose-(nOpen+1), bindings, nDepth+1, rOut ) )
+                {
+                    *pOK = false;
+                    return n;
+                }
+                rOut.push_back(' ');
+            }
+
+            ConsumeLines( p+nStart, nClose+1-nStart, nDepth );
+            return nClose+1;
+        }
+
+        size_t Invoke( const char* p, size_t n, size_t i, size_t nNameEnd, const Macro& rMacro, const Bindings& rBindings, size_t nDepth, std::string& rOut, bool* pOK )
+        {
+            Bindings params;
+            if( !rMacro.bHasParams )
+            {
+                *pOK = Expand( rMacro.pBody, rMacro.nBodyLength, params, nDepth+1, rOut );
+                return nNameEnd;
+            }
+
+            // without an argument list, it's just a name
+            size_t nOpen = SkipSpace( p, n, nNameEnd );
+            if( nOpen == n || p[nOpen] != '(' )
+            {
+                rOut.append( p+i, nNameEnd-i );
+                return nNameEnd;
+            }
+
+            size_t nClose = FindClose( p, n, nOpen );
+            if( nClose == n )
+            {
+                m_pParser->ErrorF( m_nLine, "Missing ')' after arguments to macro '%s'", rMacro.pName );
+                *pOK = false;
+                return n;
+            }
+
+            // split at the commas which aren't nested in parens
+            std::vector<std::string> args;
+            size_t nArgStart = nOpen+1;
+            size_t nParens = 0;
+            for( size_t j=nOpen+1; j<=nClose; j++ )
+            {
+                if( p[j] == '(' )
+                    nParens++;
+                else if( p[j] == ')' && nParens )
+                    nParens--;
+                else if( j == nClose || (p[j] == ',' && !nParens) )
+                {
+                    std::string arg;
+                    if( !Expand( p+nArgStart, j-nArgStart, rBindings, nDepth+1, arg ) )
+                    {
+                        *pOK = false;
+                        return n;
+                    }
+                    args.push_back( Trim(arg) );
+                    nArgStart = j+1;
+                }
+            }
+            if( args.size() == 1 && args[0].empty() && rMacro.Params.empty() )
+                args.clear();
+
+            if( args.size() != rMacro.Params.size() )
+            {
+                m_pParser->ErrorF( m_nLine, "Macro '%s' takes %u arguments, not %u", rMacro.pName, (unsigned)rMacro.Params.size(), (unsigned)args.size() );
+                *pOK = false;
+                return n;
+            }
+
+            for( size_t a=0; a<args.size(); a++ )
+                params.push_back( std::make_pair( std::string(rMacro.Params[a]), args[a] ) );
+
+            *pOK = Expand( rMacro.pBody, rMacro.nBodyLength, params, nDepth+1, rOut );
+            ConsumeLines( p+i, nClose+1-i, nDepth );
+            return nClose+1;
+        }
+
+        bool Expand( const char* p, size_t n, const Bindings& rBindings, size_t nDepth, std::string& rOut )
+        {
+            if( nDepth > MAX_EXPANSION_DEPTH )
+            {
+                m_pParser->Error( m_nLine, "Macro expansion is too deep.  Is there a recursive macro or include?" );
+                return false;
+            }
+
+            size_t i=0;
+            bool bOK = true;
+            while( i < n && bOK )
+            {
+                char c = p[i];
+                if( c == '\n' )
+                {
+                    if( nDepth == 0 )
+                    {
+                        rOut.append( 1+m_nPendingLines, '\n' );
+                        m_nPendingLines = 0;
+                        m_nLine++;
+                    }
+                    else
+                        rOut.push_back(' ');
+                    i++;
+                }
+                else if( isdigit((unsigned char)c) )
+                {
+                    // numbers, including hex and suffixes, are never substituted into
+                    size_t nEnd = SkipID( p, n, i );
+                    rOut.append( p+i, nEnd-i );
+                    i = nEnd;
+                }
+                else if( c == '$' && i+1 < n && p[i+1] == '(' )
+                {
+                    size_t nClose = FindClose( p, n, i+1 );
+                    if( nClose == n )
+                    {
+                        m_pParser->Error( m_nLine, "Missing ')' after '$('" );
+                        return false;
+                    }
+                    std::string expr;
+                    int nValue;
+                    if( !Expand( p+i+2, nClose-(i+2), rBindings, nDepth+1, expr ) || !Evaluate( expr, &nValue ) )
+                        return false;
+
+                    char value[16];
+                    sprintf( value, "%d", nValue );
+                    rOut.append( value );
+                    ConsumeLines( p+i, nClose-i, nDepth );
+                    i = nClose+1;
+                }
+                else if( c == '#' && n-i >= 8 && strncmp( p+i, "#include", 8 ) == 0 )
+                {
+                    i = Include( p, n, i, rBindings, nDepth, rOut, &bOK );
+                }
+                else if( IsIDStart(c) )
+                {
+                    size_t nEnd = SkipID( p, n, i );
+                    size_t nLength = nEnd-i;
+                    const std::string* pBinding = FindBinding( rBindings, p+i, nLength );
+                    size_t nMacro;
+                    if( pBinding )
+                    {
+                        rOut.append( *pBinding );
+                        i = nEnd;
+                    }
+                    else if( nLength == 5 && strncmp( p+i, "macro", 5 ) == 0 )
+                        i = DefineMacro( p, n, i, nDepth, rOut, &bOK );
+                    else if( nLength == 6 && strncmp( p+i, "repeat", 6 ) == 0 )
+                        i = Repeat( p, n, i, rBindings, nDepth, rOut, &bOK );
+                    else if( (nMacro = m_MacroNames.Find( p+i, nLength )) != (size_t)-1 )
+                        i = Invoke( p, n, i, nEnd, m_Macros[nMacro], rBindings, nDepth, rOut, &bOK );
+                    else
+                    {
+                        rOut.append( p+i, nLength );
+                        i = nEnd;
+                    }
+                }
+                else
+                {
+                    rOut.push_back(c);
+                    i++;
+                }
+            }
+            return bOK;
+        }
+
+        Parser* m_pParser;
+        Arena* m_pArena;
+        IIncludeHandler* m_pIncludes;
+        std::vector<Macro> m_Macros;
+        SymbolTable m_MacroNames;   ///< Indices into 'm_Macros'.  The names are in the arena
+        size_t m_nLine;             ///< Line of the top-level text that's being expanded
+        size_t m_nPendingLines;     ///< Newlines consumed by expansions on the current line
+    };
+
+    void Parser::Define( const char* pName, const char* pValue )
+    {
+        Definition def;
+        def.pName  = m_Arena.StoreString( pName );
+        def.pValue = m_Arena.StoreString( pValue );
+        m_Definitions.push_back( def );
+    }
+
+    bool Parser::ExpandMacros( const char* pText, std::string& rOut )
+    {
+        Preprocessor preprocessor( this, &m_Arena, m_pIncludeHandler );
+        for( size_t i=0; i<m_Definitions.size(); i++ )
+            if( !preprocessor.Define( m_Definitions[i].pName, m_Definitions[i].pValue ) )
+                return false;
+
+        rOut.reserve( strlen(pText) );
+        return preprocessor.Run( pText, rOut );
+    }
+
+}}}
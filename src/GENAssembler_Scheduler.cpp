@@ -0,0 +1,228 @@
+
+#include "GENAssembler_Parser.h"
+#include "GENControlFlow.h"
+
+#include <algorithm>
+
+namespace GEN{
+namespace Assembler{
+namespace _INTERNAL{
+
+    //
+    // List scheduling.
+    //
+    //  The program is cut into regions at labels, pred blocks, jumps, branches, and branch targets.
+    //  Nothing moves between regions, so all the jump and branch offsets stay valid.
+    //  Within a region we build a dependence graph, and then issue instructions greedily,
+    //   preferring whichever ready instruction has the longest chain of latency behind it
+    //
+
+    bool UsesImplicitAccumulator( Operations eOp )
+    {
+        switch( eOp )
+        {
+        case OP_MAC:
+        case OP_MACH:
+        case OP_ADDC:
+        case OP_SUBB:
+        case OP_SAD2:
+        case OP_SADA2:
+        case OP_DP4:
+        case OP_DPH:
+        case OP_DP3:
+        case OP_DP2:
+        case OP_LINE:
+        case OP_PLN:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool ReadsTimestamp( const Instruction& rInst )
+    {
+        for( size_t i=1; i<4; i++ )
+        {
+            RegisterRegion region;
+            DataTypes eType;
+            size_t nMsgRegs;
+            if( GetOperandRegion( rInst, i, &region, &eType, &nMsgRegs ) &&
+                region.GetBaseRegister().IsDirect() && region.GetBaseRegister().GetRegType() == REG_TIMESTAMP )
+                return true;
+        }
+        return false;
+    }
+
+    /// Instructions which have to stay exactly where they are.  Timestamp reads don't depend on anything,
+    ///   but they are only useful where they were written, relative to the work that they time
+    static bool IsFixed( const Instruction& rInst )
+    {
+        int nTarget;
+        if( GetJumpTarget( rInst, 0, &nTarget ) || rInst.GetClass() == IC_BRANCH || rInst.IsDDCheckDisabled() || ReadsTimestamp(rInst) )
+            return true;
+        return rInst.GetClass() == IC_SEND && static_cast<const SendInstruction&>(rInst).IsEOT();
+    }
+
+    static size_t GetLatency( const Instruction& rInst, const LatencyTable& rLatencies )
+    {
+        switch( rInst.GetClass() )
+        {
+        case IC_SEND: return rLatencies.nSend;
+        case IC_MATH: return rLatencies.nMath;
+        default:      return rLatencies.nALU;
+        }
+    }
+
+    struct DependenceEdge
+    {
+        size_t nTo;
+        size_t nLatency;
+    };
+
+    static void ScheduleRegion( Instruction* pInstructions, size_t nInstructions, const LatencyTable& rLatencies )
+    {
+        std::vector<Resources> Reads(nInstructions);
+        std::vector<Resources> Writes(nInstructions);
+        for( size_t i=0; i<nInstructions; i++ )
+            GetResources( pInstructions[i], &Reads[i], &Writes[i] );
+
+        // true dependences wait for the result.  Anti and output dependences only need to stay in order
+        std::vector< std::vector<DependenceEdge> > Successors(nInstructions);
+        std::vector<size_t> PredCounts(nInstructions,0);
+        for( size_t i=0; i<nInstructions; i++ )
+        {
+            for( size_t j=i+1; j<nInstructions; j++ )
+            {
+                DependenceEdge edge;
+                edge.nTo = j;
+                if( Writes[i].Overlaps(Reads[j]) )
+                    edge.nLatency = GetLatency( pInstructions[i], rLatencies );
+                else if( Reads[i].Overlaps(Writes[j]) || Writes[i].Overlaps(Writes[j]) )
+                    edge.nLatency = 0;
+                else
+                    continue;
+
+                Successors[i].push_back(edge);
+                PredCounts[j]++;
+            }
+        }
+
+        // priority is the length of the longest latency chain from an instruction to the end of the region
+        std::vector<size_t> Heights(nInstructions,0);
+        for( size_t i=nInstructions; i-- > 0; )
+        {
+            Heights[i] = 1;
+            for( size_t e=0; e<Successors[i].size(); e++ )
+            {
+                const DependenceEdge& rEdge = Successors[i][e];
+                Heights[i] = std::max( Heights[i], rEdge.nLatency + Heights[rEdge.nTo] );
+            }
+        }
+
+        std::vector<size_t> EarliestCycles(nInstructions,0);
+        std::vector<bool> Issued(nInstructions,false);
+        std::vector<Instruction> Scheduled;
+        Scheduled.reserve(nInstructions);
+        size_t nCycle = 0;
+        while( Scheduled.size() < nInstructions )
+        {
+            // pick the tallest instruction which can issue now.  If there isn't one, wait for the first one that can.
+            //   Ties go to the instruction which came first, so independent code keeps its original order
+            size_t nBest = nInstructions;
+            for( size_t i=0; i<nInstructions; i++ )
+            {
+                if( Issued[i] || PredCounts[i] )
+                    continue;
+                if( nBest == nInstructions )
+                {
+                    nBest = i;
+                    continue;
+                }
+
+                bool bReady     = EarliestCycles[i] <= nCycle;
+                bool bBestReady = EarliestCycles[nBest] <= nCycle;
+                if( bReady != bBestReady )
+                {
+                    if( bReady )
+                        nBest = i;
+                }
+                else if( bReady ? (Heights[i] > Heights[nBest]) : (EarliestCycles[i] < EarliestCycles[nBest]) )
+                {
+                    nBest = i;
+                }
+            }
+
+            nCycle = std::max( nCycle, EarliestCycles[nBest] );
+            Issued[nBest] = true;
+            Scheduled.push_back( pInstructions[nBest] );
+            for( size_t e=0; e<Successors[nBest].size(); e++ )
+            {
+                const DependenceEdge& rEdge = Successors[nBest][e];
+                EarliestCycles[rEdge.nTo] = std::max( EarliestCycles[rEdge.nTo], nCycle + rEdge.nLatency );
+                PredCounts[rEdge.nTo]--;
+            }
+
+            // SIMD16 instructions issue in two halves
+            nCycle += (pInstructions[nBest].GetExecSize() > 8) ? 2 : 1;
+        }
+
+        std::copy( Scheduled.begin(), Scheduled.end(), pInstructions );
+    }
+
+    void Parser::GetRegionBoundaries( std::vector<bool>& rBoundaries ) const
+    {
+        size_t nInstructions = m_Instructions.size();
+        rBoundaries.assign( nInstructions+1, false );
+        for( size_t i=0; i<m_ScheduleBarriers.size(); i++ )
+            rBoundaries[ std::min( m_ScheduleBarriers[i], nInstructions ) ] = true;
+
+        for( size_t i=0; i<nInstructions; i++ )
+        {
+            const Instruction& rInst = m_Instructions[i];
+            if( !IsFixed(rInst) )
+                continue;
+
+            rBoundaries[i]   = true;
+            rBoundaries[i+1] = true;
+
+            // jumps are 16 bytes per instruction, branches are in 8-byte units
+            int pTargets[2];
+            size_t nTargets = 0;
+            int nJump;
+            if( GetJumpTarget( rInst, 16*i, &nJump ) )
+            {
+                pTargets[nTargets++] = nJump/16;
+            }
+            else if( rInst.GetClass() == IC_BRANCH )
+            {
+                const BranchInstruction& rBranch = static_cast<const BranchInstruction&>(rInst);
+                pTargets[nTargets++] = (int)i + rBranch.GetJIP()/2;
+                pTargets[nTargets++] = (int)i + rBranch.GetUIP()/2;
+            }
+
+            for( size_t t=0; t<nTargets; t++ )
+                if( pTargets[t] >= 0 && pTargets[t] <= (int)nInstructions )
+                    rBoundaries[pTargets[t]] = true;
+        }
+    }
+
+    void Parser::Schedule()
+    {
+        size_t nInstructions = m_Instructions.size();
+
+        // find all the places that nothing may be moved across
+        std::vector<bool> Boundaries;
+        GetRegionBoundaries( Boundaries );
+
+        size_t nStart = 0;
+        for( size_t i=1; i<=nInstructions; i++ )
+        {
+            if( !Boundaries[i] )
+                continue;
+            if( i - nStart > 1 )
+                ScheduleRegion( &m_Instructions[nStart], i-nStart, *m_pLatencies );
+            nStart = i;
+        }
+    }
+
+}}}
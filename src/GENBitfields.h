@@ -0,0 +1,124 @@
+
+#ifndef _GEN_BITFIELDS_H_
+#define _GEN_BITFIELDS_H_
+
+#include <string.h>
+#include "GENIsa.h"
+
+namespace GEN{
+namespace _INTERNAL{
+
+    typedef uint32 DWORD;
+    typedef unsigned __int64 QWORD;
+
+    //
+    // Bitfield access for GEN instruction words.
+    //
+    //  Bit numbers are the ones used in the PRM.  Instructions are treated as two little-endian
+    //   64-bit lanes.  Compacted instructions only have the low lane
+    //
+
+    ///
+    /// Compile-time descriptor for the field [HI:LO].  Fields are at most 32 bits wide.
+    ///   Lane, shift and mask all fold to constants, so a field access is a load and a shift-and-mask
+    ///
+    template< DWORD HI, DWORD LO >
+    struct BitField
+    {
+        static_assert( HI >= LO && HI < 128 && (HI-LO) < 32, "derp" );
+
+        enum
+        {
+            LANE  = LO/64,
+            SHIFT = LO%64,
+            SPLIT = (HI/64) != (LO/64),  // field straddles the lanes
+        };
+
+        static QWORD Mask() { return (((QWORD)1) << (HI-LO+1)) - 1; }
+
+        static QWORD LoadLane( const uint8* p, DWORD nLane )
+        {
+            QWORD q;
+            memcpy( &q, p + 8*nLane, 8 );
+            return q;
+        }
+        static void StoreLane( uint8* p, DWORD nLane, QWORD q )
+        {
+            memcpy( p + 8*nLane, &q, 8 );
+        }
+
+        static DWORD Read( const uint8* p )
+        {
+            QWORD q = LoadLane(p,LANE) >> SHIFT;
+            if( SPLIT )
+                q |= LoadLane(p,1) << ((64-SHIFT)%64);
+            return (DWORD)(q & Mask());
+        }
+
+        static void Write( uint8* p, DWORD bits )
+        {
+            QWORD v = bits & Mask();
+            QWORD q = LoadLane(p,LANE);
+            q = (q & ~(Mask()<<SHIFT)) | (v<<SHIFT);
+            StoreLane(p,LANE,q);
+            if( SPLIT )
+            {
+                DWORD nHiShift = (64-SHIFT)%64;
+                q = LoadLane(p,1);
+                q = (q & ~(Mask()>>nHiShift)) | (v>>nHiShift);
+                StoreLane(p,1,q);
+            }
+        }
+    };
+
+    template< DWORD HI, DWORD LO > inline DWORD ReadBits( const uint8* p )           { return BitField<HI,LO>::Read(p); }
+    template< DWORD BIT >          inline DWORD ReadBit( const uint8* p )            { return BitField<BIT,BIT>::Read(p); }
+    template< DWORD HI, DWORD LO > inline void WriteBits( uint8* p, DWORD bits )     { BitField<HI,LO>::Write(p,bits); }
+    template< DWORD BIT >          inline void WriteBit( uint8* p, DWORD bit )       { BitField<BIT,BIT>::Write(p,bit); }
+
+
+    //
+    // Bit-at-a-time versions for when the field isn't known at compile time.
+    //   Much slower.  These are what everything used to use
+    //
+    inline DWORD ReadBit( const uint8* p, DWORD bit )
+    {
+        return (p[bit/8]>>(bit%8))&1;
+    }
+    inline DWORD ReadBits( const uint8* p, DWORD hi, DWORD lo )
+    {
+        DWORD a=0;
+        DWORD n = 0;
+        while( lo+n <= hi )
+        {
+            DWORD bit = ReadBit(p,lo+n);
+            a |= (bit<<n);
+            n++;
+        }
+        return a;
+    }
+
+    inline void WriteBit(  uint8* p, DWORD bit, DWORD lo )
+    {
+        DWORD byte = p[lo/8];
+        bit = bit << (lo%8);
+        byte = (byte & ~(1<<(lo%8))) | bit;
+        p[lo/8] = byte;
+    }
+    inline void WriteBits( uint8* p, DWORD bits, DWORD hi, DWORD lo )
+    {
+        while( lo <= hi )
+        {
+            DWORD bit = bits&1;
+            DWORD byte = p[lo/8];
+            bit = bit << (lo%8);
+            byte = (byte & ~bit) | bit;
+            p[lo/8] = byte;
+            bits = bits>>1;
+            lo++;
+        }
+    }
+
+}}
+
+#endif
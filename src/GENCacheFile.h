@@ -0,0 +1,78 @@
+#ifndef _GEN_CACHE_FILE_H_
+#define _GEN_CACHE_FILE_H_
+
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <functional>
+#include "GENIsa.h"
+
+#ifdef _MSC_VER
+#include <process.h>
+#define HAXWELL_GETPID _getpid
+#else
+#include <unistd.h>
+#define HAXWELL_GETPID getpid
+#endif
+
+namespace GEN{
+namespace _INTERNAL{
+
+    //
+    // Helpers for the on-disk caches.  The assembler's program cache and HAXWell's blob files both use them
+    //
+
+    static const uint64 FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+
+    /// 64-bit FNV-1a.  Start with 'FNV_OFFSET_BASIS'
+    inline uint64 HashBytes( uint64 nHash, const void* pBytes, size_t nBytes )
+    {
+        const uint8* p = (const uint8*) pBytes;
+        for( size_t i=0; i<nBytes; i++ )
+        {
+            nHash ^= p[i];
+            nHash *= 0x100000001b3ull;
+        }
+        return nHash;
+    }
+
+    /// Check that a file is exactly 'nLength' bytes long, and put the read position back where it was.
+    ///   Readers call this before allocating anything, so that a damaged header can't ask for a huge buffer
+    inline bool IsFileLength( FILE* fp, uint64 nLength )
+    {
+        long nPosition = ftell(fp);
+        if( nPosition < 0 || fseek( fp, 0, SEEK_END ) != 0 )
+            return false;
+        long nEnd = ftell(fp);
+        return fseek( fp, nPosition, SEEK_SET ) == 0 && nEnd >= 0 && (uint64)nEnd == nLength;
+    }
+
+    /// Write a file from 'nPieces' pieces.  They go to a temporary which is then moved into place, so that other processes
+    ///   never read half a file.  The temporary is named for this process and thread, in case another one is writing the same file
+    inline bool WriteFileAtomically( const std::string& rFile, const void* const* ppPieces, const size_t* pLengths, size_t nPieces )
+    {
+        char suffix[48];
+        sprintf( suffix, ".%08x.%08x.tmp", (uint32) HAXWELL_GETPID(), (uint32) std::hash<std::thread::id>()( std::this_thread::get_id() ) );
+        std::string temp = rFile + suffix;
+        FILE* fp = fopen( temp.c_str(), "wb" );
+        if( !fp )
+            return false;
+
+        bool bOK = true;
+        for( size_t i=0; i<nPieces && bOK; i++ )
+            bOK = pLengths[i] == 0 || fwrite( ppPieces[i], 1, pLengths[i], fp ) == pLengths[i];
+        bOK = (fclose(fp) == 0) && bOK;
+
+        if( bOK )
+        {
+            remove( rFile.c_str() );
+            bOK = rename( temp.c_str(), rFile.c_str() ) == 0;
+        }
+        if( !bOK )
+            remove( temp.c_str() );
+        return bOK;
+    }
+
+}}
+
+#endif
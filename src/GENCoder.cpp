@@ -1,8 +1,11 @@
 
 #include "GENIsa.h"
 #include "GENCoder.h"
+#include "GENBitfields.h"
 
 #include <string.h>
+#include <stdlib.h>
+#include <algorithm>
 
 namespace GEN
 {
@@ -10,8 +13,6 @@ namespace GEN
     {
       
         
-        typedef uint32 DWORD;
-        typedef unsigned __int64 QWORD;
 
         struct EnumLUT
         {
@@ -36,19 +37,68 @@ namespace GEN
             return TInvalid;
         }
 
+        ///
+        /// Dense forward/inverse tables built from an EnumLUT, so that translation 
+        ///   is a single indexed load instead of a table walk.
+        ///
+        ///  Every field we translate is at most 8 bits wide, and nearly all of the enums are small.
+        ///   Keys which don't fit in the dense table (e.g. the magic VStride) fall back to a linear search
+        ///
+        struct DenseLUT
+        {
+            enum { SIZE = 256 };
+
+            DenseLUT( const EnumLUT* pLUT, size_t nLUTSize, uint32 TInvalid ) 
+                : m_pLUT(pLUT), m_nLUTSize(nLUTSize), m_TInvalid(TInvalid)
+            {
+                for( size_t i=0; i<SIZE; i++ )
+                {
+                    m_pDecode[i] = TInvalid;
+                    m_pEncode[i] = TInvalid;
+                }
+
+                // walk backwards so that the first entry wins if there are duplicates, same as a linear search
+                size_t n = nLUTSize/sizeof(EnumLUT);
+                while( n-- )
+                {
+                    if( pLUT[n].nEncoding < SIZE )
+                        m_pDecode[pLUT[n].nEncoding] = pLUT[n].eEnum;
+                    if( pLUT[n].eEnum < SIZE )
+                        m_pEncode[pLUT[n].eEnum] = pLUT[n].nEncoding;
+                }
+            }
+
+            uint32 Decode( size_t en ) const
+            {
+                if( en < SIZE )
+                    return m_pDecode[en];
+                return LUTLookup( m_pLUT, m_nLUTSize, (uint32)en, m_TInvalid );
+            }
+
+            uint32 Encode( uint32 de ) const
+            {
+                if( de < SIZE )
+                    return m_pEncode[de];
+                return InverseLUTLookup( m_pLUT, m_nLUTSize, de, m_TInvalid );
+            }
+
+            uint32 m_pDecode[SIZE];
+            uint32 m_pEncode[SIZE];
+            const EnumLUT* m_pLUT;
+            size_t m_nLUTSize;
+            uint32 m_TInvalid;
+        };
+
         #define BEGIN_TRANSLATOR(T,Name) static const EnumLUT LUT_##T_##Name[] = {
         #define ENUM(Enum,Value) { Enum, Value },
         #define END_TRANSLATOR(T,Name,TInvalid) \
             };\
+            static const DenseLUT DENSE_##Name( LUT_##T_##Name, sizeof(LUT_##T_##Name), TInvalid );\
             T DECODE_##Name( size_t en ) {\
-                const EnumLUT* pLUT = LUT_##T_##Name;\
-                size_t n = sizeof(LUT_##T_##Name);\
-                return (T) LUTLookup(pLUT,n,en,TInvalid);\
+                return (T) DENSE_##Name.Decode(en);\
             }; \
             uint32 Encode_##Name( T de ) {\
-                const EnumLUT* pLUT = LUT_##T_##Name;\
-                size_t n = sizeof(LUT_##T_##Name);\
-                return (size_t) InverseLUTLookup(pLUT,n,de,TInvalid);\
+                return DENSE_##Name.Encode(de);\
             };
 
         enum 
@@ -352,46 +402,6 @@ namespace GEN
 
         DWORD ReadDWORD( const uint8* p ) { return * ((uint32*)p); }
 
-        DWORD ReadBit( const uint8* p, DWORD bit )
-        {
-            return (p[bit/8]>>(bit%8))&1;
-        }
-        DWORD ReadBits( const uint8* p, DWORD hi, DWORD lo )
-        {
-            // TODO: Optimize this once its clear we don't need to span dword boundaries
-            DWORD a=0;
-            DWORD n = 0;
-            while( lo+n <= hi )
-            {
-                DWORD bit = ReadBit(p,lo+n);
-                a |= (bit<<n);
-                n++;
-            }
-            return a;
-        }
-
-        void WriteBit(  uint8* p, DWORD bit, DWORD lo )
-        {
-            DWORD byte = p[lo/8];
-            bit = bit << (lo%8);
-            byte = (byte & ~(1<<(lo%8))) | bit;
-            p[lo/8] = byte;
-        }
-        void WriteBits( uint8* p, DWORD bits, DWORD hi, DWORD lo )
-        {
-            while( lo <= hi )
-            {
-                DWORD bit = bits&1;
-                DWORD byte = p[lo/8];
-                bit = bit << (lo%8);
-                byte = (byte & ~bit) | bit;
-                p[lo/8] = byte;
-                bits = bits>>1;
-                lo++;
-            }
-        }
-       
-
         // MSVC doesn't do binary literals yet, but the following code can be used
         //  to turn copy-pasted binary strings into hex
         //  This is what I used to generate the instruction compaction tables
@@ -569,55 +579,174 @@ namespace GEN
         {
         
             memset(pOut,0,16);
-            DWORD dwOpcode = ReadBits(pIn,6,0);
-            WriteBits( pOut, dwOpcode, 6, 0 ); // opcode
+            DWORD dwOpcode = ReadBits<6,0>(pIn);
+            WriteBits<6,0>(pOut, dwOpcode); // opcode
 
-            DWORD dwLookup1 = COMPACT1[ReadBits(pIn,12,8)];
-            WriteBits( pOut, dwLookup1, 23, 8 );  dwLookup1 >>= (23-8+1);
-            WriteBits( pOut, dwLookup1, 31, 31 ); dwLookup1 >>= 1;
-            WriteBits( pOut, dwLookup1, 90, 89 );
+            DWORD dwLookup1 = COMPACT1[ReadBits<12,8>(pIn)];
+            WriteBits<23,8>(pOut, dwLookup1);  dwLookup1 >>= (23-8+1);
+            WriteBits<31,31>(pOut, dwLookup1); dwLookup1 >>= 1;
+            WriteBits<90,89>(pOut, dwLookup1);
            
 
-            DWORD dwLookup2 = COMPACT2[ReadBits(pIn,17,13)];
-            WriteBits( pOut, dwLookup2, 46,32 ); dwLookup2 >>= (46-32+1);
-            WriteBits( pOut, dwLookup2, 63,61 ); 
+            DWORD dwLookup2 = COMPACT2[ReadBits<17,13>(pIn)];
+            WriteBits<46,32>(pOut, dwLookup2); dwLookup2 >>= (46-32+1);
+            WriteBits<63,61>(pOut, dwLookup2); 
             
 
-            DWORD dwLookup3 = COMPACT3[ReadBits(pIn,22,18)];
-            WriteBits(pOut, dwLookup3,52,48);dwLookup3 >>= (52-48+1);
-            WriteBits(pOut, dwLookup3,68,64);dwLookup3 >>= (68-64+1);
-            WriteBits(pOut, dwLookup3,100,96);
+            DWORD dwLookup3 = COMPACT3[ReadBits<22,18>(pIn)];
+            WriteBits<52,48>(pOut, dwLookup3);dwLookup3 >>= (52-48+1);
+            WriteBits<68,64>(pOut, dwLookup3);dwLookup3 >>= (68-64+1);
+            WriteBits<100,96>(pOut, dwLookup3);
 
-            WriteBits( pOut, ReadBits(pIn,23,23), 23,23 );
-            WriteBits( pOut, ReadBits(pIn,27,24), 27,24 );
-            WriteBit( pOut,0, 29 ); // clear compression control bit
+            WriteBits<28,28>(pOut, ReadBits<23,23>(pIn)); // AccWrEn
+            WriteBits<27,24>(pOut, ReadBits<27,24>(pIn));
+            WriteBit<29>(pOut,0); // clear compression control bit
 
-            WriteBits( pOut, COMPACT4[ReadBits(pIn,34,30)], 88, 77 );
-            WriteBits( pOut, ReadBits(pIn, 47,40), 60,53 );
-            WriteBits( pOut, ReadBits(pIn, 55,48), 76,69 );
+            WriteBits<88,77>(pOut, COMPACT4[ReadBits<34,30>(pIn)]);
+            WriteBits<60,53>(pOut, ReadBits<47,40>(pIn));
+            WriteBits<76,69>(pOut, ReadBits<55,48>(pIn));
 
-            DWORD dwSrc1RegFile = ReadBits(pOut, 43,42);
-            if( dwSrc1RegFile == 3 )
+            DWORD dwSrc0RegFile = ReadBits<38,37>(pOut);
+            DWORD dwSrc1RegFile = ReadBits<43,42>(pOut);
+            if( dwSrc0RegFile == 3 || dwSrc1RegFile == 3 )
             {
-                // src1 is an immediate.  The immediate is sliced together
-                //  from various fiends
-                DWORD dwImmHi = COMPACT4[ReadBits(pIn,39,35)];
-                DWORD dwImmLo = ReadBits(pIn,63,56);
+                // one of the sources is an immediate.  The immediate is a 13-bit signed value
+                //   sliced together from the src1 index and src1 regnum fields.  
+                //   Note that the index is used directly, NOT looked up in the table
+                DWORD dwImmHi = ReadBits<39,35>(pIn);
+                DWORD dwImmLo = ReadBits<63,56>(pIn);
                 DWORD dwImm   = ((dwImmHi<<8)|dwImmLo);
-                dwImm = SignExtend(dwImm,13);
-
-                WriteBits( pOut, dwImm, 127, 96 ); 
+                dwImm = SignExtend(dwImm,12);
 
+                WriteBits<127,96>(pOut, dwImm); 
             }
             else
             {
                 // src1 is not an immediate
-                WriteBits( pOut, COMPACT4[ReadBits(pIn,39,35)], 120, 109 );
-                WriteBits( pOut, ReadBits(pIn,63,56), 108,101 );
+                WriteBits<120,109>(pOut, COMPACT4[ReadBits<39,35>(pIn)]);
+                WriteBits<108,101>(pOut, ReadBits<63,56>(pIn));
             }
 
         }
 
+        int FindCompactionIndex( const DWORD* pTable, DWORD dwValue )
+        {
+            for( int i=0; i<32; i++ )
+                if( pTable[i] == dwValue )
+                    return i;
+            return -1;
+        }
+
+        ///
+        /// Try to pack a native instruction into its 8-byte compacted form.  
+        ///   This is the inverse of 'ExpandCompressedInstruction'.  Returns false if the instruction
+        ///   can't be represented, in which case 'pOut' is garbage
+        ///
+        bool CompactInstruction( uint8* pOut, const uint8* pIn )
+        {
+            DWORD dwOpcode = ReadBits<6,0>(pIn);
+            Operations eOp = DECODE_Operations(dwOpcode);
+            switch( eOp )
+            {
+            case NOT_AN_OP:
+            case OP_ILLEGAL:
+            case OP_NOP:
+            case OP_SEND:
+            case OP_SENDC:
+                return false;
+            default:
+                if( IsBasicThreeSource(eOp) )
+                    return false;
+            }
+
+            bool bImmediate = ReadBits<38,37>(pIn) == 3 || ReadBits<43,42>(pIn) == 3;
+
+            DWORD dwControl  = ReadBits<23,8>(pIn) | (ReadBits<31,31>(pIn)<<16) | (ReadBits<90,89>(pIn)<<17);
+            DWORD dwDataType = ReadBits<46,32>(pIn) | (ReadBits<63,61>(pIn)<<15);
+            DWORD dwSubReg   = ReadBits<52,48>(pIn) | (ReadBits<68,64>(pIn)<<5);
+            if( !bImmediate )
+                dwSubReg |= ReadBits<100,96>(pIn)<<10;
+
+            int nControl  = FindCompactionIndex( COMPACT1, dwControl );
+            int nDataType = FindCompactionIndex( COMPACT2, dwDataType );
+            int nSubReg   = FindCompactionIndex( COMPACT3, dwSubReg );
+            int nSrc0     = FindCompactionIndex( COMPACT4, ReadBits<88,77>(pIn) );
+            if( nControl < 0 || nDataType < 0 || nSubReg < 0 || nSrc0 < 0 )
+                return false;
+
+            memset(pOut,0,8);
+            WriteBits<6,0>(pOut, dwOpcode);
+            WriteBits<12,8>(pOut, nControl);
+            WriteBits<17,13>(pOut, nDataType);
+            WriteBits<22,18>(pOut, nSubReg);
+            WriteBits<23,23>(pOut, ReadBits<28,28>(pIn));
+            WriteBits<27,24>(pOut, ReadBits<27,24>(pIn));
+            WriteBit<29>(pOut, 1);
+            WriteBits<34,30>(pOut, nSrc0);
+            WriteBits<47,40>(pOut, ReadBits<60,53>(pIn));
+            WriteBits<55,48>(pOut, ReadBits<76,69>(pIn));
+
+            if( bImmediate )
+            {
+                int nImm = (int) ReadDWORD(pIn+12);
+                if( nImm < -4096 || nImm > 4095 )
+                    return false;
+                WriteBits<39,35>(pOut, (nImm>>8)&0x1f);
+                WriteBits<63,56>(pOut, nImm&0xff);
+            }
+            else
+            {
+                int nSrc1 = FindCompactionIndex( COMPACT4, ReadBits<120,109>(pIn) );
+                if( nSrc1 < 0 )
+                    return false;
+                WriteBits<39,35>(pOut, nSrc1);
+                WriteBits<63,56>(pOut, ReadBits<108,101>(pIn));
+            }
+
+            // Anything that the compacted form can't carry (debug ctrl, qtr ctrl, and so on) 
+            //   must have been zero.  Simplest way to be sure is to expand and compare
+            uint8 pCheck[16];
+            ExpandCompressedInstruction( pCheck, pOut );
+            return memcmp( pCheck, pIn, 16 ) == 0;
+        }
+
+        /// Check whether an instruction is an IP-relative jump (add ip, ip, imm)
+        bool IsIPJump( const Instruction& rInst )
+        {
+            if( rInst.GetClass() != IC_BINARY || rInst.GetOperation() != OP_ADD )
+                return false;
+
+            const BinaryInstruction& it = static_cast<const BinaryInstruction&>(rInst);
+            return it.GetDest().GetRegRegion().GetBaseRegister().GetRegType() == REG_INSTRUCTION_PTR &&
+                   it.GetSource1().IsImmediate();
+        }
+
+        /// Check whether an instruction carries offsets that compaction must re-target
+        bool IsRelativeJump( const Instruction& rInst )
+        {
+            return IsIPJump(rInst) || rInst.GetClass() == IC_BRANCH;
+        }
+
+        /// Convert a byte offset from instruction i into an instruction index.  'pSourceOffsets' holds where each op was
+        ///   in the layout the offset was written for, or is null for 16 bytes per op.
+        ///   Fails if the offset isn't on an instruction boundary, or leaves the program
+        bool FindJumpTarget( int* pTarget, size_t i, int nBytes, size_t nOps, const size_t* pSourceOffsets )
+        {
+            if( !pSourceOffsets )
+            {
+                *pTarget = (int)i + nBytes/16;
+                return (nBytes%16) == 0 && *pTarget >= 0 && *pTarget <= (int)nOps;
+            }
+
+            int nWhere = (int)pSourceOffsets[i] + nBytes;
+            if( nWhere < 0 )
+                return false;
+            const size_t* pEnd = pSourceOffsets + nOps + 1;
+            const size_t* p = std::lower_bound( pSourceOffsets, pEnd, (size_t)nWhere );
+            *pTarget = (int)(p - pSourceOffsets);
+            return p != pEnd && *p == (size_t)nWhere;
+        }
+
 
 
         struct RegisterFields
@@ -772,40 +901,41 @@ namespace GEN
         }
     
         
+        template< DWORD BASE >
         void WriteSourceRegFields( uint8* pLoc, const RegisterFields& reg, bool bAlign1 )
         {
-            WriteBit( pLoc, reg.bIsIndirect, 15 );
-            WriteBits( pLoc, reg.dwModifier, 14,13 );
-            WriteBits( pLoc, reg.dwVStride, 24,21 );
+            WriteBit<BASE+15>(pLoc, reg.bIsIndirect);
+            WriteBits<BASE+14,BASE+13>(pLoc, reg.dwModifier);
+            WriteBits<BASE+24,BASE+21>(pLoc, reg.dwVStride);
 
             if( bAlign1 )
             {
-                WriteBits( pLoc, reg.dwWidth, 20, 18 );
-                WriteBits( pLoc, reg.dwHStride, 17,16 );
+                WriteBits<BASE+20,BASE+18>(pLoc, reg.dwWidth);
+                WriteBits<BASE+17,BASE+16>(pLoc, reg.dwHStride);
                 if( reg.bIsIndirect )
                 {
-                    WriteBits( pLoc, reg.nAddrImm, 9,0 );
-                    WriteBits( pLoc, reg.dwAddrSubRegNum,12,10);
+                    WriteBits<BASE+9,BASE>(pLoc, reg.nAddrImm);
+                    WriteBits<BASE+12,BASE+10>(pLoc, reg.dwAddrSubRegNum);
                 }
                 else
                 {
-                    WriteBits( pLoc, reg.dwRegNum,12, 5 );
-                    WriteBits( pLoc, reg.dwSubRegNum, 4, 0 );
+                    WriteBits<BASE+12,BASE+5>(pLoc, reg.dwRegNum);
+                    WriteBits<BASE+4,BASE>(pLoc, reg.dwSubRegNum);
                 }
             }
             else
             {
-                WriteBits( pLoc, reg.dwChanSel, 3, 0 );
-                WriteBits( pLoc, reg.dwChanSel>>4, 19,16 );
+                WriteBits<BASE+3,BASE>(pLoc, reg.dwChanSel);
+                WriteBits<BASE+19,BASE+16>(pLoc, reg.dwChanSel>>4);
                 if( reg.bIsIndirect )
                 {
-                    WriteBits( pLoc, reg.nAddrImm>>4, 9,4 );
-                    WriteBits( pLoc, reg.dwAddrSubRegNum, 12,10);
+                    WriteBits<BASE+9,BASE+4>(pLoc, reg.nAddrImm>>4);
+                    WriteBits<BASE+12,BASE+10>(pLoc, reg.dwAddrSubRegNum);
                 }
                 else
                 {
-                    WriteBits( pLoc, reg.dwRegNum, 12, 5 );
-                    WriteBit( pLoc, reg.dwSubRegNum>>4,4 );
+                    WriteBits<BASE+12,BASE+5>(pLoc, reg.dwRegNum);
+                    WriteBit<BASE+4>(pLoc, reg.dwSubRegNum>>4);
                 }
             }
         }
@@ -818,26 +948,26 @@ namespace GEN
                             rFields.Src1.bAlign16 ||
                             rFields.Src2.bAlign16;
 
-            WriteBits( pLoc, rFields.dwOpcode, 6,0);
-            WriteBits( pLoc, bAlign16, 8, 8 );            
+            WriteBits<6,0>(pLoc, rFields.dwOpcode);
+            WriteBits<8,8>(pLoc, bAlign16);            
 
-            WriteBits(pLoc,rFields.nPredControl, 19,16);
-            WriteBit(pLoc,rFields.bPredInvert,20);
+            WriteBits<19,16>(pLoc,rFields.nPredControl);
+            WriteBit<20>(pLoc,rFields.bPredInvert);
             
-            WriteBits(pLoc,rFields.nThreadControl, 15,14);
-            WriteBit( pLoc, rFields.bMaskControl, 9 );
-            WriteBits( pLoc, (rFields.bNoDDChk<<1)|rFields.bNoDDClr, 11, 10 );
-            WriteBits( pLoc, rFields.nExecSize, 23,21 );
-            WriteBits( pLoc, rFields.nCondModifier, 27, 24 );
-            WriteBits( pLoc, rFields.Dest.dwRegFile,  33, 32 );
-            WriteBits( pLoc, rFields.Dest.dwDataType, 36, 34 );
-            WriteBits( pLoc, rFields.Src0.dwRegFile,  38, 37 );
-            WriteBits( pLoc, rFields.Src0.dwDataType, 41, 39 );
-            WriteBits( pLoc, rFields.Src1.dwRegFile,  43, 42 );
-            WriteBits( pLoc, rFields.Src1.dwDataType, 46, 44 );
+            WriteBits<15,14>(pLoc,rFields.nThreadControl);
+            WriteBit<9>(pLoc, rFields.bMaskControl);
+            WriteBits<11,10>(pLoc, (rFields.bNoDDChk<<1)|rFields.bNoDDClr);
+            WriteBits<23,21>(pLoc, rFields.nExecSize);
+            WriteBits<27,24>(pLoc, rFields.nCondModifier);
+            WriteBits<33,32>(pLoc, rFields.Dest.dwRegFile);
+            WriteBits<36,34>(pLoc, rFields.Dest.dwDataType);
+            WriteBits<38,37>(pLoc, rFields.Src0.dwRegFile);
+            WriteBits<41,39>(pLoc, rFields.Src0.dwDataType);
+            WriteBits<43,42>(pLoc, rFields.Src1.dwRegFile);
+            WriteBits<46,44>(pLoc, rFields.Src1.dwDataType);
     
-            WriteBit( pLoc, rFields.dwFlagRegNum,    90 );
-            WriteBit( pLoc, rFields.dwFlagSubRegNum, 89 );
+            WriteBit<90>(pLoc, rFields.dwFlagRegNum);
+            WriteBit<89>(pLoc, rFields.dwFlagSubRegNum);
 
             
 
@@ -845,34 +975,34 @@ namespace GEN
             {
                 if( rFields.Dest.bIsIndirect )
                 {
-                    WriteBits(pLoc, 1, 63,63 );
-                    WriteBits( pLoc, rFields.Dest.dwAddrSubRegNum, 60,58);
-                    WriteBits( pLoc, rFields.Dest.nAddrImm >>4, 57,52 );
+                    WriteBits<63,63>(pLoc, 1);
+                    WriteBits<60,58>(pLoc, rFields.Dest.dwAddrSubRegNum);
+                    WriteBits<57,52>(pLoc, rFields.Dest.nAddrImm >>4);
                 }
                 else
                 {
-                    WriteBits(pLoc, rFields.Dest.dwRegNum, 60,53 );
-                    WriteBits(pLoc, rFields.Dest.dwSubRegNum>>3, 52,52 );
+                    WriteBits<60,53>(pLoc, rFields.Dest.dwRegNum);
+                    WriteBits<52,52>(pLoc, rFields.Dest.dwSubRegNum>>3);
                 }
-                WriteBits(pLoc, rFields.dwDestWriteMask, 51,48 );
-                WriteBits(pLoc, rFields.Dest.dwHStride, 62,61 );
+                WriteBits<51,48>(pLoc, rFields.dwDestWriteMask);
+                WriteBits<62,61>(pLoc, rFields.Dest.dwHStride);
 
             }
             else
             {
                 if( rFields.Dest.bIsIndirect )
                 {
-                    WriteBits(pLoc, 1, 63,63 );
-                    WriteBits( pLoc, rFields.Dest.dwAddrSubRegNum, 60,58);
-                    WriteBits( pLoc, rFields.Dest.nAddrImm, 57,48 );
+                    WriteBits<63,63>(pLoc, 1);
+                    WriteBits<60,58>(pLoc, rFields.Dest.dwAddrSubRegNum);
+                    WriteBits<57,48>(pLoc, rFields.Dest.nAddrImm);
                 }
                 else
                 {
-                    WriteBits(pLoc, rFields.Dest.dwRegNum, 60,53 );
-                    WriteBits(pLoc, rFields.Dest.dwSubRegNum, 52,48 );
+                    WriteBits<60,53>(pLoc, rFields.Dest.dwRegNum);
+                    WriteBits<52,48>(pLoc, rFields.Dest.dwSubRegNum);
                 }
                      
-                WriteBits(pLoc, rFields.Dest.dwHStride, 62,61 );
+                WriteBits<62,61>(pLoc, rFields.Dest.dwHStride);
           
             }
 
@@ -884,7 +1014,7 @@ namespace GEN
             else
             {
                 // Write Src0 reg
-                WriteSourceRegFields( pLoc+8, rFields.Src0, !bAlign16 );
+                WriteSourceRegFields<64>( pLoc, rFields.Src0, !bAlign16 );
 
                 if( rFields.Src0.dwRegFile == RF_IMM ||
                     rFields.Src1.dwRegFile == RF_IMM ||
@@ -897,7 +1027,7 @@ namespace GEN
                 else
                 {
                     //Write Src1 reg
-                    WriteSourceRegFields( pLoc+12, rFields.Src1, !bAlign16 );
+                    WriteSourceRegFields<96>( pLoc, rFields.Src1, !bAlign16 );
                 }
             }
         }
@@ -905,41 +1035,41 @@ namespace GEN
         void WriteInstructionFields3Src( uint8* pLoc, const InstructionFields& rFields, Operations eOp )
         {
            
-            WriteBits( pLoc, rFields.dwOpcode, 7, 0 );
-            WriteBit( pLoc, rFields.bMaskControl, 9 );
-            WriteBits( pLoc, (rFields.bNoDDChk<<1)|rFields.bNoDDClr, 11, 10 );
-            WriteBits( pLoc, rFields.nQtrControl, 13,12 );
-            WriteBits( pLoc, rFields.nThreadControl, 15,14 );
-            WriteBits( pLoc, rFields.nPredControl,19,16);
-            WriteBit( pLoc, rFields.bPredInvert,20 );
-            WriteBits( pLoc, rFields.nExecSize,23,21);
-            WriteBits( pLoc, rFields.nCondModifier,27,24);
-            WriteBit( pLoc, rFields.bAccumWrite,28 );
-            WriteBit( pLoc, rFields.bAccumWrite,31 );
+            WriteBits<7,0>(pLoc, rFields.dwOpcode);
+            WriteBit<9>(pLoc, rFields.bMaskControl);
+            WriteBits<11,10>(pLoc, (rFields.bNoDDChk<<1)|rFields.bNoDDClr);
+            WriteBits<13,12>(pLoc, rFields.nQtrControl);
+            WriteBits<15,14>(pLoc, rFields.nThreadControl);
+            WriteBits<19,16>(pLoc, rFields.nPredControl);
+            WriteBit<20>(pLoc, rFields.bPredInvert);
+            WriteBits<23,21>(pLoc, rFields.nExecSize);
+            WriteBits<27,24>(pLoc, rFields.nCondModifier);
+            WriteBit<28>(pLoc, rFields.bAccumWrite);
+            WriteBit<31>(pLoc, rFields.bAccumWrite);
             
-            WriteBit( pLoc, rFields.dwFlagSubRegNum, 33 );
-            WriteBit( pLoc, rFields.dwFlagRegNum, 34 );
-            WriteBits( pLoc, rFields.Src0.dwModifier, 37,36);
-            WriteBits( pLoc, rFields.Src1.dwModifier, 39,38);
-            WriteBits( pLoc, rFields.Src2.dwModifier, 41,40);
-            WriteBits( pLoc, rFields.Src0.dwDataType, 43,42);
-            WriteBits( pLoc, rFields.Dest.dwDataType, 45,44);
-            WriteBits( pLoc, rFields.dwDestWriteMask, 52,49);
+            WriteBit<33>(pLoc, rFields.dwFlagSubRegNum);
+            WriteBit<34>(pLoc, rFields.dwFlagRegNum);
+            WriteBits<37,36>(pLoc, rFields.Src0.dwModifier);
+            WriteBits<39,38>(pLoc, rFields.Src1.dwModifier);
+            WriteBits<41,40>(pLoc, rFields.Src2.dwModifier);
+            WriteBits<43,42>(pLoc, rFields.Src0.dwDataType);
+            WriteBits<45,44>(pLoc, rFields.Dest.dwDataType);
+            WriteBits<52,49>(pLoc, rFields.dwDestWriteMask);
             
-            WriteBits( pLoc, rFields.Dest.dwSubRegNum>>2, 55,53);
-            WriteBits( pLoc, rFields.Dest.dwRegNum,       63,56);
+            WriteBits<55,53>(pLoc, rFields.Dest.dwSubRegNum>>2);
+            WriteBits<63,56>(pLoc, rFields.Dest.dwRegNum);
             
-            WriteBits( pLoc, rFields.Src0.dwChanSel,      72,65);
-            WriteBits( pLoc, rFields.Src0.dwSubRegNum>>2, 75,73);
-            WriteBits( pLoc, rFields.Src0.dwRegNum,       83,76);
+            WriteBits<72,65>(pLoc, rFields.Src0.dwChanSel);
+            WriteBits<75,73>(pLoc, rFields.Src0.dwSubRegNum>>2);
+            WriteBits<83,76>(pLoc, rFields.Src0.dwRegNum);
             
-            WriteBits( pLoc, rFields.Src1.dwChanSel,      93,86);
-            WriteBits( pLoc, rFields.Src1.dwSubRegNum>>2, 95,94);
-            WriteBits( pLoc, rFields.Src1.dwRegNum,       104,97);
+            WriteBits<93,86>(pLoc, rFields.Src1.dwChanSel);
+            WriteBits<95,94>(pLoc, rFields.Src1.dwSubRegNum>>2);
+            WriteBits<104,97>(pLoc, rFields.Src1.dwRegNum);
             
-            WriteBits( pLoc, rFields.Src2.dwChanSel,      114,107);
-            WriteBits( pLoc, rFields.Src2.dwSubRegNum>>2, 117,115);
-            WriteBits( pLoc, rFields.Src2.dwRegNum,       125,118);           
+            WriteBits<114,107>(pLoc, rFields.Src2.dwChanSel);
+            WriteBits<117,115>(pLoc, rFields.Src2.dwSubRegNum>>2);
+            WriteBits<125,118>(pLoc, rFields.Src2.dwRegNum);           
         }
 
 
@@ -970,41 +1100,42 @@ namespace GEN
                 fields.nPredControl = DECODE_PredModesAlign1(fields.nPredControl);
         }
       
+        template< DWORD BASE >
         void ReadSourceRegFields( RegisterFields& reg, const uint8* pIn, bool align1 )
         {
-            reg.bIsIndirect = ReadBit(pIn,15);
-            reg.dwModifier  = ReadBits(pIn,14,13);
-            reg.dwVStride   = DECODE_VStride( ReadBits(pIn,24,21) );
+            reg.bIsIndirect = ReadBit<BASE+15>(pIn);
+            reg.dwModifier  = ReadBits<BASE+14,BASE+13>(pIn);
+            reg.dwVStride   = DECODE_VStride( ReadBits<BASE+24,BASE+21>(pIn) );
             if( align1 )
             {
                 reg.dwChanSel = 0xE4; // default swizzles:   3 2 1 0 -> 11 10 01 00
-                reg.dwWidth   = DECODE_Width( ReadBits(pIn,20,18) );
-                reg.dwHStride = DECODE_HStride( ReadBits(pIn,17,16) );
+                reg.dwWidth   = DECODE_Width( ReadBits<BASE+20,BASE+18>(pIn) );
+                reg.dwHStride = DECODE_HStride( ReadBits<BASE+17,BASE+16>(pIn) );
                 if( reg.bIsIndirect )
                 {
-                    reg.nAddrImm = SignExtend( ReadBits(pIn,9,0), 9 );
-                    reg.dwAddrSubRegNum = ReadBits(pIn,12,10);
+                    reg.nAddrImm = SignExtend( ReadBits<BASE+9,BASE>(pIn), 9 );
+                    reg.dwAddrSubRegNum = ReadBits<BASE+12,BASE+10>(pIn);
                 }
                 else
                 {
-                    reg.dwRegNum = ReadBits(pIn,12,5);
-                    reg.dwSubRegNum = ReadBits(pIn,4,0);
+                    reg.dwRegNum = ReadBits<BASE+12,BASE+5>(pIn);
+                    reg.dwSubRegNum = ReadBits<BASE+4,BASE>(pIn);
                 }
             }
             else
             {
                 reg.dwWidth     = 4;
                 reg.dwHStride   = 1;
-                reg.dwChanSel   = ReadBits(pIn,3,0)|ReadBits(pIn,19,16)<<4;
+                reg.dwChanSel   = ReadBits<BASE+3,BASE>(pIn)|ReadBits<BASE+19,BASE+16>(pIn)<<4;
                 if( reg.bIsIndirect )
                 {
-                    reg.nAddrImm        = SignExtend( ReadBits(pIn,9,4)<<4, 9 );
-                    reg.dwAddrSubRegNum = ReadBits(pIn,12,10);
+                    reg.nAddrImm        = SignExtend( ReadBits<BASE+9,BASE+4>(pIn)<<4, 9 );
+                    reg.dwAddrSubRegNum = ReadBits<BASE+12,BASE+10>(pIn);
                 }
                 else
                 {
-                    reg.dwRegNum    = ReadBits(pIn,12,5);
-                    reg.dwSubRegNum = ReadBit(pIn,4)<<4;
+                    reg.dwRegNum    = ReadBits<BASE+12,BASE+5>(pIn);
+                    reg.dwSubRegNum = ReadBit<BASE+4>(pIn)<<4;
                 }
             }
 
@@ -1016,29 +1147,29 @@ namespace GEN
         void ReadInstructionFields ( InstructionFields& fields, const uint8* pIn )
         {
             memset(&fields,0,sizeof(fields));
-            fields.bAlign16 = ReadBits(pIn,8,8);
-            fields.dwOpcode              = DECODE_Operations(ReadBits(pIn,7,0));
-            fields.bMaskControl          = ReadBits(pIn,9,9);
-            fields.bNoDDChk              = ReadBit(pIn,11);
-            fields.bNoDDClr              = ReadBit(pIn,10);
-            fields.nQtrControl           = ReadBits(pIn,13,12);
-            fields.nThreadControl        = ReadBits(pIn,15,14);
-            fields.nPredControl          = ReadBits(pIn,19,16);
-            fields.bPredInvert           = ReadBits(pIn,20,20);
-            fields.nExecSize             = ReadBits(pIn,23,21);
-            fields.nCondModifier         = ReadBits(pIn,27,24);
-            fields.bAccumWrite           = ReadBits(pIn,28,28);
-            fields.bSat                  = ReadBits(pIn,31,31);
-
-            fields.Dest.dwRegFile        = ReadBits(pIn,33,32);
-            fields.Dest.dwDataType       = ReadBits(pIn,36,34);
-            fields.Src0.dwRegFile        = ReadBits(pIn,38,37);
-            fields.Src0.dwDataType       = ReadBits(pIn,41,39);
-            fields.Src1.dwRegFile        = ReadBits(pIn,43,42);
-            fields.Src1.dwDataType       = ReadBits(pIn,46,44);
-
-            fields.dwNibControl          = ReadBit( pIn,47 );
-            fields.Dest.bIsIndirect      = ReadBit( pIn,63 );
+            fields.bAlign16 = ReadBits<8,8>(pIn);
+            fields.dwOpcode              = DECODE_Operations(ReadBits<7,0>(pIn));
+            fields.bMaskControl          = ReadBits<9,9>(pIn);
+            fields.bNoDDChk              = ReadBit<11>(pIn);
+            fields.bNoDDClr              = ReadBit<10>(pIn);
+            fields.nQtrControl           = ReadBits<13,12>(pIn);
+            fields.nThreadControl        = ReadBits<15,14>(pIn);
+            fields.nPredControl          = ReadBits<19,16>(pIn);
+            fields.bPredInvert           = ReadBits<20,20>(pIn);
+            fields.nExecSize             = ReadBits<23,21>(pIn);
+            fields.nCondModifier         = ReadBits<27,24>(pIn);
+            fields.bAccumWrite           = ReadBits<28,28>(pIn);
+            fields.bSat                  = ReadBits<31,31>(pIn);
+
+            fields.Dest.dwRegFile        = ReadBits<33,32>(pIn);
+            fields.Dest.dwDataType       = ReadBits<36,34>(pIn);
+            fields.Src0.dwRegFile        = ReadBits<38,37>(pIn);
+            fields.Src0.dwDataType       = ReadBits<41,39>(pIn);
+            fields.Src1.dwRegFile        = ReadBits<43,42>(pIn);
+            fields.Src1.dwDataType       = ReadBits<46,44>(pIn);
+
+            fields.dwNibControl          = ReadBit<47>(pIn);
+            fields.Dest.bIsIndirect      = ReadBit<63>(pIn);
             bool align1 = fields.bAlign16 == 0;
             
 
@@ -1047,45 +1178,45 @@ namespace GEN
             if( align1 )
             {
                 fields.dwDestWriteMask = 0xffff;
-                fields.Dest.dwHStride = DECODE_HStride(ReadBits( pIn, 62,61));
+                fields.Dest.dwHStride = DECODE_HStride(ReadBits<62,61>(pIn));
                 if( fields.Dest.bIsIndirect )
                 {
-                    fields.Dest.nAddrImm  = SignExtend( ReadBits(pIn,57,48), 9 );
-                    fields.Dest.dwAddrSubRegNum = ReadBits(pIn,60,58);
+                    fields.Dest.nAddrImm  = SignExtend( ReadBits<57,48>(pIn), 9 );
+                    fields.Dest.dwAddrSubRegNum = ReadBits<60,58>(pIn);
                 }
                 else
                 {
-                    fields.Dest.dwRegNum    = ReadBits(pIn, 60,53);
-                    fields.Dest.dwSubRegNum = ReadBits(pIn, 52,48);
+                    fields.Dest.dwRegNum    = ReadBits<60,53>(pIn);
+                    fields.Dest.dwSubRegNum = ReadBits<52,48>(pIn);
                 }
             }
             else
             {
                 fields.Dest.dwHStride = 1;
-                fields.dwDestWriteMask = ReadBits(pIn,51,48);
+                fields.dwDestWriteMask = ReadBits<51,48>(pIn);
                
                 if( fields.Dest.bIsIndirect )
                 {
-                    fields.Dest.nAddrImm  = SignExtend( ReadBits(pIn,57,52)<<4, 9 );
-                    fields.Dest.dwAddrSubRegNum = ReadBits(pIn,60,58);
+                    fields.Dest.nAddrImm  = SignExtend( ReadBits<57,52>(pIn)<<4, 9 );
+                    fields.Dest.dwAddrSubRegNum = ReadBits<60,58>(pIn);
                 }
                 else
                 {
-                    fields.Dest.dwRegNum = ReadBits(pIn,60,53);
-                    fields.Dest.dwSubRegNum = ReadBit(pIn,52)<<4;
+                    fields.Dest.dwRegNum = ReadBits<60,53>(pIn);
+                    fields.Dest.dwSubRegNum = ReadBit<52>(pIn)<<4;
                 }
             }
             
             DecodeRegNumAndType2Src(fields.Dest);
 
-            ReadSourceRegFields(fields.Src0,pIn+8, align1);
-            ReadSourceRegFields(fields.Src1,pIn+12, align1);
+            ReadSourceRegFields<64>(fields.Src0,pIn, align1);
+            ReadSourceRegFields<96>(fields.Src1,pIn, align1);
 
             memcpy( &fields.IMM64, pIn+8,8);
             memcpy( &fields.IMM32, pIn+12,4);
             
-            fields.dwFlagRegNum    = ReadBit(pIn,90);
-            fields.dwFlagSubRegNum = ReadBit(pIn,89);
+            fields.dwFlagRegNum    = ReadBit<90>(pIn);
+            fields.dwFlagSubRegNum = ReadBit<89>(pIn);
 
             // Translate field values, and compute derived fields
             fields.nExecSize = DECODE_ExecSize(fields.nExecSize);
@@ -1128,53 +1259,53 @@ namespace GEN
             fields.Src2.bAlign16 = true;
             fields.Dest.bAlign16 = true;
             fields.bAlign16 = true;
-            fields.dwOpcode              = ReadBits(pIn,7,0);
-            fields.bMaskControl          = ReadBits(pIn,9,9);
-            fields.bNoDDChk              = ReadBit(pIn,11);
-            fields.bNoDDClr              = ReadBit(pIn,10);
-            fields.nQtrControl           = ReadBits(pIn,13,12);
-            fields.nThreadControl        = ReadBits(pIn,15,14);
-            fields.nPredControl          = ReadBits(pIn,19,16);
-            fields.bPredInvert           = ReadBits(pIn,20,20);
-            fields.nExecSize             = ReadBits(pIn,23,21);
-            fields.nCondModifier         = ReadBits(pIn,27,24);
-            fields.bAccumWrite           = ReadBits(pIn,28,28);
-            fields.bSat                  = ReadBits(pIn,31,31);
-
-            fields.dwFlagSubRegNum = ReadBit(pIn,33);
-            fields.dwFlagRegNum = ReadBit(pIn,34);
+            fields.dwOpcode              = ReadBits<7,0>(pIn);
+            fields.bMaskControl          = ReadBits<9,9>(pIn);
+            fields.bNoDDChk              = ReadBit<11>(pIn);
+            fields.bNoDDClr              = ReadBit<10>(pIn);
+            fields.nQtrControl           = ReadBits<13,12>(pIn);
+            fields.nThreadControl        = ReadBits<15,14>(pIn);
+            fields.nPredControl          = ReadBits<19,16>(pIn);
+            fields.bPredInvert           = ReadBits<20,20>(pIn);
+            fields.nExecSize             = ReadBits<23,21>(pIn);
+            fields.nCondModifier         = ReadBits<27,24>(pIn);
+            fields.bAccumWrite           = ReadBits<28,28>(pIn);
+            fields.bSat                  = ReadBits<31,31>(pIn);
+
+            fields.dwFlagSubRegNum = ReadBit<33>(pIn);
+            fields.dwFlagRegNum = ReadBit<34>(pIn);
             
-            fields.Src0.dwModifier = ReadBits(pIn,37,36);
-            fields.Src1.dwModifier = ReadBits(pIn,39,38);
-            fields.Src2.dwModifier = ReadBits(pIn,41,40);
+            fields.Src0.dwModifier = ReadBits<37,36>(pIn);
+            fields.Src1.dwModifier = ReadBits<39,38>(pIn);
+            fields.Src2.dwModifier = ReadBits<41,40>(pIn);
             
-            DWORD dwSrcType = DECODE_RegDataTypes3Src(ReadBits(pIn,43,42));
+            DWORD dwSrcType = DECODE_RegDataTypes3Src(ReadBits<43,42>(pIn));
             fields.Src0.dwDataType = dwSrcType;
             fields.Src1.dwDataType = dwSrcType;
             fields.Src2.dwDataType = dwSrcType;
-            fields.Dest.dwDataType = DECODE_RegDataTypes3Src(ReadBits(pIn,45,44));
+            fields.Dest.dwDataType = DECODE_RegDataTypes3Src(ReadBits<45,44>(pIn));
 
-            fields.dwDestWriteMask = ReadBits(pIn,52,49);
+            fields.dwDestWriteMask = ReadBits<52,49>(pIn);
   
             fields.Dest.dwRegFile = RF_GRF;
             fields.Src0.dwRegFile = RF_GRF;
             fields.Src1.dwRegFile = RF_GRF;
             fields.Src2.dwRegFile = RF_GRF;
 
-            fields.Dest.dwRegNum        = ReadBits(pIn,63,56);
-            fields.Dest.dwSubRegNum     = ReadBits(pIn,55,53)<<2;
+            fields.Dest.dwRegNum        = ReadBits<63,56>(pIn);
+            fields.Dest.dwSubRegNum     = ReadBits<55,53>(pIn)<<2;
 
-            fields.Src0.dwChanSel       = ReadBits(pIn, 72,65 );
-            fields.Src0.dwSubRegNum     = ReadBits(pIn,75,73)<<2;
-            fields.Src0.dwRegNum        = ReadBits(pIn,83,76);
+            fields.Src0.dwChanSel       = ReadBits<72,65>(pIn);
+            fields.Src0.dwSubRegNum     = ReadBits<75,73>(pIn)<<2;
+            fields.Src0.dwRegNum        = ReadBits<83,76>(pIn);
             
-            fields.Src1.dwChanSel       = ReadBits(pIn,93,86);
-            fields.Src1.dwSubRegNum     = ReadBits(pIn,95,94)<<2;
-            fields.Src1.dwRegNum        = ReadBits(pIn,104,97);
+            fields.Src1.dwChanSel       = ReadBits<93,86>(pIn);
+            fields.Src1.dwSubRegNum     = ReadBits<95,94>(pIn)<<2;
+            fields.Src1.dwRegNum        = ReadBits<104,97>(pIn);
 
-            fields.Src2.dwChanSel       = ReadBits(pIn,114,107);
-            fields.Src2.dwSubRegNum     = ReadBits(pIn,117,115)<<2;
-            fields.Src2.dwRegNum        = ReadBits(pIn,125,118);
+            fields.Src2.dwChanSel       = ReadBits<114,107>(pIn);
+            fields.Src2.dwSubRegNum     = ReadBits<117,115>(pIn)<<2;
+            fields.Src2.dwRegNum        = ReadBits<125,118>(pIn);
 
             fields.Src0.dwVStride = 8;
             fields.Src1.dwVStride = 8;
@@ -1252,6 +1383,97 @@ namespace GEN
             return GEN::FlagReference( rInst.dwFlagRegNum, rInst.dwFlagSubRegNum );
         }
 
+        /// Determine instruction class from the opcode alone.  Mirrors the class assignments made by the Decoder
+        InstructionClass ClassifyOperation( Operations eOp )
+        {
+            switch( eOp )
+            {
+            case OP_MATH:
+                return IC_MATH;
+
+            case OP_SEND:
+            case OP_SENDC:
+                return IC_SEND;
+
+            case OP_MOV     :
+            case OP_MOVI    :
+            case OP_NOT     :
+            case OP_ASR     :
+            case OP_F32TO16 :
+            case OP_F16TO32 :
+            case OP_BFREV   :
+            case OP_FRC     :
+            case OP_RNDU    :
+            case OP_RNDD    :
+            case OP_RNDE    :
+            case OP_RNDZ    :
+            case OP_FBH     :
+            case OP_FBL     :
+            case OP_CBIT    :
+                return IC_UNARY;
+
+            case OP_ADD     :
+            case OP_MUL     :
+            case OP_AVG     :
+            case OP_MAC     :
+            case OP_MACH    :
+            case OP_SEL     :
+            case OP_AND     :
+            case OP_OR      :
+            case OP_XOR     :
+            case OP_SHR     :
+            case OP_SHL     :
+            case OP_CMP     :
+            case OP_CMPN    :
+            case OP_LZD     :
+            case OP_ADDC    :
+            case OP_SUBB    :
+            case OP_SAD2    :
+            case OP_SADA2   :
+            case OP_DP4     :
+            case OP_DPH     :
+            case OP_DP3     :
+            case OP_DP2     :
+            case OP_BFI1    :
+            case OP_BFI2    :
+            case OP_LINE    :
+            case OP_PLN     :
+                return IC_BINARY;
+
+            case OP_IF      :
+            case OP_ELSE    :
+            case OP_WHILE   :
+            case OP_BREAK   :
+            case OP_CONT    :
+            case OP_ENDIF   :
+                return IC_BRANCH;
+
+            default:
+                return IsBasicThreeSource(eOp) ? IC_TERNARY : IC_NULL;
+            }
+        }
+
+        static void StoreOperand( DecodedProgram::OperandSlot e, size_t i, const RegisterFields& reg,
+                                  std::vector<uint8>* pRegTypes, std::vector<uint8>* pRegNums, std::vector<uint8>* pDataTypes )
+        {
+            pDataTypes[e][i] = (uint8) reg.dwDataType;
+            switch( reg.dwRegFile )
+            {
+            case RF_IMM:
+                pRegTypes[e][i] = REG_IMM;
+                pRegNums[e][i]  = 0;
+                break;
+            case RF_ARF:
+                pRegTypes[e][i] = (uint8) reg.dwRegNum; // already translated to a RegTypes
+                pRegNums[e][i]  = 0;
+                break;
+            default:
+                pRegTypes[e][i] = REG_GPR;
+                pRegNums[e][i]  = (uint8) reg.dwRegNum;
+                break;
+            }
+        }
+
 
     }
 
@@ -1348,6 +1570,116 @@ namespace GEN
     }
 
 
+    void DecodedProgram::Clear()
+    {
+        Resize(0);
+    }
+
+    void DecodedProgram::Resize( size_t n )
+    {
+        m_Offsets.resize(n);
+        m_Ops.resize(n);
+        m_Classes.resize(n);
+        m_ExecSizes.resize(n);
+        m_SendDescriptors.resize(n);
+        for( size_t i=0; i<OPERAND_COUNT; i++ )
+        {
+            m_RegTypes[i].resize(n);
+            m_RegNums[i].resize(n);
+            m_DataTypes[i].resize(n);
+        }
+    }
+
+    bool Decoder::DecodeAll( const uint8* pBytes, size_t nBytes, DecodedProgram& rProgram )
+    {
+        // Pass 1:  Find instruction boundaries
+        bool bResult = true;
+        rProgram.m_Offsets.clear();
+        size_t nOffset = 0;
+        while( nOffset < nBytes )
+        {
+            size_t nLength = DetermineLength( pBytes + nOffset );
+            if( !nLength || nOffset + nLength > nBytes )
+            {
+                bResult = false;
+                break;
+            }
+
+            rProgram.m_Offsets.push_back( (uint32) nOffset );
+            nOffset += nLength;
+        }
+
+        // Pass 2:  Fill in the columns
+        size_t nOps = rProgram.m_Offsets.size();
+        rProgram.Resize(nOps);
+
+        for( size_t i=0; i<nOps; i++ )
+        {
+            const uint8* pInst = pBytes + rProgram.m_Offsets[i];
+            Operations eOp = GetOperation(pInst);
+            InstructionClass eClass = _INTERNAL::ClassifyOperation(eOp);
+
+            rProgram.m_Ops[i]             = (uint8) eOp;
+            rProgram.m_Classes[i]         = (uint8) eClass;
+            rProgram.m_ExecSizes[i]       = 0;
+            rProgram.m_SendDescriptors[i] = 0;
+            for( size_t j=0; j<DecodedProgram::OPERAND_COUNT; j++ )
+            {
+                rProgram.m_RegTypes[j][i]  = REG_INVALID;
+                rProgram.m_RegNums[j][i]   = 0;
+                rProgram.m_DataTypes[j][i] = DT_INVALID;
+            }
+
+            if( eClass == IC_NULL )
+                continue;
+
+            _INTERNAL::InstructionFields fields;
+            if( eClass == IC_TERNARY )
+            {
+                _INTERNAL::ReadInstructionFieldsThreeSrc( fields, pInst );
+            }
+            else
+            {
+                uint8 pNative[16];
+                if( _INTERNAL::IsCompressedInstruction( _INTERNAL::ReadDWORD(pInst) ) && eClass != IC_SEND )
+                {
+                    _INTERNAL::ExpandCompressedInstruction( pNative, pInst );
+                    pInst = pNative;
+                }
+                _INTERNAL::ReadInstructionFields( fields, pInst );
+            }
+
+            rProgram.m_ExecSizes[i] = (uint8) fields.nExecSize;
+            if( eClass == IC_BRANCH )
+                continue;
+
+            _INTERNAL::StoreOperand( DecodedProgram::OPERAND_DEST, i, fields.Dest, 
+                                     rProgram.m_RegTypes, rProgram.m_RegNums, rProgram.m_DataTypes );
+            _INTERNAL::StoreOperand( DecodedProgram::OPERAND_SRC0, i, fields.Src0, 
+                                     rProgram.m_RegTypes, rProgram.m_RegNums, rProgram.m_DataTypes );
+            
+            switch( eClass )
+            {
+            case IC_SEND:
+                if( fields.Src1.dwRegFile == _INTERNAL::RF_IMM )
+                {
+                    rProgram.m_SendDescriptors[i] = fields.IMM32 & 0x1fffffff;
+                    rProgram.m_RegTypes[DecodedProgram::OPERAND_SRC1][i] = REG_IMM;
+                }
+                break;
+            case IC_BINARY:
+            case IC_TERNARY:
+            case IC_MATH:
+                _INTERNAL::StoreOperand( DecodedProgram::OPERAND_SRC1, i, fields.Src1, 
+                                         rProgram.m_RegTypes, rProgram.m_RegNums, rProgram.m_DataTypes );
+                break;
+            }
+        }
+
+        return bResult;
+    }
+
+
     /// Build a high-level representation of an instruction
     size_t Decoder::Decode( Instruction* pInst, const uint8* pInstructionBytes )
     {
@@ -1368,7 +1700,7 @@ namespace GEN
             {
                 pInst->m_eClass = IC_NULL;
                 pInst->m_eOp    = OP_ILLEGAL;
-                pInst->m_nExecSize = 0;
+                pInst->SetExecSize(0);
                 return 8; 
             }
             break;
@@ -1377,7 +1709,7 @@ namespace GEN
             {
                 pInst->m_eClass = IC_NULL;
                 pInst->m_eOp    = OP_NOP;
-                pInst->m_nExecSize = 0;
+                pInst->SetExecSize(0);
                 return 16;
             }
             break;
@@ -1433,13 +1765,14 @@ namespace GEN
         _INTERNAL::InstructionFields fields;
         _INTERNAL::ReadInstructionFieldsThreeSrc( fields, pIn );
 
-        pInst->m_nExecSize    = fields.nExecSize;
+        pInst->SetExecSize(fields.nExecSize);
         pInst->m_bNoWriteMask = fields.bMaskControl;
         pInst->m_bNoDDChk     = fields.bNoDDChk;
-        pInst->m_Dest         = _INTERNAL::InterpretDest( fields );
-        pInst->m_Source0      = _INTERNAL::InterpretSource(fields.Src0);
-        pInst->m_Source1      = _INTERNAL::InterpretSource(fields.Src1);
-        pInst->m_Source2      = _INTERNAL::InterpretSource(fields.Src2);
+        pInst->m_bNoDDClr     = fields.bNoDDClr;
+        pInst->SetDest( _INTERNAL::InterpretDest( fields ) );
+        pInst->SetSource( 0, _INTERNAL::InterpretSource(fields.Src0) );
+        pInst->SetSource( 1, _INTERNAL::InterpretSource(fields.Src1) );
+        pInst->SetSource( 2, _INTERNAL::InterpretSource(fields.Src2) );
         pInst->m_Predicate.Set( (PredicationModes) fields.nPredControl, fields.bPredInvert !=0);
         pInst->m_Flags         = _INTERNAL::InterpretFlagReference(fields);
         return 16;
@@ -1451,9 +1784,10 @@ namespace GEN
         _INTERNAL::ReadInstructionFields( fields, pInstructionBytes );
 
         pInst->m_eOp          = eOp;
-        pInst->m_nExecSize    = fields.nExecSize;
+        pInst->SetExecSize(fields.nExecSize);
         pInst->m_bNoWriteMask = fields.bMaskControl;
         pInst->m_bNoDDChk     = fields.bNoDDChk;
+        pInst->m_bNoDDClr     = fields.bNoDDClr;
         pInst->m_Predicate.Set( (PredicationModes) fields.nPredControl, fields.bPredInvert!=0 );
         pInst->m_Flags         = _INTERNAL::InterpretFlagReference(fields);
         if( eOp == OP_DIM )
@@ -1487,10 +1821,10 @@ namespace GEN
             {
                 // one source arithmetic
                 pInst->m_eClass  = IC_UNARY;
-                pInst->m_Dest    = _INTERNAL::InterpretDest(fields);
-                pInst->m_Source0 = _INTERNAL::InterpretSource(fields.Src0);
+                pInst->SetDest( _INTERNAL::InterpretDest(fields) );
+                pInst->SetSource( 0, _INTERNAL::InterpretSource(fields.Src0) );
                 pInst->m_eCondModifier = fields.nCondModifier;
-                return pInst->m_Dest.IsValid() && pInst->m_Source0.IsValid();
+                return pInst->GetDestOperand().IsValid() && pInst->GetSourceOperand(0).IsValid();
             }
             break;
             
@@ -1523,11 +1857,11 @@ namespace GEN
             {
                 // two source arithmetic
                 pInst->m_eClass         = IC_BINARY;
-                pInst->m_Dest           = _INTERNAL::InterpretDest(fields);
-                pInst->m_Source0        = _INTERNAL::InterpretSource(fields.Src0);
-                pInst->m_Source1        = _INTERNAL::InterpretSource(fields.Src1);
+                pInst->SetDest( _INTERNAL::InterpretDest(fields) );
+                pInst->SetSource( 0, _INTERNAL::InterpretSource(fields.Src0) );
+                pInst->SetSource( 1, _INTERNAL::InterpretSource(fields.Src1) );
                 pInst->m_eCondModifier  = fields.nCondModifier;
-                return pInst->m_Dest.IsValid() && pInst->m_Source0.IsValid() && pInst->m_Source1.IsValid();
+                return pInst->GetDestOperand().IsValid() && pInst->GetSourceOperand(0).IsValid() && pInst->GetSourceOperand(1).IsValid();
             }
             break; // two source arithmetic
 
@@ -1590,10 +1924,10 @@ namespace GEN
         bool bMsgDescriptorFromReg = fields.Src1.dwRegFile != _INTERNAL::RF_IMM;
         bool bEOT = (fields.IMM32 & 0x80000000) != 0;
         pInst->m_bMsgDescriptorFromReg = bMsgDescriptorFromReg;
-        pInst->m_Dest           = _INTERNAL::InterpretDest(fields);
-        pInst->m_Source0        = _INTERNAL::InterpretSource(fields.Src0);
+        pInst->SetDest( _INTERNAL::InterpretDest(fields) );
+        pInst->SetSource( 0, _INTERNAL::InterpretSource(fields.Src0) );
         pInst->m_eSFID          = fields.nCondModifier;
-        pInst->m_nExecSize      = fields.nExecSize;
+        pInst->SetExecSize(fields.nExecSize);
         pInst->m_bNoWriteMask   = fields.bMaskControl;
         pInst->m_bEOT           = bEOT;
         pInst->m_Predicate.Set( (PredicationModes) fields.nPredControl, fields.bPredInvert!=0 );
@@ -1611,10 +1945,10 @@ namespace GEN
         _INTERNAL::ReadInstructionFields(fields,pInstructionBytes);
 
         pInst->m_eFunctionCtrl  = fields.nCondModifier;
-        pInst->m_Dest           = _INTERNAL::InterpretDest(fields);
-        pInst->m_Source0        = _INTERNAL::InterpretSource(fields.Src0);
-        pInst->m_Source1        = _INTERNAL::InterpretSource(fields.Src1);
-        pInst->m_nExecSize      = fields.nExecSize;
+        pInst->SetDest( _INTERNAL::InterpretDest(fields) );
+        pInst->SetSource( 0, _INTERNAL::InterpretSource(fields.Src0) );
+        pInst->SetSource( 1, _INTERNAL::InterpretSource(fields.Src1) );
+        pInst->SetExecSize(fields.nExecSize);
         pInst->m_bNoWriteMask   = fields.bMaskControl;
         pInst->m_Predicate.Set( (PredicationModes) fields.nPredControl, fields.bPredInvert !=0);
         pInst->m_Flags         = _INTERNAL::InterpretFlagReference(fields);
@@ -1631,7 +1965,90 @@ namespace GEN
     }
 
 
-    size_t Encoder::Encode( void* pOutputBuffer, const GEN::Instruction* pOps, size_t nOps )
+    size_t Encoder::Encode( void* pOutputBuffer, const GEN::Instruction* pOps, size_t nOps, const size_t* pSourceOffsets )
+    {
+        size_t nBytes = EncodeNative( pOutputBuffer, pOps, nOps );
+        if( (!m_bCompaction && !pSourceOffsets) || !nOps )
+            return nBytes;
+
+        // Decide which instructions get compacted and where each one is going to land
+        //   Jumps and branches are never compacted, since their offsets will change.
+        uint8* pNative = (uint8*)pOutputBuffer;
+        size_t* pOffsets = (size_t*) malloc( sizeof(size_t)*(nOps+1) );
+        uint8 pCompact[8];
+        size_t nOffset=0;
+        for( size_t i=0; i<nOps; i++ )
+        {
+            pOffsets[i] = nOffset;
+            if( m_bCompaction && !_INTERNAL::IsRelativeJump(pOps[i]) && _INTERNAL::CompactInstruction( pCompact, pNative + 16*i ) )
+                nOffset += 8;
+            else
+                nOffset += 16;
+        }
+        pOffsets[nOps] = nOffset;
+
+        // Re-target jumps from the source layout to the new one.
+        //   If any of the jumps point somewhere strange, give up and leave everything native
+        int nTarget;
+        for( size_t i=0; i<nOps; i++ )
+        {
+            if( _INTERNAL::IsIPJump(pOps[i]) )
+            {
+                if( !_INTERNAL::FindJumpTarget( &nTarget, i, pOps[i].GetImmediate<int>(), nOps, pSourceOffsets ) )
+                {
+                    free(pOffsets);
+                    return nBytes;
+                }
+            }
+            else if( pOps[i].GetClass() == IC_BRANCH )
+            {
+                const BranchInstruction& it = static_cast<const BranchInstruction&>(pOps[i]);
+                if( !_INTERNAL::FindJumpTarget( &nTarget, i, 8*it.GetJIP(), nOps, pSourceOffsets ) ||
+                    !_INTERNAL::FindJumpTarget( &nTarget, i, 8*it.GetUIP(), nOps, pSourceOffsets ) )
+                {
+                    free(pOffsets);
+                    return nBytes;
+                }
+            }
+        }
+
+        for( size_t i=0; i<nOps; i++ )
+        {
+            uint8* pInst = pNative + 16*i;
+            if( _INTERNAL::IsIPJump(pOps[i]) )
+            {
+                _INTERNAL::FindJumpTarget( &nTarget, i, pOps[i].GetImmediate<int>(), nOps, pSourceOffsets );
+                int nJump = (int)pOffsets[nTarget] - (int)pOffsets[i];
+                memcpy( pInst+12, &nJump, 4 );
+            }
+            else if( pOps[i].GetClass() == IC_BRANCH )
+            {
+                const BranchInstruction& it = static_cast<const BranchInstruction&>(pOps[i]);
+                _INTERNAL::FindJumpTarget( &nTarget, i, 8*it.GetJIP(), nOps, pSourceOffsets );
+                int16 nJIP = (int16)( ((int)pOffsets[nTarget] - (int)pOffsets[i]) / 8 );
+                _INTERNAL::FindJumpTarget( &nTarget, i, 8*it.GetUIP(), nOps, pSourceOffsets );
+                int16 nUIP = (int16)( ((int)pOffsets[nTarget] - (int)pOffsets[i]) / 8 );
+                memcpy( pInst+12, &nJIP, 2 );
+                memcpy( pInst+14, &nUIP, 2 );
+            }
+
+            // compacted stream is never longer than the native one, so we can pack in place
+            if( pOffsets[i+1]-pOffsets[i] == 8 )
+            {
+                _INTERNAL::CompactInstruction( pCompact, pInst );
+                memcpy( pNative + pOffsets[i], pCompact, 8 );
+            }
+            else
+            {
+                memmove( pNative + pOffsets[i], pInst, 16 );
+            }
+        }
+
+        free(pOffsets);
+        return nOffset;
+    }
+
+    size_t Encoder::EncodeNative( void* pOutputBuffer, const GEN::Instruction* pOps, size_t nOps )
     {
         uint8* pOutputBytes = (uint8*)pOutputBuffer;
         for( size_t i=0; i<nOps; i++ )
@@ -1642,6 +2059,7 @@ namespace GEN
             memset(&fields,0,sizeof(fields));
             fields.bMaskControl = rInst.IsWriteMaskDisabled();
             fields.bNoDDChk = rInst.IsDDCheckDisabled();
+            fields.bNoDDClr = rInst.IsDDClearDisabled();
             
             // TODO: Handle Other conditions where we must pick align16 or align1
             fields.bAlign16 = false;
@@ -1739,12 +2157,23 @@ namespace GEN
             case IC_NULL:
                 {
                     memset( pOutputBytes,0,16 );
-                    _INTERNAL::WriteBits( pOutputBytes,_INTERNAL::Encode_Operations( rInst.GetOperation() ),6,0 );
+                    _INTERNAL::WriteBits<6,0>(pOutputBytes,_INTERNAL::Encode_Operations( rInst.GetOperation() ));
                 }
                 break;
             case IC_BRANCH:
                 {
-                    // TODO
+                    // Same layout the decoder expects: null dest and src0, JIP/UIP packed into the src1 immediate
+                    const BranchInstruction& it = static_cast<const BranchInstruction&>( rInst );
+                    DestOperand nullDest( DT_S32, RegisterRegion( DirectRegReference(REG_NULL,0),0,1,0) );
+                    SourceOperand nullSrc( DT_S32, RegisterRegion( DirectRegReference(REG_NULL,0),0,1,0) );
+                    fields.dwOpcode  = _INTERNAL::Encode_Operations(rInst.GetOperation());
+                    fields.nExecSize = _INTERNAL::Encode_ExecSize(it.GetExecSize());
+                    fields.IMM32     = (it.GetJIP() & 0xffff) | (((uint32)it.GetUIP()) << 16);
+                    _INTERNAL::FillDestRegFields( fields, nullDest );
+                    _INTERNAL::FillSourceRegFields( fields.Src0, nullSrc );
+                    fields.Src1.dwRegFile  = _INTERNAL::RF_IMM;
+                    fields.Src1.dwDataType = _INTERNAL::Encode_ImmDataTypes(DT_S32);
+                    _INTERNAL::WriteInstructionFields2Src(pOutputBytes, fields, rInst.GetOperation() );
                 }
                 break;
 
@@ -1772,6 +2201,6 @@ namespace GEN
             pOutputBytes += 16;
         }
 
-        return 16*nOps; // TODO: Compression
+        return 16*nOps;
     }
 }
@@ -0,0 +1,197 @@
+
+#include "GENControlFlow.h"
+#include "GENCoder.h"
+
+#include <algorithm>
+
+namespace GEN
+{
+    namespace _INTERNAL
+    {
+        /// Collect the byte offsets an instruction may transfer control to, other than falling through
+        static size_t GetBranchTargets( const Instruction& rInst, size_t nOffset, int* pTargets, EdgeTypes* pTypes )
+        {
+            int nJump;
+            if( GetJumpTarget( rInst, nOffset, &nJump ) )
+            {
+                pTargets[0] = nJump;
+                pTypes[0]   = EDGE_JUMP;
+                return 1;
+            }
+
+            if( rInst.GetClass() != IC_BRANCH )
+                return 0;
+
+            // JIP/UIP are in units of 8 bytes, relative to the branch
+            const BranchInstruction& rBranch = static_cast<const BranchInstruction&>(rInst);
+            pTargets[0] = (int)nOffset + 8*rBranch.GetJIP();
+            pTypes[0]   = EDGE_JIP;
+            switch( rInst.GetOperation() )
+            {
+            case OP_BREAK:
+            case OP_CONT:
+                pTargets[1] = (int)nOffset + 8*rBranch.GetUIP();
+                pTypes[1]   = EDGE_UIP;
+                return 2;
+            default:
+                return 1;
+            }
+        }
+
+        /// Check whether execution can continue to the next instruction
+        static bool FallsThrough( const Instruction& rInst, size_t nOffset )
+        {
+            int nJump;
+            if( GetJumpTarget( rInst, nOffset, &nJump ) )
+                return rInst.GetPredicate().GetMode() != PM_NONE;
+            if( rInst.GetClass() == IC_SEND )
+                return !static_cast<const SendInstruction&>(rInst).IsEOT();
+            return true;
+        }
+    }
+
+    bool GetJumpTarget( const Instruction& rInst, size_t nOffset, int* pTarget )
+    {
+        if( rInst.GetClass() != IC_BINARY || rInst.GetOperation() != OP_ADD )
+            return false;
+
+        const BinaryInstruction& it = static_cast<const BinaryInstruction&>(rInst);
+        if( it.GetDest().GetRegRegion().GetBaseRegister().GetRegType() != REG_INSTRUCTION_PTR ||
+            !it.GetSource1().IsImmediate() )
+            return false;
+
+        *pTarget = (int)nOffset + it.GetImmediate<int>();
+        return true;
+    }
+
+    void ControlFlowGraph::Clear()
+    {
+        m_Instructions.clear();
+        m_Offsets.clear();
+        m_InstructionBlocks.clear();
+        m_Blocks.clear();
+        m_Edges.clear();
+    }
+
+    size_t ControlFlowGraph::FindInstruction( size_t nOffset ) const
+    {
+        if( m_Instructions.empty() )
+            return (size_t)-1;
+
+        std::vector<size_t>::const_iterator it = std::lower_bound( m_Offsets.begin(), m_Offsets.end()-1, nOffset );
+        if( it == m_Offsets.end()-1 || *it != nOffset )
+            return (size_t)-1;
+        return it - m_Offsets.begin();
+    }
+
+    bool ControlFlowGraph::Build( Decoder* pDecoder, const void* pIsaBytes, size_t nIsaBytes )
+    {
+        Clear();
+
+        const uint8* pIsa = (const uint8*) pIsaBytes;
+        size_t nOffset = 0;
+        while( nOffset < nIsaBytes )
+        {
+            Instruction inst;
+            size_t nLength = pDecoder->Decode( &inst, pIsa + nOffset );
+            if( !nLength || nOffset + nLength > nIsaBytes )
+            {
+                Clear();
+                return false;
+            }
+
+            m_Instructions.push_back(inst);
+            m_Offsets.push_back(nOffset);
+            nOffset += nLength;
+        }
+        m_Offsets.push_back(nOffset);
+
+        size_t nOps = m_Instructions.size();
+        if( !nOps )
+            return true;
+
+        // mark block leaders:  The first instruction, branch targets, and anything after a branch
+        std::vector<bool> leaders( nOps+1, false );
+        leaders[0] = true;
+        for( size_t i=0; i<nOps; i++ )
+        {
+            int pTargets[2];
+            EdgeTypes pTypes[2];
+            size_t nTargets = _INTERNAL::GetBranchTargets( m_Instructions[i], m_Offsets[i], pTargets, pTypes );
+            for( size_t t=0; t<nTargets; t++ )
+            {
+                if( pTargets[t] < 0 )
+                    continue;
+                size_t nTarget = FindInstruction( (size_t)pTargets[t] );
+                if( nTarget != (size_t)-1 )
+                    leaders[nTarget] = true;
+            }
+
+            if( nTargets || !_INTERNAL::FallsThrough( m_Instructions[i], m_Offsets[i] ) )
+                leaders[i+1] = true;
+        }
+
+        m_InstructionBlocks.resize(nOps);
+        for( size_t i=0; i<nOps; i++ )
+        {
+            if( leaders[i] )
+            {
+                BasicBlock block;
+                block.nFirstInstruction = i;
+                block.nInstructionCount = 0;
+                block.nStartOffset      = m_Offsets[i];
+                block.nSendCount        = 0;
+                block.nFirstEdge        = 0;
+                block.nEdgeCount        = 0;
+                m_Blocks.push_back(block);
+            }
+
+            BasicBlock& rBlock = m_Blocks.back();
+            rBlock.nInstructionCount++;
+            rBlock.nEndOffset = m_Offsets[i+1];
+            if( m_Instructions[i].GetClass() == IC_SEND )
+                rBlock.nSendCount++;
+            m_InstructionBlocks[i] = m_Blocks.size()-1;
+        }
+
+        // edges leave from the last instruction in each block
+        for( size_t b=0; b<m_Blocks.size(); b++ )
+        {
+            BasicBlock& rBlock = m_Blocks[b];
+            size_t nLast = rBlock.nFirstInstruction + rBlock.nInstructionCount - 1;
+            const Instruction& rLast = m_Instructions[nLast];
+
+            rBlock.nFirstEdge = m_Edges.size();
+
+            int pTargets[3];
+            EdgeTypes pTypes[3];
+            size_t nTargets = 0;
+            if( _INTERNAL::FallsThrough( rLast, m_Offsets[nLast] ) )
+            {
+                pTargets[0] = (int)rBlock.nEndOffset;
+                pTypes[0]   = EDGE_FALLTHROUGH;
+                nTargets++;
+            }
+            nTargets += _INTERNAL::GetBranchTargets( rLast, m_Offsets[nLast], pTargets+nTargets, pTypes+nTargets );
+
+            for( size_t t=0; t<nTargets; t++ )
+            {
+                if( pTargets[t] < 0 )
+                    continue;
+                size_t nTarget = FindInstruction( (size_t)pTargets[t] );
+                if( nTarget == (size_t)-1 )
+                    continue;
+
+                ControlFlowEdge edge;
+                edge.nFromBlock = b;
+                edge.nToBlock   = m_InstructionBlocks[nTarget];
+                edge.eType      = pTypes[t];
+                m_Edges.push_back(edge);
+            }
+
+            rBlock.nEdgeCount = m_Edges.size() - rBlock.nFirstEdge;
+        }
+
+        return true;
+    }
+}
@@ -1,12 +1,17 @@
 
 #include "GENCoder.h"
+#include "GENControlFlow.h"
 #include "GENDisassembler.h"
 #include "GENIsa.h"
 
-#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace GEN
 {
@@ -15,38 +20,167 @@ namespace GEN
         
       
 
-        void Printf( IPrinter& printer, const char* Format, ... )
+        /// Growable text buffer that the disassembler formats into.
+        ///   Text goes into a local buffer first and only spills to the heap if a single 
+        ///   flush's worth of text outgrows it.  Integers and registers are formatted by hand,
+        ///   so nothing is allocated or re-scanned per field.
+        ///   Text is pushed to the printer by 'Flush', or by 'EndLine' once the buffer is half full
+        class TextWriter
         {
-            va_list vl;
-            va_start(vl,Format);
+        public:
+            TextWriter( IPrinter& rPrinter ) 
+                : m_rPrinter(rPrinter), m_pText(m_Local), m_nLength(0), m_nCapacity(sizeof(m_Local))
+            {
+            }
+            ~TextWriter()
+            {
+                if( m_pText != m_Local )
+                    free(m_pText);
+            }
 
-            char scratch[2048];
-            char* p = scratch;
+            void Char( char c )
+            {
+                Reserve(1);
+                m_pText[m_nLength++] = c;
+            }
+            void String( const char* p, size_t n )
+            {
+                Reserve(n);
+                memcpy( m_pText+m_nLength, p, n );
+                m_nLength += n;
+            }
+            void String( const char* p ) { String( p, strlen(p) ); }
 
-            int n = _vscprintf( Format, vl );
-            if( n+1 > sizeof(scratch) )
-                p = (char*) malloc( n+1 );
-            
-            vsprintf(p,Format,vl);
-            printer.Push(p);
+            void UInt( uint64 n )
+            {
+                char tmp[20];
+                size_t i=sizeof(tmp);
+                do
+                {
+                    tmp[--i] = '0' + (n%10);
+                    n /= 10;
+                } while(n);
+                String( tmp+i, sizeof(tmp)-i );
+            }
+            void Int( int32 n )
+            {
+                if( n < 0 )
+                {
+                    Char('-');
+                    UInt( 0u-(uint32)n );
+                }
+                else
+                    UInt( (uint32)n );
+            }
 
-            if( p != scratch )
-                free(p);
+            /// Lower-case hex, zero padded to at least 'nDigits' digits
+            void Hex( uint32 n, size_t nDigits )
+            {
+                const char LUT[] = "0123456789abcdef";
+                char tmp[8];
+                size_t i=sizeof(tmp);
+                do
+                {
+                    tmp[--i] = LUT[n&0xf];
+                    n >>= 4;
+                } while( n || sizeof(tmp)-i < nDigits );
+                String( tmp+i, sizeof(tmp)-i );
+            }
 
-            va_end(vl);
-        }
+            /// Same as printf's "%f"
+            void Float( double f )
+            {
+                char tmp[512];
+                String( tmp, sprintf(tmp,"%f",f) );
+            }
 
-        void catprintf( char* buff, const char* Format, ... )
-        {
-            va_list vl;
-            va_start(vl,Format);
-            
-            vsprintf( buff+strlen(buff), Format, vl );
-           
-            va_end(vl);
-        }
+            /// Right-justify everything written since 'nMark' in a field 'nWidth' wide, like "%16s"
+            size_t Mark() const { return m_nLength; }
+            void RightAlign( size_t nMark, size_t nWidth )
+            {
+                size_t nFieldLength = m_nLength - nMark;
+                if( nFieldLength >= nWidth )
+                    return;
+
+                size_t nPad = nWidth - nFieldLength;
+                Reserve(nPad);
+                memmove( m_pText+nMark+nPad, m_pText+nMark, nFieldLength );
+                memset( m_pText+nMark, ' ', nPad );
+                m_nLength += nPad;
+            }
+            void Field( size_t nWidth, const char* p )
+            {
+                size_t nMark = Mark();
+                String(p);
+                RightAlign(nMark,nWidth);
+            }
+
+            /// Escape quotes, backslashes and line breaks written since 'nMark', so they can go in a JSON string
+            void EscapeJSON( size_t nMark )
+            {
+                size_t nExtra = 0;
+                for( size_t i=nMark; i<m_nLength; i++ )
+                    if( m_pText[i] == '"' || m_pText[i] == '\\' || m_pText[i] == '\n' )
+                        nExtra++;
+                if( !nExtra )
+                    return;
+
+                Reserve(nExtra);
+                size_t nOut = m_nLength + nExtra;
+                for( size_t i=m_nLength; i-- > nMark; )
+                {
+                    char c = m_pText[i];
+                    m_pText[--nOut] = (c == '\n') ? 'n' : c;
+                    if( c == '"' || c == '\\' || c == '\n' )
+                        m_pText[--nOut] = '\\';
+                }
+                m_nLength += nExtra;
+            }
 
-        #define OPCODE_FORMAT "%8s"
+            void EndLine()
+            {
+                Char('\n');
+                if( m_nLength >= sizeof(m_Local)/2 )
+                    Flush();
+            }
+
+            void Flush()
+            {
+                if( !m_nLength )
+                    return;
+                m_pText[m_nLength] = 0;
+                m_rPrinter.Push(m_pText);
+                m_nLength = 0;
+            }
+
+        private:
+
+            void Reserve( size_t n )
+            {
+                // one extra for the terminator added by 'Flush'
+                if( m_nLength + n + 1 <= m_nCapacity )
+                    return;
+
+                size_t nCapacity = 2*m_nCapacity;
+                while( nCapacity < m_nLength + n + 1 )
+                    nCapacity *= 2;
+
+                char* pText = (char*) malloc(nCapacity);
+                memcpy( pText, m_pText, m_nLength );
+                if( m_pText != m_Local )
+                    free(m_pText);
+                m_pText = pText;
+                m_nCapacity = nCapacity;
+            }
+
+            IPrinter& m_rPrinter;
+            char* m_pText;
+            size_t m_nLength;
+            size_t m_nCapacity;
+            char m_Local[8192];
+        };
+
+        static const size_t OPCODE_WIDTH = 8;
         
 
         static const char* GetRegPrefix( RegTypes eReg )
@@ -105,7 +239,7 @@ namespace GEN
             }
         }
 
-        static void FormatSubReg( char* pBuffer, DataTypes eType, size_t nByteOffset )
+        static void FormatSubReg( TextWriter& w, DataTypes eType, size_t nByteOffset )
         {
             const char* pPrefix = GetSubRegPrefix(eType);
 
@@ -122,106 +256,138 @@ namespace GEN
             default:        nByteOffset = 0; break;
             }
 
+            w.String(pPrefix);
             if( nByteOffset > 0 )
-                sprintf( pBuffer, "%s%u", pPrefix, nByteOffset );
-            else
-                sprintf(pBuffer, "%s", pPrefix );
-
+                w.UInt(nByteOffset);
         }
 
-        void FormatRegReference( char* pBuffer, DataTypes eType, const GEN::RegReference& rReg )
+        void FormatRegReference( TextWriter& w, DataTypes eType, const GEN::RegReference& rReg )
         {
             if( rReg.IsDirect() )
             {
                 const GEN::DirectRegReference& rRegD = static_cast<const GEN::DirectRegReference&>(rReg);
-                
-                char pSubReg[16];
-                FormatSubReg(pSubReg,eType, rRegD.GetSubRegOffset() );
-
-                sprintf(pBuffer,"%s%u%s", GetRegPrefix(rRegD.GetRegType()),rRegD.GetRegNumber(), pSubReg );
+                w.String( GetRegPrefix(rRegD.GetRegType()) );
+                w.UInt( rRegD.GetRegNumber() );
+                FormatSubReg( w, eType, rRegD.GetSubRegOffset() );
             }
             else
             {
                 const GEN::IndirectRegReference& rRegI = static_cast<const GEN::IndirectRegReference&>(rReg);
-                const char* pPrefix = GetSubRegPrefix(eType);
-            
-                if( rRegI.GetImmediateOffset() < 0 )
-                    sprintf(pBuffer,"r[a0.%u-%u]%s", rRegI.GetAddressSubReg(), abs(rRegI.GetImmediateOffset()), pPrefix );
-                else if( rRegI.GetImmediateOffset() > 0 )
+                int nOffset = rRegI.GetImmediateOffset();
+                if( nOffset > 0 && nOffset % 32 == 0 )
                 {
-                    if( rRegI.GetImmediateOffset() % 32 == 0 )
-                        sprintf(pBuffer,"r%u[a0.%u]%s", rRegI.GetImmediateOffset()/32, rRegI.GetAddressSubReg(),  pPrefix );
-                    else
-                        sprintf(pBuffer,"r%u[a0.%u+%u]%s", rRegI.GetAddressSubReg(), rRegI.GetImmediateOffset(), pPrefix );
-                }    
+                    w.Char('r');
+                    w.UInt( nOffset/32 );
+                    w.String("[a0.");
+                    w.UInt( rRegI.GetAddressSubReg() );
+                }
                 else
-                    sprintf(pBuffer,"r[a0.%u]%s", rRegI.GetAddressSubReg(),  pPrefix );
+                {
+                    w.String("r[a0.");
+                    w.UInt( rRegI.GetAddressSubReg() );
+                    if( nOffset < 0 )
+                    {
+                        w.Char('-');
+                        w.UInt( -nOffset );
+                    }
+                    else if( nOffset > 0 )
+                    {
+                        w.Char('+');
+                        w.UInt( nOffset );
+                    }
+                }
+                w.Char(']');
+                w.String( GetSubRegPrefix(eType) );
             }
         }
 
        
 
-        void FormatRegRegion( char* pBuffer, DataTypes eType, const GEN::RegisterRegion& rRegion, size_t nExecSize )
+        void FormatRegRegion( TextWriter& w, DataTypes eType, const GEN::RegisterRegion& rRegion, size_t nExecSize )
         {
-            FormatRegReference(pBuffer,eType,rRegion.GetBaseRegister());
+            FormatRegReference(w,eType,rRegion.GetBaseRegister());
             if( !nExecSize )
                 return; // 0 exec size means never print a region description
 
             size_t h = rRegion.GetHStride();
             size_t v = rRegion.GetVStride();
-            size_t w = rRegion.GetWidth();
+            size_t wd = rRegion.GetWidth();
            // if( (h==1) && (w == 8 && v == 8) )
            //     return; // don't print boring region descriptions
                 
-            catprintf(pBuffer,"<%u,%u,%u>", v,w,h);
+            w.Char('<');
+            w.UInt(v);
+            w.Char(',');
+            w.UInt(wd);
+            w.Char(',');
+            w.UInt(h);
+            w.Char('>');
         }
 
-        void FormatDest( char* pBuffer, const GEN::DestOperand& rDest, size_t nExecSize )
+        void FormatDest( TextWriter& w, size_t nWidth, const GEN::DestOperand& rDest, size_t nExecSize )
         {
             // TODO write mask
-            FormatRegRegion( pBuffer, rDest.GetDataType(), rDest.GetRegRegion(), nExecSize );
+            size_t nMark = w.Mark();
+            FormatRegRegion( w, rDest.GetDataType(), rDest.GetRegRegion(), nExecSize );
+            w.RightAlign( nMark, nWidth );
         }
 
         
 
-        void FormatSource( char* pBuffer, const GEN::SourceOperand& rSrc, const GEN::Instruction& rInstruction )
+        void FormatSource( TextWriter& w, size_t nWidth, const GEN::SourceOperand& rSrc, const GEN::Instruction& rInstruction )
         {
             // TODO: swizzles
-            char tmp[64];
+            size_t nMark = w.Mark();
+            switch( rSrc.GetModifier() )
+            {
+            case SM_ABS:        w.Char('|');     break;
+            case SM_NEGATE:     w.Char('-');     break;
+            case SM_NEG_ABS:    w.String("-|");  break;
+            }
 
             if( rSrc.IsImmediate() )
             {
                 switch( rSrc.GetDataType() )
                 {
-                case DT_U32:    sprintf(tmp, "%u", rInstruction.GetImmediate<uint32>()); break;
-                case DT_S32:    sprintf(tmp, "%d", rInstruction.GetImmediate<int32>());  break;
-                case DT_U16:    sprintf(tmp, "%u", rInstruction.GetImmediate<uint16>()); break;
-                case DT_S16:    sprintf(tmp, "%d", rInstruction.GetImmediate<int16>());  break;
-                case DT_U8:     sprintf(tmp, "%u", rInstruction.GetImmediate<uint8>());  break;
-                case DT_S8:     sprintf(tmp, "%d", rInstruction.GetImmediate<int8>());   break;
-                case DT_F64:    sprintf(tmp, "%f", rInstruction.GetImmediate<double>());  break;
-                case DT_F32:    sprintf(tmp, "%f", rInstruction.GetImmediate<float>()); break;
+                case DT_U32:    w.UInt( rInstruction.GetImmediate<uint32>() ); break;
+                case DT_S32:    w.Int ( rInstruction.GetImmediate<int32>() );  break;
+                case DT_U16:    w.UInt( rInstruction.GetImmediate<uint16>() ); break;
+                case DT_S16:    w.Int ( rInstruction.GetImmediate<int16>() );  break;
+                case DT_U8:     w.UInt( rInstruction.GetImmediate<uint8>() );  break;
+                case DT_S8:     w.Int ( rInstruction.GetImmediate<int8>() );   break;
+                case DT_F64:    w.Float( rInstruction.GetImmediate<double>() ); break;
+                case DT_F32:    w.Float( rInstruction.GetImmediate<float>() );  break;
                 case DT_VEC_HALFBYTE_UINT:  
                     {
                         unsigned int pVals[8];
                         UnpackHalfByte_UINT(pVals,rInstruction.GetImmediate<uint32>() );
-                        sprintf(tmp,"imm_uvec(%u,%u,%u,%u,%u,%u,%u,%u)", 
-                                pVals[0],pVals[1],pVals[2],pVals[3],
-                                pVals[4],pVals[5],pVals[6],pVals[7]);
+                        w.String("imm_uvec(");
+                        for( size_t i=0; i<8; i++ )
+                        {
+                            if( i )
+                                w.Char(',');
+                            w.UInt(pVals[i]);
+                        }
+                        w.Char(')');
                     }
                     break;
                 case DT_VEC_HALFBYTE_SINT:  
                     {
                         int pVals[8];
                         UnpackHalfByte_SINT(pVals,rInstruction.GetImmediate<uint32>() );
-                        sprintf(tmp,"imm_ivec(%d,%d,%d,%d,%d,%d,%d,%d)", 
-                                pVals[0],pVals[1],pVals[2],pVals[3],
-                                pVals[4],pVals[5],pVals[6],pVals[7]);
+                        w.String("imm_ivec(");
+                        for( size_t i=0; i<8; i++ )
+                        {
+                            if( i )
+                                w.Char(',');
+                            w.Int(pVals[i]);
+                        }
+                        w.Char(')');
                     }
                     break;
-                case DT_VEC_HALFBYTE_FLOAT: sprintf(tmp, "HALFBYTE-FLOAT??" ); break;
+                case DT_VEC_HALFBYTE_FLOAT: w.String("HALFBYTE-FLOAT??"); break;
                 default:
-                    sprintf(tmp, "IMM??" );
+                    w.String("IMM??");
                 }
             }
             else
@@ -234,8 +400,8 @@ namespace GEN
                 case IC_TERNARY:   nExecSize = static_cast<const TernaryInstruction&>(rInstruction).GetExecSize(); break;
                 case IC_MATH:      nExecSize = static_cast<const MathInstruction&>(rInstruction).GetExecSize(); break;
                 }
-               
-                FormatRegRegion( tmp, rSrc.GetDataType(), rSrc.GetRegRegion(), nExecSize );
+
+                FormatRegRegion( w, rSrc.GetDataType(), rSrc.GetRegRegion(), nExecSize );
                 if( !rSrc.GetSwizzle().IsIdentity() )
                 {
                     const char LUT[] = "xyzw";
@@ -244,228 +410,178 @@ namespace GEN
                     str[2] = LUT[rSrc.GetSwizzle().y];
                     str[3] = LUT[rSrc.GetSwizzle().z];
                     str[4] = LUT[rSrc.GetSwizzle().w];
-                    strcat(tmp,str);
+                    w.String(str,6);
                 }
             }
 
             switch( rSrc.GetModifier() )
             {
-            default:
-            case SM_NONE:
-                strcpy(pBuffer,tmp);
-                break;
             case SM_ABS:
-                sprintf( pBuffer, "|%s|", tmp );
-                break;
-            case SM_NEGATE:
-                sprintf( pBuffer, "-%s", tmp );
-                break;
             case SM_NEG_ABS:
-                sprintf( pBuffer, "-|%s|", tmp );
+                w.Char('|');
                 break;
             }
+            w.RightAlign( nMark, nWidth );
         }
 
-        static void FormatFlagReference( char* pBuff, const FlagReference& r )
+        static void FormatFlagReference( TextWriter& w, const FlagReference& r )
         {
-            sprintf( pBuff, "f%u.%u", r.GetReg(), r.GetSubReg() );
+            w.Char('f');
+            w.UInt( r.GetReg() );
+            w.Char('.');
+            w.UInt( r.GetSubReg() );
         }
-       
-        static void FormatPredicate( char* pBuff, const Predicate& p, const FlagReference& flag )
+
+        static void FormatPredicate( TextWriter& w, const Predicate& p, const FlagReference& flag )
         {
             if( p.GetMode() == PM_NONE )
-            {
-                *pBuff=0;
                 return;
-            }
-           
+
             if( p.IsInverted() )
-                *(pBuff++) = '~';
-            
-            FormatFlagReference( pBuff, flag );
-            
+                w.Char('~');
+
+            FormatFlagReference( w, flag );
+
             switch( p.GetMode() )
             {
-            case PM_SEQUENTIAL_FLAG: strcat(pBuff,".seq"); break;
-            case PM_SWIZZLE_X:       strcat(pBuff,".x"); break;
-            case PM_SWIZZLE_Y:       strcat(pBuff,".y"); break;
-            case PM_SWIZZLE_Z:       strcat(pBuff,".z"); break;
-            case PM_SWIZZLE_W:       strcat(pBuff,".w"); break;
-            case PM_ANY4H:           strcat(pBuff,".any4h"); break;
-            case PM_ALL4H:           strcat(pBuff,".all4h"); break;
-            case PM_ANYV     :       strcat(pBuff,".anyv"); break;
-            case PM_ALLV     :       strcat(pBuff,".allv"); break;
-            case PM_ANY2H    :       strcat(pBuff,".any2h"); break;
-            case PM_ALL2H    :       strcat(pBuff,".all2h"); break;
-            case PM_ANY8H    :       strcat(pBuff,".any8h"); break;
-            case PM_ALL8H    :       strcat(pBuff,".all8h"); break;
-            case PM_ANY16H   :       strcat(pBuff,".any16h"); break;
-            case PM_ALL16H   :       strcat(pBuff,".all16h"); break;
-            case PM_ANY32H   :       strcat(pBuff,".any32h"); break;
-            case PM_ALL32H   :       strcat(pBuff,".all32h"); break;
+            case PM_SEQUENTIAL_FLAG: w.String(".seq"); break;
+            case PM_SWIZZLE_X:       w.String(".x"); break;
+            case PM_SWIZZLE_Y:       w.String(".y"); break;
+            case PM_SWIZZLE_Z:       w.String(".z"); break;
+            case PM_SWIZZLE_W:       w.String(".w"); break;
+            case PM_ANY4H:           w.String(".any4h"); break;
+            case PM_ALL4H:           w.String(".all4h"); break;
+            case PM_ANYV     :       w.String(".anyv"); break;
+            case PM_ALLV     :       w.String(".allv"); break;
+            case PM_ANY2H    :       w.String(".any2h"); break;
+            case PM_ALL2H    :       w.String(".all2h"); break;
+            case PM_ANY8H    :       w.String(".any8h"); break;
+            case PM_ALL8H    :       w.String(".all8h"); break;
+            case PM_ANY16H   :       w.String(".any16h"); break;
+            case PM_ALL16H   :       w.String(".all16h"); break;
+            case PM_ANY32H   :       w.String(".any32h"); break;
+            case PM_ALL32H   :       w.String(".all32h"); break;
+            }
+        }
+
+        static void FormatPredicatePrefix( TextWriter& w, const Instruction& op )
+        {
+            if( op.GetPredicate().GetMode() != PM_NONE )
+            {
+                w.String("     PRED(");
+                FormatPredicate( w, op.GetPredicate(), op.GetFlagReference() );
+                w.Char(')');
+            }
+        }
+
+        static void FormatOpcode( TextWriter& w, const char* pName, size_t nExecSize )
+        {
+            w.Field( OPCODE_WIDTH, pName );
+            w.Char('(');
+            w.UInt(nExecSize);
+            w.Char(')');
+        }
+
+        static const char* GetMathFunctionName( MathFunctionIDs eFunction )
+        {
+            switch( eFunction )
+            {
+            case MATH_INVERSE: return "rcp";
+            case MATH_LOG: return "log";
+            case MATH_EXP: return "exp";
+            case MATH_SQRT: return "sqrt";
+            case MATH_RSQ : return "rsq";
+            case MATH_SIN:  return "sin";
+            case MATH_COS:  return "cos";
+            case MATH_FDIV: return "fdiv";
+            case MATH_POW:  return "pow";
+            case MATH_IDIV_BOTH: return "idivmod";
+            case MATH_IDIV_QUOTIENT: return "idiv";
+            case MATH_IDIV_REMAINDER: return "imod";
+            default: return "?Math?";
             }
         }
 
         static const bool VERBOSE_SEND = false;
 
-        void DisassembleOp( IPrinter& printer, const Instruction& op )
+        void DisassembleOp( TextWriter& w, const Instruction& op )
         {
-            char Src0[64];
-            char Src1[64];
-            char Src2[64];
-            char Dst[64];
-            char Op[64];
             switch( op.GetClass() )
             {
             case IC_SEND:
                 {
                     const GEN::SendInstruction& rInst = static_cast<const GEN::SendInstruction&>( op );
-                   
-                    FormatDest(Dst,rInst.GetDest(), 0 );
-                    FormatSource(Src0,rInst.GetSource(),rInst);
+
+                    uint32 nDescriptor = rInst.GetDescriptorIMM();
+                    uint32 nMsgType    = (nDescriptor>>14)&0xf;
+                    uint32 nBindTable  = nDescriptor&0xff;
+                    uint32 nControl    = (nDescriptor>>8)&0x3f;
+                    const char* pMessage = DataPortMessageToString( rInst.GetRecipient(), nMsgType );
 
                     if( !VERBOSE_SEND )
                     {
-                        uint32 nDescriptor = rInst.GetDescriptorIMM();
-                        
-                        char Message[64];
-
-
+                        FormatOpcode( w, GEN::OperationToString(op.GetOperation()), op.GetExecSize() );
+                        w.Char(' ');
                         switch( rInst.GetRecipient() )
                         {
                         case SFID_DP_DC0:
-                            {
-                                // TODO: Should probably abstract this
-                                //  into a message class
-                                uint32 nMsgType = (nDescriptor>>14)&0xf;
-                                uint32 nBindTable = nDescriptor&0xff;
-                                uint32 nControl = (nDescriptor>>8)&0x3f;
-                                switch( nMsgType )
-                                {
-                                case 0x0: sprintf( Message, "OWordBlockRead(%u)",      nBindTable); break;
-                                case 0x1: sprintf( Message, "OWordBlockReadU(%u)",     nBindTable); break;
-                                case 0x2: sprintf( Message, "OWordBlockReadx2(%u)",    nBindTable); break;
-                                case 0x3: sprintf( Message, "DwordScatterRead(%u)",    nBindTable); break;
-                                case 0x4: sprintf( Message, "ByteScatterRead(%u)",     nBindTable); break;
-                                case 0x7: sprintf( Message, "MemFence(%u)",            nBindTable); break;
-                                case 0x8: sprintf( Message, "OWordBlockWrite(%u)",     nBindTable); break;
-                                case 0xA: sprintf( Message, "OWordBlockWritex2(%u)",   nBindTable); break;
-                                case 0xB: sprintf( Message, "DwordScatterWrite(%u)",   nBindTable); break;
-                                case 0xC: sprintf( Message, "ByteScatterWrite(%u)",    nBindTable); break;
-                                }                      
-                            }                          
-                            break;
                         case SFID_DP_DC1:
+                            if( pMessage )
                             {
-                                uint32 nMsgType = (nDescriptor>>14)&0xf;
-                                uint32 nBindTable = nDescriptor&0xff;
-                                uint32 nControl = (nDescriptor>>8)&0x3f;
-                                switch( nMsgType )
-                                {
-                                case 0x1: sprintf( Message, "UntypedRead(%u)",          nBindTable); break;
-                                case 0x2: sprintf( Message, "UntypedAtomic(%u)",        nBindTable); break;
-                                case 0x3: sprintf( Message, "UntypedAtomic4x2(%u)",     nBindTable); break;
-                                case 0x4: sprintf( Message, "MediaBlockRead(%u)",       nBindTable); break;
-                                case 0x5: sprintf( Message, "TypedRead(%u)",            nBindTable); break;
-                                case 0x6: sprintf( Message, "TypedAtomic(%u)",          nBindTable); break;
-                                case 0x7: sprintf( Message, "TypedAtomic4x2(%u)",       nBindTable); break;
-                                case 0x9: sprintf( Message, "UntypedWrite(%u)",         nBindTable); break;
-                                case 0xA: sprintf( Message, "MediaBlockWrite(%u)",      nBindTable); break;
-                                case 0xB: sprintf( Message, "AtomicCounterOp(%u)",      nBindTable); break;
-                                case 0xC: sprintf( Message, "AtomicCounterOp4x2(%u)",   nBindTable); break;
-                                case 0xD: sprintf( Message, "TypedWrite(%u)",           nBindTable); break;
-                                }
-                            
+                                w.String(pMessage);
+                                w.Char('(');
+                                w.UInt(nBindTable);
+                                w.Char(')');
                             }
                             break;
 
                         default:
-                            sprintf( Message, "desc=0x%08x dst=%s", nDescriptor,GEN::SharedFunctionToString(rInst.GetRecipient()) );
+                            w.String("desc=0x");
+                            w.Hex(nDescriptor,8);
+                            w.String(" dst=");
+                            w.String( GEN::SharedFunctionToString(rInst.GetRecipient()) );
                         }
-
-
-                        
-                        Printf( printer, OPCODE_FORMAT "(%u) %s %16s, %16s" , GEN::OperationToString(op.GetOperation()),
-                                op.GetExecSize(), Message, Dst, Src0 );
-                            
+                        w.Char(' ');
+                        FormatDest( w, 16, rInst.GetDest(), 0 );
+                        w.String(", ");
+                        FormatSource( w, 16, rInst.GetSource(), rInst );
                     }
                     else
                     {
+                        w.Field( OPCODE_WIDTH, GEN::OperationToString(op.GetOperation()) );
+                        FormatDest( w, 16, rInst.GetDest(), 0 );
+                        w.String(", ");
+                        FormatSource( w, 16, rInst.GetSource(), rInst );
                         if( rInst.IsDescriptorInRegister() )
                         {
-                            Printf( printer, OPCODE_FORMAT, GEN::OperationToString(op.GetOperation()) );
-                            Printf(printer, "%16s, %16s  dest=%s ", Dst, Src0, GEN::SharedFunctionToString(rInst.GetRecipient()));
-
-                            Printf(printer," desc=REG");
+                            w.String("  dest=");
+                            w.String( GEN::SharedFunctionToString(rInst.GetRecipient()) );
+                            w.String("  desc=REG");
                         }
                         else
                         {
-                            uint32 nDescriptor = rInst.GetDescriptorIMM();
-                        
-                            Printf( printer, OPCODE_FORMAT "%16s, %16s\n" , GEN::OperationToString(op.GetOperation()),
-                                   Dst, Src0 );
-                            
-
-                            Printf(printer, "          desc=0x%08x dest=%s\n", nDescriptor, GEN::SharedFunctionToString(rInst.GetRecipient()));
-                            Printf(printer, "          len=%u  response=%u\n", rInst.GetMessageLengthFromDescriptor(), rInst.GetResponseLengthFromDescriptor() );
-                      
-
-                            switch( rInst.GetRecipient() )
+                            w.String("\n          desc=0x");
+                            w.Hex(nDescriptor,8);
+                            w.String(" dest=");
+                            w.String( GEN::SharedFunctionToString(rInst.GetRecipient()) );
+                            w.String("\n          len=");
+                            w.UInt( rInst.GetMessageLengthFromDescriptor() );
+                            w.String("  response=");
+                            w.UInt( rInst.GetResponseLengthFromDescriptor() );
+                            w.Char('\n');
+
+                            if( pMessage )
                             {
-                            case SFID_DP_DC0:
-                                {
-                                    // TODO: Should probably abstract this
-                                    //  into a message class
-                                    uint32 nMsgType = (nDescriptor>>14)&0xf;
-                                    uint32 nBindTable = nDescriptor&0xff;
-                                    uint32 nControl = (nDescriptor>>8)&0x3f;
-                                    switch( nMsgType )
-                                    {
-                                    case 0x0: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "OWordBlockRead",nControl, nBindTable); break;
-                                    case 0x1: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "OWordBlockReadU",nControl,nBindTable); break;
-                                    case 0x2: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "OWordBlockReadx2",nControl,nBindTable); break;
-                                    case 0x3: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "DwordScatterRead",nControl,nBindTable); break;
-                                    case 0x4: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "ByteScatterRead",nControl,nBindTable); break;
-                                    case 0x7: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "MemFence",nControl,nBindTable); break;
-                                    case 0x8: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "OWordBlockWrite",nControl,nBindTable); break;
-                                    case 0xA: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "OWordBlockWritex2",nControl,nBindTable); break;
-                                    case 0xB: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "DwordScatterWrite",nControl,nBindTable); break;
-                                    case 0xC: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "ByteScatterWrite",nControl,nBindTable); break;
-                                    }                      
-                                }                          
-                                break;
-                            case SFID_DP_DC1:
-                                {
-                                    uint32 nMsgType = (nDescriptor>>14)&0xf;
-                                    uint32 nBindTable = nDescriptor&0xff;
-                                    uint32 nControl = (nDescriptor>>8)&0x3f;
-                                    switch( nMsgType )
-                                    {
-                                    case 0x1: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "UntypedRead",nControl, nBindTable); break;
-                                    case 0x2: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "UntypedAtomic",nControl,nBindTable); break;
-                                    case 0x3: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "UntypedAtomic4x2",nControl,nBindTable); break;
-                                    case 0x4: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "MediaBlockRead",nControl,nBindTable); break;
-                                    case 0x5: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "TypedRead",nControl,nBindTable); break;
-                                    case 0x6: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "TypedAtomic",nControl,nBindTable); break;
-                                    case 0x7: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "TypedAtomic4x2",nControl,nBindTable); break;
-                                    case 0x9: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "UntypedWrite",nControl,nBindTable); break;
-                                    case 0xA: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "MediaBlockWrite",nControl,nBindTable); break;
-                                    case 0xB: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "AtomicCounterOp",nControl,nBindTable); break;
-                                    case 0xC: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "AtomicCounterOp4x2",nControl,nBindTable); break;
-                                    case 0xD: Printf(printer,"          %s" " ctl=0x%x bind=0x%02x", "TypedWrite",nControl,nBindTable); break;
-                                    }
-                            
-                                }
-                                break;
-
-                            default:
-                                ;
+                                w.String("          ");
+                                w.String(pMessage);
+                                w.String(" ctl=0x");
+                                w.Hex(nControl,1);
+                                w.String(" bind=0x");
+                                w.Hex(nBindTable,2);
                             }
 
                             if( rInst.IsEOT() )
-                            {
-                                Printf(printer, "EOT");
-                            }
+                                w.String("EOT");
                         }
                     }
 
@@ -474,204 +590,628 @@ namespace GEN
 
              case IC_MATH:
                 {
-                    char Dest[64];
-                    char Src0[64];
-                    char Src1[64];
                     const GEN::MathInstruction& rMath = static_cast<const GEN::MathInstruction&>(op);
 
-                     
-                    char Pred[64];
-                    FormatPredicate(Pred,rMath.GetPredicate(), rMath.GetFlagReference() );
-                    if( rMath.GetPredicate().GetMode() != PM_NONE )
-                        Printf(printer, "     PRED(%s)", Pred );
-
-                    FormatDest(Dest, rMath.GetDest(), rMath.GetExecSize() );
-                    FormatSource(Src0, rMath.GetSource0(), rMath );
-                    FormatSource(Src1, rMath.GetSource1(), rMath );
-                    const char* pOperation = "?Math?";
-                    switch( rMath.GetFunction() )
-                    {
-                    case MATH_INVERSE: pOperation = "rcp"; break;
-                    case MATH_LOG: pOperation = "log"; break;
-                    case MATH_EXP: pOperation = "exp"; break;
-                    case MATH_SQRT: pOperation = "sqrt"; break;
-                    case MATH_RSQ : pOperation = "rsq"; break;
-                    case MATH_SIN:  pOperation = "sin"; break;
-                    case MATH_COS:  pOperation = "cos"; break;
-                    case MATH_FDIV: pOperation = "fdiv"; break;
-                    case MATH_POW:  pOperation = "pow"; break;
-                    case MATH_IDIV_BOTH: pOperation = "idivmod"; break;
-                    case MATH_IDIV_QUOTIENT: pOperation = "idiv"; break;
-                    case MATH_IDIV_REMAINDER: pOperation = "imod"; break;
-                    }
+                    FormatPredicatePrefix( w, rMath );
 
-                    Printf(printer, OPCODE_FORMAT"(%u)""%16s,%16s,%16s", pOperation, rMath.GetExecSize(), Dest, Src0, Src1 );
-                   
+                    const char* pOperation = GetMathFunctionName( rMath.GetFunction() );
+                    FormatOpcode( w, pOperation, rMath.GetExecSize() );
+                    FormatDest( w, 16, rMath.GetDest(), rMath.GetExecSize() );
+                    w.Char(',');
+                    FormatSource( w, 16, rMath.GetSource0(), rMath );
+                    w.Char(',');
+                    FormatSource( w, 16, rMath.GetSource1(), rMath );
                 }
                 break;
 
             case IC_UNARY:
                 {
                     const GEN::UnaryInstruction& rInst = static_cast<const GEN::UnaryInstruction&>( op );
-                    
-                    char Pred[64];
-                    FormatPredicate(Pred,rInst.GetPredicate(), rInst.GetFlagReference() );
-                    if( rInst.GetPredicate().GetMode() != PM_NONE )
-                        Printf(printer, "     PRED(%s)", Pred );
-
-                    FormatDest(Dst,rInst.GetDest(), rInst.GetExecSize());
-                    FormatSource(Src0,rInst.GetSource0(),rInst);
 
-                    Printf( printer, OPCODE_FORMAT"(%u)" "%16s,%16s", 
-                           GEN::OperationToString(op.GetOperation()),
-                           rInst.GetExecSize(),
-                           Dst,
-                           Src0 );
+                    FormatPredicatePrefix( w, rInst );
+                    FormatOpcode( w, GEN::OperationToString(op.GetOperation()), rInst.GetExecSize() );
+                    FormatDest( w, 16, rInst.GetDest(), rInst.GetExecSize() );
+                    w.Char(',');
+                    FormatSource( w, 16, rInst.GetSource0(), rInst );
 
                     if( rInst.GetConditionModifier() != CM_NONE )
-                        Printf( printer, "  cm(%s)", GEN::ConditionalModifierToString(rInst.GetConditionModifier()) );
-
-                   
-                    
+                    {
+                        w.String("  cm(");
+                        w.String( GEN::ConditionalModifierToString(rInst.GetConditionModifier()) );
+                        w.Char(')');
+                    }
                 }
                 break;
 
             case IC_BINARY:
                 {
                     const GEN::BinaryInstruction& rInst = static_cast<const GEN::BinaryInstruction&>( op );
-                    char Pred[64];
-                    FormatPredicate(Pred,rInst.GetPredicate(), rInst.GetFlagReference() );
-                    if( rInst.GetPredicate().GetMode() != PM_NONE )
-                        Printf(printer, "     PRED(%s)", Pred );
-
-                    FormatDest(Dst,rInst.GetDest(), rInst.GetExecSize());
-                    FormatSource(Src0,rInst.GetSource0(),rInst);
-                    FormatSource(Src1,rInst.GetSource1(),rInst);
 
+                    FormatPredicatePrefix( w, rInst );
                     if( op.GetOperation() == OP_CMP )
                     {
                         // print compares as cmpxxx for brevity
-                        char Flag[64];
-                        FormatFlagReference( Flag, rInst.GetFlagReference() );
-
-                        Printf( printer, OPCODE_FORMAT"%s(%u)(%s)" "%16s,%16s,%16s", 
-                               GEN::OperationToString(op.GetOperation()),
-                               GEN::ConditionalModifierToString(rInst.GetConditionModifier()),
-                               rInst.GetExecSize(),
-                               Flag,
-                               Dst,
-                               Src0,
-                               Src1 );
+                        w.Field( OPCODE_WIDTH, GEN::OperationToString(op.GetOperation()) );
+                        w.String( GEN::ConditionalModifierToString(rInst.GetConditionModifier()) );
+                        w.Char('(');
+                        w.UInt( rInst.GetExecSize() );
+                        w.String(")(");
+                        FormatFlagReference( w, rInst.GetFlagReference() );
+                        w.Char(')');
                     }
                     else
                     {
-                        Printf( printer, OPCODE_FORMAT"(%u)" "%16s,%16s,%16s", 
-                               GEN::OperationToString(op.GetOperation()),
-                               rInst.GetExecSize(),
-                               Dst,
-                               Src0,
-                               Src1 );
-
-                        if( rInst.GetConditionModifier() != CM_NONE )
-                            Printf( printer, "  cm(%s)", GEN::ConditionalModifierToString(rInst.GetConditionModifier()) );
+                        FormatOpcode( w, GEN::OperationToString(op.GetOperation()), rInst.GetExecSize() );
                     }
 
+                    FormatDest( w, 16, rInst.GetDest(), rInst.GetExecSize() );
+                    w.Char(',');
+                    FormatSource( w, 16, rInst.GetSource0(), rInst );
+                    w.Char(',');
+                    FormatSource( w, 16, rInst.GetSource1(), rInst );
+
+                    if( op.GetOperation() != OP_CMP && rInst.GetConditionModifier() != CM_NONE )
+                    {
+                        w.String("  cm(");
+                        w.String( GEN::ConditionalModifierToString(rInst.GetConditionModifier()) );
+                        w.Char(')');
+                    }
                 }
                 break;
 
             case IC_TERNARY:
                 {
                     const GEN::TernaryInstruction& rInst = static_cast<const GEN::TernaryInstruction&>( op );
-                    
-                    char Pred[64];
-                    FormatPredicate(Pred,rInst.GetPredicate(), rInst.GetFlagReference() );
-                    if( rInst.GetPredicate().GetMode() != PM_NONE )
-                        Printf(printer, "     PRED(%s)", Pred );
-
-                    FormatDest(Dst,rInst.GetDest(), rInst.GetExecSize());
-                    FormatSource(Src0,rInst.GetSource0(),rInst);
-                    FormatSource(Src1,rInst.GetSource1(),rInst);
-                    FormatSource(Src2,rInst.GetSource2(),rInst);
-
-                    
-                    Printf( printer, OPCODE_FORMAT"(%u)" "%16s,%14s,%14s,%14s", 
-                            GEN::OperationToString(op.GetOperation()),
-                            rInst.GetExecSize(),
-                            Dst,
-                            Src0,
-                            Src1,
-                            Src2);
-
-              
+
+                    FormatPredicatePrefix( w, rInst );
+                    FormatOpcode( w, GEN::OperationToString(op.GetOperation()), rInst.GetExecSize() );
+                    FormatDest( w, 16, rInst.GetDest(), rInst.GetExecSize() );
+                    w.Char(',');
+                    FormatSource( w, 14, rInst.GetSource0(), rInst );
+                    w.Char(',');
+                    FormatSource( w, 14, rInst.GetSource1(), rInst );
+                    w.Char(',');
+                    FormatSource( w, 14, rInst.GetSource2(), rInst );
                 }
                 break;
             case IC_NULL:
                 {
-                    Printf( printer, OPCODE_FORMAT, GEN::OperationToString(op.GetOperation()) );
+                    w.Field( OPCODE_WIDTH, GEN::OperationToString(op.GetOperation()) );
                 }
                 break;
             case IC_BRANCH:
                 {
                     const GEN::BranchInstruction& rBranch = static_cast<const GEN::BranchInstruction&>( op );
 
-                    char Pred[64];
-                    FormatPredicate(Pred,rBranch.GetPredicate(), rBranch.GetFlagReference() );
-
-                    Printf( printer, OPCODE_FORMAT"(%u) JIP=%d UIP=%d  PRED=%s", 
-                           GEN::OperationToString(op.GetOperation()),
-                           rBranch.GetExecSize(),
-                           rBranch.GetJIP(),
-                           rBranch.GetUIP(),
-                           Pred );
-                
+                    FormatOpcode( w, GEN::OperationToString(op.GetOperation()), rBranch.GetExecSize() );
+                    w.String(" JIP=");
+                    w.Int( rBranch.GetJIP() );
+                    w.String(" UIP=");
+                    w.Int( rBranch.GetUIP() );
+                    w.String("  PRED=");
+                    FormatPredicate( w, rBranch.GetPredicate(), rBranch.GetFlagReference() );
                 }
                 break;
             }
 
             if( op.IsDDCheckDisabled() )
-                Printf(printer,"NoDDChk");
+                w.String(" NoDDChk");
+            if( op.IsDDClearDisabled() )
+                w.String(" NoDDClr");
         }
 
     }
 
 
+    namespace _INTERNAL
+    {
+        /// Disassemble the instructions in [nBegin,nEnd) of a blob.  
+        ///   Offsets in error messages are relative to the start of the blob
+        bool DisassembleRange( IPrinter& printer, Decoder* pDecoder, const uint8* pIsaBytes, size_t nBegin, size_t nEnd, size_t nIsaBytes )
+        {
+            TextWriter w(printer);
+            size_t offs=nBegin;
+            while( offs < nEnd )
+            {
+                Instruction op;
+                size_t nLength = pDecoder->Decode( &op, pIsaBytes+offs );
+                if( offs+nLength > nIsaBytes || nLength == 0 )
+                {
+                    w.String( nLength ? "Instruction at 0x" : "No legal instruction at: 0x" );
+                    w.Hex( (uint32)(size_t)(pIsaBytes+offs), 8 );
+                    w.String(" (offset ");
+                    w.UInt(offs);
+                    w.String( nLength ? ") would overrun specified buffer\n" : ")\n" );
+                    w.Flush();
+                    return false;
+                }
+
+
+                //if( nLength == 8 )
+                //    w.String("c ");
+                //else
+                //    w.String("n ");
+
+                _INTERNAL::DisassembleOp( w, op );
+                w.EndLine();
+
+                offs += nLength;
+
+            }
+
+            w.Flush();
+            return true;
+        }
+
+        class TextBuffer : public IPrinter
+        {
+        public:
+            virtual void Push( const char* p ) { m_Text.append(p); }
+            std::string m_Text;
+        };
+
+        struct DisassemblyChunk
+        {
+            size_t nBlob;
+            size_t nBegin;
+            size_t nEnd;
+            bool bOK;
+            TextBuffer Text;
+        };
+
+        /// Chunks are cut at the first instruction boundary past this many bytes
+        static const size_t DISASSEMBLY_CHUNK_SIZE = 16*1024;
+
+
+        static const char* GetDataTypeName( DataTypes eType )
+        {
+            switch( eType )
+            {
+            case DT_VEC_HALFBYTE_UINT:  return "uv";
+            case DT_VEC_HALFBYTE_SINT:  return "v";
+            case DT_VEC_HALFBYTE_FLOAT: return "vf";
+            default:                    return GetSubRegPrefix(eType)+1;
+            }
+        }
+
+        static const char* GetClassName( InstructionClass eClass )
+        {
+            switch( eClass )
+            {
+            case IC_UNARY:   return "unary";
+            case IC_BINARY:  return "binary";
+            case IC_TERNARY: return "ternary";
+            case IC_SEND:    return "send";
+            case IC_MATH:    return "math";
+            case IC_BRANCH:  return "branch";
+            default:         return "null";
+            }
+        }
+
+        static const char* GetEdgeTypeName( EdgeTypes eType )
+        {
+            switch( eType )
+            {
+            case EDGE_FALLTHROUGH: return "fallthrough";
+            case EDGE_JUMP:        return "jump";
+            case EDGE_JIP:         return "jip";
+            case EDGE_UIP:         return "uip";
+            default:               return "???";
+            }
+        }
+
+        static void FormatRegReferenceJSON( TextWriter& w, const RegReference& rReg )
+        {
+            if( rReg.IsDirect() )
+            {
+                const DirectRegReference& rRegD = static_cast<const DirectRegReference&>(rReg);
+                w.String("\"reg\":\"");
+                w.String( GetRegPrefix(rRegD.GetRegType()) );
+                w.String("\",\"num\":");
+                w.UInt( rRegD.GetRegNumber() );
+                w.String(",\"subreg\":");
+                w.UInt( rRegD.GetSubRegOffset() );
+            }
+            else
+            {
+                const IndirectRegReference& rRegI = static_cast<const IndirectRegReference&>(rReg);
+                w.String("\"reg\":\"r\",\"indirect\":true,\"addr_subreg\":");
+                w.UInt( rRegI.GetAddressSubReg() );
+                w.String(",\"offset\":");
+                w.Int( rRegI.GetImmediateOffset() );
+            }
+        }
+
+        static void FormatDestJSON( TextWriter& w, const DestOperand& rDest )
+        {
+            RegisterRegion region = rDest.GetRegRegion();
+            w.String("\"dst\":{\"type\":\"");
+            w.String( GetDataTypeName(rDest.GetDataType()) );
+            w.String("\",");
+            FormatRegReferenceJSON( w, region.GetBaseRegister() );
+            w.String(",\"hstride\":");
+            w.UInt( region.GetHStride() );
+            w.Char('}');
+        }
+
+        static void FormatSourceJSON( TextWriter& w, const SourceOperand& rSrc )
+        {
+            w.String("{\"type\":\"");
+            w.String( GetDataTypeName(rSrc.GetDataType()) );
+            w.String("\",");
+            if( rSrc.IsImmediate() )
+            {
+                uint32 pBits[2];
+                memcpy( pBits, rSrc.GetImmediateBits(), sizeof(pBits) );
+                w.String("\"imm\":\"0x");
+                if( rSrc.GetDataType() == DT_F64 )
+                    w.Hex( pBits[1], 8 );
+                w.Hex( pBits[0], 8 );
+                w.Char('"');
+            }
+            else
+            {
+                RegisterRegion region = rSrc.GetRegRegion();
+                FormatRegReferenceJSON( w, region.GetBaseRegister() );
+                w.String(",\"region\":[");
+                w.UInt( region.GetVStride() );
+                w.Char(',');
+                w.UInt( region.GetWidth() );
+                w.Char(',');
+                w.UInt( region.GetHStride() );
+                w.Char(']');
+            }
+
+            switch( rSrc.GetModifier() )
+            {
+            case SM_ABS:     w.String(",\"mod\":\"abs\""); break;
+            case SM_NEGATE:  w.String(",\"mod\":\"neg\""); break;
+            case SM_NEG_ABS: w.String(",\"mod\":\"negabs\""); break;
+            }
+            w.Char('}');
+        }
+
+        static void FormatSourcesJSON( TextWriter& w, const SourceOperand* pSources, size_t nSources )
+        {
+            w.String(",\"src\":[");
+            for( size_t i=0; i<nSources; i++ )
+            {
+                if( i )
+                    w.Char(',');
+                FormatSourceJSON( w, pSources[i] );
+            }
+            w.Char(']');
+        }
+
+        static void FormatConditionModifierJSON( TextWriter& w, ConditionalModifiers eCM )
+        {
+            if( eCM == CM_NONE )
+                return;
+            w.String(",\"cm\":\"");
+            w.String( ConditionalModifierToString(eCM) );
+            w.Char('"');
+        }
+
+        /// One instruction as a single-line JSON object
+        static void FormatInstructionJSON( TextWriter& w, const ControlFlowGraph& cfg, size_t i )
+        {
+            const Instruction& op = cfg.GetInstruction(i);
+            size_t nOffset = cfg.GetInstructionOffset(i);
+
+            w.String("{\"index\":");
+            w.UInt(i);
+            w.String(",\"offset\":");
+            w.UInt(nOffset);
+            w.String(",\"length\":");
+            w.UInt( cfg.GetInstructionLength(i) );
+            w.String(",\"block\":");
+            w.UInt( cfg.GetInstructionBlock(i) );
+            w.String(",\"op\":\"");
+            if( op.GetClass() == IC_MATH )
+                w.String( GetMathFunctionName( static_cast<const MathInstruction&>(op).GetFunction() ) );
+            else
+                w.String( OperationToString(op.GetOperation()) );
+            w.String("\",\"class\":\"");
+            w.String( GetClassName(op.GetClass()) );
+            w.String("\",\"exec\":");
+            w.UInt( op.GetExecSize() );
+
+            if( op.GetPredicate().GetMode() != PM_NONE )
+            {
+                w.String(",\"pred\":\"");
+                FormatPredicate( w, op.GetPredicate(), op.GetFlagReference() );
+                w.Char('"');
+            }
+            if( op.IsWriteMaskDisabled() )
+                w.String(",\"nomask\":true");
+            if( op.IsDDCheckDisabled() )
+                w.String(",\"noddchk\":true");
+            if( op.IsDDClearDisabled() )
+                w.String(",\"noddclr\":true");
+
+            switch( op.GetClass() )
+            {
+            case IC_UNARY:
+                {
+                    const UnaryInstruction& rInst = static_cast<const UnaryInstruction&>(op);
+                    SourceOperand pSources[] = { rInst.GetSource0() };
+                    FormatConditionModifierJSON( w, rInst.GetConditionModifier() );
+                    w.Char(',');
+                    FormatDestJSON( w, rInst.GetDest() );
+                    FormatSourcesJSON( w, pSources, 1 );
+                }
+                break;
+
+            case IC_BINARY:
+                {
+                    const BinaryInstruction& rInst = static_cast<const BinaryInstruction&>(op);
+                    SourceOperand pSources[] = { rInst.GetSource0(), rInst.GetSource1() };
+                    FormatConditionModifierJSON( w, rInst.GetConditionModifier() );
+                    w.Char(',');
+                    FormatDestJSON( w, rInst.GetDest() );
+                    FormatSourcesJSON( w, pSources, 2 );
+
+                    int nTarget;
+                    if( GetJumpTarget( op, nOffset, &nTarget ) )
+                    {
+                        w.String(",\"target\":");
+                        w.Int(nTarget);
+                    }
+                }
+                break;
+
+            case IC_TERNARY:
+                {
+                    const TernaryInstruction& rInst = static_cast<const TernaryInstruction&>(op);
+                    SourceOperand pSources[] = { rInst.GetSource0(), rInst.GetSource1(), rInst.GetSource2() };
+                    w.Char(',');
+                    FormatDestJSON( w, rInst.GetDest() );
+                    FormatSourcesJSON( w, pSources, 3 );
+                }
+                break;
+
+            case IC_MATH:
+                {
+                    const MathInstruction& rInst = static_cast<const MathInstruction&>(op);
+                    SourceOperand pSources[] = { rInst.GetSource0(), rInst.GetSource1() };
+                    w.Char(',');
+                    FormatDestJSON( w, rInst.GetDest() );
+                    FormatSourcesJSON( w, pSources, 2 );
+                }
+                break;
+
+            case IC_SEND:
+                {
+                    const SendInstruction& rInst = static_cast<const SendInstruction&>(op);
+                    SourceOperand pSources[] = { rInst.GetSource() };
+                    w.String(",\"sfid\":\"");
+                    w.String( SharedFunctionToString(rInst.GetRecipient()) );
+                    w.Char('"');
+                    if( rInst.IsDescriptorInRegister() )
+                    {
+                        w.String(",\"desc_reg\":true");
+                    }
+                    else
+                    {
+                        uint32 nDescriptor = rInst.GetDescriptorIMM();
+                        w.String(",\"desc\":\"0x");
+                        w.Hex( nDescriptor, 8 );
+                        w.String("\",\"mlen\":");
+                        w.UInt( rInst.GetMessageLengthFromDescriptor() );
+                        w.String(",\"rlen\":");
+                        w.UInt( rInst.GetResponseLengthFromDescriptor() );
+
+                        const char* pMessage = DataPortMessageToString( rInst.GetRecipient(), (nDescriptor>>14)&0xf );
+                        if( pMessage )
+                        {
+                            w.String(",\"message\":\"");
+                            w.String(pMessage);
+                            w.Char('"');
+                        }
+                    }
+                    if( rInst.IsEOT() )
+                        w.String(",\"eot\":true");
+                    w.Char(',');
+                    FormatDestJSON( w, rInst.GetDest() );
+                    FormatSourcesJSON( w, pSources, 1 );
+                }
+                break;
+
+            case IC_BRANCH:
+                {
+                    // targets are byte offsets from the start of the program
+                    const BranchInstruction& rBranch = static_cast<const BranchInstruction&>(op);
+                    w.String(",\"jip\":");
+                    w.Int( rBranch.GetJIP() );
+                    w.String(",\"uip\":");
+                    w.Int( rBranch.GetUIP() );
+                    w.String(",\"jip_target\":");
+                    w.Int( (int)nOffset + 8*rBranch.GetJIP() );
+                    w.String(",\"uip_target\":");
+                    w.Int( (int)nOffset + 8*rBranch.GetUIP() );
+                }
+                break;
+            }
+
+            w.String(",\"asm\":\"");
+            size_t nMark = w.Mark();
+            DisassembleOp( w, op );
+            w.EscapeJSON(nMark);
+            w.String("\"}");
+        }
+    }
 
     bool Disassemble( IPrinter& printer, Decoder* pDecoder, const void* pIsa, size_t nIsaBytes )
     {
-        const uint8* pIsaBytes = (const uint8*)pIsa;
-        size_t offs=0;
-        while( offs < nIsaBytes )
+        return _INTERNAL::DisassembleRange( printer, pDecoder, (const uint8*)pIsa, 0, nIsaBytes, nIsaBytes );
+    }
+
+    bool DisassembleJSON( IPrinter& printer, Decoder* pDecoder, const void* pIsa, size_t nIsaBytes )
+    {
+        ControlFlowGraph cfg;
+        if( !cfg.Build( pDecoder, pIsa, nIsaBytes ) )
+            return false;
+
+        _INTERNAL::TextWriter w(printer);
+        w.String("{\"bytes\":");
+        w.UInt(nIsaBytes);
+        w.String(",\"instructions\":[");
+        w.EndLine();
+        for( size_t i=0; i<cfg.GetInstructionCount(); i++ )
+        {
+            if( i )
+            {
+                w.Char(',');
+                w.EndLine();
+            }
+            _INTERNAL::FormatInstructionJSON( w, cfg, i );
+        }
+        w.String("],\"blocks\":[");
+        w.EndLine();
+        for( size_t b=0; b<cfg.GetBlockCount(); b++ )
         {
-            Instruction op;
-            size_t nLength = pDecoder->Decode( &op, pIsaBytes+offs );
-            if( offs+nLength > nIsaBytes )
+            const BasicBlock& rBlock = cfg.GetBlock(b);
+            if( b )
             {
-                _INTERNAL::Printf( printer, "Instruction at 0x%08x (offset %u) would overrun specified buffer\n", pIsaBytes+offs, offs );
-                return false;
+                w.Char(',');
+                w.EndLine();
             }
-            if( nLength == 0 )
+            w.String("{\"index\":");
+            w.UInt(b);
+            w.String(",\"start\":");
+            w.UInt(rBlock.nStartOffset);
+            w.String(",\"end\":");
+            w.UInt(rBlock.nEndOffset);
+            w.String(",\"first\":");
+            w.UInt(rBlock.nFirstInstruction);
+            w.String(",\"count\":");
+            w.UInt(rBlock.nInstructionCount);
+            w.String(",\"sends\":");
+            w.UInt(rBlock.nSendCount);
+            w.String(",\"successors\":[");
+            for( size_t e=0; e<rBlock.nEdgeCount; e++ )
             {
-                _INTERNAL::Printf( printer, "No legal instruction at: 0x%08x (offset %u)\n", pIsaBytes+offs, offs );
-                return false;
+                if( e )
+                    w.Char(',');
+                w.UInt( cfg.GetEdge(rBlock.nFirstEdge+e).nToBlock );
             }
+            w.String("]}");
+        }
+        w.String("],\"edges\":[");
+        w.EndLine();
+        for( size_t e=0; e<cfg.GetEdgeCount(); e++ )
+        {
+            const ControlFlowEdge& rEdge = cfg.GetEdge(e);
+            if( e )
+            {
+                w.Char(',');
+                w.EndLine();
+            }
+            w.String("{\"from\":");
+            w.UInt(rEdge.nFromBlock);
+            w.String(",\"to\":");
+            w.UInt(rEdge.nToBlock);
+            w.String(",\"type\":\"");
+            w.String( _INTERNAL::GetEdgeTypeName(rEdge.eType) );
+            w.String( rEdge.IsBackEdge() ? "\",\"back\":true}" : "\"}" );
+        }
+        w.String("]}");
+        w.EndLine();
+        w.Flush();
+        return true;
+    }
 
+    bool DisassembleParallel( IPrinter& printer, const IsaBlob* pBlobs, size_t nBlobs, size_t nThreads )
+    {
+        if( !nThreads )
+            nThreads = std::thread::hardware_concurrency();
+        if( !nThreads )
+            nThreads = 1;
+
+        // Split each blob into instruction-aligned chunks.  Chunking stops at the first 
+        //  bad or truncated instruction, and the chunk that reaches it reports the error 
+        //  the same way the serial path would
+        Decoder decoder;
+        std::vector<_INTERNAL::DisassemblyChunk> chunks;
+        for( size_t b=0; b<nBlobs; b++ )
+        {
+            const uint8* pIsaBytes = (const uint8*) pBlobs[b].pIsaBytes;
+            size_t nIsaBytes = pBlobs[b].nIsaBytes;
+            
+            _INTERNAL::DisassemblyChunk chunk;
+            chunk.nBlob  = b;
+            chunk.nBegin = 0;
+            chunk.bOK    = true;
 
-            //if( nLength == 8 )
-            //    _INTERNAL::Printf(printer, "c ");
-            //else
-            //    _INTERNAL::Printf(printer, "n ");
+            size_t offs=0;
+            while( offs < nIsaBytes )
+            {
+                size_t nLength = decoder.DetermineLength( pIsaBytes+offs );
+                if( !nLength || offs+nLength > nIsaBytes )
+                    break;
 
-            _INTERNAL::DisassembleOp( printer, op );
-            
-            _INTERNAL::Printf(printer,"\n");
+                offs += nLength;
+                if( offs - chunk.nBegin >= _INTERNAL::DISASSEMBLY_CHUNK_SIZE && offs < nIsaBytes )
+                {
+                    chunk.nEnd = offs;
+                    chunks.push_back(chunk);
+                    chunk.nBegin = offs;
+                }
+            }
 
-            offs += nLength;
-            
+            chunk.nEnd = nIsaBytes;
+            chunks.push_back(chunk);
         }
 
+        // Work through the chunks a window at a time, so that only a window's worth 
+        //   of text is held in memory.  Output is stitched together in order
+        bool bResult = true;
+        size_t nFailedBlob = nBlobs;
+        size_t nWindow = 8*nThreads;
+        for( size_t nFirst=0; nFirst < chunks.size(); nFirst += nWindow )
+        {
+            size_t nLast = std::min( nFirst+nWindow, chunks.size() );
+            std::atomic<size_t> nNext(nFirst);
 
-        return true;
+            auto worker = [&]()
+            {
+                Decoder threadDecoder;
+                for( size_t i = nNext++; i < nLast; i = nNext++ )
+                {
+                    _INTERNAL::DisassemblyChunk& rChunk = chunks[i];
+                    const IsaBlob& rBlob = pBlobs[rChunk.nBlob];
+                    rChunk.bOK = _INTERNAL::DisassembleRange( rChunk.Text, &threadDecoder, (const uint8*)rBlob.pIsaBytes,
+                                                              rChunk.nBegin, rChunk.nEnd, rBlob.nIsaBytes );
+                }
+            };
+
+            std::vector<std::thread> threads;
+            for( size_t t=1; t<nThreads; t++ )
+                threads.push_back( std::thread(worker) );
+            worker();
+            for( size_t t=0; t<threads.size(); t++ )
+                threads[t].join();
+
+            for( size_t i=nFirst; i<nLast; i++ )
+            {
+                // serial disassembly stops at the first error in a blob
+                _INTERNAL::DisassemblyChunk& rChunk = chunks[i];
+                if( rChunk.nBlob != nFailedBlob )
+                {
+                    if( !rChunk.Text.m_Text.empty() )
+                        printer.Push( rChunk.Text.m_Text.c_str() );
+                    if( !rChunk.bOK )
+                    {
+                        nFailedBlob = rChunk.nBlob;
+                        bResult = false;
+                    }
+                }
+                std::string().swap( rChunk.Text.m_Text );
+            }
+        }
+
+        return bResult;
     }
 
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,1154 @@
+
+#include "GENInterpreter.h"
+#include "GENControlFlow.h"
+#include "GENCoder.h"
+#include "GENDisassembler.h" // for 'IPrinter'
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+namespace GEN
+{
+    namespace _INTERNAL
+    {
+        enum
+        {
+            LANES = 16,     ///< Every instruction is evaluated on this many channels, whatever its exec size
+        };
+
+        static bool IsFloatType( DataTypes eType )
+        {
+            return eType == DT_F32 || eType == DT_F64 || eType == DT_VEC_HALFBYTE_FLOAT;
+        }
+
+        static bool IsLogicOp( Operations eOp )
+        {
+            return eOp == OP_AND || eOp == OP_OR || eOp == OP_XOR || eOp == OP_NOT;
+        }
+
+        /// Ops which only make sense on integers
+        static bool IsIntegerOp( Operations eOp )
+        {
+            switch( eOp )
+            {
+            case OP_AND:
+            case OP_OR:
+            case OP_XOR:
+            case OP_NOT:
+            case OP_SHL:
+            case OP_SHR:
+            case OP_ASR:
+            case OP_AVG:
+            case OP_LZD:
+            case OP_FBH:
+            case OP_FBL:
+            case OP_CBIT:
+            case OP_BFREV:
+            case OP_BFE:
+            case OP_BFI1:
+            case OP_BFI2:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        static size_t GetMathSourceCount( MathFunctionIDs eFunction )
+        {
+            switch( eFunction )
+            {
+            case MATH_FDIV:
+            case MATH_POW:
+            case MATH_IDIV_BOTH:
+            case MATH_IDIV_QUOTIENT:
+            case MATH_IDIV_REMAINDER:
+                return 2;
+            default:
+                return 1;
+            }
+        }
+
+        static uint64 LoadBits( const uint8* p, size_t nBytes )
+        {
+            uint64 n = 0;
+            memcpy( &n, p, nBytes );
+            return n;
+        }
+
+        static double BitsToDouble( uint64 nBits, DataTypes eType );
+
+        static int64 BitsToInt( uint64 nBits, DataTypes eType )
+        {
+            switch( eType )
+            {
+            case DT_U32: return (uint32)nBits;
+            case DT_S32: return (int32)nBits;
+            case DT_U16: return (uint16)nBits;
+            case DT_S16: return (int16)nBits;
+            case DT_U8:  return (uint8)nBits;
+            case DT_S8:  return (signed char)nBits;
+            default:     return (int64)BitsToDouble( nBits, eType );
+            }
+        }
+
+        static double BitsToDouble( uint64 nBits, DataTypes eType )
+        {
+            if( eType == DT_F32 )
+            {
+                float f;
+                uint32 n = (uint32)nBits;
+                memcpy( &f, &n, 4 );
+                return f;
+            }
+            if( eType == DT_F64 )
+            {
+                double d;
+                memcpy( &d, &nBits, 8 );
+                return d;
+            }
+            return (double)BitsToInt( nBits, eType );
+        }
+
+        /// Float to integer conversions round toward zero and saturate.  NaN becomes 0
+        static uint64 DoubleToBits( double d, DataTypes eType )
+        {
+            double fMin, fMax;
+            switch( eType )
+            {
+            case DT_F32:
+                {
+                    float f = (float)d;
+                    uint32 n;
+                    memcpy( &n, &f, 4 );
+                    return n;
+                }
+            case DT_F64:
+                {
+                    uint64 n;
+                    memcpy( &n, &d, 8 );
+                    return n;
+                }
+            case DT_U32: fMin = 0;           fMax = 4294967295.0; break;
+            case DT_S32: fMin = -2147483648.0; fMax = 2147483647.0; break;
+            case DT_U16: fMin = 0;           fMax = 65535;        break;
+            case DT_S16: fMin = -32768;      fMax = 32767;        break;
+            case DT_U8:  fMin = 0;           fMax = 255;          break;
+            case DT_S8:  fMin = -128;        fMax = 127;          break;
+            default:
+                return 0;
+            }
+            if( d != d )
+                return 0;
+            d = (d < fMin) ? fMin : ((d > fMax) ? fMax : d);
+            return (uint64)(int64)d;
+        }
+
+        static uint64 IntToBits( int64 n, DataTypes eType )
+        {
+            if( IsFloatType(eType) )
+                return DoubleToBits( (double)n, eType );
+            return (uint64)n;
+        }
+
+        /// 8-bit restricted float from a VF immediate.  Sign, 3 exponent bits biased by 3, and 4 mantissa bits
+        static float RestrictedFloat( uint32 n )
+        {
+            uint32 nExponent = (n>>4)&7;
+            uint32 nMantissa = n&0xf;
+            float f = nExponent ? ldexpf( 1.0f + nMantissa/16.0f, (int)nExponent - 3 ) : ldexpf( nMantissa/16.0f, -2 );
+            return (n & 0x80) ? -f : f;
+        }
+
+        template< class T >
+        static bool Compare( T a, T b, ConditionalModifiers eCond )
+        {
+            switch( eCond )
+            {
+            case CM_ZERO:           return a == b;
+            case CM_NOTZERO:        return a != b;
+            case CM_GREATER_THAN:   return a > b;
+            case CM_GREATER_EQUAL:  return a >= b;
+            case CM_LESS_THAN:      return a < b;
+            case CM_LESS_EQUAL:     return a <= b;
+            case CM_UNORDERED:      return a != a || b != b;
+            default:                return false;
+            }
+        }
+
+        static uint32 LeadingZeros( uint32 n )
+        {
+            uint32 nCount = 0;
+            for( uint32 nBit = 0x80000000; nBit && !(n & nBit); nBit >>= 1 )
+                nCount++;
+            return nCount;
+        }
+
+        static uint32 TrailingZeros( uint32 n )
+        {
+            uint32 nCount = 0;
+            for( uint32 nBit = 1; nBit && !(n & nBit); nBit <<= 1 )
+                nCount++;
+            return nCount;
+        }
+
+        static uint32 CountBits( uint32 n )
+        {
+            uint32 nCount = 0;
+            for( ; n; n &= n-1 )
+                nCount++;
+            return nCount;
+        }
+
+        static uint32 ReverseBits( uint32 n )
+        {
+            uint32 nReversed = 0;
+            for( size_t i=0; i<32; i++ )
+                nReversed |= ((n>>i)&1) << (31-i);
+            return nReversed;
+        }
+
+        static uint32 LoadDword( const Surface* pSurface, uint64 nByte )
+        {
+            uint32 n = 0;
+            if( pSurface && nByte + 4 <= pSurface->nBytes )
+                memcpy( &n, (const uint8*)pSurface->pData + nByte, 4 );
+            return n;
+        }
+
+        static void StoreDword( const Surface* pSurface, uint64 nByte, uint32 n )
+        {
+            if( pSurface && nByte + 4 <= pSurface->nBytes )
+                memcpy( (uint8*)pSurface->pData + nByte, &n, 4 );
+        }
+
+        /// Number of owords, and the first dword of the response or payload they go in, for OWord block messages
+        static bool GetOWordBlockSize( uint32 nDescriptor, size_t* pOWords, size_t* pFirstDword )
+        {
+            *pFirstDword = 0;
+            switch( (nDescriptor>>8)&7 )
+            {
+            case 0: *pOWords = 1; return true;
+            case 1: *pOWords = 1; *pFirstDword = 4; return true;
+            case 2: *pOWords = 2; return true;
+            case 3: *pOWords = 4; return true;
+            case 4: *pOWords = 8; return true;
+            default:
+                return false;
+            }
+        }
+    }
+
+    using namespace _INTERNAL;
+
+    bool Interpreter::Load( Decoder* pDecoder, const void* pIsaBytes, size_t nIsaBytes )
+    {
+        m_Instructions.clear();
+        m_Offsets.clear();
+
+        const uint8* pBytes = (const uint8*) pIsaBytes;
+        size_t nOffset = 0;
+        while( nOffset < nIsaBytes )
+        {
+            if( nIsaBytes - nOffset < 8 )
+                return false;
+            size_t nLength = pDecoder->DetermineLength( pBytes + nOffset );
+            if( !nLength || nLength > nIsaBytes - nOffset )
+                return false;
+
+            Instruction inst;
+            pDecoder->Decode( &inst, pBytes + nOffset );
+            m_Instructions.push_back(inst);
+            m_Offsets.push_back(nOffset);
+            nOffset += nLength;
+        }
+        return true;
+    }
+
+    size_t Interpreter::FindInstruction( size_t nOffset ) const
+    {
+        std::vector<size_t>::const_iterator it = std::lower_bound( m_Offsets.begin(), m_Offsets.end(), nOffset );
+        if( it == m_Offsets.end() || *it != nOffset )
+            return (size_t)-1;
+        return it - m_Offsets.begin();
+    }
+
+    bool Interpreter::Run( const ThreadPayload& rPayload, IPrinter* pErrors ) const
+    {
+        InterpreterThread* pThread = new InterpreterThread();
+        pThread->Start( *this, rPayload );
+
+        InterpreterThread::StepResult eResult;
+        do
+        {
+            eResult = pThread->Step();
+        } while( eResult == InterpreterThread::STEP_OK );
+
+        if( eResult == InterpreterThread::STEP_ERROR && pErrors )
+        {
+            pErrors->Push( pThread->GetError() );
+            pErrors->Push( "\n" );
+        }
+        delete pThread;
+        return eResult == InterpreterThread::STEP_DONE;
+    }
+
+    void InterpreterThread::Start( const Interpreter& rProgram, const ThreadPayload& rPayload )
+    {
+        m_pProgram       = &rProgram;
+        m_Payload        = rPayload;
+        m_nIP            = 0;
+        m_nRunning       = rPayload.nDispatchMask;
+        m_nWaiting       = 0;
+        m_nTimestamp     = 0;
+        m_bHostTimestamp = true;
+        m_Error[0]       = 0;
+        memset( m_State, 0, sizeof(m_State) );
+        memset( m_GPRs, 0, sizeof(m_GPRs) );
+        memset( m_Accumulators, 0, sizeof(m_Accumulators) );
+        memset( m_Flags, 0, sizeof(m_Flags) );
+        memset( m_Address, 0, sizeof(m_Address) );
+
+        memcpy( m_GPRs, rPayload.Header, 32 );
+        if( rPayload.pCURBE )
+            memcpy( m_GPRs + 32, rPayload.pCURBE, 32*std::min<size_t>( rPayload.nCURBERegs, 127 ) );
+    }
+
+    void InterpreterThread::SetState( const uint32* pState )
+    {
+        memcpy( m_State, pState, sizeof(m_State) );
+    }
+
+    InterpreterThread::StepResult InterpreterThread::Step()
+    {
+        if( m_nIP >= m_pProgram->GetInstructionCount() )
+        {
+            sprintf( m_Error, "ran past the end of the program" );
+            return STEP_ERROR;
+        }
+
+        // channels waiting for this instruction start following the thread again
+        for( uint32 nWaiting = m_nWaiting; nWaiting; nWaiting &= nWaiting-1 )
+        {
+            size_t c = TrailingZeros(nWaiting);
+            if( m_WaitIP[c] == m_nIP )
+            {
+                m_nRunning |= 1<<c;
+                m_nWaiting &= ~(1<<c);
+            }
+        }
+
+        const Instruction& rInst = m_pProgram->GetInstruction(m_nIP);
+        size_t nNextIP = m_nIP+1;
+        switch( rInst.GetClass() )
+        {
+        case IC_NULL:
+            if( rInst.GetOperation() != OP_NOP && !Fail("illegal instruction") )
+                return STEP_ERROR;
+            break;
+
+        case IC_BRANCH:
+            if( !ExecuteBranch( static_cast<const BranchInstruction&>(rInst), &nNextIP ) )
+                return STEP_ERROR;
+            break;
+
+        case IC_SEND:
+            {
+                const SendInstruction& rSend = static_cast<const SendInstruction&>(rInst);
+                size_t nExec = rSend.GetExecSize();
+                uint32 nChannels = (nExec >= 32) ? 0xffffffff : (1u<<nExec)-1;
+                uint32 nPredicate;
+                if( !rSend.IsWriteMaskDisabled() )
+                    nChannels &= m_nRunning;
+                if( !GetPredicateMask( rSend, &nPredicate ) || !ExecuteSend( rSend, nChannels & nPredicate ) )
+                    return STEP_ERROR;
+                if( rSend.IsEOT() )
+                    return STEP_DONE;
+            }
+            break;
+
+        default:
+            if( !ExecuteALU( rInst, &nNextIP ) )
+                return STEP_ERROR;
+            break;
+        }
+
+        // with nothing left running, skip ahead to wherever the first waiting channels are
+        if( !m_nRunning && m_nWaiting )
+        {
+            size_t nFirst = (size_t)-1;
+            for( uint32 nWaiting = m_nWaiting; nWaiting; nWaiting &= nWaiting-1 )
+                nFirst = std::min( nFirst, m_WaitIP[TrailingZeros(nWaiting)] );
+            nNextIP = std::max( nNextIP, nFirst );
+        }
+
+        m_nIP = nNextIP;
+        return STEP_OK;
+    }
+
+    bool InterpreterThread::Fail( const char* pWhat )
+    {
+        sprintf( m_Error, "0x%08x: %.100s", (unsigned) m_pProgram->GetOffset(m_nIP), pWhat );
+        return false;
+    }
+
+    void InterpreterThread::WaitAt( uint32 nChannels, size_t nIP )
+    {
+        for( uint32 n = nChannels; n; n &= n-1 )
+            m_WaitIP[TrailingZeros(n)] = nIP;
+        m_nWaiting |= nChannels;
+        m_nRunning &= ~nChannels;
+    }
+
+    uint8* InterpreterThread::GetRegBytes( RegTypes eReg, size_t nReg, size_t* pBytes )
+    {
+        switch( eReg )
+        {
+        case REG_GPR:
+            if( nReg >= 128 )
+                return 0;
+            *pBytes = 32*(128-nReg);
+            return m_GPRs + 32*nReg;
+
+        case REG_ACCUM0:  *pBytes = 64; return m_Accumulators;
+        case REG_ACCUM1:  *pBytes = 32; return m_Accumulators + 32;
+        case REG_FLAG0:   *pBytes = 8;  return m_Flags;
+        case REG_FLAG1:   *pBytes = 4;  return m_Flags + 4;
+        case REG_ADDRESS: *pBytes = 32; return m_Address;
+
+        case REG_NULL:
+            memset( m_Scratch, 0, sizeof(m_Scratch) );
+            *pBytes = sizeof(m_Scratch);
+            return m_Scratch;
+
+        case REG_TIMESTAMP:
+            {
+                uint64 nTime = m_nTimestamp;
+                if( m_bHostTimestamp )
+                    nTime = (uint64) std::chrono::high_resolution_clock::now().time_since_epoch().count();
+                memset( m_Scratch, 0, sizeof(m_Scratch) );
+                memcpy( m_Scratch, &nTime, sizeof(nTime) );
+                *pBytes = sizeof(m_Scratch);
+                return m_Scratch;
+            }
+
+        case REG_STATE:
+            memset( m_Scratch, 0, sizeof(m_Scratch) );
+            memcpy( m_Scratch, m_State, sizeof(m_State) );
+            *pBytes = sizeof(m_Scratch);
+            return m_Scratch;
+
+        case REG_CHANNEL_ENABLE:
+            memset( m_Scratch, 0, sizeof(m_Scratch) );
+            memcpy( m_Scratch, &m_nRunning, 4 );
+            *pBytes = sizeof(m_Scratch);
+            return m_Scratch;
+
+        default:
+            return 0;
+        }
+    }
+
+    uint8* InterpreterThread::GetOperandBytes( const RegisterRegion& rRegion, size_t* pBytes )
+    {
+        RegReference reg = rRegion.GetBaseRegister();
+        if( !reg.IsDirect() )
+        {
+            // indirect operands are addressed in bytes from r0
+            const IndirectRegReference& rIndirect = static_cast<const IndirectRegReference&>(reg);
+            uint16 nAddress;
+            memcpy( &nAddress, m_Address + 2*(rIndirect.GetAddressSubReg()%16), 2 );
+            int nOffset = (int)nAddress + rIndirect.GetImmediateOffset();
+            if( nOffset < 0 || nOffset >= (int)sizeof(m_GPRs) )
+                return 0;
+            *pBytes = sizeof(m_GPRs) - nOffset;
+            return m_GPRs + nOffset;
+        }
+
+        const DirectRegReference& rDirect = static_cast<const DirectRegReference&>(reg);
+        uint8* pBase = GetRegBytes( reg.GetRegType(), rDirect.GetRegNumber(), pBytes );
+        if( !pBase || rDirect.GetSubRegOffset() >= *pBytes )
+            return 0;
+        *pBytes -= rDirect.GetSubRegOffset();
+        return pBase + rDirect.GetSubRegOffset();
+    }
+
+    bool InterpreterThread::ReadSource( const SourceOperand& rSrc, size_t nExec, bool bFloat, bool bLogic, float* pFloats, int64* pInts )
+    {
+        DataTypes eType = rSrc.GetDataType();
+        uint64 Bits[LANES];
+        if( rSrc.IsImmediate() )
+        {
+            uint32 nPacked = (uint32) LoadBits( rSrc.GetImmediateBits(), 4 );
+            if( eType == DT_VEC_HALFBYTE_UINT || eType == DT_VEC_HALFBYTE_SINT )
+            {
+                for( size_t c=0; c<LANES; c++ )
+                {
+                    int32 n = (nPacked >> (4*(c%8))) & 0xf;
+                    if( eType == DT_VEC_HALFBYTE_SINT && (n & 8) )
+                        n -= 16;
+                    Bits[c] = (uint64)(int64)n;
+                }
+                eType = DT_S32;
+            }
+            else if( eType == DT_VEC_HALFBYTE_FLOAT )
+            {
+                for( size_t c=0; c<LANES; c++ )
+                {
+                    float f = RestrictedFloat( (nPacked >> (8*(c%4))) & 0xff );
+                    uint32 n;
+                    memcpy( &n, &f, 4 );
+                    Bits[c] = n;
+                }
+                eType = DT_F32;
+            }
+            else
+            {
+                uint64 n = LoadBits( rSrc.GetImmediateBits(), GetTypeSize(eType) );
+                for( size_t c=0; c<LANES; c++ )
+                    Bits[c] = n;
+            }
+        }
+        else
+        {
+            RegisterRegion region = rSrc.GetRegRegion();
+            size_t nBytes;
+            const uint8* pBase = GetOperandBytes( region, &nBytes );
+            size_t nSize  = GetTypeSize(eType);
+            size_t nWidth = region.GetWidth() ? region.GetWidth() : 1;
+            if( !pBase || !nSize )
+                return false;
+
+            for( size_t c=0; c<LANES; c++ )
+            {
+                Bits[c] = 0;
+                if( c >= nExec )
+                    continue;
+                size_t nByte = ((c/nWidth)*region.GetVStride() + (c%nWidth)*region.GetHStride()) * nSize;
+                if( nByte + nSize > nBytes )
+                    return false;
+                Bits[c] = LoadBits( pBase + nByte, nSize );
+            }
+        }
+
+        SourceModifiers eMod = rSrc.GetModifier();
+        if( bFloat )
+        {
+            for( size_t c=0; c<LANES; c++ )
+                pFloats[c] = (float) BitsToDouble( Bits[c], eType );
+            if( eMod & SM_ABS )
+                for( size_t c=0; c<LANES; c++ )
+                    pFloats[c] = fabsf(pFloats[c]);
+            if( eMod & SM_NEGATE )
+                for( size_t c=0; c<LANES; c++ )
+                    pFloats[c] = -pFloats[c];
+        }
+        else
+        {
+            for( size_t c=0; c<LANES; c++ )
+                pInts[c] = BitsToInt( Bits[c], eType );
+
+            // on logic ops, 'negate' is a bitwise not
+            if( bLogic )
+            {
+                if( eMod & SM_NEGATE )
+                    for( size_t c=0; c<LANES; c++ )
+                        pInts[c] = ~pInts[c];
+            }
+            else
+            {
+                if( eMod & SM_ABS )
+                    for( size_t c=0; c<LANES; c++ )
+                        pInts[c] = (pInts[c] < 0) ? -pInts[c] : pInts[c];
+                if( eMod & SM_NEGATE )
+                    for( size_t c=0; c<LANES; c++ )
+                        pInts[c] = -pInts[c];
+            }
+        }
+        return true;
+    }
+
+    uint32 InterpreterThread::GetFlags( FlagReference flag )
+    {
+        uint16 nFlags;
+        memcpy( &nFlags, m_Flags + 4*(flag.GetReg()&1) + 2*(flag.GetSubReg()&1), 2 );
+        return nFlags;
+    }
+
+    void InterpreterThread::SetFlags( FlagReference flag, uint32 nMask, uint32 nBits )
+    {
+        uint16 nFlags = (uint16)( (GetFlags(flag) & ~nMask) | (nBits & nMask) );
+        memcpy( m_Flags + 4*(flag.GetReg()&1) + 2*(flag.GetSubReg()&1), &nFlags, 2 );
+    }
+
+    bool InterpreterThread::GetPredicateMask( const Instruction& rInst, uint32* pMask )
+    {
+        Predicate pred = rInst.GetPredicate();
+        size_t nGroup;
+        bool bAll;
+        switch( pred.GetMode() )
+        {
+        case PM_NONE:               *pMask = 0xffffffff; return true;
+        case PM_SEQUENTIAL_FLAG:    nGroup = 1;  bAll = false; break;
+        case PM_ANY2H:              nGroup = 2;  bAll = false; break;
+        case PM_ALL2H:              nGroup = 2;  bAll = true;  break;
+        case PM_ANY4H:              nGroup = 4;  bAll = false; break;
+        case PM_ALL4H:              nGroup = 4;  bAll = true;  break;
+        case PM_ANY8H:              nGroup = 8;  bAll = false; break;
+        case PM_ALL8H:              nGroup = 8;  bAll = true;  break;
+        case PM_ANY16H:             nGroup = 16; bAll = false; break;
+        case PM_ALL16H:             nGroup = 16; bAll = true;  break;
+        default:
+            return Fail("unsupported predicate mode");
+        }
+
+        uint32 nFlags = GetFlags( rInst.GetFlagReference() );
+        uint32 nMask = 0;
+        for( size_t c=0; c<LANES; c += nGroup )
+        {
+            uint32 nGroupBits = ((1u<<nGroup)-1) << c;
+            bool bPass = bAll ? (nFlags & nGroupBits) == nGroupBits : (nFlags & nGroupBits) != 0;
+            if( bPass )
+                nMask |= nGroupBits;
+        }
+        *pMask = pred.IsInverted() ? ~nMask : nMask;
+        return true;
+    }
+
+    bool InterpreterThread::ExecuteBranch( const BranchInstruction& rBranch, size_t* pNextIP )
+    {
+        size_t nExec = rBranch.GetExecSize();
+        uint32 nActive = m_nRunning & ((nExec >= 32) ? 0xffffffff : (1u<<nExec)-1);
+        uint32 nPredicate;
+        if( !GetPredicateMask( rBranch, &nPredicate ) )
+            return false;
+
+        int nOffset = (int) m_pProgram->GetOffset(m_nIP);
+        size_t nJIP = m_pProgram->FindInstruction( (size_t)( nOffset + 8*rBranch.GetJIP() ) );
+        size_t nUIP = m_pProgram->FindInstruction( (size_t)( nOffset + 8*rBranch.GetUIP() ) );
+        const size_t NONE = (size_t)-1;
+
+        switch( rBranch.GetOperation() )
+        {
+        case OP_IF:
+            if( nJIP == NONE )
+                return Fail("bad 'if' JIP");
+            WaitAt( nActive & ~nPredicate, nJIP );
+            return true;
+
+        case OP_ELSE:
+            if( nJIP == NONE )
+                return Fail("bad 'else' JIP");
+            WaitAt( nActive, nJIP );
+            return true;
+
+        case OP_ENDIF:
+            return true;
+
+        case OP_WHILE:
+            if( nJIP == NONE )
+                return Fail("bad 'while' JIP");
+            if( nActive & nPredicate )
+            {
+                WaitAt( nActive & ~nPredicate, m_nIP+1 );
+                *pNextIP = nJIP;
+            }
+            return true;
+
+        case OP_BREAK:
+            // UIP is the loop's 'while'.  Broken channels wait until the loop is done
+            if( nUIP == NONE )
+                return Fail("bad 'break' UIP");
+            WaitAt( nActive & nPredicate, nUIP+1 );
+            return true;
+
+        case OP_CONT:
+            if( nUIP == NONE )
+                return Fail("bad 'cont' UIP");
+            WaitAt( nActive & nPredicate, nUIP );
+            return true;
+
+        default:
+            return Fail("unsupported branch");
+        }
+    }
+
+    bool InterpreterThread::ExecuteALU( const Instruction& rInst, size_t* pNextIP )
+    {
+        // every instruction class keeps its operands in the same place, so the ternary accessors work for all of them
+        const TernaryInstruction& rOps = static_cast<const TernaryInstruction&>(rInst);
+        Operations eOp = rInst.GetOperation();
+        DestOperand dst = rOps.GetDest();
+        size_t nExec = rInst.GetExecSize();
+
+        uint32 nPredicate;
+        if( !GetPredicateMask( rInst, &nPredicate ) )
+            return false;
+
+        // IP-relative jumps are SIMD1
+        if( dst.GetRegRegion().GetBaseRegister().GetRegType() == REG_INSTRUCTION_PTR )
+        {
+            int nTarget;
+            if( !GetJumpTarget( rInst, m_pProgram->GetOffset(m_nIP), &nTarget ) )
+                return Fail("unsupported write to ip");
+            if( !(nPredicate & 1) )
+                return true;
+            size_t nIndex = m_pProgram->FindInstruction( (size_t)nTarget );
+            if( nIndex == (size_t)-1 )
+                return Fail("jump target is not an instruction");
+
+            // channels waiting somewhere the jump skips over would never see their IP come up.
+            //  They pick the thread back up here instead
+            size_t nLow  = std::min( m_nIP, nIndex );
+            size_t nHigh = std::max( m_nIP, nIndex );
+            for( uint32 nWaiting = m_nWaiting; nWaiting; nWaiting &= nWaiting-1 )
+            {
+                size_t c = TrailingZeros(nWaiting);
+                if( m_WaitIP[c] > nLow && m_WaitIP[c] < nHigh )
+                {
+                    m_nRunning |= 1<<c;
+                    m_nWaiting &= ~(1<<c);
+                }
+            }
+            *pNextIP = nIndex;
+            return true;
+        }
+
+        if( nExec > LANES )
+            return Fail("exec size is too big");
+
+        size_t nSources = 0;
+        ConditionalModifiers eCond = CM_NONE;
+        MathFunctionIDs eFunction = MATH_INVALID;
+        switch( rInst.GetClass() )
+        {
+        case IC_UNARY:   nSources = 1; eCond = rOps.GetConditionModifier(); break;
+        case IC_BINARY:  nSources = 2; eCond = rOps.GetConditionModifier(); break;
+        case IC_TERNARY: nSources = 3; eCond = rOps.GetConditionModifier(); break;
+        case IC_MATH:
+            eFunction = static_cast<const MathInstruction&>(rInst).GetFunction();
+            nSources = GetMathSourceCount(eFunction);
+            break;
+        default:
+            return Fail("unsupported instruction");
+        }
+
+        SourceOperand pSources[3] = { rOps.GetSource0(), rOps.GetSource1(), rOps.GetSource2() };
+        bool bFloat = false;
+        if( eFunction != MATH_INVALID )
+            bFloat = eFunction < MATH_IDIV_BOTH;
+        else if( !IsIntegerOp(eOp) )
+            for( size_t i=0; i<nSources; i++ )
+                bFloat |= IsFloatType( pSources[i].GetDataType() );
+
+        // the float path works in single precision, and would quietly round doubles
+        bool bDouble = dst.GetDataType() == DT_F64;
+        for( size_t i=0; i<nSources; i++ )
+            bDouble |= pSources[i].GetDataType() == DT_F64;
+        if( bFloat && bDouble )
+            return Fail("double precision operations are not supported");
+
+        float F0[LANES], F1[LANES], F2[LANES];
+        int64 I0[LANES], I1[LANES], I2[LANES];
+        float* pF[3] = { F0, F1, F2 };
+        int64* pI[3] = { I0, I1, I2 };
+        for( size_t i=0; i<nSources; i++ )
+            if( !ReadSource( pSources[i], nExec, bFloat, IsLogicOp(eOp), pF[i], pI[i] ) )
+                return Fail("source operand is out of range");
+
+        // Gen7's integer multiplier is 32x16.  A dword src1 only contributes its low 16 bits, extended by its type
+        if( !bFloat && (eOp == OP_MUL || eOp == OP_MAC) && GetTypeSize( pSources[1].GetDataType() ) == 4 )
+        {
+            bool bSigned = pSources[1].GetDataType() == DT_S32;
+            for( size_t c=0; c<LANES; c++ )
+                I1[c] = bSigned ? (int64)(int16)I1[c] : (I1[c] & 0xffff);
+        }
+
+        // 'sel' uses its predicate to pick a source, instead of to mask channels.  With no predicate and no
+        //   conditional modifier, it picks src0
+        uint32 nChannels = (1u<<nExec)-1;
+        if( !rInst.IsWriteMaskDisabled() )
+            nChannels &= m_nRunning;
+        if( eOp != OP_SEL )
+            nChannels &= nPredicate;
+
+        bool bCompare = (eOp == OP_CMP || eOp == OP_CMPN);
+        uint32 nCompareBits = 0;
+        float RF[LANES];
+        int64 RI[LANES];
+
+        if( bFloat )
+        {
+            switch( eOp )
+            {
+            case OP_MOV: for( size_t c=0; c<LANES; c++ ) RF[c] = F0[c]; break;
+            case OP_ADD: for( size_t c=0; c<LANES; c++ ) RF[c] = F0[c] + F1[c]; break;
+            case OP_MUL: for( size_t c=0; c<LANES; c++ ) RF[c] = F0[c] * F1[c]; break;
+            case OP_MAC:
+                for( size_t c=0; c<LANES; c++ )
+                {
+                    float fAccum;
+                    memcpy( &fAccum, m_Accumulators + 4*c, 4 );
+                    RF[c] = fAccum + F0[c]*F1[c];
+                }
+                break;
+            case OP_FRC:  for( size_t c=0; c<LANES; c++ ) RF[c] = F0[c] - floorf(F0[c]); break;
+            case OP_RNDU: for( size_t c=0; c<LANES; c++ ) RF[c] = ceilf(F0[c]); break;
+            case OP_RNDD: for( size_t c=0; c<LANES; c++ ) RF[c] = floorf(F0[c]); break;
+            case OP_RNDE: for( size_t c=0; c<LANES; c++ ) RF[c] = rintf(F0[c]); break;
+            case OP_RNDZ: for( size_t c=0; c<LANES; c++ ) RF[c] = truncf(F0[c]); break;
+            case OP_FMA:  for( size_t c=0; c<LANES; c++ ) RF[c] = F0[c] + F1[c]*F2[c]; break;
+            case OP_LRP:  for( size_t c=0; c<LANES; c++ ) RF[c] = F0[c]*F1[c] + (1.0f-F0[c])*F2[c]; break;
+            case OP_SEL:
+                for( size_t c=0; c<LANES; c++ )
+                {
+                    bool bFirst = (rInst.GetPredicate().GetMode() != PM_NONE) ? ((nPredicate>>c)&1) != 0 :
+                                  (eCond == CM_NONE) || Compare( F0[c], F1[c], eCond );
+                    RF[c] = bFirst ? F0[c] : F1[c];
+                }
+                break;
+            case OP_CSEL:
+                for( size_t c=0; c<LANES; c++ ) RF[c] = Compare( F2[c], 0.0f, eCond ) ? F0[c] : F1[c];
+                break;
+            case OP_CMP:
+            case OP_CMPN:
+                for( size_t c=0; c<LANES; c++ ) nCompareBits |= (uint32)Compare( F0[c], F1[c], eCond ) << c;
+                break;
+            case OP_MATH:
+                switch( eFunction )
+                {
+                case MATH_INVERSE: for( size_t c=0; c<LANES; c++ ) RF[c] = 1.0f/F0[c]; break;
+                case MATH_LOG:     for( size_t c=0; c<LANES; c++ ) RF[c] = log2f(F0[c]); break;
+                case MATH_EXP:     for( size_t c=0; c<LANES; c++ ) RF[c] = exp2f(F0[c]); break;
+                case MATH_SQRT:    for( size_t c=0; c<LANES; c++ ) RF[c] = sqrtf(F0[c]); break;
+                case MATH_RSQ:     for( size_t c=0; c<LANES; c++ ) RF[c] = 1.0f/sqrtf(F0[c]); break;
+                case MATH_SIN:     for( size_t c=0; c<LANES; c++ ) RF[c] = sinf(F0[c]); break;
+                case MATH_COS:     for( size_t c=0; c<LANES; c++ ) RF[c] = cosf(F0[c]); break;
+                case MATH_FDIV:    for( size_t c=0; c<LANES; c++ ) RF[c] = F0[c]/F1[c]; break;
+                case MATH_POW:     for( size_t c=0; c<LANES; c++ ) RF[c] = powf(F0[c],F1[c]); break;
+                default:
+                    return Fail("unsupported math function");
+                }
+                break;
+            default:
+                return Fail("unsupported float operation");
+            }
+        }
+        else
+        {
+            uint64 nShiftMask = (GetTypeSize( pSources[0].GetDataType() ) == 4) ? 0xffffffffull :
+                                (GetTypeSize( pSources[0].GetDataType() ) == 2) ? 0xffffull : 0xffull;
+            switch( eOp )
+            {
+            case OP_MOV:
+            case OP_RNDZ:
+            case OP_RNDD:
+            case OP_RNDU:
+            case OP_RNDE:
+                for( size_t c=0; c<LANES; c++ ) RI[c] = I0[c];
+                break;
+            case OP_ADD: for( size_t c=0; c<LANES; c++ ) RI[c] = (int64)( (uint64)I0[c] + (uint64)I1[c] ); break;
+            case OP_MUL: for( size_t c=0; c<LANES; c++ ) RI[c] = (int64)( (uint64)I0[c] * (uint64)I1[c] ); break;
+            case OP_MAC:
+                for( size_t c=0; c<LANES; c++ )
+                {
+                    int32 nAccum;
+                    memcpy( &nAccum, m_Accumulators + 4*c, 4 );
+                    RI[c] = (int64)( (uint64)nAccum + (uint64)I0[c] * (uint64)I1[c] );
+                }
+                break;
+            case OP_AVG:  for( size_t c=0; c<LANES; c++ ) RI[c] = (I0[c] + I1[c] + 1) >> 1; break;
+            case OP_AND:  for( size_t c=0; c<LANES; c++ ) RI[c] = I0[c] & I1[c]; break;
+            case OP_OR:   for( size_t c=0; c<LANES; c++ ) RI[c] = I0[c] | I1[c]; break;
+            case OP_XOR:  for( size_t c=0; c<LANES; c++ ) RI[c] = I0[c] ^ I1[c]; break;
+            case OP_NOT:  for( size_t c=0; c<LANES; c++ ) RI[c] = ~I0[c]; break;
+            case OP_SHL:  for( size_t c=0; c<LANES; c++ ) RI[c] = (int64)( (uint64)I0[c] << (I1[c]&31) ); break;
+            case OP_SHR:  for( size_t c=0; c<LANES; c++ ) RI[c] = (int64)( ((uint64)I0[c] & nShiftMask) >> (I1[c]&31) ); break;
+            case OP_ASR:  for( size_t c=0; c<LANES; c++ ) RI[c] = I0[c] >> (I1[c]&31); break;
+            case OP_LZD:  for( size_t c=0; c<LANES; c++ ) RI[c] = LeadingZeros( (uint32)I0[c] ); break;
+            case OP_CBIT: for( size_t c=0; c<LANES; c++ ) RI[c] = CountBits( (uint32)I0[c] ); break;
+            case OP_BFREV: for( size_t c=0; c<LANES; c++ ) RI[c] = ReverseBits( (uint32)I0[c] ); break;
+            case OP_FBL:
+                for( size_t c=0; c<LANES; c++ ) RI[c] = (uint32)I0[c] ? TrailingZeros( (uint32)I0[c] ) : 0xffffffff;
+                break;
+            case OP_FBH:
+                // signed sources look for the first bit which differs from the sign
+                for( size_t c=0; c<LANES; c++ )
+                {
+                    uint32 n = (uint32)I0[c];
+                    if( pSources[0].GetDataType() == DT_S32 && (n & 0x80000000) )
+                        n = ~n;
+                    RI[c] = n ? LeadingZeros(n) : 0xffffffff;
+                }
+                break;
+            case OP_BFE:
+                for( size_t c=0; c<LANES; c++ )
+                {
+                    uint32 nWidth = I0[c]&31, nOffset = I1[c]&31;
+                    uint32 nField = (uint32)( ((uint64)I2[c] & 0xffffffff) >> nOffset );
+                    nField &= nWidth ? 0xffffffffu >> (32-nWidth) : 0;
+                    if( pSources[2].GetDataType() == DT_S32 && nWidth && (nField >> (nWidth-1)) )
+                        nField |= ~(0xffffffffu >> (32-nWidth));
+                    RI[c] = (int32)nField;
+                }
+                break;
+            case OP_BFI1:
+                for( size_t c=0; c<LANES; c++ )
+                {
+                    uint32 nWidth = I0[c]&31, nOffset = I1[c]&31;
+                    RI[c] = (uint32)( (nWidth ? (0xffffffffu >> (32-nWidth)) : 0) << nOffset );
+                }
+                break;
+            case OP_BFI2:
+                for( size_t c=0; c<LANES; c++ ) RI[c] = (I0[c] & I1[c]) | (~I0[c] & I2[c]);
+                break;
+            case OP_FMA: for( size_t c=0; c<LANES; c++ ) RI[c] = (int64)( (uint64)I0[c] + (uint64)I1[c]*(uint64)I2[c] ); break;
+            case OP_SEL:
+                for( size_t c=0; c<LANES; c++ )
+                {
+                    bool bFirst = (rInst.GetPredicate().GetMode() != PM_NONE) ? ((nPredicate>>c)&1) != 0 :
+                                  (eCond == CM_NONE) || Compare( I0[c], I1[c], eCond );
+                    RI[c] = bFirst ? I0[c] : I1[c];
+                }
+                break;
+            case OP_CSEL:
+                for( size_t c=0; c<LANES; c++ ) RI[c] = Compare( I2[c], (int64)0, eCond ) ? I0[c] : I1[c];
+                break;
+            case OP_CMP:
+            case OP_CMPN:
+                for( size_t c=0; c<LANES; c++ ) nCompareBits |= (uint32)Compare( I0[c], I1[c], eCond ) << c;
+                break;
+            case OP_MATH:
+                // divide by zero gives all ones, like the hardware
+                switch( eFunction )
+                {
+                case MATH_IDIV_QUOTIENT:
+                    for( size_t c=0; c<LANES; c++ ) RI[c] = I1[c] ? I0[c]/I1[c] : -1;
+                    break;
+                case MATH_IDIV_REMAINDER:
+                    for( size_t c=0; c<LANES; c++ ) RI[c] = I1[c] ? I0[c]%I1[c] : -1;
+                    break;
+                default:
+                    return Fail("unsupported math function");
+                }
+                break;
+            default:
+                return Fail("unsupported integer operation");
+            }
+        }
+
+        // write the channels out, converting to the destination type
+        DataTypes eDstType = dst.GetDataType();
+        RegisterRegion dstRegion = dst.GetRegRegion();
+        size_t nDstSize = GetTypeSize(eDstType);
+        size_t nDstStride = (dstRegion.GetHStride() ? dstRegion.GetHStride() : 1) * nDstSize;
+        size_t nDstBytes;
+        uint8* pDst = GetOperandBytes( dstRegion, &nDstBytes );
+        if( !pDst || !nDstSize )
+            return Fail("destination operand is out of range");
+
+        uint64 Bits[LANES];
+        if( bCompare )
+            for( size_t c=0; c<LANES; c++ ) Bits[c] = ((nCompareBits>>c)&1) ? ~0ull : 0;
+        else if( bFloat )
+            for( size_t c=0; c<LANES; c++ ) Bits[c] = DoubleToBits( RF[c], eDstType );
+        else
+            for( size_t c=0; c<LANES; c++ ) Bits[c] = IntToBits( RI[c], eDstType );
+
+        for( uint32 n = nChannels; n; n &= n-1 )
+        {
+            size_t c = TrailingZeros(n);
+            if( nDstStride*c + nDstSize > nDstBytes )
+                return Fail("destination operand is out of range");
+            memcpy( pDst + nDstStride*c, &Bits[c], nDstSize );
+        }
+
+        // 'sel' uses its conditional modifier to pick a source, and leaves the flags alone
+        if( bCompare )
+        {
+            SetFlags( rInst.GetFlagReference(), nChannels, nCompareBits );
+        }
+        else if( eCond != CM_NONE && eOp != OP_SEL && eOp != OP_CSEL )
+        {
+            uint32 nFlagBits = 0;
+            for( size_t c=0; c<LANES; c++ )
+                nFlagBits |= (uint32)Compare( BitsToDouble( Bits[c], eDstType ), 0.0, eCond ) << c;
+            SetFlags( rInst.GetFlagReference(), nChannels, nFlagBits );
+        }
+        return true;
+    }
+
+    bool InterpreterThread::ExecuteSend( const SendInstruction& rSend, uint32 nChannels )
+    {
+        if( rSend.IsDescriptorInRegister() )
+            return Fail("send descriptor in a register");
+
+        switch( rSend.GetRecipient() )
+        {
+        case SFID_NULL:
+        case SFID_SPAWNER:  // the only thing we send to the spawner is the EOT
+            return true;
+        case SFID_DP_DC0:
+        case SFID_DP_DC1:
+            return ExecuteDataPort( rSend, nChannels );
+        default:
+            return Fail("unsupported message recipient");
+        }
+    }
+
+    bool InterpreterThread::ExecuteDataPort( const SendInstruction& rSend, uint32 nChannels )
+    {
+        uint32 nDescriptor   = rSend.GetDescriptorIMM();
+        uint32 nType         = (nDescriptor>>14)&0xf;
+        size_t nMessageRegs  = rSend.GetMessageLengthFromDescriptor();
+        size_t nResponseRegs = rSend.GetResponseLengthFromDescriptor();
+        bool bHeader         = ((nDescriptor>>19)&1) != 0;
+
+        RegReference src = rSend.GetSource().GetRegRegion().GetBaseRegister();
+        RegReference dst = rSend.GetDest().GetRegRegion().GetBaseRegister();
+        if( src.GetRegType() != REG_GPR || !src.IsDirect() )
+            return Fail("message payload is not a GPR");
+        size_t nSrcReg = static_cast<const DirectRegReference&>(src).GetRegNumber();
+        if( nSrcReg + nMessageRegs > 128 )
+            return Fail("message payload runs past r127");
+
+        uint32 Payload[16*8];
+        memcpy( Payload, m_GPRs + 32*nSrcReg, 32*nMessageRegs );
+
+        // channels which aren't written keep whatever they had
+        uint32 Response[32*8];
+        uint8* pResponse = 0;
+        if( nResponseRegs )
+        {
+            if( dst.GetRegType() != REG_GPR || !dst.IsDirect() )
+                return Fail("message response is not a GPR");
+            size_t nDstReg = static_cast<const DirectRegReference&>(dst).GetRegNumber();
+            if( nDstReg + nResponseRegs > 128 )
+                return Fail("message response runs past r127");
+            pResponse = m_GPRs + 32*nDstReg;
+            memcpy( Response, pResponse, 32*nResponseRegs );
+        }
+
+        uint32 nBind = nDescriptor & 0xff;
+        const Surface* pSurface = 0;
+        if( nBind < m_Payload.nSurfaces && m_Payload.pSurfaces && m_Payload.pSurfaces[nBind].pData )
+            pSurface = &m_Payload.pSurfaces[nBind];
+
+        const uint32* pAddresses = Payload + (bHeader ? 8 : 0);
+        size_t nPayloadNeeded  = 0;
+        size_t nResponseNeeded = 0;
+        if( rSend.GetRecipient() == SFID_DP_DC0 )
+        {
+            switch( nType )
+            {
+            case 0x0:   // OWord block read.  The offset is in owords
+            case 0x1:   // unaligned OWord block read.  The offset is in bytes
+                {
+                    size_t nOWords, nFirst;
+                    if( !GetOWordBlockSize( nDescriptor, &nOWords, &nFirst ) )
+                        return Fail("bad OWord block size");
+                    uint64 nOffset = (nType == 0x0) ? 16*(uint64)Payload[2] : Payload[2];
+                    nPayloadNeeded  = 8;
+                    nResponseNeeded = nFirst + 4*nOWords;
+                    if( nPayloadNeeded > 8*nMessageRegs || nResponseNeeded > 8*nResponseRegs )
+                        return Fail("message is too short");
+                    for( size_t i=0; i<4*nOWords; i++ )
+                        Response[nFirst+i] = LoadDword( pSurface, nOffset + 4*i );
+                }
+                break;
+
+            case 0x3:   // dword scattered read.  Addresses are in dwords
+                {
+                    size_t nSIMD = (((nDescriptor>>8)&3) == 3) ? 16 : 8;
+                    nPayloadNeeded  = (bHeader ? 8 : 0) + nSIMD;
+                    nResponseNeeded = nSIMD;
+                    if( nPayloadNeeded > 8*nMessageRegs || nResponseNeeded > 8*nResponseRegs )
+                        return Fail("message is too short");
+                    for( size_t c=0; c<nSIMD; c++ )
+                        if( (nChannels>>c)&1 )
+                            Response[c] = LoadDword( pSurface, 4*(uint64)pAddresses[c] );
+                }
+                break;
+
+            case 0x7:   // memory fence.  Everything is visible already
+                break;
+
+            case 0x8:   // OWord block write.  The data follows the header
+                {
+                    size_t nOWords, nFirst;
+                    if( !GetOWordBlockSize( nDescriptor, &nOWords, &nFirst ) )
+                        return Fail("bad OWord block size");
+                    uint64 nOffset = 16*(uint64)Payload[2];
+                    nPayloadNeeded = 8 + nFirst + 4*nOWords;
+                    if( nPayloadNeeded > 8*nMessageRegs )
+                        return Fail("message is too short");
+                    for( size_t i=0; i<4*nOWords; i++ )
+                        StoreDword( pSurface, nOffset + 4*i, Payload[8+nFirst+i] );
+                }
+                break;
+
+            case 0xB:   // dword scattered write.  The data follows the addresses
+                {
+                    size_t nSIMD = (((nDescriptor>>8)&3) == 3) ? 16 : 8;
+                    nPayloadNeeded = (bHeader ? 8 : 0) + 2*nSIMD;
+                    if( nPayloadNeeded > 8*nMessageRegs )
+                        return Fail("message is too short");
+                    for( size_t c=0; c<nSIMD; c++ )
+                        if( (nChannels>>c)&1 )
+                            StoreDword( pSurface, 4*(uint64)pAddresses[c], pAddresses[nSIMD+c] );
+                }
+                break;
+
+            default:
+                return Fail("unsupported dataport message");
+            }
+        }
+        else
+        {
+            if( nType != 0x1 && nType != 0x9 )
+                return Fail("unsupported dataport message");
+
+            // untyped reads and writes.  Addresses are in bytes, and each enabled channel is one dword past the last
+            size_t nSIMD;
+            switch( (nDescriptor>>12)&3 )
+            {
+            case 1: nSIMD = 16; break;
+            case 2: nSIMD = 8;  break;
+            default:
+                return Fail("unsupported untyped message mode");
+            }
+
+            uint32 nDisabled = (nDescriptor>>8)&0xf;
+            size_t nEnabled = 4 - CountBits(nDisabled);
+            bool bRead = (nType == 0x1);
+            nPayloadNeeded  = (bHeader ? 8 : 0) + nSIMD + (bRead ? 0 : nEnabled*nSIMD);
+            nResponseNeeded = bRead ? nEnabled*nSIMD : 0;
+            if( nPayloadNeeded > 8*nMessageRegs || nResponseNeeded > 8*nResponseRegs )
+                return Fail("message is too short");
+
+            size_t nSlot = 0;
+            for( size_t k=0; k<4; k++ )
+            {
+                if( nDisabled & (1<<k) )
+                    continue;
+                for( size_t c=0; c<nSIMD; c++ )
+                {
+                    if( !((nChannels>>c)&1) )
+                        continue;
+                    uint64 nByte = (uint64)pAddresses[c] + 4*k;
+                    if( bRead )
+                        Response[nSlot*nSIMD + c] = LoadDword( pSurface, nByte );
+                    else
+                        StoreDword( pSurface, nByte, pAddresses[(nSlot+1)*nSIMD + c] );
+                }
+                nSlot++;
+            }
+        }
+
+        if( pResponse )
+            memcpy( pResponse, Response, 32*nResponseRegs );
+        return true;
+    }
+}
@@ -26,6 +26,47 @@ namespace GEN
         }
     }
     
+    const char* DataPortMessageToString( SharedFunctionIDs eSFID, uint32 nMsgType )
+    {
+        switch( eSFID )
+        {
+        case SFID_DP_DC0:
+            switch( nMsgType )
+            {
+            case 0x0: return "OWordBlockRead";
+            case 0x1: return "OWordBlockReadU";
+            case 0x2: return "OWordBlockReadx2";
+            case 0x3: return "DwordScatterRead";
+            case 0x4: return "ByteScatterRead";
+            case 0x7: return "MemFence";
+            case 0x8: return "OWordBlockWrite";
+            case 0xA: return "OWordBlockWritex2";
+            case 0xB: return "DwordScatterWrite";
+            case 0xC: return "ByteScatterWrite";
+            }
+            break;
+
+        case SFID_DP_DC1:
+            switch( nMsgType )
+            {
+            case 0x1: return "UntypedRead";
+            case 0x2: return "UntypedAtomic";
+            case 0x3: return "UntypedAtomic4x2";
+            case 0x4: return "MediaBlockRead";
+            case 0x5: return "TypedRead";
+            case 0x6: return "TypedAtomic";
+            case 0x7: return "TypedAtomic4x2";
+            case 0x9: return "UntypedWrite";
+            case 0xA: return "MediaBlockWrite";
+            case 0xB: return "AtomicCounterOp";
+            case 0xC: return "AtomicCounterOp4x2";
+            case 0xD: return "TypedWrite";
+            }
+            break;
+        }
+        return 0;
+    }
+
     const char* OperationToString( Operations op )
     {
         switch( op )
@@ -116,6 +157,166 @@ namespace GEN
         }
     }
 
+    size_t GetTypeSize( DataTypes eType )
+    {
+        switch( eType )
+        {
+        default:     return 0;
+        case DT_U32: return 4;
+        case DT_S32: return 4;
+        case DT_U16: return 2;
+        case DT_S16: return 2;
+        case DT_U8:  return 1;
+        case DT_S8:  return 1;
+        case DT_F64: return 8;
+        case DT_F32: return 4;
+        }
+    }
+
+
+    uint32 Instruction::PackRegionCode( size_t n, uint32 nInvalid )
+    {
+        uint32 nCode=0;
+        while( nCode < nInvalid && n > ((size_t)1<<nCode)>>1 )
+            nCode++;
+
+        // Non-powers of two and out-of-range values unpack to 0xff, which is what 
+        //  the old uint8 fields held for them.  The encoder rejects both the same way
+        if( nCode >= nInvalid || n != (((size_t)1<<nCode)>>1) )
+            return nInvalid;
+        return nCode;
+    }
+
+    size_t Instruction::UnpackRegionCode( uint32 nCode, uint32 nInvalid )
+    {
+        if( nCode == nInvalid )
+            return 0xff;
+        return ((size_t)1<<nCode)>>1;
+    }
+
+    void Instruction::PackOperand( PackedOperand& rOp, DataTypes eType, const RegisterRegion& rRegion, uint32 nSwizzle )
+    {
+        RegReference base = rRegion.GetBaseRegister();
+        rOp.m_eDataType = eType;
+        rOp.m_eRegType  = base.GetRegType();
+        rOp.m_bIndirect = !base.IsDirect();
+        if( base.IsDirect() )
+        {
+            const DirectRegReference& rDirect = static_cast<const DirectRegReference&>(base);
+            rOp.m_nRegBits = (rDirect.GetRegNumber() & 0xff) | ((rDirect.GetSubRegOffset() & 0x3f)<<8);
+        }
+        else
+        {
+            const IndirectRegReference& rIndirect = static_cast<const IndirectRegReference&>(base);
+            rOp.m_nRegBits = (rIndirect.GetAddressSubReg() & 0xf) | ((rIndirect.GetImmediateOffset() & 0x3ff)<<4);
+        }
+        rOp.m_nHStride  = PackRegionCode( rRegion.GetHStride(), 7 );
+        rOp.m_nVStride  = PackRegionCode( rRegion.GetVStride(), 15 );
+        rOp.m_nWidth    = PackRegionCode( rRegion.GetWidth(), 7 );
+        rOp.m_nSwizzle  = nSwizzle;
+    }
+
+    RegisterRegion Instruction::UnpackRegion( const PackedOperand& rOp )
+    {
+        size_t nVStride = UnpackRegionCode( rOp.m_nVStride, 15 );
+        size_t nWidth   = UnpackRegionCode( rOp.m_nWidth, 7 );
+        size_t nHStride = UnpackRegionCode( rOp.m_nHStride, 7 );
+        if( rOp.m_bIndirect )
+        {
+            // address immediate is a signed 10-bit field
+            int16 nOffset = (int16)(rOp.m_nRegBits >> 4);
+            if( nOffset & 0x200 )
+                nOffset -= 0x400;
+            return RegisterRegion( IndirectRegReference( nOffset, rOp.m_nRegBits & 0xf ), nVStride, nWidth, nHStride );
+        }
+
+        return RegisterRegion( DirectRegReference( (RegTypes)rOp.m_eRegType, rOp.m_nRegBits & 0xff, rOp.m_nRegBits >> 8 ),
+                               nVStride, nWidth, nHStride );
+    }
+
+    bool Instruction::RelocateGPR( size_t nOperand, size_t nRegs )
+    {
+        PackedOperand* pOperands[] = { &m_Dest, &m_Source0, &m_Source1, &m_Source2 };
+        PackedOperand& rOp = *pOperands[nOperand];
+        if( rOp.m_bIndirect )
+        {
+            int nOffset = rOp.m_nRegBits >> 4;
+            if( nOffset & 0x200 )
+                nOffset -= 0x400;
+            nOffset += (int)(32*nRegs);
+            if( nOffset > 0x1ff )
+                return false;
+            rOp.m_nRegBits = (rOp.m_nRegBits & 0xf) | ((nOffset & 0x3ff)<<4);
+            return true;
+        }
+
+        size_t nRegNum = (rOp.m_nRegBits & 0xff) + nRegs;
+        if( nRegNum > 0xff )
+            return false;
+        rOp.m_nRegBits = (rOp.m_nRegBits & ~0xff) | nRegNum;
+        return true;
+    }
+
+    void Instruction::ClearFields()
+    {
+        m_nExecSize     = 0;
+        m_bNoWriteMask  = 0;
+        m_bNoDDChk      = 0;
+        m_bNoDDClr      = 0;
+        m_Predicate     = Predicate();
+        m_Flags         = FlagReference();
+        m_eCondModifier = 0;
+        m_bEOT          = 0;
+        m_bMsgDescriptorFromReg = 0;
+        memset( m_ImmediateOperand, 0, sizeof(m_ImmediateOperand) );
+        SetDest( DestOperand() );
+        SetSource( 0, SourceOperand(DT_INVALID,RegisterRegion()) );
+        SetSource( 1, SourceOperand(DT_INVALID,RegisterRegion()) );
+    }
+
+    void Instruction::SetDest( const DestOperand& rDest )
+    {
+        PackOperand( m_Dest, rDest.GetDataType(), rDest.GetRegRegion(), rDest.GetWriteMask() );
+        m_Dest.m_eModifier  = 0;
+        m_Dest.m_bImmediate = 0;
+    }
+
+    void Instruction::SetSource( size_t i, const SourceOperand& rSource )
+    {
+        PackedOperand* pOps[] = { &m_Source0, &m_Source1, &m_Source2 };
+        PackedOperand& rOp = *pOps[i];
+        if( rSource.IsImmediate() )
+        {
+            // immediate bits are copied into the instruction by whoever builds it
+            PackOperand( rOp, rSource.GetDataType(), RegisterRegion(), 0 );
+        }
+        else
+        {
+            PackOperand( rOp, rSource.GetDataType(), rSource.GetRegRegion(), rSource.GetSwizzle().PackBits() );
+        }
+        rOp.m_eModifier  = rSource.GetModifier();
+        rOp.m_bImmediate = rSource.IsImmediate();
+    }
+
+    DestOperand Instruction::GetDestOperand() const
+    {
+        return DestOperand( (DataTypes)m_Dest.m_eDataType, UnpackRegion(m_Dest), m_Dest.m_nSwizzle );
+    }
+
+    SourceOperand Instruction::GetSourceOperand( size_t i ) const
+    {
+        const PackedOperand* pOps[] = { &m_Source0, &m_Source1, &m_Source2 };
+        const PackedOperand& rOp = *pOps[i];
+        if( rOp.m_bImmediate )
+        {
+            SourceOperand src( (DataTypes)rOp.m_eDataType, (SourceModifiers)rOp.m_eModifier );
+            memcpy( src.fields.Imm, m_ImmediateOperand, sizeof(m_ImmediateOperand) );
+            return src;
+        }
+
+        return SourceOperand( (DataTypes)rOp.m_eDataType, UnpackRegion(rOp), Swizzle(rOp.m_nSwizzle), (SourceModifiers)rOp.m_eModifier );
+    }
+
 
     SendInstruction SendEOT( uint32 nSourceGPR )
     {
@@ -300,6 +501,23 @@ namespace GEN
         return write;
     }
 
+    SendInstruction UntypedRead( uint32 nBindTableIndex, size_t nSIMD, size_t nChannels, GEN::RegReference addr, GEN::RegReference data )
+    {
+        uint32 nRegsPerChannel = (nSIMD == 16) ? 2 : 1;
+        uint32 dwDescriptor = 0;
+        dwDescriptor  = (nRegsPerChannel<<25);                // message length (1 gpr per 8 addresses)
+        dwDescriptor |= ((nChannels*nRegsPerChannel)<<20);    // response length
+        dwDescriptor |= 0x1<<14;                              // message type (untyped surface read)
+        dwDescriptor |= ((nSIMD == 16) ? 0x10 : 0x20)<<8;     // SIMD16 or SIMD8
+        dwDescriptor |= ((0xf<<nChannels)&0xf)<<8;            // channel mask.  Set bits turn channels off
+        dwDescriptor |=  (nBindTableIndex&0xff);
+
+        SendInstruction read( nSIMD,SFID_DP_DC1, dwDescriptor,
+                              DestOperand( DT_U32, RegisterRegion(data,8,8,1)),
+                              SourceOperand( DT_U32,  RegisterRegion( addr,8,8,1)) );
+        return read;
+    }
+
     SendInstruction UntypedWrite_SIMD16x2( uint32 nBindTableIndex, GEN::RegReference addr, GEN::RegReference writeCommit )
     {
         uint32 dwDescriptor = 0;
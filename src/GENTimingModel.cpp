@@ -0,0 +1,455 @@
+
+#include "GENTimingModel.h"
+#include "GENAssembler.h"
+#include "GENDisassembler.h" // for 'IPrinter'
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <queue>
+
+namespace GEN
+{
+    namespace _INTERNAL
+    {
+        enum
+        {
+            TIMING_RESOURCES = 128 + 8,    ///< GPRs, then the 'OtherResources' bits
+        };
+
+        static const uint64 NEVER = ~(uint64)0;
+
+        /// What the model needs to know about each instruction, worked out once per run
+        struct TimedInstruction
+        {
+            std::vector<uint16> Resources;  ///< Everything the instruction reads or writes.  It waits for all of them
+            std::vector<uint16> Writes;
+            InstructionCost cost;
+            size_t nMessageBytes;           ///< Payload plus response, for sends which go through the dataport
+            size_t nLine;                   ///< Instruction cache line
+        };
+
+        struct TimedThread
+        {
+            InterpreterThread* pExec;
+            size_t nIndex;                  ///< Into the model's thread list
+            uint32 State[4];                ///< What it reads from sr0
+            size_t nLine;                   ///< Cache line that it last fetched
+            uint64 nFetchReady;
+            uint64 ReadyCycles[TIMING_RESOURCES];
+            bool bStarted;
+        };
+
+        struct EUState
+        {
+            size_t nSubSlice;
+            size_t nLastSlot;               ///< Round-robin issue starts after this slot
+            uint64 nBusyUntil;
+            std::vector<TimedThread*> Slots;
+            std::vector<uint64> SlotFreeCycles;
+        };
+
+        struct CacheLine
+        {
+            size_t nLine;
+            uint64 nReady;                  ///< When the line arrives.  Threads which hit it before then wait too
+        };
+
+        struct SubSliceState
+        {
+            uint64 nPortFree;               ///< First cycle that the dataport can start another message
+            std::list<CacheLine> ICache;    ///< Most recently used first
+        };
+
+        struct TimingEvent
+        {
+            uint64 nCycle;
+            size_t nTarget;                 ///< An EU, or the EU count for the dispatcher
+            bool operator>( const TimingEvent& e ) const { return nCycle > e.nCycle || (nCycle == e.nCycle && nTarget > e.nTarget); }
+        };
+
+        static void AddResources( std::vector<uint16>& rList, const Resources& r )
+        {
+            for( size_t i=0; i<128; i++ )
+                if( r.GPRs[i/32] & (1u<<(i%32)) )
+                    rList.push_back( (uint16)i );
+            for( size_t i=0; i<8; i++ )
+                if( (r.nOther & ~RESOURCE_MEMORY) & (1<<i) )
+                    rList.push_back( (uint16)(128+i) );
+        }
+
+        /// Returns the cycle that a fetch of 'nLine' at 'nCycle' can issue.  Misses replace the least recently used line
+        static uint64 FetchLine( SubSliceState& rSubSlice, size_t nLine, uint64 nCycle, const TimingParameters& rParams, size_t nCapacity, uint64* pMisses )
+        {
+            for( std::list<CacheLine>::iterator it = rSubSlice.ICache.begin(); it != rSubSlice.ICache.end(); ++it )
+            {
+                if( it->nLine == nLine )
+                {
+                    rSubSlice.ICache.splice( rSubSlice.ICache.begin(), rSubSlice.ICache, it );
+                    return std::max( nCycle, rSubSlice.ICache.front().nReady );
+                }
+            }
+
+            CacheLine line = { nLine, nCycle + rParams.nICacheMissCycles };
+            rSubSlice.ICache.push_front( line );
+            if( rSubSlice.ICache.size() > nCapacity )
+                rSubSlice.ICache.pop_back();
+            (*pMisses)++;
+            return line.nReady;
+        }
+
+        /// EU IDs in sr0 skip from 4 to 8, so each subslice's EUs are numbered in two rows
+        static uint32 GetStateRegister( size_t nSubSlice, size_t nEU, size_t nSlot, size_t nEUsPerSubSlice )
+        {
+            size_t nEUsPerRow = (nEUsPerSubSlice+1)/2;
+            uint32 nEUID = (uint32)( ((nEU/nEUsPerRow)<<3) | (nEU%nEUsPerRow) );
+            return (uint32)nSlot | (nEUID<<8) | ((uint32)nSubSlice<<12);
+        }
+    }
+
+    using namespace _INTERNAL;
+
+    TimingParameters::TimingParameters()
+        : nSubSlices(2),
+          nEUsPerSubSlice(10),
+          nThreadsPerEU(7),
+          nDispatchCycles(4),
+          nDataPortBytesPerCycle(64),
+          nICacheLineBytes(64),
+          nICacheMissCycles(100),
+          nClockMHz(1100)
+    {
+    }
+
+    bool TimingModel::Run( const Interpreter& rProgram, const TimingParameters& rParams, const TimingDispatch& rDispatch, IPrinter* pErrors )
+    {
+        m_Threads.clear();
+        m_nTotalCycles     = 0;
+        m_nIssueCycles     = 0;
+        m_nICacheMisses    = 0;
+        m_nPortStallCycles = 0;
+
+        char pError[256];
+        size_t nSubSliceSlots = rParams.nEUsPerSubSlice*rParams.nThreadsPerEU;
+        pError[0] = 0;
+        if( !rParams.nSubSlices )
+            sprintf( pError, "TimingModel: 'nSubSlices' is 0\n" );
+        else if( !rParams.nEUsPerSubSlice )
+            sprintf( pError, "TimingModel: 'nEUsPerSubSlice' is 0\n" );
+        else if( !rParams.nThreadsPerEU )
+            sprintf( pError, "TimingModel: 'nThreadsPerEU' is 0\n" );
+        else if( !rParams.nICacheLineBytes )
+            sprintf( pError, "TimingModel: 'nICacheLineBytes' is 0\n" );
+        else if( !rParams.nDataPortBytesPerCycle )
+            sprintf( pError, "TimingModel: 'nDataPortBytesPerCycle' is 0\n" );
+        else if( rDispatch.nThreadsPerGroup > nSubSliceSlots )
+            sprintf( pError, "TimingModel: %u threads per group won't fit in a subslice\n", (unsigned)rDispatch.nThreadsPerGroup );
+        if( pError[0] )
+        {
+            if( pErrors )
+                pErrors->Push( pError );
+            return false;
+        }
+
+        std::vector<TimedInstruction> Instructions( rProgram.GetInstructionCount() );
+        for( size_t i=0; i<Instructions.size(); i++ )
+        {
+            const Instruction& rInst = rProgram.GetInstruction(i);
+            TimedInstruction& rTimed = Instructions[i];
+            Resources reads, writes;
+            GetResources( rInst, &reads, &writes );
+            AddResources( rTimed.Resources, reads );
+            AddResources( rTimed.Resources, writes );
+            AddResources( rTimed.Writes, writes );
+            rTimed.cost          = rParams.Costs.GetCost( rInst );
+            rTimed.nLine         = rProgram.GetOffset(i) / rParams.nICacheLineBytes;
+            rTimed.nMessageBytes = 0;
+            if( rInst.GetClass() == IC_SEND )
+            {
+                const SendInstruction& rSend = static_cast<const SendInstruction&>(rInst);
+                SharedFunctionIDs eSFID = rSend.GetRecipient();
+                if( (eSFID == SFID_DP_DC0 || eSFID == SFID_DP_DC1) && !rSend.IsDescriptorInRegister() )
+                    rTimed.nMessageBytes = 32*( rSend.GetMessageLengthFromDescriptor() + rSend.GetResponseLengthFromDescriptor() );
+            }
+        }
+
+        size_t nEUs = rParams.nSubSlices*rParams.nEUsPerSubSlice;
+        size_t nICacheLines = std::max<size_t>( rParams.Costs.nICacheBytes / rParams.nICacheLineBytes, 1 );
+        std::vector<EUState> EUs( nEUs );
+        std::vector<SubSliceState> SubSlices( rParams.nSubSlices );
+        for( size_t e=0; e<nEUs; e++ )
+        {
+            EUs[e].nSubSlice  = e / rParams.nEUsPerSubSlice;
+            EUs[e].nLastSlot  = rParams.nThreadsPerEU-1;
+            EUs[e].nBusyUntil = 0;
+            EUs[e].Slots.resize( rParams.nThreadsPerEU, 0 );
+            EUs[e].SlotFreeCycles.resize( rParams.nThreadsPerEU, 0 );
+        }
+        for( size_t s=0; s<SubSlices.size(); s++ )
+            SubSlices[s].nPortFree = 0;
+
+        // events for stale times are left in the queue, and skipped when they come out
+        std::priority_queue< TimingEvent, std::vector<TimingEvent>, std::greater<TimingEvent> > Events;
+        std::vector<uint64> Scheduled( nEUs+1, NEVER );
+        size_t DISPATCHER = nEUs;
+        auto Schedule = [&]( size_t nTarget, uint64 nCycle )
+        {
+            if( nCycle < Scheduled[nTarget] )
+            {
+                Scheduled[nTarget] = nCycle;
+                TimingEvent e = { nCycle, nTarget };
+                Events.push(e);
+            }
+        };
+
+        size_t nTotalThreads = rDispatch.nGroups*rDispatch.nThreadsPerGroup;
+        size_t nNextThread   = 0;
+        size_t nGroupSubSlice = 0;
+        uint64 nNextDispatch = 0;
+        size_t nLiveThreads  = 0;
+        std::vector<TimedThread*> FreeThreads;
+        bool bFailed = false;
+
+        m_Threads.resize( nTotalThreads );
+        Schedule( DISPATCHER, rDispatch.nStartCycle );
+
+        while( !Events.empty() && !bFailed )
+        {
+            TimingEvent event = Events.top();
+            Events.pop();
+            if( event.nCycle != Scheduled[event.nTarget] )
+                continue;
+            Scheduled[event.nTarget] = NEVER;
+            uint64 nCycle = event.nCycle;
+
+            if( event.nTarget == DISPATCHER )
+            {
+                if( nNextThread == nTotalThreads )
+                    continue;
+                if( nCycle < nNextDispatch )
+                {
+                    Schedule( DISPATCHER, nNextDispatch );
+                    continue;
+                }
+
+                // a new group goes to the subslice with the most free slots, once one can hold all of it
+                size_t nThreadInGroup = nNextThread % rDispatch.nThreadsPerGroup;
+                if( nThreadInGroup == 0 )
+                {
+                    size_t nBestFree = 0;
+                    for( size_t s=0; s<SubSlices.size(); s++ )
+                    {
+                        size_t nFree = 0;
+                        for( size_t e=s*rParams.nEUsPerSubSlice; e<(s+1)*rParams.nEUsPerSubSlice; e++ )
+                            for( size_t t=0; t<rParams.nThreadsPerEU; t++ )
+                                nFree += (!EUs[e].Slots[t] && EUs[e].SlotFreeCycles[t] <= nCycle);
+                        if( nFree > nBestFree )
+                        {
+                            nBestFree = nFree;
+                            nGroupSubSlice = s;
+                        }
+                    }
+                    if( nBestFree < rDispatch.nThreadsPerGroup )
+                        continue; // retiring threads wake the dispatcher
+                }
+
+                // each thread goes to its subslice's least loaded EU
+                size_t nBestEU = nEUs, nBestSlot = 0, nBestFree = 0;
+                for( size_t e=nGroupSubSlice*rParams.nEUsPerSubSlice; e<(nGroupSubSlice+1)*rParams.nEUsPerSubSlice; e++ )
+                {
+                    size_t nFree = 0, nFirstFree = 0;
+                    for( size_t t=rParams.nThreadsPerEU; t-- > 0; )
+                    {
+                        if( !EUs[e].Slots[t] && EUs[e].SlotFreeCycles[t] <= nCycle )
+                        {
+                            nFree++;
+                            nFirstFree = t;
+                        }
+                    }
+                    if( nFree > nBestFree )
+                    {
+                        nBestFree = nFree;
+                        nBestEU   = e;
+                        nBestSlot = nFirstFree;
+                    }
+                }
+                if( nBestEU == nEUs )
+                    continue;
+
+                TimedThread* pThread;
+                if( FreeThreads.empty() )
+                {
+                    pThread = new TimedThread();
+                    pThread->pExec = new InterpreterThread();
+                }
+                else
+                {
+                    pThread = FreeThreads.back();
+                    FreeThreads.pop_back();
+                }
+
+                size_t nGroup = nNextThread / rDispatch.nThreadsPerGroup;
+                ThreadPayload payload;
+                memset( &payload, 0, sizeof(payload) );
+                payload.Header[1]     = (uint32)nGroup;
+                payload.nCURBERegs    = rDispatch.nCURBERegsPerThread;
+                payload.pCURBE        = rDispatch.pCURBE ? (const uint8*)rDispatch.pCURBE + 32*nThreadInGroup*rDispatch.nCURBERegsPerThread : 0;
+                payload.nDispatchMask = rDispatch.nDispatchMask;
+                payload.pSurfaces     = rDispatch.pSurfaces;
+                payload.nSurfaces     = rDispatch.nSurfaces;
+                pThread->pExec->Start( rProgram, payload );
+
+                size_t nSlice = EUs[nBestEU].nSubSlice;
+                memset( pThread->State, 0, sizeof(pThread->State) );
+                pThread->State[0] = GetStateRegister( nSlice, nBestEU % rParams.nEUsPerSubSlice, nBestSlot, rParams.nEUsPerSubSlice );
+                pThread->nIndex   = nNextThread;
+                pThread->bStarted = false;
+                pThread->nLine    = Instructions.empty() ? 0 : Instructions[0].nLine;
+                pThread->nFetchReady = nCycle;
+                if( !Instructions.empty() )
+                    pThread->nFetchReady = FetchLine( SubSlices[nSlice], pThread->nLine, nCycle, rParams, nICacheLines, &m_nICacheMisses );
+                for( size_t r=0; r<TIMING_RESOURCES; r++ )
+                    pThread->ReadyCycles[r] = 0;
+
+                ThreadTiming& rTiming  = m_Threads[nNextThread];
+                rTiming.nGroup         = nGroup;
+                rTiming.nThreadInGroup = nThreadInGroup;
+                rTiming.nState         = pThread->State[0];
+                rTiming.nStartCycle    = 0;
+                rTiming.nEndCycle      = 0;
+
+                EUs[nBestEU].Slots[nBestSlot] = pThread;
+                nLiveThreads++;
+                nNextThread++;
+                nNextDispatch = nCycle + rParams.nDispatchCycles;
+                Schedule( nBestEU, nCycle );
+                Schedule( DISPATCHER, nNextDispatch );
+                continue;
+            }
+
+            EUState& rEU = EUs[event.nTarget];
+            if( nCycle < rEU.nBusyUntil )
+            {
+                Schedule( event.nTarget, rEU.nBusyUntil );
+                continue;
+            }
+
+            // round-robin over the slots, starting after the last one which issued
+            size_t nIssueSlot = rParams.nThreadsPerEU;
+            uint64 nEarliest  = NEVER;
+            for( size_t k=1; k<=rParams.nThreadsPerEU; k++ )
+            {
+                size_t nSlot = (rEU.nLastSlot + k) % rParams.nThreadsPerEU;
+                TimedThread* pThread = rEU.Slots[nSlot];
+                if( !pThread )
+                    continue;
+
+                uint64 nReady = pThread->nFetchReady;
+                size_t nIP = pThread->pExec->GetIP();
+                if( nIP < Instructions.size() )
+                {
+                    const std::vector<uint16>& rResources = Instructions[nIP].Resources;
+                    for( size_t r=0; r<rResources.size(); r++ )
+                        nReady = std::max( nReady, pThread->ReadyCycles[rResources[r]] );
+                }
+                if( nReady <= nCycle )
+                {
+                    nIssueSlot = nSlot;
+                    break;
+                }
+                nEarliest = std::min( nEarliest, nReady );
+            }
+
+            if( nIssueSlot == rParams.nThreadsPerEU )
+            {
+                if( nEarliest != NEVER )
+                    Schedule( event.nTarget, nEarliest );
+                continue;
+            }
+
+            TimedThread* pThread = rEU.Slots[nIssueSlot];
+            ThreadTiming& rTiming = m_Threads[pThread->nIndex];
+            size_t nIP = pThread->pExec->GetIP();
+            pThread->pExec->SetTimestamp( nCycle );
+            pThread->pExec->SetState( pThread->State );
+            InterpreterThread::StepResult eResult = pThread->pExec->Step();
+            if( eResult == InterpreterThread::STEP_ERROR )
+            {
+                sprintf( pError, "TimingModel: group %u thread %u: %.200s\n", (unsigned)rTiming.nGroup, (unsigned)rTiming.nThreadInGroup, pThread->pExec->GetError() );
+                if( pErrors )
+                    pErrors->Push( pError );
+                bFailed = true;
+                break;
+            }
+
+            const TimedInstruction& rInst = Instructions[nIP];
+            uint64 nComplete = nCycle + rInst.cost.nLatency;
+            if( rInst.nMessageBytes )
+            {
+                SubSliceState& rSubSlice = SubSlices[rEU.nSubSlice];
+                uint64 nStart = std::max( nCycle, rSubSlice.nPortFree );
+                m_nPortStallCycles  += nStart - nCycle;
+                rSubSlice.nPortFree  = nStart + (rInst.nMessageBytes + rParams.nDataPortBytesPerCycle-1) / rParams.nDataPortBytesPerCycle;
+                nComplete            = rSubSlice.nPortFree + rInst.cost.nLatency;
+            }
+            for( size_t r=0; r<rInst.Writes.size(); r++ )
+                pThread->ReadyCycles[rInst.Writes[r]] = std::max( pThread->ReadyCycles[rInst.Writes[r]], nComplete );
+
+            if( !pThread->bStarted )
+            {
+                pThread->bStarted   = true;
+                rTiming.nStartCycle = nCycle;
+            }
+
+            rEU.nLastSlot  = nIssueSlot;
+            rEU.nBusyUntil = nCycle + rInst.cost.nIssue;
+            m_nIssueCycles += rInst.cost.nIssue;
+
+            if( eResult == InterpreterThread::STEP_DONE )
+            {
+                rTiming.nEndCycle = nCycle;
+                rEU.Slots[nIssueSlot] = 0;
+                rEU.SlotFreeCycles[nIssueSlot] = rEU.nBusyUntil;
+                m_nTotalCycles = std::max( m_nTotalCycles, rEU.nBusyUntil - rDispatch.nStartCycle );
+                FreeThreads.push_back( pThread );
+                nLiveThreads--;
+                Schedule( DISPATCHER, std::max( rEU.nBusyUntil, nNextDispatch ) );
+            }
+            else
+            {
+                // jumping to another line, or running off the end of this one, means another fetch
+                size_t nNextIP = pThread->pExec->GetIP();
+                if( nNextIP < Instructions.size() && Instructions[nNextIP].nLine != pThread->nLine )
+                {
+                    pThread->nLine = Instructions[nNextIP].nLine;
+                    pThread->nFetchReady = FetchLine( SubSlices[rEU.nSubSlice], pThread->nLine, rEU.nBusyUntil, rParams, nICacheLines, &m_nICacheMisses );
+                }
+            }
+            Schedule( event.nTarget, rEU.nBusyUntil );
+        }
+
+        for( size_t e=0; e<EUs.size(); e++ )
+        {
+            for( size_t t=0; t<EUs[e].Slots.size(); t++ )
+            {
+                if( EUs[e].Slots[t] )
+                    FreeThreads.push_back( EUs[e].Slots[t] );
+            }
+        }
+        for( size_t i=0; i<FreeThreads.size(); i++ )
+        {
+            delete FreeThreads[i]->pExec;
+            delete FreeThreads[i];
+        }
+
+        if( !bFailed && (nLiveThreads || nNextThread != nTotalThreads) )
+        {
+            if( pErrors )
+                pErrors->Push( "TimingModel: threads were left running\n" );
+            bFailed = true;
+        }
+        return !bFailed;
+    }
+}
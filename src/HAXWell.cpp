@@ -1,8 +1,12 @@
+#include "HAXWell.h"
+
+// See HAXWell_CPU.cpp for the host implementation
+#ifndef HAXWELL_CPU
+
 #include <Windows.h>
 #include <GL/GL.h>
 #include <stdio.h>
 
-#include "HAXWell.h"
 #include "HAXWell_Utils.h"
 
 #define GL_COMPILE_STATUS                 0x8B81
@@ -221,6 +225,18 @@ namespace HAXWell
 
     Blob g_TemplateBlob;
     size_t g_nTemplateIsaOffset;
+    PatchBlobCache g_TemplateHashes;
+
+    /// Shaders made from args with the same contents share one program, which is deleted with its last handle
+    struct CachedShader
+    {
+        std::vector<unsigned char> Contents;
+        GLuint hProgram;
+        size_t nRefs;
+    };
+    std::map<QWORD,CachedShader> g_Shaders;     // by 'GetShaderKey'
+    std::map<GLuint,QWORD> g_ShaderKeys;        // by program
+    std::string g_ShaderCacheDirectory;
     GLenum g_eBinaryFormat;
 
     HDC g_hDC = 0;
@@ -326,6 +342,7 @@ namespace HAXWell
         glGetProgramiv( hProgram, GL_PROGRAM_BINARY_LENGTH, &nBinaryLength );
         
         g_TemplateBlob.SetLength(nBinaryLength);
+        g_TemplateHashes.Clear();
 
         glGetProgramBinary( hProgram, nBinaryLength, &nBinaryLength, &g_eBinaryFormat, g_TemplateBlob.GetBytes() );
 
@@ -351,12 +368,8 @@ namespace HAXWell
 
 
 
-    ShaderHandle CreateShader( const HAXWell::ShaderArgs& rArgs )
+    GLuint LoadProgramBinary( const Blob& blob )
     {
-        
-        Blob blob;
-        HAXWell::PatchBlob( blob, rArgs, g_TemplateBlob, g_nTemplateIsaOffset );
-
         GLuint hProgram = glCreateProgram();
         glProgramBinary( hProgram, g_eBinaryFormat, blob.GetBytes(), blob.GetLength());
 
@@ -368,9 +381,60 @@ namespace HAXWell
             return 0;
         }
 
+        return hProgram;
+    }
+
+    ShaderHandle CreateShader( const HAXWell::ShaderArgs& rArgs )
+    {
+        std::vector<unsigned char> contents;
+        HAXWell::GetShaderContents( contents, rArgs );
+        QWORD nKey = HAXWell::GetShaderKey( contents, g_TemplateBlob );
+
+        // On a key collision, the new shader just doesn't get shared
+        std::map<QWORD,CachedShader>::iterator it = g_Shaders.find(nKey);
+        if( it != g_Shaders.end() && it->second.Contents == contents )
+        {
+            it->second.nRefs++;
+            return (ShaderHandle)it->second.hProgram;
+        }
+        bool bShared = (it == g_Shaders.end());
+
+        Blob blob;
+        bool bFromFile = !g_ShaderCacheDirectory.empty() && HAXWell::ReadBlobFile( blob, g_ShaderCacheDirectory, nKey, contents );
+        if( !bFromFile )
+            HAXWell::PatchBlob( blob, rArgs, g_TemplateBlob, g_nTemplateIsaOffset, &g_TemplateHashes );
+
+        GLuint hProgram = LoadProgramBinary( blob );
+        if( !hProgram && bFromFile )
+        {
+            // the driver doesn't like the stored blob, so make it again
+            bFromFile = false;
+            HAXWell::PatchBlob( blob, rArgs, g_TemplateBlob, g_nTemplateIsaOffset, &g_TemplateHashes );
+            hProgram = LoadProgramBinary( blob );
+        }
+        if( !hProgram )
+            return 0;
+
+        if( !bFromFile && !g_ShaderCacheDirectory.empty() )
+            HAXWell::WriteBlobFile( g_ShaderCacheDirectory, nKey, contents, blob );
+
+        if( bShared )
+        {
+            CachedShader& rShader = g_Shaders[nKey];
+            rShader.Contents.swap(contents);
+            rShader.hProgram = hProgram;
+            rShader.nRefs    = 1;
+            g_ShaderKeys[hProgram] = nKey;
+        }
+
         return (ShaderHandle)hProgram;
     }
 
+    void SetShaderCacheDirectory( const char* pPath )
+    {
+        g_ShaderCacheDirectory = pPath ? pPath : "";
+    }
+
     ShaderHandle CreateGLSLShader( const char* pGLSL )
     {
         // TODO: Handle compile/link fails
@@ -395,6 +459,17 @@ namespace HAXWell
 
     void ReleaseShader( ShaderHandle h )
     {
+        std::map<GLuint,QWORD>::iterator it = g_ShaderKeys.find( (GLuint)h );
+        if( it != g_ShaderKeys.end() )
+        {
+            std::map<QWORD,CachedShader>::iterator shader = g_Shaders.find( it->second );
+            if( --shader->second.nRefs )
+                return;
+
+            g_Shaders.erase(shader);
+            g_ShaderKeys.erase(it);
+        }
+
         glDeleteProgram( (GLuint)h );
     }
 
@@ -538,4 +613,6 @@ namespace HAXWell
         return success;
     }
 
-}
\ No newline at end of file
+}
+
+#endif
@@ -0,0 +1,288 @@
+#include "HAXWell.h"
+
+// Runs shaders through the ISA interpreter, so that kernels can be run without the Intel GL driver.
+//   See HAXWell.cpp for the GL implementation
+#ifdef HAXWELL_CPU
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "GENCoder.h"
+#include "GENDisassembler.h" // for 'IPrinter'
+#include "GENInterpreter.h"
+#include "GENTimingModel.h"
+
+namespace HAXWell
+{
+    namespace _INTERNAL
+    {
+        struct CPUBuffer
+        {
+            void* pBytes;
+            size_t nBytes;
+        };
+
+        struct CPUShader
+        {
+            GEN::Interpreter program;
+            size_t nThreads;
+            size_t nSIMDMode;
+            size_t nCURBEAllocsPerThread;
+            std::vector<unsigned char> CURBE;
+        };
+
+        struct CPUTimer
+        {
+            std::chrono::high_resolution_clock::time_point start;
+            std::chrono::high_resolution_clock::time_point end;
+            GEN::uint64 nStartCycle;
+            GEN::uint64 nEndCycle;
+        };
+
+        class ErrorPrinter : public GEN::IPrinter
+        {
+        public:
+            virtual void Push( const char* p ) { printf("%s", p); }
+        };
+
+        /// Fence handles just need to be non-null
+        int g_nFence;
+
+        bool g_bTimingModel = false;
+        GEN::TimingParameters g_TimingParameters;
+        GEN::uint64 g_nModelCycles = 0;  ///< Modelled time, summed over dispatches
+    }
+
+    using namespace _INTERNAL;
+
+    bool Init( bool bCreateGLContext )
+    {
+        printf( "HAXWell: shaders will run on the CPU\n" );
+        return true;
+    }
+
+    BufferHandle CreateBuffer( const void* pOptionalInitialData, size_t nDataSize )
+    {
+        CPUBuffer* pBuffer = (CPUBuffer*) malloc( sizeof(CPUBuffer) );
+        if( !pBuffer )
+            return 0;
+
+        pBuffer->pBytes = calloc( nDataSize ? nDataSize : 1, 1 );
+        pBuffer->nBytes = nDataSize;
+        if( !pBuffer->pBytes )
+        {
+            free(pBuffer);
+            return 0;
+        }
+
+        if( pOptionalInitialData )
+            memcpy( pBuffer->pBytes, pOptionalInitialData, nDataSize );
+        return (BufferHandle)pBuffer;
+    }
+
+    void* MapBuffer( BufferHandle h )
+    {
+        return ((CPUBuffer*)h)->pBytes;
+    }
+
+    void UnmapBuffer( BufferHandle h )
+    {
+    }
+
+    void ReleaseBuffer( BufferHandle h )
+    {
+        CPUBuffer* pBuffer = (CPUBuffer*)h;
+        if( pBuffer )
+            free( pBuffer->pBytes );
+        free( pBuffer );
+    }
+
+    ShaderHandle CreateShader( const HAXWell::ShaderArgs& rArgs )
+    {
+        CPUShader* pShader = new CPUShader();
+        GEN::Decoder decoder;
+        if( !pShader->program.Load( &decoder, rArgs.pIsa, rArgs.nIsaLength ) )
+        {
+            delete pShader;
+            return 0;
+        }
+
+        pShader->nThreads              = rArgs.nDispatchThreadCount;
+        pShader->nSIMDMode             = rArgs.nSIMDMode;
+        pShader->nCURBEAllocsPerThread = rArgs.nCURBEAllocsPerThread;
+
+        size_t nCURBEBytes = rArgs.nCURBEAllocsPerThread*rArgs.nDispatchThreadCount*32;
+        if( rArgs.pCURBE && nCURBEBytes )
+        {
+            const unsigned char* pCURBE = (const unsigned char*) rArgs.pCURBE;
+            pShader->CURBE.assign( pCURBE, pCURBE + nCURBEBytes );
+        }
+        return (ShaderHandle)pShader;
+    }
+
+    ShaderHandle CreateGLSLShader( const char* pGLSL )
+    {
+        printf( "HAXWell: GLSL shaders are not supported on the CPU\n" );
+        return 0;
+    }
+
+    void ReleaseShader( ShaderHandle h )
+    {
+        delete (CPUShader*)h;
+    }
+
+    void SetShaderCacheDirectory( const char* pPath )
+    {
+    }
+
+    TimerHandle BeginTimer()
+    {
+        CPUTimer* pTimer = new CPUTimer();
+        pTimer->start = std::chrono::high_resolution_clock::now();
+        pTimer->end   = pTimer->start;
+        pTimer->nStartCycle = g_nModelCycles;
+        pTimer->nEndCycle   = g_nModelCycles;
+        return (TimerHandle)pTimer;
+    }
+
+    void EndTimer( TimerHandle hTimer )
+    {
+        ((CPUTimer*)hTimer)->end = std::chrono::high_resolution_clock::now();
+        ((CPUTimer*)hTimer)->nEndCycle = g_nModelCycles;
+    }
+
+    // GL timers count nanoseconds, so these do too
+    timer_t ReadTimer( TimerHandle hTimer )
+    {
+        CPUTimer* pTimer = (CPUTimer*)hTimer;
+        timer_t time = (timer_t) std::chrono::duration_cast<std::chrono::nanoseconds>( pTimer->end - pTimer->start ).count();
+        if( g_bTimingModel )
+            time = (timer_t) ( (pTimer->nEndCycle - pTimer->nStartCycle)*1000 / g_TimingParameters.nClockMHz );
+        delete pTimer;
+        return time;
+    }
+
+    void SetTimingModel( bool bEnable )
+    {
+        g_bTimingModel = bEnable;
+    }
+
+    // Thread groups are spread over a pool of host threads.  Each group's HW threads run one after another,
+    //   on one host thread, since nothing that the interpreter runs can make them wait for one another
+    void DispatchShader( ShaderHandle hShader, BufferHandle* pBuffers, size_t nBuffers, size_t nThreadGroups )
+    {
+        const CPUShader* pShader = (const CPUShader*)hShader;
+        if( !pShader )
+            return;
+
+        GEN::Surface pSurfaces[BIND_TABLE_BASE+MAX_BUFFERS];
+        memset( pSurfaces, 0, sizeof(pSurfaces) );
+        for( size_t i=0; i<nBuffers && i<MAX_BUFFERS; i++ )
+        {
+            const CPUBuffer* pBuffer = (const CPUBuffer*)pBuffers[i];
+            pSurfaces[BIND_TABLE_BASE+i].pData  = pBuffer->pBytes;
+            pSurfaces[BIND_TABLE_BASE+i].nBytes = pBuffer->nBytes;
+        }
+
+        GEN::uint32 nDispatchMask = 0xffffffff;
+        if( pShader->nSIMDMode == 8 )
+            nDispatchMask = 0xff;
+        else if( pShader->nSIMDMode == 16 )
+            nDispatchMask = 0xffff;
+
+        if( g_bTimingModel )
+        {
+            GEN::TimingDispatch dispatch;
+            dispatch.nGroups             = nThreadGroups;
+            dispatch.nThreadsPerGroup    = pShader->nThreads;
+            dispatch.nDispatchMask       = nDispatchMask;
+            dispatch.pCURBE              = pShader->CURBE.empty() ? 0 : &pShader->CURBE[0];
+            dispatch.nCURBERegsPerThread = pShader->nCURBEAllocsPerThread;
+            dispatch.pSurfaces           = pSurfaces;
+            dispatch.nSurfaces           = BIND_TABLE_BASE+MAX_BUFFERS;
+            dispatch.nStartCycle         = g_nModelCycles;
+
+            GEN::TimingModel model;
+            ErrorPrinter errors;
+            model.Run( pShader->program, g_TimingParameters, dispatch, &errors );
+            g_nModelCycles += model.GetTotalCycles();
+            return;
+        }
+
+        std::atomic<size_t> nNextGroup(0);
+        std::atomic<bool> bFailed(false);
+        auto Worker = [&]()
+        {
+            GEN::InterpreterThread* pThread = new GEN::InterpreterThread();
+            for( size_t nGroup = nNextGroup++; nGroup < nThreadGroups; nGroup = nNextGroup++ )
+            {
+                for( size_t t=0; t<pShader->nThreads; t++ )
+                {
+                    GEN::ThreadPayload payload;
+                    memset( &payload, 0, sizeof(payload) );
+                    payload.Header[1]     = (GEN::uint32) nGroup;
+                    payload.nCURBERegs    = pShader->nCURBEAllocsPerThread;
+                    payload.pCURBE        = pShader->CURBE.empty() ? 0 : &pShader->CURBE[t*pShader->nCURBEAllocsPerThread*32];
+                    payload.nDispatchMask = nDispatchMask;
+                    payload.pSurfaces     = pSurfaces;
+                    payload.nSurfaces     = BIND_TABLE_BASE+MAX_BUFFERS;
+
+                    pThread->Start( pShader->program, payload );
+                    GEN::InterpreterThread::StepResult eResult;
+                    do
+                    {
+                        eResult = pThread->Step();
+                    } while( eResult == GEN::InterpreterThread::STEP_OK );
+
+                    // report the first failure only, there will usually be one per thread
+                    if( eResult == GEN::InterpreterThread::STEP_ERROR && !bFailed.exchange(true) )
+                        printf( "HAXWell: thread group %u thread %u: %s\n", (unsigned)nGroup, (unsigned)t, pThread->GetError() );
+                }
+            }
+            delete pThread;
+        };
+
+        size_t nWorkers = std::thread::hardware_concurrency();
+        if( nWorkers == 0 )
+            nWorkers = 1;
+        if( nWorkers > nThreadGroups )
+            nWorkers = nThreadGroups;
+
+        std::vector<std::thread> workers;
+        for( size_t i=1; i<nWorkers; i++ )
+            workers.push_back( std::thread(Worker) );
+        Worker();
+        for( size_t i=0; i<workers.size(); i++ )
+            workers[i].join();
+    }
+
+    // Dispatches are finished by the time they return, so there is never anything to wait for
+    void Finish()
+    {
+    }
+
+    void Flush()
+    {
+    }
+
+    FenceHandle BeginFence()
+    {
+        return (FenceHandle)&g_nFence;
+    }
+
+    void WaitFence( FenceHandle hFence )
+    {
+    }
+
+    bool RipIsaFromGLSL( Blob& rBlob, const char* pGLSL )
+    {
+        return false;
+    }
+}
+
+#endif
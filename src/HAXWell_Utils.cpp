@@ -2,9 +2,18 @@
 #include "HAXWell_Utils.h"
 #include "GENCoder.h"
 #include "GENIsa.h"
+#include "GENCacheFile.h"
 
 #include "HAXWell.h"
 
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+    #include <emmintrin.h>
+    #define HAXWELL_SSE2
+#endif
+
 namespace HAXWell
 {
 
@@ -33,12 +42,19 @@ namespace HAXWell
     //  
     // The function is relatively short, so I just backported the disassembly to C
     //
-    void DriverHashFunction( DWORD* pCRC, const DWORD* pData, DWORD nDwords )
+    void DriverHash::Init()
+    {
+        m_esi = 0x428A2F98;
+        m_edx = 0x71374491;
+        m_edi = 0x0B5C0FBCF;
+    }
+
+    void DriverHash::Update( const DWORD* pData, DWORD nDwords )
     {
         DWORD eax;
-        DWORD esi = 0x428A2F98;
-        DWORD edx = 0x71374491;
-        DWORD edi = 0x0B5C0FBCF;
+        DWORD esi = m_esi;
+        DWORD edx = m_edx;
+        DWORD edi = m_edi;
         DWORD ebx = nDwords;
         const DWORD* ecx = pData;
         while( ebx )
@@ -93,9 +109,28 @@ namespace HAXWell
             ebx--;             //dec         ebx  
         }
 
-        eax = edi;
-        pCRC[0] = eax;
-        pCRC[1] = edx;
+        m_esi = esi;
+        m_edx = edx;
+        m_edi = edi;
+    }
+
+    void DriverHash::Finalize( DWORD* pCRC ) const
+    {
+        pCRC[0] = m_edi;
+        pCRC[1] = m_edx;
+    }
+
+    void DriverHashFunction( DWORD* pCRC, const DWORD* pData, DWORD nDwords )
+    {
+        DriverHash hash;
+        hash.Update( pData, nDwords );
+        hash.Finalize( pCRC );
+    }
+
+    const DriverHash* PatchBlobCache::Find( size_t nBlobLength ) const
+    {
+        std::map<size_t,DriverHash>::const_iterator it = m_Prefixes.find(nBlobLength);
+        return (it == m_Prefixes.end()) ? 0 : &it->second;
     }
      
     
@@ -105,94 +140,175 @@ namespace HAXWell
     
     
 
-    // Given a blob, attempt to locate a GEN program by searching for valid opcodes
-    bool FindIsaInBlob( size_t* pIsaOffset, size_t* pIsaLength, const void* pBlob, size_t nBlobLength )
+    namespace _INTERNAL
     {
-        const unsigned char* pBytes = (const unsigned char*)pBlob;
-
-        GEN::Decoder decoder;
+        enum
+        {
+            SEND_OPCODE = 0x31, ///< Low 7 bits of an instruction's first byte
+            EOT_BIT     = 0x80, ///< High bit of a native instruction's last byte
+        };
 
-        
-        // All GEN threads must in a SEND instruction with the 'EOT' field set 
-        //     Find this instruction
-        
-        size_t nSendInstruction = 0;
-        while( nSendInstruction < nBlobLength )
+        /// Returns the first offset at or after 'nStart' whose byte has the SEND opcode, and whose 15th byte after it
+        ///  has the EOT bit, or 'nBlobLength' if there aren't any.  Callers must confirm these with the decoder
+        size_t FindEOTCandidate( const unsigned char* pBytes, size_t nStart, size_t nBlobLength )
         {
-            const unsigned char* pWhere = pBytes + nSendInstruction;
-            
-            GEN::Operations eOp = decoder.GetOperation(pBytes + nSendInstruction);
-            if( eOp == GEN::OP_SEND )
+            size_t i = nStart;
+
+#ifdef HAXWELL_SSE2
+            // Most of a blob isn't SENDs, so test 32 offsets at a time, then 16, and let the scalar loop do the rest.
+            //  The second load of each pair is 15 bytes along, so that its bytes line up with their instructions' first bytes
+            const __m128i vOpcodeMask = _mm_set1_epi8( 0x7f );
+            const __m128i vSend       = _mm_set1_epi8( SEND_OPCODE );
+            for( ; i+32+15 <= nBlobLength; i += 32 )
             {
-                GEN::SendInstruction inst;
-                if( decoder.Decode( &inst, pWhere ) )
+                __m128i vOps0  = _mm_loadu_si128( (const __m128i*)(pBytes+i) );
+                __m128i vOps1  = _mm_loadu_si128( (const __m128i*)(pBytes+i+16) );
+                __m128i vEOTs0 = _mm_loadu_si128( (const __m128i*)(pBytes+i+15) );
+                __m128i vEOTs1 = _mm_loadu_si128( (const __m128i*)(pBytes+i+31) );
+                __m128i vHits0 = _mm_and_si128( _mm_cmpeq_epi8( _mm_and_si128( vOps0, vOpcodeMask ), vSend ), vEOTs0 );
+                __m128i vHits1 = _mm_and_si128( _mm_cmpeq_epi8( _mm_and_si128( vOps1, vOpcodeMask ), vSend ), vEOTs1 );
+                unsigned int nHits = _mm_movemask_epi8(vHits0) | (_mm_movemask_epi8(vHits1) << 16);
+                if( nHits )
                 {
-                    if( !inst.IsDescriptorInRegister() && inst.IsEOT() )
-                        break;
+                    while( !(nHits & 1) )
+                    {
+                        nHits >>= 1;
+                        i++;
+                    }
+                    return i;
                 }
             }
-         
-            nSendInstruction++;
-        }
 
-        if( nSendInstruction == nBlobLength )
-            return false;
-        
-        
-        // Now work our way backwards to the first non-instruction we see
-        //  This won't work if there exists a native instruction whose upper half
-        //   happens to exactly match a compressed one, but its the best we've got
-        const unsigned char* pIsaEnd   = (pBytes + nSendInstruction+16);
-        const unsigned char* scan = pIsaEnd;
-        while( scan > pBytes )
-        {
-            const unsigned char* p2x = scan-8;
-            const unsigned char* p4x = scan-16;
-            DWORD* pD2x = (DWORD*)p2x;
-            DWORD* pD4x = (DWORD*)p4x;
-
-            size_t len2 = decoder.DetermineLength(p2x);
-            size_t len4 = decoder.DetermineLength(p4x);
-            GEN::Operations eOp2 = decoder.GetOperation(p2x);
-            GEN::Operations eOp4 = decoder.GetOperation(p4x);
-        
-            if( eOp2 != GEN::OP_ILLEGAL && eOp2 != GEN::NOT_AN_OP && len2 == 8 )
+            if( i+16+15 <= nBlobLength )
             {
-                // legal compacted instruction
-                scan = p2x;
+                __m128i vOps  = _mm_loadu_si128( (const __m128i*)(pBytes+i) );
+                __m128i vEOTs = _mm_loadu_si128( (const __m128i*)(pBytes+i+15) );
+                __m128i vHits = _mm_and_si128( _mm_cmpeq_epi8( _mm_and_si128( vOps, vOpcodeMask ), vSend ), vEOTs );
+                unsigned int nHits = _mm_movemask_epi8(vHits);
+                if( nHits )
+                {
+                    while( !(nHits & 1) )
+                    {
+                        nHits >>= 1;
+                        i++;
+                    }
+                    return i;
+                }
+                i += 16;
             }
-            else if( eOp2 != GEN::OP_ILLEGAL && eOp2 != GEN::NOT_AN_OP && len2 == 16 )
+#endif
+
+            for( ; i+16 <= nBlobLength; i++ )
             {
-                // this means the last iteration mistook the upper half of a native instruction for a compressed instruction
-                scan = p2x;
+                if( (pBytes[i] & 0x7f) == SEND_OPCODE && (pBytes[i+15] & EOT_BIT) )
+                    return i;
             }
-            else if( eOp4 != GEN::OP_ILLEGAL && eOp4 != GEN::NOT_AN_OP && len4==16 )
+            return nBlobLength;
+        }
+
+        /// All GEN threads must end in a SEND instruction with the 'EOT' field set.  Find the next one at or after 'nStart'
+        size_t FindEOTSend( GEN::Decoder& decoder, const unsigned char* pBytes, size_t nStart, size_t nBlobLength )
+        {
+            size_t nSend = FindEOTCandidate( pBytes, nStart, nBlobLength );
+            while( nSend < nBlobLength )
             {
-                // legal native instruction
-                scan = p4x;
+                GEN::SendInstruction inst;
+                if( decoder.Decode( &inst, pBytes+nSend ) )
+                {
+                    if( !inst.IsDescriptorInRegister() && inst.IsEOT() )
+                        break;
+                }
+
+                nSend = FindEOTCandidate( pBytes, nSend+1, nBlobLength );
             }
-            else
+            return nSend;
+        }
+
+        bool IsLegalOperation( GEN::Decoder& decoder, const unsigned char* pBytes )
+        {
+            GEN::Operations eOp = decoder.GetOperation(pBytes);
+            return eOp != GEN::OP_ILLEGAL && eOp != GEN::NOT_AN_OP;
+        }
+
+        /// Work our way backwards from the end of a program to the first non-instruction we see, without going past 'nLimit'
+        ///  This won't work if there exists a native instruction whose upper half
+        ///   happens to exactly match a compressed one, but its the best we've got
+        size_t FindIsaStart( GEN::Decoder& decoder, const unsigned char* pBytes, size_t nIsaEnd, size_t nLimit )
+        {
+            size_t scan = nIsaEnd;
+            while( scan - nLimit >= 8 )
             {
-                // the end is nigh
-                break;
+                // A legal op 8 bytes back is either a compacted instruction, or the upper half of a native
+                //  instruction which the last step mistook for a compacted one.  Both are 8 byte steps
+                if( IsLegalOperation( decoder, pBytes+scan-8 ) )
+                    scan -= 8;
+                else if( scan - nLimit >= 16 && IsLegalOperation( decoder, pBytes+scan-16 ) && decoder.DetermineLength( pBytes+scan-16 ) == 16 )
+                    scan -= 16; // legal native instruction
+                else
+                    break; // the end is nigh
             }
+            return scan;
         }
+    }
 
+    // Given a blob, attempt to locate a GEN program by searching for valid opcodes
+    bool FindIsaInBlob( size_t* pIsaOffset, size_t* pIsaLength, const void* pBlob, size_t nBlobLength )
+    {
+        const unsigned char* pBytes = (const unsigned char*)pBlob;
 
-        if( scan < pBytes )
+        GEN::Decoder decoder;
+        size_t nSendInstruction = _INTERNAL::FindEOTSend( decoder, pBytes, 0, nBlobLength );
+        if( nSendInstruction == nBlobLength )
             return false;
 
+        size_t nIsaEnd   = nSendInstruction+16;
+        size_t nIsaStart = _INTERNAL::FindIsaStart( decoder, pBytes, nIsaEnd, 0 );
+
         if( pIsaOffset )
-            *pIsaOffset = scan - pBytes;
+            *pIsaOffset = nIsaStart;
         if( pIsaLength )
-            *pIsaLength = pIsaEnd - scan;
+            *pIsaLength = nIsaEnd - nIsaStart;
 
         return true;
     }
 
+    size_t FindAllIsaInBlob( std::vector<IsaLocation>& rPrograms, const void* pBlob, size_t nBlobLength )
+    {
+        const unsigned char* pBytes = (const unsigned char*)pBlob;
+
+        GEN::Decoder decoder;
+        rPrograms.clear();
+
+        // Each walk back stops where the last program ended.  If it gets there, the send belongs to that program
+        size_t nLastEnd = 0;
+        size_t nSendInstruction = _INTERNAL::FindEOTSend( decoder, pBytes, 0, nBlobLength );
+        while( nSendInstruction < nBlobLength )
+        {
+            size_t nIsaEnd   = nSendInstruction+16;
+            size_t nIsaStart = _INTERNAL::FindIsaStart( decoder, pBytes, nIsaEnd, nLastEnd );
+            if( !rPrograms.empty() && nIsaStart == nLastEnd )
+            {
+                rPrograms.back().nLength = nIsaEnd - rPrograms.back().nOffset;
+            }
+            else
+            {
+                IsaLocation loc;
+                loc.nOffset = nIsaStart;
+                loc.nLength = nIsaEnd - nIsaStart;
+                rPrograms.push_back(loc);
+            }
+
+            nLastEnd = nIsaEnd;
+            nSendInstruction = _INTERNAL::FindEOTSend( decoder, pBytes, nIsaEnd, nBlobLength );
+        }
+
+        return rPrograms.size();
+    }
+
    
 
-    void PatchBlob( Blob& rOutputBlob, const ShaderArgs& rArgs, const Blob& rTemplateBlob, size_t nTemplateIsaStart )
+    void PatchBlob( Blob& rOutputBlob, const ShaderArgs& rArgs, const Blob& rTemplateBlob, size_t nTemplateIsaStart,
+                    PatchBlobCache* pHashCache )
     {
         
         //
@@ -343,9 +459,134 @@ namespace HAXWell
         DWORD nSizeDifference = rTemplateBlob.GetLength() - FetchDWORD( pTemplate + 13 );
         WriteDWORD( pNewBlob + 13, nNewBlobSize - nSizeDifference );
 
-        // fix the hash
-        DriverHashFunction( (DWORD*)(pNewBlob + (nNewBlobSize-8)), (DWORD*)pNewBlob, (nNewBlobSize-8)/4 );
+        // fix the hash.  Everything before the fields at isa-702 is a copy of the template, except for the length above,
+        //   so that part of the hash can come from the cache
+        DWORD nHashDwords   = (nNewBlobSize-8)/4;
+        DWORD nPrefixDwords = (nPreIsaLength-702)/4;
+        const DriverHash* pPrefixHash = pHashCache ? pHashCache->Find(nNewBlobSize) : 0;
+
+        DriverHash hash;
+        if( pPrefixHash )
+        {
+            hash = *pPrefixHash;
+        }
+        else
+        {
+            hash.Update( (DWORD*)pNewBlob, nPrefixDwords );
+            if( pHashCache )
+                pHashCache->Add( nNewBlobSize, hash );
+        }
 
+        hash.Update( (DWORD*)pNewBlob + nPrefixDwords, nHashDwords - nPrefixDwords );
+        hash.Finalize( (DWORD*)(pNewBlob + (nNewBlobSize-8)) );
+
+    }
+
+
+    namespace _INTERNAL
+    {
+        /// Header at the start of each blob file.  The shader's contents and then the blob follow it
+        struct BlobFileHeader
+        {
+            DWORD nMagic;
+            DWORD nVersion;
+            QWORD nKey;
+            DWORD nContentsLength;
+            DWORD nBlobLength;
+        };
+        static_assert( sizeof(BlobFileHeader) == 24, "derp" );
+
+        static const DWORD BLOB_FILE_MAGIC   = 0x42575848; // 'HXWB'
+        static const DWORD BLOB_FILE_VERSION = 1;          // bump this whenever 'PatchBlob's output changes
+
+        std::string GetBlobFileName( const std::string& rDirectory, QWORD nKey )
+        {
+            char name[32];
+            sprintf( name, "%08x%08x.blob", (DWORD)(nKey>>32), (DWORD)nKey );
+
+            std::string file = rDirectory;
+            if( !file.empty() && file[file.length()-1] != '/' && file[file.length()-1] != '\\' )
+                file.push_back('/');
+            file.append(name);
+            return file;
+        }
+    }
+
+    void GetShaderContents( std::vector<unsigned char>& rContents, const ShaderArgs& rArgs )
+    {
+        DWORD pCounts[4] = {
+            (DWORD) rArgs.nDispatchThreadCount,
+            (DWORD) rArgs.nSIMDMode,
+            (DWORD) rArgs.nIsaLength,
+            (DWORD) rArgs.nCURBEAllocsPerThread,
+        };
+        size_t nCURBELength = rArgs.nCURBEAllocsPerThread*rArgs.nDispatchThreadCount*32;
+
+        const unsigned char* pIsa   = (const unsigned char*) rArgs.pIsa;
+        const unsigned char* pCURBE = (const unsigned char*) rArgs.pCURBE;
+        rContents.assign( (const unsigned char*)pCounts, (const unsigned char*)(pCounts+4) );
+        rContents.insert( rContents.end(), pIsa, pIsa + rArgs.nIsaLength );
+        if( nCURBELength )
+            rContents.insert( rContents.end(), pCURBE, pCURBE + nCURBELength );
+    }
+
+    QWORD GetShaderKey( const std::vector<unsigned char>& rContents, const Blob& rTemplateBlob )
+    {
+        DWORD pTemplate[3] = { (DWORD) rTemplateBlob.GetLength(), 0, 0 };
+        if( rTemplateBlob.GetLength() >= 8 )
+            memcpy( pTemplate+1, (const unsigned char*)rTemplateBlob.GetBytes() + rTemplateBlob.GetLength() - 8, 8 );
+
+        QWORD nHash = GEN::_INTERNAL::FNV_OFFSET_BASIS;
+        nHash = GEN::_INTERNAL::HashBytes( nHash, &_INTERNAL::BLOB_FILE_VERSION, sizeof(DWORD) );
+        nHash = GEN::_INTERNAL::HashBytes( nHash, pTemplate, sizeof(pTemplate) );
+        return GEN::_INTERNAL::HashBytes( nHash, rContents.data(), rContents.size() );
+    }
+
+    bool ReadBlobFile( Blob& rBlob, const std::string& rDirectory, QWORD nKey, const std::vector<unsigned char>& rContents )
+    {
+        std::string file = _INTERNAL::GetBlobFileName( rDirectory, nKey );
+        FILE* fp = fopen( file.c_str(), "rb" );
+        if( !fp )
+            return false;
+
+        _INTERNAL::BlobFileHeader header;
+        bool bOK = fread( &header, sizeof(header), 1, fp ) == 1 &&
+                   header.nMagic == _INTERNAL::BLOB_FILE_MAGIC &&
+                   header.nVersion == _INTERNAL::BLOB_FILE_VERSION &&
+                   header.nKey == nKey &&
+                   header.nContentsLength == rContents.size() &&
+                   header.nBlobLength > 0 &&
+                   GEN::_INTERNAL::IsFileLength( fp, sizeof(header) + (QWORD)header.nContentsLength + header.nBlobLength );
+        if( bOK )
+        {
+            std::vector<unsigned char> contents( header.nContentsLength );
+            bOK = ( contents.empty() || fread( contents.data(), 1, contents.size(), fp ) == contents.size() ) &&
+                  contents == rContents;
+        }
+        if( bOK )
+        {
+            rBlob.SetLength( header.nBlobLength );
+            bOK = rBlob.GetBytes() &&
+                  fread( rBlob.GetBytes(), 1, header.nBlobLength, fp ) == header.nBlobLength;
+        }
+        fclose(fp);
+
+        // stale, truncated, or another shader's.  It'll be overwritten once the blob is patched
+        return bOK;
+    }
+
+    void WriteBlobFile( const std::string& rDirectory, QWORD nKey, const std::vector<unsigned char>& rContents, const Blob& rBlob )
+    {
+        _INTERNAL::BlobFileHeader header;
+        header.nMagic          = _INTERNAL::BLOB_FILE_MAGIC;
+        header.nVersion        = _INTERNAL::BLOB_FILE_VERSION;
+        header.nKey            = nKey;
+        header.nContentsLength = (DWORD) rContents.size();
+        header.nBlobLength     = (DWORD) rBlob.GetLength();
+
+        const void* ppPieces[3] = { &header, rContents.data(), rBlob.GetBytes() };
+        size_t pLengths[3]      = { sizeof(header), rContents.size(), rBlob.GetLength() };
+        GEN::_INTERNAL::WriteFileAtomically( _INTERNAL::GetBlobFileName( rDirectory, nKey ), ppPieces, pLengths, 3 );
     }
 
 }
\ No newline at end of file